@@ -38,9 +38,23 @@ static const char* g_helpMessage =
     "-d | --data=       \t  specify copy data directory\n"
     "-m | --meta=       \t  specify copy meta directory\n"
     "-k | --checkpoint= \t  specify checkpoint directory\n"
+    "-j | --journal     \t  journal blocks done as checkpoint instead of saving snapshot periodically\n"
+    "-t | --maptable    \t  map checksum tables from meta files instead of holding them in memory\n"
     "-p | --prevmeta=   \t  specify previous copy meta directory\n"
     "-r | --restore     \t  used when performing restore operation\n"
-    "-z | --zerocopy    \t  enable zero copy during restore\n"
+    "-z | --zerocopy    \t  enable zero copy during restore, or full backup without checksum\n"
+    "-w | --diff        \t  only write blocks of volume differing from the copy during restore\n"
+    "-y | --verify      \t  verify blocks restored with checksum of the copy\n"
+    "-u | --iouring     \t  use io_uring async I/O engine (linux only)\n"
+    "-a | --allocated   \t  only backup blocks allocated by filesystem (ext2/3/4, xfs)\n"
+    "-o | --sparse      \t  keep zero blocks of copy as holes, or punch/zero out zero blocks of volume on restore\n"
+    "-c | --cache=      \t  specify page cache mode [BUFFERED, DIRECT, DROP_BEHIND], io_uring requires BUFFERED\n"
+    "-x | --hash=       \t  specify block hash algorithm [SHA256, XXH3_128, BLAKE3, CRC32C]\n"
+    "-s | --subblock=   \t  specify sub-block size in KB to rewrite changed range of block only, 0 by default\n"
+    "-g | --changed=    \t  specify file listing ranges changed since previous copy, \"offset length\" per line\n"
+    "-e | --dmera=      \t  specify dm-era device name to query ranges changed since previous copy (linux only)\n"
+    "-b | --bandwidth=  \t  specify max MB read and written per second, 0 for no limit\n"
+    "-i | --ioprio=     \t  specify I/O priority class [NORMAL, LOW, IDLE] (linux only)\n"
     "-l | --loglevel=   \t  specify logger level [INFO, DEBUG]\n"
     "-h | --help        \t  print help\n";
 
@@ -51,10 +65,24 @@ struct CliArgs {
     std::string     copyDataDirPath;
     std::string     copyMetaDirPath;
     std::string     checkpointDirPath;
+    bool            journalCheckpoint    { false };
+    bool            mapChecksumTable     { false };
     std::string     prevCopyMetaDirPath;
     LoggerLevel     logLevel             { LoggerLevel::INFO };
     bool            isRestore            { false };
     bool            enableZeroCopy       { false };
+    bool            differentialRestore  { false };
+    bool            verifyRestore        { false };
+    bool            enableIOUring        { false };
+    bool            skipUnallocated      { false };
+    bool            sparse               { false };
+    IOCacheMode     cacheMode            { IOCacheMode::BUFFERED };
+    HashAlgorithm   hashAlgorithm        { HashAlgorithm::SHA256 };
+    uint32_t        subBlockSize         { 0 };
+    ChangedBlockTracking cbtType         { ChangedBlockTracking::NONE };
+    std::string     cbtSource;
+    uint64_t        bytesPerSecond       { 0 };
+    IOPriority      ioPriority           { IOPriority::NORMAL };
     bool            printHelp            { false };
 };
 
@@ -87,6 +115,47 @@ static CopyFormat ParseCopyFormat(const std::string& copyFormat)
     return copyFormatEnum;
 }
 
+static IOCacheMode ParseIOCacheMode(const std::string& cacheMode)
+{
+    IOCacheMode cacheModeEnum = IOCacheMode::BUFFERED;
+    if (cacheMode == "DIRECT") {
+        cacheModeEnum = IOCacheMode::DIRECT;
+    } else if (cacheMode == "DROP_BEHIND") {
+        cacheModeEnum = IOCacheMode::DROP_BEHIND;
+    } else if (cacheMode != "BUFFERED") {
+        std::cerr << "invalid cache mode input: " << cacheMode << ", use BUFFERED" << std::endl;
+    }
+    return cacheModeEnum;
+}
+
+static IOPriority ParseIOPriority(const std::string& ioPriority)
+{
+    IOPriority ioPriorityEnum = IOPriority::NORMAL;
+    if (ioPriority == "LOW") {
+        ioPriorityEnum = IOPriority::LOW;
+    } else if (ioPriority == "IDLE") {
+        ioPriorityEnum = IOPriority::IDLE;
+    } else if (ioPriority != "NORMAL") {
+        std::cerr << "invalid I/O priority input: " << ioPriority << ", use NORMAL" << std::endl;
+    }
+    return ioPriorityEnum;
+}
+
+static HashAlgorithm ParseHashAlgorithm(const std::string& hashAlgorithm)
+{
+    HashAlgorithm hashAlgorithmEnum = HashAlgorithm::SHA256;
+    if (hashAlgorithm == "XXH3_128") {
+        hashAlgorithmEnum = HashAlgorithm::XXH3_128;
+    } else if (hashAlgorithm == "BLAKE3") {
+        hashAlgorithmEnum = HashAlgorithm::BLAKE3;
+    } else if (hashAlgorithm == "CRC32C") {
+        hashAlgorithmEnum = HashAlgorithm::CRC32C;
+    } else if (hashAlgorithm != "SHA256") {
+        std::cerr << "invalid hash algorithm input: " << hashAlgorithm << ", use SHA256" << std::endl;
+    }
+    return hashAlgorithmEnum;
+}
+
 static LoggerLevel ParseLoggerLevel(const std::string& loggerLevelStr)
 {
     LoggerLevel loggerLevel = LoggerLevel::DEBUG;
@@ -111,9 +180,10 @@ static CliArgs ParseCliArgs(int argc, const char** argv)
     CliArgs cliAgrs;
     GetOptionResult result = GetOption(
         argv + 1, argc - 1,
-        "v:n:f:d:m:k:p:hzr:l:",
-        {"--volume=", "--name=", "--format=", "--data=", "--meta=", "--checkpoint=",
-        "--prevmeta=", "--help", "--zerocopy", "--restore", "--loglevel="});
+        "v:n:f:d:m:k:jtp:hzwyuaoc:x:s:g:e:r:l:b:i:",
+        {"--volume=", "--name=", "--format=", "--data=", "--meta=", "--checkpoint=", "--journal", "--maptable",
+        "--prevmeta=", "--help", "--zerocopy", "--diff", "--verify", "--iouring", "--allocated", "--sparse", "--cache=",
+        "--hash=", "--restore", "--loglevel=", "--subblock=", "--changed=", "--dmera=", "--bandwidth=", "--ioprio="});
     for (const OptionResult opt: result.opts) {
         if (opt.option == "v" || opt.option == "volume") {
             cliAgrs.volumePath = opt.value;
@@ -127,12 +197,42 @@ static CliArgs ParseCliArgs(int argc, const char** argv)
             cliAgrs.copyMetaDirPath = opt.value;
         } else if (opt.option == "k" || opt.option == "checkpoint") {
             cliAgrs.checkpointDirPath = opt.value;
+        } else if (opt.option == "j" || opt.option == "journal") {
+            cliAgrs.journalCheckpoint = true;
+        } else if (opt.option == "t" || opt.option == "maptable") {
+            cliAgrs.mapChecksumTable = true;
         } else if (opt.option == "p" || opt.option == "prevmeta") {
             cliAgrs.prevCopyMetaDirPath = opt.value;
         } else if (opt.option == "r" || opt.option == "restore") {
             cliAgrs.isRestore = true;
         } else if (opt.option == "z" || opt.option == "zerocopy") {
             cliAgrs.enableZeroCopy = true;
+        } else if (opt.option == "w" || opt.option == "diff") {
+            cliAgrs.differentialRestore = true;
+        } else if (opt.option == "y" || opt.option == "verify") {
+            cliAgrs.verifyRestore = true;
+        } else if (opt.option == "o" || opt.option == "sparse") {
+            cliAgrs.sparse = true;
+        } else if (opt.option == "u" || opt.option == "iouring") {
+            cliAgrs.enableIOUring = true;
+        } else if (opt.option == "a" || opt.option == "allocated") {
+            cliAgrs.skipUnallocated = true;
+        } else if (opt.option == "c" || opt.option == "cache") {
+            cliAgrs.cacheMode = ParseIOCacheMode(opt.value);
+        } else if (opt.option == "x" || opt.option == "hash") {
+            cliAgrs.hashAlgorithm = ParseHashAlgorithm(opt.value);
+        } else if (opt.option == "s" || opt.option == "subblock") {
+            cliAgrs.subBlockSize = static_cast<uint32_t>(std::stoul(opt.value) * ONE_KB);
+        } else if (opt.option == "g" || opt.option == "changed") {
+            cliAgrs.cbtType = ChangedBlockTracking::FILE;
+            cliAgrs.cbtSource = opt.value;
+        } else if (opt.option == "e" || opt.option == "dmera") {
+            cliAgrs.cbtType = ChangedBlockTracking::DM_ERA;
+            cliAgrs.cbtSource = opt.value;
+        } else if (opt.option == "b" || opt.option == "bandwidth") {
+            cliAgrs.bytesPerSecond = std::stoull(opt.value) * ONE_MB;
+        } else if (opt.option == "i" || opt.option == "ioprio") {
+            cliAgrs.ioPriority = ParseIOPriority(opt.value);
         } else if (opt.option == "l" || opt.option == "loglevel") {
             cliAgrs.logLevel = ParseLoggerLevel(opt.value);
         } else if (opt.option == "h" || opt.option == "help") {
@@ -231,14 +331,30 @@ static int ExecVolumeBackup(const CliArgs& cliArgs)
     backupConfig.checkpointDirPath = cliArgs.checkpointDirPath;
     backupConfig.enableCheckpoint = !cliArgs.checkpointDirPath.empty();
     backupConfig.clearCheckpointsOnSucceed = true;
+    backupConfig.checkpointMode = cliArgs.journalCheckpoint ? CheckpointMode::JOURNAL : CheckpointMode::SNAPSHOT;
+    backupConfig.mapChecksumTable = cliArgs.mapChecksumTable;
     backupConfig.blockSize = DEFAULT_BLOCK_SIZE;
     backupConfig.sessionSize = 3 * ONE_GB;
     backupConfig.hasherNum = hasherWorkerNum;
     backupConfig.hasherEnabled = true;
+    backupConfig.ioEngine = cliArgs.enableIOUring ? IOEngine::IO_URING : IOEngine::SYNC;
+    backupConfig.skipUnallocatedBlock = cliArgs.skipUnallocated;
+    backupConfig.skipEmptyBlock = cliArgs.sparse;
+    backupConfig.ioCacheMode = cliArgs.cacheMode;
+    backupConfig.hashAlgorithm = cliArgs.hashAlgorithm;
+    backupConfig.subBlockSize = cliArgs.subBlockSize;
+    backupConfig.cbtType = cliArgs.cbtType;
+    backupConfig.cbtSource = cliArgs.cbtSource;
+    backupConfig.rateLimit.readBytesPerSecond = cliArgs.bytesPerSecond;
+    backupConfig.rateLimit.writeBytesPerSecond = cliArgs.bytesPerSecond;
+    backupConfig.ioPriority = cliArgs.ioPriority;
 
     if (backupConfig.prevCopyMetaDirPath.empty()) {
         std::cout << "----- Perform Full Backup -----" << std::endl;
         backupConfig.backupType = BackupType::FULL;
+        // zero copy backup generates no checksum, the copy can not be the base of increment backup
+        backupConfig.enableZeroCopy = cliArgs.enableZeroCopy;
+        backupConfig.hasherEnabled = !cliArgs.enableZeroCopy;
     } else {
         std::cout << "----- Perform Forever Increment Backup -----" << std::endl;
         backupConfig.backupType = BackupType::FOREVER_INC;
@@ -275,7 +391,16 @@ static int ExecVolumeRestore(const CliArgs& cliAgrs)
     restoreConfig.copyMetaDirPath = cliAgrs.copyMetaDirPath;
     restoreConfig.checkpointDirPath = cliAgrs.checkpointDirPath;
     restoreConfig.enableCheckpoint = !cliAgrs.checkpointDirPath.empty();
+    restoreConfig.checkpointMode = cliAgrs.journalCheckpoint ? CheckpointMode::JOURNAL : CheckpointMode::SNAPSHOT;
     restoreConfig.enableZeroCopy = cliAgrs.enableZeroCopy;
+    restoreConfig.differentialRestore = cliAgrs.differentialRestore;
+    restoreConfig.verifyRestore = cliAgrs.verifyRestore;
+    restoreConfig.punchZeroBlock = cliAgrs.sparse;
+    restoreConfig.ioEngine = cliAgrs.enableIOUring ? IOEngine::IO_URING : IOEngine::SYNC;
+    restoreConfig.ioCacheMode = cliAgrs.cacheMode;
+    restoreConfig.rateLimit.readBytesPerSecond = cliAgrs.bytesPerSecond;
+    restoreConfig.rateLimit.writeBytesPerSecond = cliAgrs.bytesPerSecond;
+    restoreConfig.ioPriority = cliAgrs.ioPriority;
 
     if (restoreConfig.enableZeroCopy) {
         std::cout << "using zero copy optimization." << std::endl;
@@ -297,6 +422,9 @@ static int ExecVolumeRestore(const CliArgs& cliAgrs)
         std::this_thread::sleep_for(std::chrono::seconds(1));
     }
     PrintTaskStatistics(task->GetStatistics());
+    for (uint64_t index : task->GetMismatchedBlocks()) {
+        std::cerr << "block " << index << " restored mismatch with copy" << std::endl;
+    }
     std::cout << "volume restore task completed!" << std::endl;
     return 0;
 }
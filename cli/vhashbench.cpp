@@ -0,0 +1,168 @@
+/*
+ * ================================================================
+ *   Copyright (C) 2023-2024 XUranus All rights reserved.
+ *
+ *   File:         vhashbench.cpp
+ *   Author:       XUranus
+ *   Date:         2024-03-08
+ *   Description:  a command line tool to benchmark single core throughput
+ *                 of block checksum algorithms used by hasher
+ * ==================================================================
+ */
+
+#include "GetOption.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include <openssl/evp.h>
+
+#include "common/BlockHash.h"
+
+using namespace xuranus::getopt;
+using namespace volumeprotect;
+
+namespace {
+    const uint64_t ONE_MB = 1024LLU * 1024LLU;
+    const uint64_t DEFAULT_BENCH_BLOCK_SIZE = 4 * ONE_MB;
+    const uint32_t DEFAULT_BLOCK_NUM = 64;
+    const uint32_t DEFAULT_ROUNDS = 4;
+}
+
+static const char* g_helpMessage =
+    "vhashbench [options...]    util to benchmark block checksum throughput on a single core\n"
+    "[ -b | --blocksize= ]  block size in bytes, default 4194304\n"
+    "[ -n | --blocks= ]     number of blocks in buffer pool, default 64\n"
+    "[ -r | --rounds= ]     rounds over the buffer pool, default 4\n"
+    "[ -h | --help ]        show help\n";
+
+struct BenchParam {
+    uint64_t    blockSize   { DEFAULT_BENCH_BLOCK_SIZE };
+    uint32_t    blockNum    { DEFAULT_BLOCK_NUM };
+    uint32_t    rounds      { DEFAULT_ROUNDS };
+};
+
+// return GB/s of hashing all blocks for param.rounds times
+static double RunBench(const BenchParam& param, const std::function<bool()>& hashAllBlocks)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < param.rounds; ++round) {
+        if (!hashAllBlocks()) {
+            ::fprintf(stderr, "hash failed!\n");
+            return 0;
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    double bytes = static_cast<double>(param.blockSize) * param.blockNum * param.rounds;
+    return bytes / (static_cast<double>(duration.count()) + 1.0) / 1000.0; // bytes per us => GB/s
+}
+
+// the way hasher used to compute SHA256: lookup digest and allocate EVP_MD_CTX for every block
+static bool LegacySHA256(const uint8_t* data, uint64_t len, uint8_t* output)
+{
+    const EVP_MD* md = ::EVP_get_digestbyname("SHA256");
+    EVP_MD_CTX* mdctx = ::EVP_MD_CTX_new();
+    if (md == nullptr || mdctx == nullptr) {
+        ::EVP_MD_CTX_free(mdctx);
+        return false;
+    }
+    unsigned int mdLen = 0;
+    bool ret = ::EVP_DigestInit_ex(mdctx, md, nullptr) == 1 &&
+        ::EVP_DigestUpdate(mdctx, data, len) == 1 &&
+        ::EVP_DigestFinal_ex(mdctx, output, &mdLen) == 1;
+    ::EVP_MD_CTX_free(mdctx);
+    return ret;
+}
+
+int main(int argc, const char** argv)
+{
+    BenchParam param {};
+    GetOptionResult result = GetOption(
+        argv + 1, argc - 1,
+        "b:n:r:h",
+        {"--blocksize=", "--blocks=", "--rounds=", "--help"});
+    for (const OptionResult opt: result.opts) {
+        if (opt.option == "b" || opt.option == "blocksize") {
+            param.blockSize = std::max(1ULL, std::stoull(opt.value));
+        } else if (opt.option == "n" || opt.option == "blocks") {
+            param.blockNum = std::max(1, std::stoi(opt.value));
+        } else if (opt.option == "r" || opt.option == "rounds") {
+            param.rounds = std::max(1, std::stoi(opt.value));
+        } else if (opt.option == "h" || opt.option == "help") {
+            ::printf("%s\n", g_helpMessage);
+            return 0;
+        }
+    }
+    ::printf("block size: %llu, blocks: %u, rounds: %u, multi-buffer SHA256 lanes: %u\n",
+        static_cast<unsigned long long>(param.blockSize), param.blockNum, param.rounds,
+        blockhash::SHA256MultiBufferLanes());
+
+    std::vector<std::vector<uint8_t>> blocks(param.blockNum, std::vector<uint8_t>(param.blockSize));
+    for (uint32_t i = 0; i < param.blockNum; ++i) {
+        for (uint64_t j = 0; j < param.blockSize; ++j) {
+            blocks[i][j] = static_cast<uint8_t>((i * 131 + j * 7) & 0xFF);
+        }
+    }
+    std::vector<uint8_t> checksums(param.blockNum * SHA256_CHECKSUM_SIZE, 0);
+
+    double rate = RunBench(param, [&]() {
+        for (uint32_t i = 0; i < param.blockNum; ++i) {
+            if (!LegacySHA256(blocks[i].data(), param.blockSize, &checksums[i * SHA256_CHECKSUM_SIZE])) {
+                return false;
+            }
+        }
+        return true;
+    });
+    ::printf("SHA256 (per block EVP lookup): %.3f GB/s\n", rate);
+
+    blockhash::DigestContext context(HashAlgorithm::SHA256);
+    rate = RunBench(param, [&]() {
+        for (uint32_t i = 0; i < param.blockNum; ++i) {
+            if (!context.Compute(blocks[i].data(), param.blockSize, &checksums[i * SHA256_CHECKSUM_SIZE])) {
+                return false;
+            }
+        }
+        return true;
+    });
+    ::printf("SHA256 (reused context):       %.3f GB/s\n", rate);
+
+    rate = RunBench(param, [&]() {
+        uint32_t batchSize = context.MaxBatchSize();
+        std::vector<const uint8_t*> data(batchSize);
+        std::vector<uint64_t> len(batchSize, param.blockSize);
+        std::vector<uint8_t*> output(batchSize);
+        for (uint32_t i = 0; i < param.blockNum; i += batchSize) {
+            uint32_t count = std::min(batchSize, param.blockNum - i);
+            for (uint32_t k = 0; k < count; ++k) {
+                data[k] = blocks[i + k].data();
+                output[k] = &checksums[(i + k) * SHA256_CHECKSUM_SIZE];
+            }
+            if (!context.ComputeBatch(data.data(), len.data(), output.data(), count)) {
+                return false;
+            }
+        }
+        return true;
+    });
+    ::printf("SHA256 (batch of %u):          %.3f GB/s\n", context.MaxBatchSize(), rate);
+
+    for (HashAlgorithm algorithm : { HashAlgorithm::XXH3_128, HashAlgorithm::BLAKE3, HashAlgorithm::CRC32C }) {
+        uint32_t digestSize = blockhash::DigestSize(algorithm);
+        rate = RunBench(param, [&]() {
+            for (uint32_t i = 0; i < param.blockNum; ++i) {
+                if (!blockhash::ComputeDigest(algorithm, blocks[i].data(), param.blockSize,
+                    &checksums[i * SHA256_CHECKSUM_SIZE], digestSize)) {
+                    return false;
+                }
+            }
+            return true;
+        });
+        ::printf("%-8s:                      %.3f GB/s\n", blockhash::AlgorithmName(algorithm).c_str(), rate);
+    }
+    return 0;
+}
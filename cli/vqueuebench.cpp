@@ -0,0 +1,126 @@
+/*
+ * ================================================================
+ *   Copyright (C) 2023-2024 XUranus All rights reserved.
+ *
+ *   File:         vqueuebench.cpp
+ *   Author:       XUranus
+ *   Date:         2024-03-01
+ *   Description:  a command line tool to benchmark BlockingQueue and RingQueue
+ *                 under the producer/consumer pattern of the block pipeline
+ * ==================================================================
+ */
+
+#include "GetOption.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "common/BlockingQueue.h"
+#include "common/RingQueue.h"
+
+using namespace xuranus::getopt;
+
+namespace {
+    const int DEFAULT_PRODUCER_NUM = 8;
+    const int DEFAULT_CONSUMER_NUM = 1;
+    const uint64_t DEFAULT_ITEMS_NUM = 1000000;
+    const std::size_t DEFAULT_QUEUE_CAPACITY = 64;
+}
+
+static const char* g_helpMessage =
+    "vqueuebench [options...]    util to benchmark BlockingQueue and RingQueue\n"
+    "[ -p | --producer= ]   producer thread num, default 8 (hashers pushing to write queue)\n"
+    "[ -c | --consumer= ]   consumer thread num, default 1 (writer)\n"
+    "[ -n | --items= ]      total items to transfer, default 1000000\n"
+    "[ -s | --size= ]       queue capacity, default 64\n"
+    "[ -h | --help ]        show help\n";
+
+struct BenchItem {
+    uint8_t*    ptr;
+    uint64_t    index;
+    uint64_t    volumeOffset;
+    uint32_t    length;
+};
+
+struct BenchParam {
+    int         producerNum     { DEFAULT_PRODUCER_NUM };
+    int         consumerNum     { DEFAULT_CONSUMER_NUM };
+    uint64_t    itemsNum        { DEFAULT_ITEMS_NUM };
+    std::size_t capacity        { DEFAULT_QUEUE_CAPACITY };
+};
+
+template<typename Queue>
+static double RunBench(const BenchParam& param)
+{
+    Queue queue(param.capacity);
+    std::atomic<uint64_t> consumed { 0 };
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < param.consumerNum; ++i) {
+        threads.emplace_back([&]() {
+            BenchItem item {};
+            while (queue.BlockingPop(item)) {
+                ++consumed;
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int i = 0; i < param.producerNum; ++i) {
+        producers.emplace_back([&, i]() {
+            for (uint64_t index = i; index < param.itemsNum; index += param.producerNum) {
+                queue.BlockingPush(BenchItem { nullptr, index, index, 0 });
+            }
+        });
+    }
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+    queue.Finish();
+    for (std::thread& consumer : threads) {
+        consumer.join();
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    if (consumed != param.itemsNum) {
+        ::fprintf(stderr, "item lost! consumed %llu, expected %llu\n",
+            static_cast<unsigned long long>(consumed.load()), static_cast<unsigned long long>(param.itemsNum));
+    }
+    return static_cast<double>(param.itemsNum) / (static_cast<double>(duration.count()) + 1.0); // items per us
+}
+
+int main(int argc, const char** argv)
+{
+    BenchParam param {};
+    GetOptionResult result = GetOption(
+        argv + 1, argc - 1,
+        "p:c:n:s:h",
+        {"--producer=", "--consumer=", "--items=", "--size=", "--help"});
+    for (const OptionResult opt: result.opts) {
+        if (opt.option == "p" || opt.option == "producer") {
+            param.producerNum = std::max(1, std::stoi(opt.value));
+        } else if (opt.option == "c" || opt.option == "consumer") {
+            param.consumerNum = std::max(1, std::stoi(opt.value));
+        } else if (opt.option == "n" || opt.option == "items") {
+            param.itemsNum = std::stoull(opt.value);
+        } else if (opt.option == "s" || opt.option == "size") {
+            param.capacity = std::stoull(opt.value);
+        } else if (opt.option == "h" || opt.option == "help") {
+            ::printf("%s\n", g_helpMessage);
+            return 0;
+        }
+    }
+    ::printf("producer: %d, consumer: %d, items: %llu, capacity: %llu\n",
+        param.producerNum, param.consumerNum,
+        static_cast<unsigned long long>(param.itemsNum), static_cast<unsigned long long>(param.capacity));
+    double blockingQueueRate = RunBench<BlockingQueue<BenchItem>>(param);
+    ::printf("BlockingQueue: %.3f M items/s\n", blockingQueueRate);
+    double ringQueueRate = RunBench<RingQueue<BenchItem>>(param);
+    ::printf("RingQueue:     %.3f M items/s\n", ringQueueRate);
+    return 0;
+}
@@ -13,6 +13,14 @@
 #include "common/VolumeProtectMacros.h"
 #include <string>
 
+/**
+ * @brief Version of the C++ ABI, bumped once the layout of exported structs or the virtual table of exported classes
+ *  changes, binaries built against headers of an older version must be rebuilt. The C API stays compatible.
+ *  2: StatefulTask::Abort became virtual, VolumeProtectTask added virtual SetRateLimit and GetMismatchedBlocks,
+ *     VolumeBackupConfig/VolumeRestoreConfig added fields.
+ */
+#define VOLUMEPROTECT_ABI_VERSION 2
+
 /**
  * @brief volume backup/restore facade and common struct defines
  */
@@ -27,20 +35,37 @@ const uint64_t ONE_TB = 1024LLU * ONE_GB;
 const uint32_t DEFAULT_BLOCK_SIZE = 4LU * ONE_MB;
 const uint64_t DEFAULT_SESSION_SIZE = ONE_TB;
 const uint32_t DEFAULT_HASHER_NUM = 8LU;
+const uint32_t DEFAULT_READER_NUM = 1LU;
+const uint32_t DEFAULT_ZERO_COPY_THREAD_NUM = 4LU;
+const uint32_t DEFAULT_SESSION_CONCURRENCY = 1LU;
+const uint32_t DEFAULT_SCHEDULER_TASK_CONCURRENCY = 4LU;
+const uint32_t DEFAULT_SCHEDULER_TASKS_PER_DEVICE = 1LU;
 const uint32_t DEFAULT_ALLOCATOR_BLOCK_NUM = 32; // 128MB
+const uint64_t DEFAULT_BUFFER_POOL_CACHE_SIZE = 512LLU * ONE_MB; // keep buffers of 4 sessions for reuse
 const uint32_t DEFAULT_QUEUE_SIZE = 64;
 const uint32_t SHA256_CHECKSUM_SIZE = 32; // 256bits
+const uint32_t XXH3_128_CHECKSUM_SIZE = 16; // 128bits
+const uint32_t BLAKE3_CHECKSUM_SIZE = 32; // 256bits
+const uint32_t CRC32C_CHECKSUM_SIZE = 4; // 32bits
+const uint32_t DEFAULT_IO_QUEUE_DEPTH = 16;
+const uint32_t DEFAULT_DIRECT_IO_ALIGNMENT = 4096; // buffer/offset/length alignment of direct I/O
+const uint32_t DEFAULT_SUB_BLOCK_SIZE = 64LU * ONE_KB; // suggested size if sub-block checksum is enabled
+const uint32_t MAX_SUB_BLOCKS_PER_BLOCK = 64; // each block track changed sub-blocks using a 64bits mask
+const uint32_t SUB_BLOCK_CHECKSUM_SIZE = 8; // block digest algorithm truncated to 64bits
 
 const std::string DEFAULT_VOLUME_COPY_NAME = "volumeprotect";
 
 const std::string VOLUME_COPY_META_JSON_FILENAME_EXTENSION = ".volumecopy.meta.json";
 const std::string SHA256_CHECKSUM_BINARY_FILENAME_EXTENSION = ".sha256.meta.bin";
+const std::string SUB_BLOCK_CHECKSUM_BINARY_FILENAME_EXTENSION = ".subblock.meta.bin";
 const std::string COPY_DATA_BIN_FILENAME_EXTENSION = ".copydata.bin";
 const std::string COPY_DATA_BIN_PARTED_FILENAME_EXTENSION = ".copydata.bin.part";
 const std::string COPY_DATA_IMAGE_FILENAME_EXTENSION = ".copydata.img";
 const std::string COPY_DATA_VHD_FILENAME_EXTENSION = ".copydata.vhd";
 const std::string COPY_DATA_VHDX_FILENAME_EXTENSION = ".copydata.vhdx";
 const std::string WRITER_BITMAP_FILENAME_EXTENSION = ".checkpoint.bin";
+const std::string CHECKPOINT_JOURNAL_FILENAME_EXTENSION = ".checkpoint.journal";
+const std::string RESTORED_CHECKSUM_FILENAME_EXTENSION = ".checkpoint.sha256.bin";
 
 // define error codes used by backup/restore tasks
 const ErrCodeType VOLUMEPROTECT_ERR_SUCCESS                 = 0x00000000;   // no error
@@ -48,6 +73,7 @@ const ErrCodeType VOLUMEPROTECT_ERR_VOLUME_ACCESS_DENIED    = 0x00114514;   // r
 const ErrCodeType VOLUMEPROTECT_ERR_COPY_ACCESS_DENIED      = 0x00114515;   // read/write copy data access denied
 const ErrCodeType VOLUMEPROTECT_ERR_NO_SPACE                = 0x00114516;   // write copy data failed for no space left
 const ErrCodeType VOLUMEPROTECT_ERR_INVALID_VOLUME          = 0x00114517;   // not a valid volume block device
+const ErrCodeType VOLUMEPROTECT_ERR_CHECKSUM_MISMATCH       = 0x00114518;   // data restored mismatch with the copy
 
 /**
  * @brief Used to specify backup type : full backup or forever increment backup
@@ -71,11 +97,88 @@ enum class VOLUMEPROTECT_API CopyFormat {
 #endif
 };
 
+/**
+ * @brief Used to specify which I/O engine to use for reading/writing volume and copy data
+ */
+enum class VOLUMEPROTECT_API IOEngine {
+    SYNC = 0,           ///< blocking read/write, one I/O in flight per reader/writer
+    IO_URING = 1        ///< linux io_uring asynchronous I/O, fallback to SYNC if unsupported
+};
+
+/**
+ * @brief Used to specify how reading/writing volume and copy data interact with OS page cache (posix only)
+ */
+enum class VOLUMEPROTECT_API IOCacheMode {
+    BUFFERED = 0,       ///< use page cache
+    DIRECT = 1,         ///< bypass page cache with O_DIRECT, fallback to BUFFERED if unsupported
+    DROP_BEHIND = 2     ///< use page cache, but drop pages already read/written to avoid evicting hot pages
+};
+
+/**
+ * @brief Used to specify I/O priority class of reading/writing volume and copy data (linux only)
+ */
+enum class VOLUMEPROTECT_API IOPriority {
+    NORMAL = 0,         ///< default priority derived from cpu nice value of the process
+    LOW = 1,            ///< best effort class with the lowest priority level
+    IDLE = 2            ///< only served when no other I/O needs the disk, may starve on a busy disk
+};
+
+/**
+ * @brief Used to specify which algorithm to compute block checksum for forever increment backup
+ */
+enum class VOLUMEPROTECT_API HashAlgorithm {
+    SHA256 = 0,         ///< cryptographic, 32 bytes digest, compatible with copies generated by older version
+    XXH3_128 = 1,       ///< non-cryptographic xxHash3 128bits, 16 bytes digest, fastest
+    BLAKE3 = 2,         ///< cryptographic, 32 bytes digest, much faster than SHA256 without hardware SHA extension
+    CRC32C = 3          ///< 4 bytes digest, collision prone for large volume, only for testing purpose
+};
+
+/**
+ * @brief Used to specify the source of changed block tracking (CBT) for forever increment backup,
+ *  blocks not reported as changed since the previous copy will not be read
+ */
+enum class VOLUMEPROTECT_API ChangedBlockTracking {
+    NONE = 0,           ///< read all blocks and compare checksum with the previous copy
+    FILE = 1,           ///< changed ranges listed in a text file, one "offset length" pair in bytes per line
+    DM_ERA = 2          ///< query the dm-era target stacked on the volume, linux only
+};
+
+/**
+ * @brief Used to specify how checkpoint of a session is persisted
+ */
+enum class VOLUMEPROTECT_API CheckpointMode {
+    SNAPSHOT = 0,       ///< rewrite bitmaps and checksum table on each interval, reader is paused meanwhile
+    JOURNAL = 1         ///< append blocks done since the last checkpoint to a journal, compacted periodically
+};
+
 /**
  * @brief Defines structs for volume backup/restore task
  */
 namespace task {
 
+/**
+ * @brief I/O rate limit of a backup/restore task, shared by all of it's sessions, 0 for no limit.
+ *  Read limits apply to reading volume during backup and reading copy during restore, write limits the opposite.
+ */
+struct VOLUMEPROTECT_API IORateLimit {
+    uint64_t    readBytesPerSecond      { 0 };  ///< max bytes read per second
+    uint64_t    readOpsPerSecond        { 0 };  ///< max read requests per second
+    uint64_t    writeBytesPerSecond     { 0 };  ///< max bytes written per second
+    uint64_t    writeOpsPerSecond       { 0 };  ///< max write requests per second
+    uint32_t    readLatencyThresholdUs  { 0 };  ///< lower read rate while average read latency exceeds, 0 to disable
+};
+
+/**
+ * @brief Process-wide config of the pool block buffers of all tasks are leased from
+ */
+struct VOLUMEPROTECT_API BufferPoolConfig {
+    bool        hugePages       { true };   ///< use hugetlb pages if reserved, else transparent hugepages (linux)
+    bool        lockMemory      { false };  ///< mlock buffers to keep them from being swapped out (linux)
+    bool        prefault        { false };  ///< populate pages when mapped instead of on first use (linux)
+    bool        numaLocal       { false };  ///< place pages on the numa node of the thread touching them (linux)
+    uint64_t    maxCachedBytes  { DEFAULT_BUFFER_POOL_CACHE_SIZE }; ///< max bytes of released buffers kept for reuse
+};
+
 /**
  * @brief Immutable config, used to build volume backup task
  */
@@ -91,11 +194,29 @@ struct VOLUMEPROTECT_API VolumeBackupConfig {
     uint32_t        blockSize       { DEFAULT_BLOCK_SIZE };  ///< [optional] default blocksize used for checksum
     uint64_t        sessionSize     { DEFAULT_SESSION_SIZE };///< default sesson size used to split session
     uint32_t        hasherNum       { DEFAULT_HASHER_NUM };  ///< hasher worker count, set to the num of processors
+    uint32_t        readerNum       { DEFAULT_READER_NUM };  ///< reader workers of each session, blocks are striped
+    uint32_t        sessionConcurrency { DEFAULT_SESSION_CONCURRENCY }; ///< max sessions reading at the same time
+    uint64_t        sessionMemoryBudget { 0 };               ///< max memory of live sessions, 0 to disable overlapping
+    uint32_t        stageConcurrency { 0 };                  ///< max block stage routines running at once, 0 no limit
     bool            hasherEnabled   { true };                ///< if set to false, won't compute checksum
+    HashAlgorithm   hashAlgorithm   { HashAlgorithm::SHA256 }; ///< must be the same with previous copy for increment backup
+    uint32_t        subBlockSize    { 0 };                   ///< rewrite changed sub-blocks only, 0 to disable
     bool            enableCheckpoint{ true };                ///< start from checkpoint if exists
     std::string     checkpointDirPath;                       ///< directory path where checkpoint stores at
     bool            clearCheckpointsOnSucceed { true };      ///< if clear checkpoint files on succeed
-    bool            skipEmptyBlock  { false };               ///< use sparsefile and skip zero block to save storage
+    CheckpointMode  checkpointMode  { CheckpointMode::SNAPSHOT }; ///< how checkpoint is persisted
+    bool            mapChecksumTable{ false };               ///< map checksum tables from meta files instead of heap
+    bool            skipEmptyBlock  { false };               ///< use sparsefile, zero block is skipped or punched
+    bool            skipUnallocatedBlock { false };          ///< skip reading blocks not allocated by filesystem (ext2/3/4, xfs)
+    ChangedBlockTracking cbtType    { ChangedBlockTracking::NONE }; ///< skip blocks unchanged since previous copy
+    std::string     cbtSource;                               ///< changed range file path, or dm-era device name
+    IOEngine        ioEngine        { IOEngine::SYNC };      ///< I/O engine used to read volume and write copy
+    uint32_t        ioQueueDepth    { DEFAULT_IO_QUEUE_DEPTH }; ///< max I/O in flight, only for async I/O engine
+    IOCacheMode     ioCacheMode     { IOCacheMode::BUFFERED }; ///< page cache mode, io_uring requires BUFFERED
+    IORateLimit     rateLimit;                               ///< pace reading volume and writing copy
+    IOPriority      ioPriority      { IOPriority::NORMAL };  ///< I/O priority class of reader/writer (linux only)
+    bool            enableZeroCopy  { false };               ///< copy in kernel if full backup without hasher/skipping
+    uint32_t        zeroCopyThreadNum { DEFAULT_ZERO_COPY_THREAD_NUM }; ///< threads copying ranges of each session
 };
 
 /**
@@ -109,7 +230,30 @@ struct VOLUMEPROTECT_API VolumeRestoreConfig {
     bool            enableCheckpoint { true };                      ///< start from checkpoint if exists
     std::string     checkpointDirPath;                              ///< directory path where checkpoint stores at
     bool            clearCheckpointsOnSucceed { true };             ///< if clear checkpoint files on succeed
-    bool            enableZeroCopy { false };                       ///< use zero copy optimization for CopyFormat::IMAGE restore
+    CheckpointMode  checkpointMode { CheckpointMode::SNAPSHOT };    ///< how checkpoint is persisted
+    bool            enableZeroCopy { false };                       ///< use zero copy optimization for CopyFormat::IMAGE/BIN restore
+    uint32_t        zeroCopyThreadNum { DEFAULT_ZERO_COPY_THREAD_NUM }; ///< threads copying ranges of each session
+    bool            differentialRestore { false };                  ///< only write blocks differing from the copy
+    bool            verifyRestore  { false };                       ///< check blocks restored with copy checksum
+    uint32_t        hasherNum      { DEFAULT_HASHER_NUM };          ///< hasher worker count of differential/verify
+    IOEngine        ioEngine       { IOEngine::SYNC };              ///< I/O engine used to read copy and write volume
+    uint32_t        ioQueueDepth   { DEFAULT_IO_QUEUE_DEPTH };      ///< max I/O in flight, only for async I/O engine
+    uint32_t        readerNum      { DEFAULT_READER_NUM };          ///< reader worker count of each session
+    uint32_t        stageConcurrency { 0 };                         ///< max reader/writer routines running at once
+    IOCacheMode     ioCacheMode    { IOCacheMode::BUFFERED };       ///< page cache mode, io_uring requires BUFFERED
+    IORateLimit     rateLimit;                                      ///< pace reading copy and writing volume
+    IOPriority      ioPriority     { IOPriority::NORMAL };          ///< I/O priority class of reader/writer (linux)
+    bool            punchZeroBlock { false };                       ///< punch hole/BLKZEROOUT zero blocks on volume
+};
+
+/**
+ * @brief Immutable config, used to build a scheduler running backup tasks of many volumes
+ */
+struct VOLUMEPROTECT_API VolumeBackupSchedulerConfig {
+    std::vector<VolumeBackupConfig> backupConfigs;      ///< one backup task for each config, started in order
+    uint32_t    maxRunningTasks     { DEFAULT_SCHEDULER_TASK_CONCURRENCY }; ///< max backup tasks running at once
+    uint32_t    maxTasksPerDevice   { DEFAULT_SCHEDULER_TASKS_PER_DEVICE }; ///< max running tasks of a physical disk
+    uint64_t    memoryBudget        { 0 };              ///< max estimated memory of running tasks, 0 for no limit
 };
 
 /**
@@ -144,7 +288,7 @@ struct VOLUMEPROTECT_API TaskStatistics {
 class VOLUMEPROTECT_API StatefulTask {
 public:
     ///< Abort a running task
-    void        Abort();
+    virtual void Abort();
     ///< Get TaskStatus enum of current task
     TaskStatus  GetStatus() const;
     ///< Check if current task is failed
@@ -174,6 +318,11 @@ public:
     virtual bool            Start() = 0;
     ///< Get current statictic info of current running task
     virtual TaskStatistics  GetStatistics() const = 0;
+    ///< Change I/O rate limit of a running task, return false if the task doesn't support rate limit
+    virtual bool            SetRateLimit(const IORateLimit& rateLimit);
+    ///< Get volume block index (offset / block size) of blocks restored mismatch with checksum of the copy,
+    ///< only reported by restore task with verifyRestore enabled, sessions completed are included
+    virtual std::vector<uint64_t> GetMismatchedBlocks() const;
 
     virtual ~VolumeProtectTask() = default;
 
@@ -192,6 +341,22 @@ public:
      * @return `nullptr` if failed
      */
     static std::unique_ptr<VolumeProtectTask> BuildRestoreTask(const VolumeRestoreConfig& restoreConfig);
+
+    /**
+     * @brief Builder function to build a scheduler running backup tasks of many volumes, tasks reading from the
+     *  same physical disk are limited to avoid I/O contention, statistics of all tasks are summed up
+     * @param schedulerConfig
+     * @return a valid `std::unique_ptr<VolumeProtectTask>` ptr if succeed
+     * @return `nullptr` if failed to build backup task of any volume
+     */
+    static std::unique_ptr<VolumeProtectTask> BuildBackupScheduler(const VolumeBackupSchedulerConfig& schedulerConfig);
+
+    /**
+     * @brief Configure the process-wide pool block buffers of sessions are leased from,
+     *  only buffers allocated after it's called are affected
+     * @param bufferPoolConfig
+     */
+    static void ConfigureBufferPool(const BufferPoolConfig& bufferPoolConfig);
 };
 
 }
@@ -264,6 +429,9 @@ VOLUMEPROTECT_API bool                IsTaskFailed(void* task);
 
 VOLUMEPROTECT_API bool                IsTaskTerminated(void* task);
 
+VOLUMEPROTECT_API bool                SetTaskRateLimit(
+    void* task, uint64_t readBytesPerSecond, uint64_t writeBytesPerSecond);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,107 @@
+/**
+ * @file BlockHash.h
+ * @brief This file defines block checksum algorithms used by hasher to detect changed blocks.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_BLOCK_HASH_HEADER
+#define VOLUMEBACKUP_BLOCK_HASH_HEADER
+
+#include "common/VolumeProtectMacros.h"
+#include "VolumeProtector.h"
+#include <cstdint>
+#include <string>
+
+// forward declaration of EVP_MD/EVP_MD_CTX of OpenSSL
+struct evp_md_st;
+struct evp_md_ctx_st;
+
+namespace volumeprotect {
+/**
+ * @brief block checksum algorithms, xxHash3/BLAKE3/CRC32C are portable implementations with no dependency,
+ *  digests are written in canonical byte order so that they are identical with the reference implementations.
+ */
+namespace blockhash {
+
+// digest size in bytes of the algorithm, return 0 if algorithm is unknown
+uint32_t DigestSize(HashAlgorithm algorithm);
+
+// literal name of the algorithm, such as "SHA256", "XXH3_128"
+std::string AlgorithmName(HashAlgorithm algorithm);
+
+// parse algorithm from literal name (case sensitive), return false if name is unknown
+bool ParseAlgorithm(const std::string& name, HashAlgorithm& algorithm);
+
+/**
+ * @brief compute digest of data using the specified algorithm
+ * @param output buffer to store digest
+ * @param outputLen must equal to DigestSize(algorithm)
+ * @return false if algorithm is unknown or outputLen mismatch
+ */
+bool ComputeDigest(HashAlgorithm algorithm, const uint8_t* data, uint64_t len, uint8_t* output, uint32_t outputLen);
+
+// SHA256 using OpenSSL EVP interface, 32 bytes output
+bool ComputeSHA256(const uint8_t* data, uint64_t len, uint8_t* output);
+
+// xxHash3 128bits with default secret and zero seed, 16 bytes output (big endian, high 64bits first)
+void ComputeXXH3_128(const uint8_t* data, uint64_t len, uint8_t* output);
+
+// BLAKE3 default hash mode, 32 bytes output
+void ComputeBLAKE3(const uint8_t* data, uint64_t len, uint8_t* output);
+
+// CRC32C (Castagnoli), 4 bytes output (big endian)
+void ComputeCRC32C(const uint8_t* data, uint64_t len, uint8_t* output);
+
+// check if all bytes of data are zero, 64 bytes are tested at once using AVX2/SSE2 if available
+bool IsZeroBlock(const uint8_t* data, uint64_t len);
+
+// max number of buffers can be hashed at once by multi-buffer SHA256 kernel (SHA-NI or AVX2), 0 if unsupported
+uint32_t SHA256MultiBufferLanes();
+
+/**
+ * @brief compute SHA256 of count buffers with the same length at once
+ * @return false if multi-buffer kernel is unsupported or count exceed SHA256MultiBufferLanes()
+ */
+bool ComputeSHA256MultiBuffer(const uint8_t* const data[], uint64_t len, uint8_t* const output[], uint32_t count);
+
+/**
+ * @brief Reusable digest context owned by a single thread (not thread safe).
+ *  Message digest of OpenSSL is fetched and EVP_MD_CTX is allocated only once in constructor,
+ *  batch of blocks with the same length are hashed together by multi-buffer kernel if supported.
+ */
+class DigestContext {
+public:
+    explicit DigestContext(HashAlgorithm algorithm);
+
+    ~DigestContext();
+
+    DigestContext(const DigestContext&) = delete;
+
+    DigestContext& operator = (const DigestContext&) = delete;
+
+    bool Ok() const;
+
+    uint32_t DigestSize() const;
+
+    // max count of blocks worth to be passed to ComputeBatch, 1 if multi-buffer is not supported
+    uint32_t MaxBatchSize() const;
+
+    bool Compute(const uint8_t* data, uint64_t len, uint8_t* output);
+
+    bool ComputeBatch(const uint8_t* const data[], const uint64_t len[], uint8_t* const output[], uint32_t count);
+
+private:
+    HashAlgorithm       m_algorithm     { HashAlgorithm::SHA256 };
+    uint32_t            m_digestSize    { 0 };
+    uint32_t            m_lanes         { 0 };  // lanes of multi-buffer kernel, 0 if unsupported
+    const evp_md_st*    m_md            { nullptr };
+    evp_md_ctx_st*      m_mdctx         { nullptr };
+    bool                m_mdFetched     { false };  // m_md need to be freed
+};
+
+}
+}
+
+#endif
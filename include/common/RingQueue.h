@@ -0,0 +1,427 @@
+/**
+ * @file RingQueue.h
+ * @brief This file implement a bounded lock-free multi-producer multi-consumer ring queue.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_RING_QUEUE_H
+#define VOLUMEBACKUP_RING_QUEUE_H
+
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+#include "common/VolumeProtectMacros.h"
+
+/**
+ * @brief RingQueue provide the same interface as BlockingQueue, items are stored in a ring of sequenced cells.
+ *  Push/pop only contend on a CAS of the enqueue/dequeue position (Dmitry Vyukov's bounded MPMC queue),
+ *  mutex and condition variable are only touched when the queue is full/empty and someone need to wait.
+ */
+template<typename T>
+class RingQueue {
+public:
+    explicit RingQueue(std::size_t maxSize); // capacity will be rounded up to power of 2
+
+    ~RingQueue();
+
+    bool BlockingPush(const T&);    // blocking push, return false if queue is set to finished
+
+    bool BlockingPop(T&);           // blocking pop, return false if queue is set to finished and empty
+
+    bool BlockingPushBatch(const std::vector<T>& items); // blocking push all items, false if set to finished
+
+    std::size_t BlockingPopBatch(std::vector<T>& items, std::size_t maxCount); // pop at least one unless finished
+
+    void Finish();
+
+    bool TryBlockingPush(const T&); // non-blocking push
+
+    bool TryBlockingPop(T&);        // non-blocking pop
+
+    std::size_t TryBlockingPopBatch(std::vector<T>& items, std::size_t maxCount); // non-blocking batch pop
+
+    bool Drained();                 // queue is set to finished and all items are popped
+
+    bool Empty();
+
+    std::size_t Size();
+
+    // [optional] called after items are pushed/popped or the queue is finished, must be set before the queue is used
+    void SetNotifyHook(std::function<void()> hook);
+
+private:
+    struct Cell {
+        std::atomic<std::size_t>    sequence;
+        T                           data;
+    };
+
+    std::size_t TryPushBatch(const T* items, std::size_t count);
+
+    std::size_t TryPopBatch(T* items, std::size_t count);
+
+    bool IsWritable() const;
+
+    bool IsReadable() const;
+
+    void NotifyNotEmpty(std::size_t count);
+
+    void NotifyNotFull(std::size_t count);
+
+private:
+    static const std::size_t CACHE_LINE_SIZE = 64;
+
+    Cell*                       m_cells;
+    std::size_t                 m_mask;
+    char                        m_pad0[CACHE_LINE_SIZE];
+    std::atomic<std::size_t>    m_enqueuePos    { 0 };
+    char                        m_pad1[CACHE_LINE_SIZE];
+    std::atomic<std::size_t>    m_dequeuePos    { 0 };
+    char                        m_pad2[CACHE_LINE_SIZE];
+    std::atomic<bool>           m_finished      { false };
+    std::atomic<uint32_t>       m_pushWaiters   { 0 };
+    std::atomic<uint32_t>       m_popWaiters    { 0 };
+    std::mutex                  m_mutex;
+    std::condition_variable     m_notEmpty;
+    std::condition_variable     m_notFull;
+    // let non-blocking producers/consumers be woken up by their scheduler
+    std::function<void()>       m_notifyHook;
+};
+
+template<typename T>
+RingQueue<T>::RingQueue(std::size_t maxSize)
+{
+    std::size_t capacity = 2;
+    while (capacity < maxSize) {
+        capacity <<= 1;
+    }
+    m_mask = capacity - 1;
+    m_cells = new Cell[capacity];
+    for (std::size_t i = 0; i < capacity; ++i) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+RingQueue<T>::~RingQueue()
+{
+    delete[] m_cells;
+    m_cells = nullptr;
+}
+
+/**
+ * @brief reserve up to count continuous writable cells with a single CAS, then publish them one by one
+ * @return number of items pushed, 0 if queue is full
+ */
+template<typename T>
+std::size_t RingQueue<T>::TryPushBatch(const T* items, std::size_t count)
+{
+    std::size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    std::size_t reserved = 0;
+    while (true) {
+        reserved = 0;
+        while (reserved < count && reserved <= m_mask &&
+            m_cells[(pos + reserved) & m_mask].sequence.load(std::memory_order_acquire) == pos + reserved) {
+            ++reserved;
+        }
+        if (reserved == 0) {
+            std::size_t seq = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+            if (static_cast<std::ptrdiff_t>(seq - pos) < 0) {
+                return 0; // the cell has not been consumed yet, queue is full
+            }
+            pos = m_enqueuePos.load(std::memory_order_relaxed); // other producer moved ahead
+            continue;
+        }
+        if (m_enqueuePos.compare_exchange_weak(pos, pos + reserved, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    for (std::size_t i = 0; i < reserved; ++i) {
+        Cell& cell = m_cells[(pos + i) & m_mask];
+        cell.data = items[i];
+        cell.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return reserved;
+}
+
+/**
+ * @brief reserve up to count continuous readable cells with a single CAS, then release them one by one
+ * @return number of items poped, 0 if queue is empty
+ */
+template<typename T>
+std::size_t RingQueue<T>::TryPopBatch(T* items, std::size_t count)
+{
+    std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    std::size_t reserved = 0;
+    while (true) {
+        reserved = 0;
+        while (reserved < count && reserved <= m_mask &&
+            m_cells[(pos + reserved) & m_mask].sequence.load(std::memory_order_acquire) == pos + reserved + 1) {
+            ++reserved;
+        }
+        if (reserved == 0) {
+            std::size_t seq = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+            if (static_cast<std::ptrdiff_t>(seq - (pos + 1)) < 0) {
+                return 0; // the cell has not been published yet, queue is empty
+            }
+            pos = m_dequeuePos.load(std::memory_order_relaxed); // other consumer moved ahead
+            continue;
+        }
+        if (m_dequeuePos.compare_exchange_weak(pos, pos + reserved, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    for (std::size_t i = 0; i < reserved; ++i) {
+        Cell& cell = m_cells[(pos + i) & m_mask];
+        items[i] = cell.data;
+        cell.sequence.store(pos + i + m_mask + 1, std::memory_order_release);
+    }
+    return reserved;
+}
+
+template<typename T>
+bool RingQueue<T>::IsWritable() const
+{
+    std::size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    return static_cast<std::ptrdiff_t>(m_cells[pos & m_mask].sequence.load(std::memory_order_acquire) - pos) >= 0;
+}
+
+template<typename T>
+bool RingQueue<T>::IsReadable() const
+{
+    std::size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    return static_cast<std::ptrdiff_t>(
+        m_cells[pos & m_mask].sequence.load(std::memory_order_acquire) - (pos + 1)) >= 0;
+}
+
+// waiter register itself with mutex held before checking, so taking the mutex here avoid lost wakeup
+template<typename T>
+void RingQueue<T>::NotifyNotEmpty(std::size_t count)
+{
+    // order the release of cell sequence before checking waiters
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_popWaiters.load() != 0) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        count == 1 ? m_notEmpty.notify_one() : m_notEmpty.notify_all();
+    }
+    if (m_notifyHook) {
+        m_notifyHook();
+    }
+}
+
+template<typename T>
+void RingQueue<T>::NotifyNotFull(std::size_t count)
+{
+    // order the release of cell sequence before checking waiters
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_pushWaiters.load() != 0) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        count == 1 ? m_notFull.notify_one() : m_notFull.notify_all();
+    }
+    if (m_notifyHook) {
+        m_notifyHook();
+    }
+}
+
+/**
+ * @brief blocking push an item, invoker thread will be blocked if queue is full
+ * @tparam T
+ * @param v
+ * @return true if push successfully
+ * @return false if queue is set to finish
+ */
+template<typename T>
+bool RingQueue<T>::BlockingPush(const T& v)
+{
+    while (!m_finished.load()) {
+        if (TryPushBatch(&v, 1) == 1) {
+            NotifyNotEmpty(1);
+            return true;
+        }
+        std::unique_lock<std::mutex> lk(m_mutex);
+        ++m_pushWaiters;
+        m_notFull.wait(lk, [&]() { return IsWritable() || m_finished.load(); });
+        --m_pushWaiters;
+    }
+    return false;
+}
+
+/**
+ * @brief blocking pop an item from queue, invoker thread will be blocked if queue is empty
+ * @tparam T
+ * @param v
+ * @return true if item is poped successfully
+ * @return false if queue is empty and has been set to finished
+ */
+template<typename T>
+bool RingQueue<T>::BlockingPop(T& v)
+{
+    while (true) {
+        if (TryPopBatch(&v, 1) == 1) {
+            NotifyNotFull(1);
+            return true;
+        }
+        if (m_finished.load()) {
+            // items pushed before finish are still available
+            if (TryPopBatch(&v, 1) == 1) {
+                NotifyNotFull(1);
+                return true;
+            }
+            return false;
+        }
+        std::unique_lock<std::mutex> lk(m_mutex);
+        ++m_popWaiters;
+        m_notEmpty.wait(lk, [&]() { return IsReadable() || m_finished.load(); });
+        --m_popWaiters;
+    }
+}
+
+template<typename T>
+bool RingQueue<T>::BlockingPushBatch(const std::vector<T>& items)
+{
+    std::size_t pushed = 0;
+    while (pushed < items.size() && !m_finished.load()) {
+        std::size_t count = TryPushBatch(items.data() + pushed, items.size() - pushed);
+        if (count != 0) {
+            pushed += count;
+            NotifyNotEmpty(count);
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(m_mutex);
+        ++m_pushWaiters;
+        m_notFull.wait(lk, [&]() { return IsWritable() || m_finished.load(); });
+        --m_pushWaiters;
+    }
+    return pushed == items.size();
+}
+
+template<typename T>
+std::size_t RingQueue<T>::BlockingPopBatch(std::vector<T>& items, std::size_t maxCount)
+{
+    items.resize(maxCount);
+    while (maxCount != 0) {
+        std::size_t count = TryPopBatch(items.data(), maxCount);
+        if (count != 0) {
+            items.resize(count);
+            NotifyNotFull(count);
+            return count;
+        }
+        if (m_finished.load()) {
+            count = TryPopBatch(items.data(), maxCount);
+            items.resize(count);
+            if (count != 0) {
+                NotifyNotFull(count);
+            }
+            return count;
+        }
+        std::unique_lock<std::mutex> lk(m_mutex);
+        ++m_popWaiters;
+        m_notEmpty.wait(lk, [&]() { return IsReadable() || m_finished.load(); });
+        --m_popWaiters;
+    }
+    return 0;
+}
+
+/**
+ * @brief to mark the queue to finished
+ * No more item should be pushed anymore and BlockingPop may return false once empty
+ * @tparam T
+ */
+template<typename T>
+void RingQueue<T>::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_finished = true;
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+    if (m_notifyHook) {
+        m_notifyHook();
+    }
+}
+
+/**
+ * @brief try to push an item (non-blocking)
+ * @tparam T
+ * @param v
+ * @return true if push successfully
+ * @return false if push failed
+ */
+template<typename T>
+bool RingQueue<T>::TryBlockingPush(const T& v)
+{
+    if (m_finished.load() || TryPushBatch(&v, 1) == 0) {
+        return false;
+    }
+    NotifyNotEmpty(1);
+    return true;
+}
+
+/**
+ * @brief try to pop an item (non-blocking)
+ * @tparam T
+ * @param v
+ * @return true if pop successfully
+ * @return false if pop failed
+ */
+template<typename T>
+bool RingQueue<T>::TryBlockingPop(T& v)
+{
+    if (TryPopBatch(&v, 1) == 0) {
+        return false;
+    }
+    NotifyNotFull(1);
+    return true;
+}
+
+/**
+ * @brief try to pop up to maxCount items (non-blocking)
+ * @return number of items poped, 0 if queue is empty
+ */
+template<typename T>
+std::size_t RingQueue<T>::TryBlockingPopBatch(std::vector<T>& items, std::size_t maxCount)
+{
+    items.resize(maxCount);
+    std::size_t count = (maxCount == 0) ? 0 : TryPopBatch(items.data(), maxCount);
+    items.resize(count);
+    if (count != 0) {
+        NotifyNotFull(count);
+    }
+    return count;
+}
+
+/**
+ * @brief used by non-blocking consumer to check termination after a failed try pop,
+ *  items are pushed before the queue is set to finished, so no more item will come once it's drained
+ */
+template<typename T>
+bool RingQueue<T>::Drained()
+{
+    return m_finished.load() && !IsReadable();
+}
+
+template<typename T>
+bool RingQueue<T>::Empty()
+{
+    return Size() == 0;
+}
+
+// approximate size, items reserved but not published yet are counted
+template<typename T>
+std::size_t RingQueue<T>::Size()
+{
+    std::size_t dequeuePos = m_dequeuePos.load();
+    std::size_t enqueuePos = m_enqueuePos.load();
+    return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+}
+
+template<typename T>
+void RingQueue<T>::SetNotifyHook(std::function<void()> hook)
+{
+    m_notifyHook = hook;
+}
+
+#endif
@@ -22,7 +22,7 @@ namespace volumeprotect {
 // volume data in [offset, offset + length) store in the file
 struct CopySegment {
     std::string                 copyDataFile;           // name of the copy file
-    std::string                 checksumBinFile;        // name of checksum binary file
+    std::string                 checksumBinFile;        // name of checksum binary file, empty if no checksum
     int                         index;                  // session index
     uint64_t                    offset;                 // volume offset
     uint64_t                    length;
@@ -43,6 +43,11 @@ struct VolumeCopyMeta {
     int                         copyFormat;     ///< cast CopyFormat to int
     uint64_t                    volumeSize;     ///< volume size in bytes
     uint32_t                    blockSize;      ///< block size in bytes
+    int                         hashAlgorithm { 0 };    ///< cast HashAlgorithm to int, SHA256 for older copy
+    uint32_t                    checksumSize { SHA256_CHECKSUM_SIZE }; ///< digest size of block, 0 if no checksum
+    uint32_t                    subBlockSize { 0 };     ///< 0 if sub-block checksum is not generated
+    int                         cbtType { 0 };          ///< cast ChangedBlockTracking to int
+    std::string                 cbtToken;               ///< point-in-time of the CBT source when the copy was taken
     std::vector<CopySegment>    segments;
 
     std::string                 volumePath;
@@ -62,6 +67,11 @@ struct VolumeCopyMeta {
     SERIALIZE_FIELD(volumeSize, volumeSize);
     SERIALIZE_FIELD(volumePath, volumePath);
     SERIALIZE_FIELD(blockSize, blockSize);
+    SERIALIZE_FIELD(hashAlgorithm, hashAlgorithm);
+    SERIALIZE_FIELD(checksumSize, checksumSize);
+    SERIALIZE_FIELD(subBlockSize, subBlockSize);
+    SERIALIZE_FIELD(cbtType, cbtType);
+    SERIALIZE_FIELD(cbtToken, cbtToken);
     SERIALIZE_FIELD(segments, segments);
     SERIALIZE_SECTION_END
 };
@@ -77,6 +87,12 @@ std::string GetChecksumBinPath(
     int                 sessionIndex
 );
 
+std::string GetSubBlockChecksumBinPath(
+    const std::string&  copyMetaDirPath,
+    const std::string&  copyName,
+    int                 sessionIndex
+);
+
 std::string GetCopyDataFilePath(
     const std::string&  copyDataDirPath,
     const std::string&  copyName,
@@ -90,6 +106,18 @@ std::string GetWriterBitmapFilePath(
     int                 sessionIndex
 );
 
+std::string GetCheckpointJournalFilePath(
+    const std::string&  checkpointDirPath,
+    const std::string&  copyName,
+    int                 sessionIndex
+);
+
+std::string GetRestoredChecksumFilePath(
+    const std::string&  checkpointDirPath,
+    const std::string&  copyName,
+    int                 sessionIndex
+);
+
 std::string GetFileName(const std::string& fullpath);
 
 std::string GetParentDirectoryPath(const std::string& fullpath);
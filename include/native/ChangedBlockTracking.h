@@ -0,0 +1,88 @@
+/**
+ * @file ChangedBlockTracking.h
+ * @brief Provide ranges of a volume changed since the previous copy, used to skip reading unchanged blocks.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_NATIVE_CHANGED_BLOCK_TRACKING_HEADER
+#define VOLUMEBACKUP_NATIVE_CHANGED_BLOCK_TRACKING_HEADER
+
+#include "common/VolumeProtectMacros.h"
+#include "VolumeProtector.h"
+#include "VolumeAllocationMap.h"
+
+namespace volumeprotect {
+/**
+ * @brief changed block tracking (CBT) sources
+ */
+namespace cbt {
+
+/**
+ * @brief ChangedBlockProvider list ranges of a volume written since a point-in-time identified by a token.
+ *  Token of the current point-in-time is saved in the copy meta and used by the next forever increment backup.
+ *  Range reported as changed may be not changed actually, the hasher will still compare it's checksum.
+ */
+class ChangedBlockProvider {
+public:
+    /**
+     * @brief Builder function to build a provider of specified CBT source
+     * @param type
+     * @param source changed range file path for ChangedBlockTracking::FILE,
+     *  name of the dm device for ChangedBlockTracking::DM_ERA
+     * @return a valid `std::unique_ptr<ChangedBlockProvider>` ptr if succeed
+     * @return `nullptr` if type is ChangedBlockTracking::NONE or not supported on this platform
+     */
+    static std::unique_ptr<ChangedBlockProvider> Build(ChangedBlockTracking type, const std::string& source);
+
+    virtual ~ChangedBlockProvider() = default;
+
+    ///< Get name of the CBT source
+    virtual std::string Name() const = 0;
+
+    /**
+     * @brief Get token of the current point-in-time, must be called before the volume is read,
+     *  so that writes happened during reading will be reported by the next ListChangedExtents
+     * @param token
+     * @return false if CBT source is not available
+     */
+    virtual bool CurrentToken(std::string& token) = 0;
+
+    /**
+     * @brief List ranges changed since the point-in-time identified by sinceToken
+     * @param sinceToken token got from CurrentToken() when the previous copy is generated
+     * @param changedExtents sorted by offset and not overlapped
+     * @return false if changes since the token is unknown, all blocks should be read then
+     */
+    virtual bool ListChangedExtents(
+        const std::string& sinceToken, std::vector<fsapi::VolumeExtent>& changedExtents) = 0;
+};
+
+/**
+ * @brief Read changed ranges from a text file maintained by an external tracker, one "offset length" pair
+ *  in bytes per line, lines start with '#' are ignored. Token is not used and always empty.
+ */
+class FileChangedBlockProvider : public ChangedBlockProvider {
+public:
+    explicit FileChangedBlockProvider(const std::string& filePath);
+
+    std::string Name() const override;
+
+    bool CurrentToken(std::string& token) override;
+
+    bool ListChangedExtents(const std::string& sinceToken, std::vector<fsapi::VolumeExtent>& changedExtents) override;
+
+private:
+    std::string     m_filePath;
+};
+
+/**
+ * @brief Sort extents by offset and merge overlapped or continuous extents
+ */
+void NormalizeExtents(std::vector<fsapi::VolumeExtent>& extents);
+
+}
+}
+
+#endif
@@ -34,6 +34,9 @@ bool        IsDirectoryExists(const std::string& path);
 
 uint8_t*    ReadBinaryBuffer(const std::string& filepath, uint64_t length);
 
+// read into buffer allocated by caller, bytes beyond the end of file are zero
+bool        ReadBinaryBuffer(const std::string& filepath, uint8_t* buffer, uint64_t length);
+
 bool        WriteBinaryBuffer(const std::string& filepath, const uint8_t* buffer, uint64_t length);
 
 bool        IsVolumeExists(const std::string& volumePath);
@@ -48,8 +51,24 @@ bool        RemoveFile(const std::string& dirPath, const std::string& filename);
 
 bool        RemoveFile(const std::string& filepath);
 
+// flush data of the file to disk
+bool        SyncFile(const std::string& filepath);
+
+// resolve symbolic links and relative components, the path itself is returned if it can't be resolved
+std::string CanonicalPath(const std::string& path);
+
 #ifdef __linux__
 uint64_t    ReadSectorSizeLinux(const std::string& devicePath);
+
+/**
+ * @brief Resolve a block device to names of the underlying physical disks by walking sysfs,
+ *  dm/LVM/md devices are resolved through their slaves and partitions to the disk containing it
+ * @param devicePath path of the block device, symbolic link like /dev/mapper/vg-lv is resolved first
+ * @param sysfsRoot
+ * @return sorted disk names (eg: "sda", "nvme0n1"), the name of the device itself if it's not found in sysfs
+ */
+std::vector<std::string> ResolvePhysicalDisksLinux(
+    const std::string& devicePath, const std::string& sysfsRoot = "/sys");
 #endif
 
 }
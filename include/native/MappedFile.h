@@ -0,0 +1,72 @@
+/**
+ * @file MappedFile.h
+ * @brief Map a file into memory and write back pages modified on demand.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_NATIVE_MAPPED_FILE_HEADER
+#define VOLUMEBACKUP_NATIVE_MAPPED_FILE_HEADER
+
+#include "common/VolumeProtectMacros.h"
+
+#include <atomic>
+
+namespace volumeprotect {
+namespace fsapi {
+
+/**
+ * @brief File mapped shared into memory, pages are loaded on access and evicted under memory pressure,
+ *  so the resident size is bounded no matter how large the file is.
+ *  Writers of the mapped memory mark the range written, Flush only writes back pages marked since the previous one.
+ */
+class MappedFile {
+public:
+    /**
+     * @brief map size bytes of the file
+     * @param writable map read-write, the file is created or resized to size, otherwise read-only
+     * @param truncate drop content of writable file, pages are zero filled
+     * @return nullptr if failed
+     */
+    static std::shared_ptr<MappedFile> Open(const std::string& filepath, uint64_t size, bool writable, bool truncate);
+
+    ~MappedFile();
+
+    uint8_t* Ptr() const;
+
+    uint64_t Size() const;
+
+    // mark range written through Ptr(), thread safe
+    void MarkDirty(uint64_t offset, uint64_t length);
+
+    // write back pages marked dirty and wait for them to be durable
+    bool Flush();
+
+private:
+    MappedFile(const std::string& filepath, uint64_t size, bool writable);
+
+    bool Map(bool truncate);
+
+    bool FlushRange(uint64_t offset, uint64_t length);
+
+private:
+    std::string                 m_filepath;
+    uint64_t                    m_size;
+    bool                        m_writable;
+    uint8_t*                    m_ptr           { nullptr };
+    uint64_t                    m_pageSize      { 0 };
+    uint64_t                    m_wordNum       { 0 };
+    std::unique_ptr<std::atomic<uint64_t>[]> m_dirtyWords;  // bit i of word j is set if page j * 64 + i is dirty
+#ifdef _WIN32
+    void*                       m_fileHandle    { nullptr };
+    void*                       m_mappingHandle { nullptr };
+#else
+    int                         m_fd            { -1 };
+#endif
+};
+
+}
+}
+
+#endif
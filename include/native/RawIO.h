@@ -39,6 +39,18 @@ public:
 
     virtual HandleType Handle() = 0;
 
+    /**
+     * @brief Get the first range holding data within [offset, offset + length), the rest are holes reading as zero
+     * @param dataLength set to 0 if there is no data in the range
+     * @return false if failed to query, default implementation treats the whole range as data
+     */
+    virtual bool NextDataRange(uint64_t offset, uint64_t length, uint64_t& dataOffset, uint64_t& dataLength)
+    {
+        dataOffset = offset;
+        dataLength = length;
+        return true;
+    }
+
     virtual ~RawDataReader() = default;
 };
 
@@ -58,9 +70,82 @@ public:
 
     virtual HandleType Handle() = 0;
 
+    /**
+     * @brief Deallocate [offset, offset + length) so that it reads as zero without writing zero data
+     * @return false if not supported by the target or failed, caller should write zero data instead
+     */
+    virtual bool PunchHole(uint64_t offset, uint64_t length, ErrCodeType& errorCode)
+    {
+        (void)offset;
+        (void)length;
+        errorCode = 0;
+        return false;
+    }
+
     virtual ~RawDataWriter() = default;
 };
 
+/**
+ * @brief Completion of an asynchronous I/O request submitted to AsyncRawDataReader/AsyncRawDataWriter
+ */
+struct AsyncIOResult {
+    uint64_t        key;            ///< key specified on submission, used to identify the request
+    uint32_t        length;         ///< bytes transferred
+    ErrCodeType     errorCode;      ///< 0 if the request succeed
+};
+
+/**
+ * @brief AsyncRawDataReader extends RawDataReader to allow multiple read requests in flight.
+ *  Submit() and Reap() are not thread safe and should be invoked from the same thread.
+ */
+class AsyncRawDataReader : public RawDataReader {
+public:
+    /**
+     * @brief Submit a read request without waiting for its completion
+     * @param key identify the request, returned by Reap() within AsyncIOResult
+     * @return false if the request can not be submitted, error code is set to errorCode
+     */
+    virtual bool Submit(uint64_t key, uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) = 0;
+
+    /**
+     * @brief Reap a completed request
+     * @param result completion of the request
+     * @param wait block until a request completes if set to true
+     * @return true if a completion is reaped
+     * @return false if no request completed or error occurs, check Error() if InFlight() is not zero
+     */
+    virtual bool Reap(AsyncIOResult& result, bool wait) = 0;
+
+    virtual uint32_t InFlight() const = 0;
+
+    virtual uint32_t QueueDepth() const = 0;
+};
+
+/**
+ * @brief AsyncRawDataWriter extends RawDataWriter to allow multiple write requests in flight.
+ *  Submit() and Reap() are not thread safe and should be invoked from the same thread,
+ *  Flush() only guarantee the requests that have been reaped are persisted.
+ */
+class AsyncRawDataWriter : public RawDataWriter {
+public:
+    virtual bool Submit(uint64_t key, uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) = 0;
+
+    virtual bool Reap(AsyncIOResult& result, bool wait) = 0;
+
+    virtual uint32_t InFlight() const = 0;
+
+    virtual uint32_t QueueDepth() const = 0;
+};
+
+/**
+ * @brief Option to specify which I/O engine the RawDataReader/RawDataWriter builder should use
+ */
+struct RawIOOption {
+    IOEngine        ioEngine;       ///< fallback to IOEngine::SYNC if the engine is not supported
+    uint32_t        queueDepth;     ///< max I/O in flight, only for async I/O engine
+    IOCacheMode     cacheMode;      ///< page cache mode of sync I/O engine, async I/O engine requires BUFFERED
+};
+
 /**
  * @brief Param struct to build RawDataReader/RawDataWriter.
  * Used to build reader/writer for each backup restore session to read/write from/to copyfile.
@@ -70,6 +155,7 @@ struct SessionCopyRawIOParam {
     std::string         copyFilePath;   ///< absolute file path of copy
     uint64_t            volumeOffset;   ///< volume offset in bytes
     uint64_t            length;         ///< session size in bytes
+    RawIOOption         ioOption;       ///< I/O engine used to access copy file
 };
 
 /**
@@ -96,6 +182,15 @@ std::shared_ptr<RawDataWriter> OpenRawDataCopyWriter(const SessionCopyRawIOParam
 */
 std::shared_ptr<RawDataReader> OpenRawDataVolumeReader(const std::string& volumePath);
 
+/**
+ * @brief Builder function to build a volume reader using given volume path and I/O engine
+ * @param volumePath
+ * @param option
+ * @return a valid `std::shared_ptr<RawDataReader>` ptr if succeed, may be a AsyncRawDataReader
+ * @return `nullptr` if failed
+*/
+std::shared_ptr<RawDataReader> OpenRawDataVolumeReader(const std::string& volumePath, const RawIOOption& option);
+
 /**
  * @brief Builder function to build a volume writer using given volume path
  * @param param
@@ -104,6 +199,15 @@ std::shared_ptr<RawDataReader> OpenRawDataVolumeReader(const std::string& volume
 */
 std::shared_ptr<RawDataWriter> OpenRawDataVolumeWriter(const std::string& volumePath);
 
+/**
+ * @brief Builder function to build a volume writer using given volume path and I/O engine
+ * @param volumePath
+ * @param option
+ * @return a valid `std::shared_ptr<RawDataWriter>` ptr if succeed, may be a AsyncRawDataWriter
+ * @return `nullptr` if failed
+*/
+std::shared_ptr<RawDataWriter> OpenRawDataVolumeWriter(const std::string& volumePath, const RawIOOption& option);
+
 /**
  * @brief Truncate create a file (maybe sparse file)
  * @param path absolute file path
@@ -114,6 +218,13 @@ std::shared_ptr<RawDataWriter> OpenRawDataVolumeWriter(const std::string& volume
  */
 bool TruncateCreateFile(const std::string& path, uint64_t size, ErrCodeType& errorCode);
 
+/**
+ * @brief Get the alignment of buffer, offset and length required by direct I/O (unbuffered I/O)
+ * @param path path of block device or common file
+ * @return logical sector size of block device, no less than DEFAULT_DIRECT_IO_ALIGNMENT
+ */
+uint32_t DirectIOAlignment(const std::string& path);
+
 }
 };
 
@@ -0,0 +1,68 @@
+/**
+ * @file VolumeAllocationMap.h
+ * @brief Provide filesystem allocation map of a volume, used to skip blocks not allocated by filesystem.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_NATIVE_VOLUME_ALLOCATION_MAP_HEADER
+#define VOLUMEBACKUP_NATIVE_VOLUME_ALLOCATION_MAP_HEADER
+
+#include "common/VolumeProtectMacros.h"
+#include "RawIO.h"
+
+namespace volumeprotect {
+namespace fsapi {
+
+/**
+ * @brief Describe a continuous range of a volume in bytes
+ */
+struct VolumeExtent {
+    uint64_t    offset;     ///< offset in bytes relative to the start of the volume
+    uint64_t    length;     ///< length in bytes
+};
+
+/**
+ * @brief AllocationMapProvider parse the filesystem metadata of a volume to list all free extents.
+ *  Range not covered by free extents is regarded as allocated, include ranges out of the filesystem.
+ *  The volume should be a snapshot or not mounted, otherwise the result may be outdated immediately.
+ */
+class AllocationMapProvider {
+public:
+    /**
+     * @brief Builder function to build a provider according to the filesystem type of the volume,
+     *  return a generic provider if the filesystem is unknown or not supported
+     * @param volumePath
+     * @return a valid `std::unique_ptr<AllocationMapProvider>` ptr if succeed
+     * @return `nullptr` if failed to open the volume
+     */
+    static std::unique_ptr<AllocationMapProvider> Build(const std::string& volumePath);
+
+    virtual ~AllocationMapProvider() = default;
+
+    ///< Get filesystem type name of the provider, empty for generic provider
+    virtual std::string FileSystemType() const = 0;
+
+    /**
+     * @brief List all free extents of the volume, sorted by offset and not overlapped
+     * @param freeExtents
+     * @return false if filesystem metadata is invalid or failed to read
+     */
+    virtual bool ListFreeExtents(std::vector<VolumeExtent>& freeExtents) = 0;
+};
+
+/**
+ * @brief Fallback provider for unknown filesystem, regard the whole volume as allocated
+ */
+class GenericAllocationMapProvider : public AllocationMapProvider {
+public:
+    std::string FileSystemType() const override;
+
+    bool ListFreeExtents(std::vector<VolumeExtent>& freeExtents) override;
+};
+
+}
+}
+
+#endif
@@ -104,6 +104,16 @@ private:
     bool   m_readonly { false };
 };
 
+/**
+ * @brief Status or table line of a single target of an active dm device
+ */
+struct DmTargetStatus {
+    uint64_t        startSector;
+    uint64_t        sectorsCount;
+    std::string     targetType;
+    std::string     params;         ///< status info, or the table parameter string if queried with table flag
+};
+
 enum class DmDeviceStatus {
     INVALID,
     SUSPENDED,
@@ -126,6 +136,19 @@ bool GetDeviceStatusUniquePath(const std::string& name, std::string& uniquePath)
 
 bool GetDevicePathByName(const std::string& name, std::string& dmDevicePath);
 
+/**
+ * @brief Get status of each target of the active table of dm device, equivalent to `dmsetup status/table`
+ * @param name dm device name
+ * @param tableParams get table parameter string of the targets instead of status info if set to true
+ * @param targets
+ */
+bool GetTableStatus(const std::string& name, bool tableParams, std::vector<DmTargetStatus>& targets);
+
+/**
+ * @brief Send message to the target of dm device at specified sector, equivalent to `dmsetup message`
+ */
+bool SendMessage(const std::string& name, const std::string& message, uint64_t sector = 0);
+
 }
 }
 
@@ -0,0 +1,93 @@
+/**
+ * @file DmEraChangedBlockProvider.h
+ * @brief Changed block tracking provider based on linux dm-era target by parsing it's on-disk metadata.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_LINUX_DM_ERA_CHANGED_BLOCK_PROVIDER_HEADER
+#define VOLUMEBACKUP_LINUX_DM_ERA_CHANGED_BLOCK_PROVIDER_HEADER
+
+#include "common/VolumeProtectMacros.h"
+
+#ifdef __linux__
+
+#include <functional>
+
+#include "ChangedBlockTracking.h"
+#include "RawIO.h"
+
+namespace volumeprotect {
+namespace cbt {
+
+/**
+ * @brief Parse the metadata snapshot of dm-era. A block is changed since era N if it is set in any archived
+ *  writeset of era >= N, or it's value in the era array is >= N. Writesets are digested into the era array
+ *  by kernel lazily, so both of them need to be checked.
+ * @link https://github.com/torvalds/linux/blob/master/drivers/md/dm-era-target.c
+ */
+class DmEraMetadataParser {
+public:
+    explicit DmEraMetadataParser(std::shared_ptr<rawio::RawDataReader> metadataReader);
+
+    /**
+     * @brief List blocks written since specified era from the metadata snapshot,
+     *  the snapshot must be taken by message "take_metadata_snap" in advance
+     * @param sinceEra
+     * @param changedExtents in bytes, sorted by offset and not overlapped
+     * @return false if metadata snapshot not exists or metadata is invalid
+     */
+    bool ListChangedExtents(uint32_t sinceEra, std::vector<fsapi::VolumeExtent>& changedExtents);
+
+private:
+    struct SuperBlock {
+        uint32_t    dataBlockSize;      // in sectors
+        uint32_t    nrBlocks;
+        uint32_t    currentEra;
+        uint64_t    writesetTreeRoot;
+        uint64_t    eraArrayRoot;
+        uint64_t    metadataSnap;
+    };
+
+    using BtreeVisitor = std::function<bool(uint64_t key, const uint8_t* value)>;
+
+    bool ReadSuperBlock(uint64_t blocknr, SuperBlock& superBlock);
+
+    bool WalkBtree(uint64_t blocknr, uint32_t valueSize, uint32_t depth, const BtreeVisitor& visitor);
+
+    bool WalkArray(uint64_t root, uint32_t valueSize, const BtreeVisitor& visitor);
+
+    bool ReadMetadataBlock(uint64_t blocknr, std::vector<uint8_t>& block);
+
+private:
+    std::shared_ptr<rawio::RawDataReader>   m_metadataReader;
+};
+
+/**
+ * @brief Query dm-era target of a dm device with single target, token is the era when CurrentToken() is called.
+ *  Metadata snapshot is held during ListChangedExtents() and dropped before it returns.
+ */
+class DmEraChangedBlockProvider : public ChangedBlockProvider {
+public:
+    explicit DmEraChangedBlockProvider(const std::string& dmName);
+
+    std::string Name() const override;
+
+    bool CurrentToken(std::string& token) override;
+
+    bool ListChangedExtents(const std::string& sinceToken, std::vector<fsapi::VolumeExtent>& changedExtents) override;
+
+private:
+    bool GetMetadataDevicePath(std::string& metadataDevicePath) const;
+
+private:
+    std::string     m_dmName;
+};
+
+}
+}
+
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @file IOUringRawIO.h
+ * @brief Linux io_uring based asynchronous volume block level I/O API.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_NATIVE_IO_URING_RAW_IO_HEADER
+#define VOLUMEBACKUP_NATIVE_IO_URING_RAW_IO_HEADER
+
+#include "common/VolumeProtectMacros.h"
+
+#if defined(POSIXAPI) && defined(VOLUMEPROTECT_IO_URING)
+
+#include "RawIO.h"
+
+namespace volumeprotect {
+namespace rawio {
+namespace posix {
+
+class IOUringQueue;
+
+// IOUringRawDataReader keep up to queueDepth read requests in flight using a private io_uring instance
+class IOUringRawDataReader : public AsyncRawDataReader {
+public:
+    IOUringRawDataReader(const std::string& path, uint32_t queueDepth, int flag = 0, uint64_t shiftOffset = 0);
+    ~IOUringRawDataReader();
+    bool Read(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) override;
+    bool Submit(uint64_t key, uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) override;
+    bool Reap(AsyncIOResult& result, bool wait) override;
+    uint32_t InFlight() const override;
+    uint32_t QueueDepth() const override;
+    bool Ok() override;
+    HandleType Handle() override;
+    ErrCodeType Error() override;
+    bool NextDataRange(uint64_t offset, uint64_t length, uint64_t& dataOffset, uint64_t& dataLength) override;
+
+private:
+    int m_fd {};
+    int m_flag { 0 };
+    uint64_t m_shiftOffset { 0 };
+    ErrCodeType m_error { 0 };
+    std::unique_ptr<IOUringQueue> m_queue;
+};
+
+// IOUringRawDataWriter keep up to queueDepth write requests in flight using a private io_uring instance
+class IOUringRawDataWriter : public AsyncRawDataWriter {
+public:
+    IOUringRawDataWriter(const std::string& path, uint32_t queueDepth, int flag = 0, uint64_t shiftOffset = 0);
+    ~IOUringRawDataWriter();
+    bool Write(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) override;
+    bool Submit(uint64_t key, uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) override;
+    bool Reap(AsyncIOResult& result, bool wait) override;
+    uint32_t InFlight() const override;
+    uint32_t QueueDepth() const override;
+    bool Ok() override;
+    HandleType Handle() override;
+    bool Flush() override;
+    ErrCodeType Error() override;
+    bool PunchHole(uint64_t offset, uint64_t length, ErrCodeType& errorCode) override;
+
+private:
+    int m_fd {};
+    int m_flag { 0 };
+    uint64_t m_shiftOffset { 0 };
+    ErrCodeType m_error { 0 };
+    std::unique_ptr<IOUringQueue> m_queue;
+};
+
+}
+}
+}
+
+#endif
+#endif
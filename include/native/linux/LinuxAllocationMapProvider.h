@@ -0,0 +1,113 @@
+/**
+ * @file LinuxAllocationMapProvider.h
+ * @brief Allocation map provider for ext2/3/4 and xfs by parsing on-disk filesystem metadata.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_LINUX_ALLOCATION_MAP_PROVIDER_HEADER
+#define VOLUMEBACKUP_LINUX_ALLOCATION_MAP_PROVIDER_HEADER
+
+#include "common/VolumeProtectMacros.h"
+
+#ifdef __linux__
+
+#include "VolumeAllocationMap.h"
+
+namespace volumeprotect {
+namespace fsapi {
+
+/**
+ * @brief Parse block bitmap of each block group of ext2/3/4.
+ *  Block group with flag BLOCK_UNINIT has no bitmap on disk,
+ *  all it's blocks are free except superblock backup, group descriptors and bitmaps/inode tables located in it.
+ */
+class Ext4AllocationMapProvider : public AllocationMapProvider {
+public:
+    explicit Ext4AllocationMapProvider(std::shared_ptr<rawio::RawDataReader> dataReader);
+
+    std::string FileSystemType() const override;
+
+    bool ListFreeExtents(std::vector<VolumeExtent>& freeExtents) override;
+
+private:
+    struct GroupDescriptor {
+        uint64_t    blockBitmap;
+        uint64_t    inodeBitmap;
+        uint64_t    inodeTable;
+        uint16_t    flags;
+    };
+
+    bool ReadSuperBlock();
+
+    bool ReadGroupDescriptors(std::vector<GroupDescriptor>& descriptors);
+
+    bool GroupHasSuperBlock(uint64_t group) const;
+
+    bool ReadGroupBitmap(
+        uint64_t group,
+        const std::vector<GroupDescriptor>& descriptors,
+        const std::vector<std::pair<uint64_t, uint64_t>>& metadataBlocks,
+        std::vector<uint8_t>& bitmap);
+
+    bool ReadBytes(uint64_t offset, uint8_t* buffer, uint32_t length);
+
+private:
+    std::shared_ptr<rawio::RawDataReader>   m_dataReader;
+    uint64_t    m_blockSize             { 0 };
+    uint64_t    m_blocksCount           { 0 };
+    uint64_t    m_firstDataBlock        { 0 };
+    uint64_t    m_blocksPerGroup        { 0 };
+    uint64_t    m_inodesPerGroup        { 0 };
+    uint64_t    m_inodeSize             { 0 };
+    uint64_t    m_descSize              { 0 };
+    uint64_t    m_groupsCount           { 0 };
+    uint64_t    m_reservedGdtBlocks     { 0 };
+    uint64_t    m_gdtBlocks             { 0 };
+    uint64_t    m_inodeTableBlocks      { 0 };
+    uint32_t    m_featureCompat         { 0 };
+    uint32_t    m_featureIncompat       { 0 };
+    uint32_t    m_featureRoCompat       { 0 };
+    uint32_t    m_backupGroups[2]       { 0, 0 };
+};
+
+/**
+ * @brief Walk the free space B+tree indexed by block number (bnobt) of each allocation group of xfs.
+ */
+class XfsAllocationMapProvider : public AllocationMapProvider {
+public:
+    explicit XfsAllocationMapProvider(std::shared_ptr<rawio::RawDataReader> dataReader);
+
+    std::string FileSystemType() const override;
+
+    bool ListFreeExtents(std::vector<VolumeExtent>& freeExtents) override;
+
+private:
+    bool ReadSuperBlock();
+
+    bool WalkFreeSpaceBtree(
+        uint32_t agno,
+        uint32_t agbno,
+        uint32_t expectedLevel,
+        std::vector<VolumeExtent>& freeExtents,
+        uint64_t& blocksVisited);
+
+    bool ReadBytes(uint64_t offset, uint8_t* buffer, uint32_t length);
+
+private:
+    std::shared_ptr<rawio::RawDataReader>   m_dataReader;
+    uint64_t    m_blockSize     { 0 };
+    uint64_t    m_dataBlocks    { 0 };
+    uint32_t    m_agBlocks      { 0 };
+    uint32_t    m_agCount       { 0 };
+    uint32_t    m_sectorSize    { 0 };
+    bool        m_crcEnabled    { false };  // v5 filesystem with crc enabled btree block header
+};
+
+}
+}
+
+#endif
+
+#endif
@@ -20,37 +20,72 @@ namespace volumeprotect {
 namespace rawio {
 namespace posix {
 
+// find the first range holding data of file within [offset, offset + length) using SEEK_DATA/SEEK_HOLE
+bool SeekDataRange(int fd, uint64_t offset, uint64_t length, uint64_t& dataOffset, uint64_t& dataLength);
+
+// punch hole in common file, or zero out range of block device by BLKZEROOUT which thin provisioning may unmap
+bool PunchHoleRange(int fd, uint64_t offset, uint64_t length, ErrCodeType& errorCode);
+
 // PosixRawDataReader can read from any block device or common file at given offset
 class PosixRawDataReader : public RawDataReader {
 public:
-    PosixRawDataReader(const std::string& path, int flag = 0, uint64_t shiftOffset = 0);
+    PosixRawDataReader(
+        const std::string& path,
+        int flag = 0,
+        uint64_t shiftOffset = 0,
+        IOCacheMode cacheMode = IOCacheMode::BUFFERED);
     ~PosixRawDataReader();
     bool Read(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) override;
     bool Ok() override;
     HandleType Handle() override;
     ErrCodeType Error() override;
+    bool NextDataRange(uint64_t offset, uint64_t length, uint64_t& dataOffset, uint64_t& dataLength) override;
+
+private:
+    // read unaligned range using a aligned bounce buffer, only for direct I/O
+    bool ReadUnaligned(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode);
 
 private:
     int m_fd {};
     int m_flag { 0 };
     uint64_t m_shiftOffset { 0 };
+    IOCacheMode m_cacheMode { IOCacheMode::BUFFERED };
+    uint32_t m_alignment { DEFAULT_DIRECT_IO_ALIGNMENT };
 };
 
 // PosixRawDataWriter can write to any block device or common file at give offset
 class PosixRawDataWriter : public RawDataWriter {
 public:
-    PosixRawDataWriter(const std::string& path, int flag = 0, uint64_t shiftOffset = 0);
+    PosixRawDataWriter(
+        const std::string& path,
+        int flag = 0,
+        uint64_t shiftOffset = 0,
+        IOCacheMode cacheMode = IOCacheMode::BUFFERED);
     ~PosixRawDataWriter();
     bool Write(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) override;
     bool Ok() override;
     HandleType Handle() override;
     bool Flush() override;
     ErrCodeType Error() override;
+    bool PunchHole(uint64_t offset, uint64_t length, ErrCodeType& errorCode) override;
+
+private:
+    // write unaligned range using a buffered fd, only for direct I/O
+    bool WriteUnaligned(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode);
+
+    // start writeback of the range just written, wait and drop pages of the range written last time
+    void DropBehind(uint64_t offset, int length);
 
 private:
     int m_fd {};
+    int m_bufferedFd { -1 };    // lazy opened for unaligned write if direct I/O enabled
     int m_flag { 0 };
     uint64_t m_shiftOffset { 0 };
+    std::string m_path;
+    IOCacheMode m_cacheMode { IOCacheMode::BUFFERED };
+    uint32_t m_alignment { DEFAULT_DIRECT_IO_ALIGNMENT };
+    uint64_t m_lastWriteOffset { 0 };
+    uint64_t m_lastWriteLength { 0 };
 };
 
 }
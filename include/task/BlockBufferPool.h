@@ -0,0 +1,72 @@
+/**
+ * @file BlockBufferPool.h
+ * @brief Process-wide pool of block buffer memory leased by sessions of all tasks.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_BLOCK_BUFFER_POOL_HEADER
+#define VOLUMEBACKUP_BLOCK_BUFFER_POOL_HEADER
+
+#include "common/VolumeProtectMacros.h"
+#include "VolumeProtector.h"
+
+#include <map>
+#include <mutex>
+
+namespace volumeprotect {
+namespace task {
+
+// regions leased are aligned to at least page size
+const uint32_t BUFFER_POOL_REGION_ALIGNMENT = 4096;
+
+/**
+ * @brief Hand out page aligned memory regions for block buffers, a region released is kept and leased again to
+ *  the next session asking for the same size class, so it's only mapped and page-faulted once.
+ *  Size classes are rounded up to hugepage size (page size for small regions), sessions using different block size
+ *  but the same buffer memory share regions. On linux regions are backed by hugetlb pages if reserved,
+ *  otherwise by transparent hugepages, optionally locked, prefaulted and bound to the local numa node.
+ */
+class BlockBufferPool {
+public:
+    static BlockBufferPool& Instance();
+
+    ~BlockBufferPool();
+
+    // apply to regions mapped later, regions cached are dropped
+    void Configure(const BufferPoolConfig& config);
+
+    /**
+     * @brief lease a region of at least size bytes
+     * @param capacity actual size of region leased, required to release it
+     * @return page aligned region, nullptr if failed
+     */
+    uint8_t* Lease(uint64_t size, uint64_t& capacity);
+
+    void Release(uint8_t* ptr, uint64_t capacity);
+
+    uint64_t CachedBytes() const;
+
+private:
+    BlockBufferPool() = default;
+
+    uint64_t SizeClass(uint64_t size) const;
+
+    uint8_t* MapRegion(uint64_t capacity) const;
+
+    void UnmapRegion(uint8_t* ptr, uint64_t capacity) const;
+
+    void DropCachedRegions();
+
+private:
+    mutable std::mutex                  m_mutex;
+    BufferPoolConfig                    m_config;
+    std::multimap<uint64_t, uint8_t*>   m_cachedRegions;    // capacity => region released
+    uint64_t                            m_cachedBytes   { 0 };
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,119 @@
+/**
+ * @file CheckpointJournal.h
+ * @brief Append-only journal of blocks done by a session, used as incremental checkpoint.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_CHECKPOINT_JOURNAL_HEADER
+#define VOLUMEBACKUP_CHECKPOINT_JOURNAL_HEADER
+
+#include "common/VolumeProtectMacros.h"
+#include "VolumeProtectTaskContext.h"
+
+#include <cstdio>
+#include <mutex>
+#include <chrono>
+#include <vector>
+
+namespace volumeprotect {
+namespace task {
+
+/**
+ * @brief Record blocks processed/written by a session since the last compaction.
+ *  Hasher and writer append block index in memory once a block is done, the task main thread commits them
+ *  periodically: records of all blocks appended (with digest of the block during backup) are written in one batch
+ *  and made durable by a single fdatasync (group commit), so the cost of a checkpoint only depends on the number of
+ *  blocks done since the previous one, the reader is never paused.
+ *  Once the journal outgrows a full snapshot it's compacted into the snapshot file and checksum table, then truncated.
+ *
+ *  File layout is a header followed by fixed size records, each record holds a block index and written flag,
+ *  followed by the block digest and sub-block checksums if hasher enabled. Torn records at tail are dropped on replay.
+ */
+class CheckpointJournal {
+public:
+    /**
+     * @param numBlocks number of blocks of the session
+     * @param checksumSize digest size of each block, 0 if hasher disabled
+     * @param subChecksumSize size of sub-block checksums of each block, 0 if disabled
+     * @return nullptr if failed to open journal file
+     */
+    static std::shared_ptr<CheckpointJournal> Open(
+        const std::string&  filepath,
+        uint64_t            numBlocks,
+        uint32_t            checksumSize,
+        uint32_t            subChecksumSize);
+
+    ~CheckpointJournal();
+
+    // record a block processed, also written if written is true, called by hasher/writer and never do I/O
+    void Append(uint64_t index, bool written);
+
+    // commit interval elapsed, blocks done meanwhile are committed in one group
+    bool IsCommitDue() const;
+
+    // take blocks appended so far into the next commit, data of them must be flushed before Commit
+    void Seal();
+
+    // persist blocks sealed along with their digests in hashing context (nullptr if hasher disabled)
+    bool Commit(const BlockHashingContext* hashingContext);
+
+    // journal exceeds the size of a full snapshot and should be compacted
+    bool NeedCompaction() const;
+
+    // bitmaps of all blocks committed or replayed, saved as snapshot on compaction
+    std::shared_ptr<CheckpointSnapshot> TakeCommittedSnapshot() const;
+
+    // drop records saved in snapshot, blocks committed are kept
+    bool Truncate();
+
+    // drop records and blocks committed, session is started from beginning
+    bool Reset();
+
+    /**
+     * @brief apply records on restart, bitmaps and hashing context must be restored from snapshot (if any) before
+     * @return false if journal doesn't belong to the session, invalid records at tail are truncated
+     */
+    bool Replay(Bitmap& processedBitmap, Bitmap& writtenBitmap, BlockHashingContext* hashingContext);
+
+    // no record in journal
+    bool Empty() const;
+
+private:
+    CheckpointJournal(
+        const std::string&  filepath,
+        uint64_t            numBlocks,
+        uint32_t            checksumSize,
+        uint32_t            subChecksumSize);
+
+    bool OpenFile();
+
+    bool WriteHeader();
+
+    bool WriteDurable(const uint8_t* buffer, uint64_t length);
+
+    bool TruncateFile(uint64_t length);
+
+private:
+    std::string             m_filepath;
+    FILE*                   m_file              { nullptr };
+    uint64_t                m_numBlocks;
+    uint32_t                m_checksumSize;
+    uint32_t                m_subChecksumSize;
+    uint32_t                m_recordSize;
+    uint64_t                m_compactThreshold;
+    uint64_t                m_fileSize          { 0 };
+    std::chrono::steady_clock::time_point m_lastCommit { std::chrono::steady_clock::now() };
+
+    std::mutex              m_mutex;
+    std::vector<uint64_t>   m_pending;          // appended by hasher/writer, written flag packed in the highest bit
+    std::vector<uint64_t>   m_sealed;           // only accessed by task main thread
+    std::shared_ptr<Bitmap> m_processedBitmap;
+    std::shared_ptr<Bitmap> m_writtenBitmap;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file IORateLimiter.h
+ * @brief Pace reader/writer I/O of a task under bytes/s and ops/s limits.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_IO_RATE_LIMITER_HEADER
+#define VOLUMEBACKUP_IO_RATE_LIMITER_HEADER
+
+#include "common/VolumeProtectMacros.h"
+#include "VolumeProtector.h"
+
+#include <mutex>
+#include <chrono>
+
+namespace volumeprotect {
+namespace task {
+
+/**
+ * @brief Token bucket in the form of virtual scheduling: each I/O pushes the time the bucket is refilled
+ *  (theoretical arrival time) forward by its cost, an I/O is admitted if that time is within a small burst
+ *  tolerance from now. Tokens never accumulate beyond the tolerance, so I/O is paced evenly instead of bursting
+ *  after an idle period. Shared by all workers and sessions of a task, limits can be changed at any time.
+ *
+ *  In adaptive mode the effective bytes/s limit is lowered while the average latency reported exceeds the threshold
+ *  and raised back slowly once it drops, if no bytes/s limit is configured it backs off from the observed rate.
+ */
+class IORateLimiter {
+public:
+    // 0 for no limit
+    IORateLimiter(uint64_t bytesPerSecond, uint64_t opsPerSecond, uint32_t latencyThresholdUs = 0);
+
+    void SetLimit(uint64_t bytesPerSecond, uint64_t opsPerSecond, uint32_t latencyThresholdUs = 0);
+
+    // check if a new I/O can be issued now, never block
+    bool Admit();
+
+    // charge an I/O issued, called once the I/O is submitted or done
+    void Consume(uint64_t bytes, uint64_t ops = 1);
+
+    // report latency of an I/O done, used by adaptive mode only
+    void RecordLatency(std::chrono::microseconds latency);
+
+    // bytes/s limit currently enforced, lower than configured one if adaptive mode has backed off, 0 for no limit
+    uint64_t EffectiveBytesPerSecond() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t EffectiveBytesPerSecondLocked() const;
+
+    void AdjustAdaptiveRate(Clock::time_point now);
+
+private:
+    mutable std::mutex  m_mutex;
+    uint64_t            m_bytesPerSecond;
+    uint64_t            m_opsPerSecond;
+    uint32_t            m_latencyThresholdUs;
+    Clock::time_point   m_bytesRefillTime;      // bucket is full again at this time
+    Clock::time_point   m_opsRefillTime;
+
+    // adaptive mode
+    uint64_t            m_adaptiveBytesPerSecond    { 0 };  // 0 if not backed off
+    Clock::time_point   m_windowStart;
+    uint64_t            m_windowBytes               { 0 };
+    uint64_t            m_windowLatencyUs           { 0 };
+    uint64_t            m_windowSamples             { 0 };
+};
+
+/**
+ * @brief Set I/O priority of the calling thread (linux only), executor workers are shared by tasks of different
+ *  priority, so stages call it each step and the syscall is only issued if the priority of the thread changes
+ */
+void ApplyThreadIOPriority(IOPriority priority);
+
+}
+}
+
+#endif
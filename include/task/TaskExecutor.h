@@ -0,0 +1,185 @@
+/**
+ * @file TaskExecutor.h
+ * @brief Process-wide work-stealing executor shared by reader/hasher/writer of all sessions and tasks.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_TASK_EXECUTOR_HEADER
+#define VOLUMEBACKUP_TASK_EXECUTOR_HEADER
+
+#include "common/VolumeProtectMacros.h"
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+namespace volumeprotect {
+namespace task {
+
+/**
+ * @brief Result of running one step of a routine
+ */
+enum class StepResult {
+    CONTINUE,   ///< progress made, schedule the routine again
+    WAIT,       ///< blocked by other stages (queue full/empty, no buffer, paused), see TaskExecutor::WaitFor
+    DONE        ///< routine terminated
+};
+
+/**
+ * @brief A routine is called repeatedly until it returns StepResult::DONE. Each call must not block on other stages,
+ *  otherwise the routine may occupy an executor worker that the stage it's waiting for needs. Blocking on I/O is ok.
+ */
+using StepRoutine = std::function<StepResult()>;
+
+/**
+ * @brief Limit how many routines of a task can run at the same time on the executor
+ */
+class ExecutorGroup {
+public:
+    // 0 for no limit other than executor worker number
+    explicit ExecutorGroup(uint32_t maxConcurrency);
+
+    bool TryAcquire();
+
+    void Release();
+
+private:
+    const uint32_t          m_maxConcurrency;
+    std::atomic<uint32_t>   m_running { 0 };
+};
+
+class TaskExecutor;
+
+/**
+ * @brief Signal of a condition routines of other stages wait for, like a buffer freed or a block pushed to a queue.
+ *  Notify is lock free unless some routine is parked on the event.
+ */
+class ExecutorEvent {
+public:
+    // taken by a routine before checking the condition, so a notification after that is never missed
+    uint64_t Sequence() const;
+
+    // called after the condition changed, reschedule routines parked on the event
+    void Notify();
+
+private:
+    friend class TaskExecutor;
+
+    std::atomic<uint64_t>       m_sequence  { 0 };
+    std::atomic<uint32_t>       m_waiters   { 0 };
+    std::atomic<TaskExecutor*>  m_executor  { nullptr };
+};
+
+/**
+ * @brief Handle of a routine submitted to executor, used to wait for the routine to terminate
+ */
+class ExecutorJob {
+public:
+    ExecutorJob(StepRoutine routine, std::shared_ptr<ExecutorGroup> group);
+
+    // block until the routine returns StepResult::DONE
+    void Wait();
+
+    bool IsDone() const;
+
+private:
+    friend class TaskExecutor;
+
+    void MarkDone();
+
+private:
+    StepRoutine                             m_routine;
+    std::shared_ptr<ExecutorGroup>          m_group;
+    // retry time and delay of a waiting routine, accessed only by the worker holding the job
+    std::chrono::microseconds               m_backoff { 0 };
+    std::chrono::steady_clock::time_point   m_wakeTime;
+    // event the parked routine is waiting for, nullptr if retried by backoff, protected by executor mutex
+    std::shared_ptr<ExecutorEvent>          m_waitEvent;
+
+    mutable std::mutex                      m_mutex;
+    std::condition_variable                 m_cv;
+    bool                                    m_done { false };
+};
+
+/**
+ * @brief Run routines on a fixed number of worker threads, each worker has a local run queue and steals from
+ *  others when it's empty. A routine returns StepResult::CONTINUE is pushed back to the local queue,
+ *  one returns StepResult::WAIT is parked until the event it waits for is notified, or retried with exponential
+ *  backoff if it's not waiting for any event (paused, throttled).
+ */
+class TaskExecutor {
+public:
+    // executor shared by all tasks of the process, worker threads are created on first use
+    static TaskExecutor& Instance();
+
+    explicit TaskExecutor(uint32_t workerNum);
+
+    ~TaskExecutor();
+
+    std::shared_ptr<ExecutorJob> Submit(StepRoutine routine, std::shared_ptr<ExecutorGroup> group = nullptr);
+
+    uint32_t WorkerNum() const;
+
+    /**
+     * @brief Called by a routine returning the result, park the routine until event is notified after sequence
+     *  was taken. The routine is also retried after a while in case it's waiting for other conditions (abort).
+     * @return StepResult::WAIT
+     */
+    static StepResult WaitFor(std::shared_ptr<ExecutorEvent> event, uint64_t sequence);
+
+private:
+    friend class ExecutorEvent;
+
+    struct WorkerQueue {
+        std::mutex                                  mutex;
+        std::deque<std::shared_ptr<ExecutorJob>>    jobs;
+    };
+
+    void WorkerThread(uint32_t workerID);
+
+    void RunJob(uint32_t workerID, std::shared_ptr<ExecutorJob> job);
+
+    void Push(uint32_t workerID, std::shared_ptr<ExecutorJob> job);
+
+    void Park(std::shared_ptr<ExecutorJob> job);
+
+    void ParkOnEvent(uint32_t workerID, std::shared_ptr<ExecutorJob> job,
+        std::shared_ptr<ExecutorEvent> event, uint64_t sequence);
+
+    void Wake(const ExecutorEvent* event);
+
+    std::shared_ptr<ExecutorJob> Unpark(std::size_t index);
+
+    std::shared_ptr<ExecutorJob> PopLocal(uint32_t workerID);
+
+    std::shared_ptr<ExecutorJob> Steal(uint32_t workerID);
+
+    std::shared_ptr<ExecutorJob> PopParked();
+
+    std::chrono::steady_clock::time_point NextWakeTime() const;
+
+private:
+    std::vector<std::unique_ptr<WorkerQueue>>   m_queues;
+    std::vector<std::thread>                    m_workers;
+    std::atomic<uint32_t>                       m_nextQueue     { 0 };
+    std::atomic<uint64_t>                       m_readyJobs     { 0 };  // jobs in all local queues
+
+    // protect parked jobs and idle workers
+    mutable std::mutex                          m_mutex;
+    std::condition_variable                     m_cv;
+    std::vector<std::shared_ptr<ExecutorJob>>   m_parked;
+    bool                                        m_stop          { false };
+};
+
+}
+}
+
+#endif
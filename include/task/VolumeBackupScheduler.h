@@ -0,0 +1,84 @@
+/**
+ * @file VolumeBackupScheduler.h
+ * @brief Run backup tasks of many volumes under global, per physical disk and memory limits.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_BACKUP_SCHEDULER_HEADER
+#define VOLUMEBACKUP_BACKUP_SCHEDULER_HEADER
+
+#include "VolumeProtector.h"
+#include "VolumeProtectTaskContext.h"
+
+namespace volumeprotect {
+namespace task {
+
+/**
+ * @brief A backup task waiting to be scheduled and the resources it holds while running
+ */
+struct ScheduledBackupTask {
+    std::unique_ptr<VolumeProtectTask>  task;
+    std::string                         volumePath;
+    std::vector<std::string>            devices;            // physical disks the volume resides on
+    uint64_t                            memory  { 0 };      // estimated memory held while running
+    bool                                started { false };
+};
+
+/**
+ * @brief Start pending backup tasks in order once limits allow, a task blocked by a busy disk won't block
+ *  the tasks of idle disks behind it. Scheduler fails if any task fails, the others still run to the end.
+ */
+class VolumeBackupScheduler : public VolumeProtectTask {
+public:
+    bool            Start() override;
+    TaskStatistics  GetStatistics() const override;
+
+    void            Abort() override;
+
+    bool            SetRateLimit(const IORateLimit& rateLimit) override;
+
+    VolumeBackupScheduler(
+        const VolumeBackupSchedulerConfig& schedulerConfig,
+        std::vector<std::shared_ptr<ScheduledBackupTask>> tasks);
+    ~VolumeBackupScheduler();
+
+    // memory of block buffers and checksum tables held by concurrent sessions of a backup task
+    static uint64_t EstimateTaskMemory(const VolumeBackupConfig& backupConfig, uint64_t volumeSize);
+
+    // physical disks of the volume, the volume path itself if it can't be resolved
+    static std::vector<std::string> ResolveVolumeDevices(const std::string& volumePath);
+
+private:
+    void ThreadFunc();
+
+    bool CanStartTask(const ScheduledBackupTask& scheduledTask) const;
+
+    void StartPendingTasks();
+
+    void PollRunningTasks();
+
+    void AbortRunningTasks();
+
+    void ReleaseTaskResources(const ScheduledBackupTask& scheduledTask);
+
+private:
+    uint32_t                                            m_maxRunningTasks;
+    uint32_t                                            m_maxTasksPerDevice;
+    uint64_t                                            m_memoryBudget;
+    std::vector<std::shared_ptr<ScheduledBackupTask>>   m_tasks;        // immutable after constructed
+
+    // only accessed by the scheduler thread
+    std::vector<std::shared_ptr<ScheduledBackupTask>>   m_runningTasks;
+    std::map<std::string, uint32_t>                     m_deviceRunningTasks;
+    uint64_t                                            m_runningMemory { 0 };
+
+    std::thread                                         m_thread;
+    std::shared_ptr<TaskEventNotifier>                  m_notifier;
+};
+
+}
+}
+
+#endif
@@ -12,6 +12,8 @@
 #include "VolumeProtector.h"
 #include "VolumeProtectTaskContext.h"
 #include "native/TaskResourceManager.h"
+#include "native/VolumeAllocationMap.h"
+#include "native/ChangedBlockTracking.h"
 #include "VolumeUtils.h"
 
 namespace volumeprotect {
@@ -28,6 +30,10 @@ public:
     bool            Start() override;
     TaskStatistics  GetStatistics() const override;
 
+    void            Abort() override;
+
+    bool            SetRateLimit(const IORateLimit& rateLimit) override;
+
     VolumeBackupTask(const VolumeBackupConfig& backupConfig, uint64_t volumeSize);
     ~VolumeBackupTask();
 private:
@@ -35,7 +41,13 @@ private:
 
     void ThreadFunc();
 
-    bool WaitSessionTerminate(std::shared_ptr<VolumeTaskSession> session);
+    bool PollRunningSessions(std::vector<std::shared_ptr<VolumeTaskSession>>& runningSessions);
+
+    void CompleteSession(std::shared_ptr<VolumeTaskSession> session);
+
+    bool CanStartNextSession(const std::vector<std::shared_ptr<VolumeTaskSession>>& runningSessions) const;
+
+    uint64_t EstimateSessionMemory(const VolumeTaskSession& session) const;
 
     bool StartBackupSession(std::shared_ptr<VolumeTaskSession> session) const;
 
@@ -51,8 +63,14 @@ private:
 
     bool InitHashingContext(std::shared_ptr<VolumeTaskSession> session) const;
 
+    bool InitMappedHashingContext(std::shared_ptr<VolumeTaskSession> session) const;
+
     virtual bool LoadSessionPreviousCopyChecksum(std::shared_ptr<VolumeTaskSession> session) const;
 
+    virtual bool LoadSessionPreviousSubBlockChecksum(std::shared_ptr<VolumeTaskSession> session) const;
+
+    virtual bool IsPreviousSubBlockChecksumMatched() const;
+
     virtual bool SaveVolumeCopyMeta(
         const std::string& copyMetaDirPath,
         const std::string& copyName,
@@ -62,6 +80,22 @@ private:
 
     void ClearAllCheckpoints() const;
 
+    virtual bool LoadVolumeFreeExtents();
+
+    bool InitSessionAllocatedBitmap(std::shared_ptr<VolumeTaskSession> session) const;
+
+    bool FillUnallocatedBlockChecksum(std::shared_ptr<VolumeTaskSession> session) const;
+
+    bool ComputeZeroBlockChecksum(
+        std::shared_ptr<VolumeTaskSharedConfig> sharedConfig,
+        uint64_t blockLength,
+        std::vector<uint8_t>& checksum,
+        std::vector<uint8_t>& subChecksum) const;
+
+    virtual bool LoadChangedExtents(std::string& currentToken);
+
+    void InitSessionChangedBitmap(std::shared_ptr<VolumeTaskSession> session) const;
+
 protected:
     uint64_t                                m_volumeSize;
     std::shared_ptr<VolumeBackupConfig>     m_backupConfig;
@@ -70,6 +104,16 @@ protected:
     SessionQueue                            m_sessionQueue;
     std::shared_ptr<TaskResourceManager>    m_resourceManager;
     std::vector<std::string>                m_checkpointFiles;
+    std::shared_ptr<TaskEventNotifier>      m_notifier;
+    // reader/hasher/writer of all sessions run on the shared executor, limited by this group
+    std::shared_ptr<ExecutorGroup>          m_executorGroup;
+    std::shared_ptr<IORateLimiter>          m_readLimiter;
+    std::shared_ptr<IORateLimiter>          m_writeLimiter;
+    std::vector<fsapi::VolumeExtent>        m_freeExtents;  // sorted free extents of volume, empty if not loaded
+    uint32_t                                m_subBlockSize  { 0 };  // 0 if sub-block checksum disabled
+    bool                                    m_prevSubBlockChecksumAvailable { false };
+    std::vector<fsapi::VolumeExtent>        m_changedExtents;   // sorted extents changed since previous copy
+    bool                                    m_changedExtentsAvailable { false }; // read all blocks if false
 };
 
 }
@@ -2,6 +2,8 @@
 #define VOLUMEBACKUP_BLOCK_HASHER_HEADER
 
 #include "VolumeProtectTaskContext.h"
+#include "BlockHash.h"
+#include <unordered_map>
 
 namespace volumeprotect {
 namespace task {
@@ -10,7 +12,11 @@ enum class  HasherForwardMode {
     // direct move block to write queue after block checksum is computed
     DIRECT,
     // diff the checksum computed with the corresponding previous one and move block forward only it's cheksum changed
-    DIFF
+    DIFF,
+    // diff the checksum of target volume with the copy, never move block forward, record the mismatched ones
+    COMPARE,
+    // direct move block to write queue, record blocks read from copy mismatch with checksum of the copy
+    VERIFY
 };
 
 /**
@@ -22,6 +28,8 @@ struct VolumeBlockHasherParam {
     uint32_t                    workerThreadNum                 { DEFAULT_HASHER_NUM };
     HasherForwardMode           forwardMode                     { HasherForwardMode::DIRECT };
     uint32_t                    singleChecksumSize              { 0 };
+    HashAlgorithm               hashAlgorithm                   { HashAlgorithm::SHA256 };
+    uint32_t                    subBlockSize                    { 0 };
 };
 
 /**
@@ -41,18 +49,47 @@ public:
     explicit VolumeBlockHasher(const VolumeBlockHasherParam& param);
 
 private:
-    void WorkerThread(uint32_t workerID);
+    /**
+     * @brief mutable state owned by a hasher worker routine
+     */
+    struct HasherWorker {
+        uint32_t    workerID        { 0 };
+        uint32_t    batchSize       { 1 };
+        TaskStatus  status          { TaskStatus::INIT };
+        // digest context is reused by all blocks consumed by this worker
+        std::unique_ptr<blockhash::DigestContext>   digestContext;
+        std::vector<VolumeConsumeBlock>             batch;
+        std::deque<VolumeConsumeBlock>              pendingBlocks;  // changed blocks waiting for write queue space
+    };
 
-    void ComputeSHA256(uint8_t* data, uint32_t len, uint8_t* output, uint32_t outputLen);
+    StepResult WorkerStep(HasherWorker& worker);
 
-    void HandleWorkerTerminate();
+    bool PushPendingBlocks(HasherWorker& worker);
+
+    // zero blocks of the batch are flagged and not hashed
+    bool ComputeChecksumBatch(blockhash::DigestContext& digestContext, std::vector<VolumeConsumeBlock>& batch);
+
+    // digest of zero data of the length, computed only once from the first zero block and cached
+    bool ZeroDigest(blockhash::DigestContext& digestContext, const uint8_t* zeroData, uint64_t length, uint8_t* output);
+
+    bool ComputeSubBlockChecksum(blockhash::DigestContext& digestContext, const VolumeConsumeBlock& consumeBlock);
+
+    bool IsBlockChanged(uint64_t index) const;
+
+    uint64_t ChangedSubBlockMask(const VolumeConsumeBlock& consumeBlock) const;
+
+    void ForwardBlock(HasherWorker& worker, const VolumeConsumeBlock& consumeBlock);
+
+    void HandleWorkerTerminate(HasherWorker& worker);
 
 private:
     uint32_t                    m_singleChecksumSize    { 0 };
+    HashAlgorithm               m_hashAlgorithm         { HashAlgorithm::SHA256 };
     HasherForwardMode           m_forwardMode           { HasherForwardMode::DIRECT };
     uint32_t                    m_workerThreadNum       { DEFAULT_HASHER_NUM };
     std::atomic<uint32_t>       m_workersRunning        { 0 };
-    std::vector<std::shared_ptr<std::thread>>   m_workers;
+    std::vector<std::shared_ptr<ExecutorJob>>   m_workers;
+    std::vector<std::shared_ptr<HasherWorker>>  m_hasherWorkers;
     std::shared_ptr<VolumeTaskSharedConfig>     m_sharedConfig;
 
     // only the borrowed reference from BlockHashingContext, won't be free by VolumeBlockHasher
@@ -61,6 +98,16 @@ private:
     uint8_t*                                    m_lastestChecksumTable { nullptr }; // mutable, shared within worker
     uint64_t                                    m_lastestChecksumTableSize;         // bytes allocated
 
+    // sub-block checksum tables are also borrowed from BlockHashingContext, nullptr if not available
+    uint32_t                                    m_subBlockSize          { 0 };
+    uint32_t                                    m_subBlocksPerBlock     { 0 };  // 0 if sub-block checksum disabled
+    uint8_t*                                    m_subPrevChecksumTable  { nullptr };
+    uint8_t*                                    m_subLastestChecksumTable { nullptr };
+
+    // digest of zero data keyed by data length, shared by all workers
+    std::mutex                                  m_zeroDigestMutex;
+    std::unordered_map<uint64_t, std::vector<uint8_t>>  m_zeroDigests;
+
     std::shared_ptr<VolumeTaskSharedContext>    m_sharedContext;
 };
 
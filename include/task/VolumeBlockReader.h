@@ -22,11 +22,14 @@ struct VolumeBlockReaderParam {
     std::shared_ptr<rawio::RawDataReader>         dataReader;
     std::shared_ptr<VolumeTaskSharedConfig>     sharedConfig;
     std::shared_ptr<VolumeTaskSharedContext>    sharedContext;
-
+    // [optional] data readers for the rest reader workers, each worker requires a exclusive data reader
+    std::vector<std::shared_ptr<rawio::RawDataReader>>    extraDataReaders;
 };
 
 /**
- * @brief Independent routine to keep reading block from volume or copy file and then push to queue
+ * @brief Independent routine to keep reading block from volume or copy file and then push to queue.
+ *  Session blocks can be splited to multiple reader workers,
+ *  worker[i] reads block of index i, i + N, i + 2N ... (N is the number of workers)
  */
 class VolumeBlockReader : public StatefulTask {
 public:
@@ -53,21 +56,70 @@ public:
     void Resume();
 
 private:
-    void MainThread();
+    /**
+     * @brief mutable state owned by a reader worker thread
+     */
+    struct ReaderWorker {
+        uint32_t    workerID        { 0 };
+        uint64_t    currentIndex    { 0 };
+        TaskStatus  status          { TaskStatus::INIT };
+        std::shared_ptr<rawio::RawDataReader>               dataReader;
+        // not null if dataReader support asynchronous I/O
+        std::shared_ptr<rawio::AsyncRawDataReader>          asyncDataReader;
+        std::unordered_map<uint64_t, VolumeConsumeBlock>    inflightBlocks;     // index => block submitted
+        // index => time submitted, only tracked if rate limited
+        std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> inflightSince;
+        std::deque<VolumeConsumeBlock>                      pendingBlocks;      // blocks waiting for queue space
+        bool                                                waitingBuffer   { false };
+        std::chrono::steady_clock::time_point               waitBufferSince;
+    };
+
+    StepResult ReadStep(ReaderWorker& worker);
+
+    StepResult AsyncReadStep(ReaderWorker& worker);
+
+    StepResult TerminateWorker(ReaderWorker& worker, TaskStatus status);
+
+    void HandleWorkerTerminate(const ReaderWorker& worker);
+
+    uint64_t InitCurrentIndex(const ReaderWorker& worker) const;
+
+    void PushForward(ReaderWorker& worker, const VolumeConsumeBlock& consumeBlock) const;
+
+    bool PushPendingBlocks(ReaderWorker& worker) const;
+
+    // notified once the queue blocks are pushed forward to is popped
+    std::shared_ptr<ExecutorEvent> ForwardQueueEvent() const;
+
+    bool SkipReadingBlock(const ReaderWorker& worker) const;
+
+    bool IsBlockExcluded(uint64_t index) const;
+
+    void InitHoleBitmap();
+
+    bool IsHoleBlock(uint64_t index) const;
+
+    void PushHoleBlock(ReaderWorker& worker, uint8_t* buffer);
+
+    uint64_t BytesToRead() const;
+
+    bool IsReadCompleted(const ReaderWorker& worker) const;
+
+    void RevertNextBlock(ReaderWorker& worker) const;
 
-    uint64_t InitCurrentIndex() const;
+    bool IsReadThrottled() const;
 
-    void BlockingPushForward(const VolumeConsumeBlock& consumeBlock) const;
+    uint8_t* FetchBlockBuffer(ReaderWorker& worker);
 
-    bool SkipReadingBlock() const;
+    uint32_t CurrentBlockLength(const ReaderWorker& worker) const;
 
-    bool IsReadCompleted() const;
+    bool ReadBlock(ReaderWorker& worker, uint8_t* buffer, uint32_t& nBytesReaded);
 
-    void RevertNextBlock();
+    bool SubmitReadBlock(ReaderWorker& worker, uint8_t* buffer);
 
-    uint8_t* FetchBlockBuffer(std::chrono::seconds timeout) const;
+    void HandleReadCompletion(ReaderWorker& worker, const rawio::AsyncIOResult& result);
 
-    bool ReadBlock(uint8_t* buffer, uint32_t& nBytesReaded);
+    void DrainInflightBlocks(ReaderWorker& worker);
 
     void HandleReadError(ErrCodeType errorCode);
 
@@ -80,16 +132,19 @@ private:
 
     // mutable fields
     std::shared_ptr<VolumeTaskSharedContext>                m_sharedContext;
-    std::thread                                             m_readerThread;
-    std::shared_ptr<volumeprotect::rawio::RawDataReader>    m_dataReader;
+    std::vector<std::shared_ptr<ReaderWorker>>              m_readerWorkers;
+    std::vector<std::shared_ptr<ExecutorJob>>               m_workers;
+    std::atomic<uint32_t>                                   m_workersRunning    { 0 };
+    std::mutex                                              m_workerMutex;
 
     uint64_t    m_maxIndex      { 0 };
-    uint64_t    m_currentIndex  { 0 };
     bool        m_pause         { false };
+    // blocks entirely in holes of copy file, filled with zero without I/O, nullptr if copy file has no hole
+    std::shared_ptr<Bitmap>                                 m_holeBitmap        { nullptr };
 
 };
 
 }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -48,9 +48,33 @@ public:
     bool Flush();
 
 private:
-    bool NeedToWrite(uint8_t* buffer, int length) const;
+    // zero block is punched if punchZeroBlock enabled, or skipped if skipEmptyBlock enabled
+    bool NeedToWrite(const VolumeConsumeBlock& consumeBlock);
 
-    void MainThread();
+    // return false if failed to deallocate the block, zero data should be written instead
+    bool PunchZeroBlock(const VolumeConsumeBlock& consumeBlock);
+
+    void HandleWriterTerminate();
+
+    StepResult WriteStep();
+
+    StepResult AsyncWriteStep();
+
+    bool WriteDirtyRanges(const VolumeConsumeBlock& consumeBlock, ErrCodeType& errorCode);
+
+    void DirtySpan(const VolumeConsumeBlock& consumeBlock, uint32_t& start, uint32_t& length) const;
+
+    void SubmitWriteBlock(const VolumeConsumeBlock& consumeBlock);
+
+    bool ReapWriteCompletions(bool wait);
+
+    void HandleWriteCompletion(const rawio::AsyncIOResult& result);
+
+    bool IsWriteThrottled() const;
+
+    void ChargeWrite(const VolumeConsumeBlock& consumeBlock) const;
+
+    void MarkBlockWritten(const VolumeConsumeBlock& consumeBlock);
 
     void HandleWriteError(ErrCodeType errorCode);
 
@@ -62,8 +86,12 @@ private:
 
     // mutable fields
     std::shared_ptr<VolumeTaskSharedContext>                m_sharedContext { nullptr };
-    std::thread                                             m_writerThread;
+    std::shared_ptr<ExecutorJob>                            m_writerJob     { nullptr };
     std::shared_ptr<volumeprotect::rawio::RawDataWriter>    m_dataWriter    { nullptr };
+    // not null if m_dataWriter support asynchronous I/O
+    std::shared_ptr<volumeprotect::rawio::AsyncRawDataWriter>   m_asyncDataWriter   { nullptr };
+    std::unordered_map<uint64_t, VolumeConsumeBlock>            m_inflightBlocks;   // index => block submitted
+    bool                                                        m_punchHoleFailed   { false };
 };
 
 }
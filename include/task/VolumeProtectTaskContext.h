@@ -11,7 +11,14 @@
 
 #include "common/VolumeProtectMacros.h"
 #include "VolumeProtector.h"
-#include "BlockingQueue.h"
+#include "RingQueue.h"
+#include "TaskExecutor.h"
+#include "IORateLimiter.h"
+#include "native/MappedFile.h"
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
 
 namespace volumeprotect {
 namespace task {
@@ -19,6 +26,7 @@ namespace task {
 class VolumeBlockReader;
 class VolumeBlockWriter;
 class VolumeBlockHasher;
+class CheckpointJournal;
 
 /**
  * @brief Struct to describle a volume data block in memory, used for hash/writer consuming
@@ -28,24 +36,44 @@ struct VolumeConsumeBlock {
     uint64_t        index;
     uint64_t        volumeOffset;
     uint32_t        length;
+    uint64_t        dirtyMask;      // bit i is set if i-th sub-block changed, 0 to write the whole block
+    bool            zero;           // all bytes are zero, set by reader for hole of copy file or by hasher
 };
 
 /**
- * @brief A fixed memory block allocator to improve `malloc` performance
+ * @brief A fixed memory block allocator to improve `malloc` performance,
+ *  memory of blocks is leased from the process-wide BlockBufferPool and returned to it on destruction
  */
 class VolumeBlockAllocator {
 public:
-    VolumeBlockAllocator(uint32_t blockSize, uint32_t blockNum);
+    // each block buffer is aligned to alignment (power of 2) if block size is multiple of it, required by direct I/O
+    VolumeBlockAllocator(uint32_t blockSize, uint32_t blockNum, uint32_t alignment = DEFAULT_DIRECT_IO_ALIGNMENT);
     ~VolumeBlockAllocator();
+    // lock free, return nullptr immediately if no block available
     uint8_t*    BlockAlloc();
+    // block until a block is available or timeout, return nullptr if timeout
+    uint8_t*    BlockAllocWait(std::chrono::milliseconds timeout);
     void        BlockFree(uint8_t* ptr);
+    // notified on each BlockFree, routines failed to alloc on the executor wait for it
+    std::shared_ptr<ExecutorEvent> FreeEvent() const;
+
+private:
+    uint32_t    PopFreeIndex();
+    void        PushFreeIndex(uint32_t index);
 
 private:
+    uint8_t*    m_rawPool;
+    uint64_t    m_rawPoolSize   { 0 };
     uint8_t*    m_pool;
-    bool*       m_allocTable;
     uint32_t    m_blockSize;
     uint32_t    m_blockNum;
-    std::mutex  m_mutex;
+    // free list of block index, head packs a ABA tag (high 32 bits) and the index (low 32 bits)
+    std::atomic<uint64_t>   m_freeHead      { 0 };
+    std::atomic<uint32_t>*  m_nextFree      { nullptr };
+    std::atomic<uint32_t>   m_waiters       { 0 };
+    std::mutex              m_mutex;
+    std::condition_variable m_freeCond;
+    std::shared_ptr<ExecutorEvent>  m_freeEvent     { std::make_shared<ExecutorEvent>() };
 };
 
 /**
@@ -62,7 +90,12 @@ struct SessionCounter {
 };
 
 /**
- * @brief Manage the checksum table of previous/latest hashing checksum
+ * @brief Manage the checksum table of previous/latest hashing checksum,
+ *  table size is the number of blocks multiplied by the digest size of the hash algorithm used.
+ *  Optional sub-block tables store SUB_BLOCK_CHECKSUM_SIZE bytes for each sub-block,
+ *  sub-blocks of block[i] start at i * sub-blocks per block.
+ *  Tables can be mapped from checksum files instead of heap memory, the previous ones read-only,
+ *  writers of latest tables must mark the range written so that only dirty pages are flushed.
  */
 struct BlockHashingContext {
     uint64_t    lastestSize     { 0 }; // size in bytes
@@ -70,30 +103,72 @@ struct BlockHashingContext {
     uint8_t*    lastestTable    { nullptr };
     uint8_t*    previousTable   { nullptr };
 
+    uint64_t    subLastestSize  { 0 };
+    uint64_t    subPreviousSize { 0 };
+    uint8_t*    subLastestTable { nullptr };    // nullptr if sub-block checksum disabled
+    uint8_t*    subPreviousTable{ nullptr };    // loaded from previous copy, nullptr if not available
+
+    // nullptr if table is allocated in heap memory
+    std::shared_ptr<fsapi::MappedFile>  lastestFile     { nullptr };
+    std::shared_ptr<fsapi::MappedFile>  previousFile    { nullptr };
+    std::shared_ptr<fsapi::MappedFile>  subLastestFile  { nullptr };
+    std::shared_ptr<fsapi::MappedFile>  subPreviousFile { nullptr };
+
+    BlockHashingContext() = default;
     BlockHashingContext(uint64_t pSize, uint64_t lSize);
     BlockHashingContext(uint64_t lSize);
     ~BlockHashingContext();
+    void AllocSubBlockTable(uint64_t lSize);
+    // map table from file in place of the heap one, content is kept unless truncate
+    bool MapLastestTable(const std::string& filepath, uint64_t lSize, bool truncate);
+    bool MapSubLastestTable(const std::string& filepath, uint64_t lSize, bool truncate);
+    bool MapPreviousTable(const std::string& filepath, uint64_t pSize);
+    bool MapSubPreviousTable(const std::string& filepath, uint64_t pSize);
+    bool IsLastestMapped() const;
+    void MarkLastestDirty(uint64_t offset, uint64_t length);
+    void MarkSubLastestDirty(uint64_t offset, uint64_t length);
+    // write back dirty pages of mapped latest tables
+    bool FlushLastest();
 };
 
 /**
  * @brief A dynamic version of std::bitset, used to record index of block written.
  * for 1TB session, max blocks cnt 262144, max bitmap size = 32768 bytes
+ *  Bits are stored in 64bits words and set atomically, so it can be set by hasher workers and writer concurrently.
+ *  A summary level marks words that are full and words with any bit set, scans skip 64 words at a time.
+ *  Checkpoint stores it as byte array, bit i is in byte i / 8 at position i % 8.
  */
 class Bitmap {
 public:
     explicit Bitmap(uint64_t size);
+    // take ownership of a byte array allocated by new[]
     Bitmap(uint8_t* ptr, uint64_t capacity);
     ~Bitmap();
     bool Test(uint64_t index) const;
     void Set(uint64_t index);
+    void SetRange(uint64_t begin, uint64_t end);    // set index in [begin, end)
     uint64_t FirstIndexUnset() const;
+    // first index set/unset not less than from, MaxIndex() + 1 if not found
+    uint64_t NextSet(uint64_t from) const;
+    uint64_t NextUnset(uint64_t from) const;
+    // next run of index set [begin, end) not less than from, return false if not found
+    bool NextSetRange(uint64_t from, uint64_t& begin, uint64_t& end) const;
     uint64_t Capacity() const;      // capacity in bytes
     uint64_t MaxIndex() const;
     uint64_t TotalSetCount() const;
-    const uint8_t* Ptr() const;
+    void CopyTo(uint8_t* buffer) const; // copy as byte array of capacity bytes
 private:
-    uint64_t    m_capacity  { 0 };
-    uint8_t*    m_table     { nullptr };
+    void Init(uint64_t capacity);
+    uint64_t ValidMask(uint64_t wordIndex) const;
+    void SetWordBits(uint64_t wordIndex, uint64_t mask);
+    uint64_t NextWord(const std::atomic<uint64_t>* summary, uint64_t from, bool set) const;
+private:
+    uint64_t                m_capacity      { 0 };
+    uint64_t                m_wordNum       { 0 };
+    std::atomic<uint64_t>*  m_words         { nullptr };
+    std::atomic<uint64_t>*  m_fullWords     { nullptr };    // summary, bit i is set if word i is full
+    std::atomic<uint64_t>*  m_usedWords     { nullptr };    // summary, bit i is set if word i has any bit set
+    std::atomic<uint64_t>   m_setCount      { 0 };
 };
 
 /**
@@ -118,18 +193,36 @@ struct VolumeTaskSharedConfig {
     bool            hasherEnabled;
     bool            checkpointEnabled;
     uint32_t        hasherWorkerNum;
+    uint32_t        readerWorkerNum;
     std::string     volumePath;
     std::string     copyFilePath;
     CopyFormat      copyFormat;
+    IOEngine        ioEngine;
+    uint32_t        ioQueueDepth;
+    IOCacheMode     ioCacheMode;
+    IOPriority      ioPriority;
 
     // immutable fields (for backup)
     std::string     lastestChecksumBinPath;
-    std::string     prevChecksumBinPath;
+    std::string     prevChecksumBinPath;            // checksum of the copy for differential/verify restore
     std::string     checkpointFilePath;
+    std::string     checkpointJournalPath;          // empty if checkpoint is not journaled
+    bool            mapChecksumTable;               // checksum tables are mapped from meta files
     bool            skipEmptyBlock;
+    bool            punchZeroBlock;                 // zero block is deallocated in target instead of written/skipped
+    HashAlgorithm   hashAlgorithm;
+    uint32_t        subBlockSize;                   // 0 if sub-block checksum disabled
+    std::string     lastestSubChecksumBinPath;
+    std::string     prevSubChecksumBinPath;         // empty if previous copy has no sub-block checksum
 };
 
 
+// number of sub-blocks each block is split into, 0 if sub-block checksum is disabled
+uint32_t SubBlocksPerBlock(uint32_t blockSize, uint32_t subBlockSize);
+
+// bytes of the block need to be written according to it's dirty mask
+uint32_t DirtyLength(const VolumeConsumeBlock& consumeBlock, uint32_t subBlockSize);
+
 /**
  * @brief Snapshot of bitmap of a task
  */
@@ -145,6 +238,26 @@ struct CheckpointSnapshot {
     bool SaveTo(const std::string& filepath) const;
 };
 
+/**
+ * @brief Wake up the main thread of backup/restore task when reader/hasher/writer of any session terminates
+ *  or the task is aborted, shared by all sessions of the task.
+ */
+class TaskEventNotifier {
+public:
+    void Notify();
+
+    /**
+     * @brief block until notified or timeout, events notified before waiting are not lost
+     * @return true if notified
+     */
+    bool WaitFor(std::chrono::milliseconds timeout);
+
+private:
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cv;
+    uint64_t                    m_pendingEvents { 0 };
+};
+
 /**
  * @brief Manage context of a volume backup/restore task.
  */
@@ -152,12 +265,37 @@ struct VolumeTaskSharedContext {
     // bitmap to implement checkpoint
     std::shared_ptr<Bitmap>                             processedBitmap         { nullptr };
     std::shared_ptr<Bitmap>                             writtenBitmap           { nullptr };
+    // bitmap of blocks allocated by filesystem, nullptr if all blocks need to be read
+    std::shared_ptr<Bitmap>                             allocatedBitmap         { nullptr };
+    // bitmap of blocks changed since previous copy reported by CBT source, nullptr if all blocks need to be read
+    std::shared_ptr<Bitmap>                             changedBitmap           { nullptr };
+    // blocks of target volume differing from the copy found by hasher in COMPARE mode,
+    // or blocks restored mismatch with the copy found in VERIFY mode, nullptr if not comparing
+    std::shared_ptr<Bitmap>                             mismatchedBitmap        { nullptr };
+    // record blocks processed/written since the last compaction, nullptr if checkpoint is not journaled
+    std::shared_ptr<CheckpointJournal>                  checkpointJournal       { nullptr };
 
     std::shared_ptr<SessionCounter>                     counter                 { nullptr };
     std::shared_ptr<VolumeBlockAllocator>               allocator               { nullptr };
-    std::shared_ptr<BlockingQueue<VolumeConsumeBlock>>  hashingQueue            { nullptr };
-    std::shared_ptr<BlockingQueue<VolumeConsumeBlock>>  writeQueue              { nullptr };
+    std::shared_ptr<RingQueue<VolumeConsumeBlock>>      hashingQueue            { nullptr };
+    std::shared_ptr<RingQueue<VolumeConsumeBlock>>      writeQueue              { nullptr };
+    // notified on push/pop/finish of the queue, nullptr if queue is not created by InitHashingQueue/InitWriteQueue
+    std::shared_ptr<ExecutorEvent>                      hashingQueueEvent       { nullptr };
+    std::shared_ptr<ExecutorEvent>                      writeQueueEvent         { nullptr };
     std::shared_ptr<BlockHashingContext>                hashingContext          { nullptr };
+    // notify task main thread on termination of reader/hasher/writer, nullptr if task is polling
+    std::shared_ptr<TaskEventNotifier>                  notifier                { nullptr };
+    // limit routines of the task running on the shared executor, nullptr for no limit
+    std::shared_ptr<ExecutorGroup>                      executorGroup           { nullptr };
+    // pace reader/writer I/O of all sessions of the task, nullptr for no limit
+    std::shared_ptr<IORateLimiter>                      readLimiter             { nullptr };
+    std::shared_ptr<IORateLimiter>                      writeLimiter            { nullptr };
+    // time of the last checkpoint refreshed, each of concurrent sessions is refreshed in it's own period
+    std::chrono::steady_clock::time_point               lastCheckpointTime      { std::chrono::steady_clock::now() };
+
+    // create the queue with it's event, so routines waiting on the queue are rescheduled once it's pushed/popped
+    void InitHashingQueue(std::size_t size);
+    void InitWriteQueue(std::size_t size);
 };
 
 struct VolumeTaskSession {
@@ -184,9 +322,12 @@ class TaskStatisticTrait {
 protected:
     void UpdateRunningSessionStatistics(std::shared_ptr<VolumeTaskSession> session);
     void UpdateCompletedSessionStatistics(std::shared_ptr<VolumeTaskSession> session);
+    void UpdateConcurrentSessionStatistics(
+        const std::vector<std::shared_ptr<VolumeTaskSession>>& runningSessions,
+        const std::vector<std::shared_ptr<VolumeTaskSession>>& completedSessions);
 protected:
     mutable std::mutex m_statisticMutex;
-    TaskStatistics  m_currentSessionStatistics;     // current running session statistics
+    TaskStatistics  m_currentSessionStatistics;     // current running session(s) statistics
     TaskStatistics  m_completedSessionStatistics;   // statistic sum of all completed session
 };
 
@@ -197,6 +338,8 @@ protected:
  *  which records checksum info computed and block data that have been written to disk.
  *  Both two file will also be generated no matter "enableCheckpoint" is true or false,
  *  "enableCheckpoint" will only decide if to restore the task if process is restarted.
+ *  In CheckpointMode::JOURNAL blocks done are committed to a CheckpointJournal instead, the snapshot file and
+ *  checksum file are only written when the journal is compacted.
  */
 class VolumeTaskCheckpointTrait {
     using SessionPtr = std::shared_ptr<VolumeTaskSession>;
@@ -207,6 +350,8 @@ protected:
     bool FlushSessionLatestHashingTable(SessionPtr session) const;
     bool FlushSessionWriter(SessionPtr session) const;
     bool FlushSessionBitmap(SessionPtr session) const;
+    bool CommitSessionJournal(SessionPtr session) const;
+    bool CompactSessionJournal(SessionPtr session) const;
     // common utils
     virtual bool IsSessionRestarted(SessionPtr session) const;
     bool IsCheckpointEnabled(SessionPtr session) const;
@@ -217,16 +362,15 @@ protected:
     bool RestoreSessionLatestHashingTable(std::shared_ptr<VolumeTaskSession> session) const;
     bool RestoreSessionBitmap(std::shared_ptr<VolumeTaskSession> session) const;
     void RestoreSessionCounter(std::shared_ptr<VolumeTaskSession> session) const;
+    void RestoreSessionJournal(std::shared_ptr<VolumeTaskSession> session) const;
+    void ResetSessionJournal(std::shared_ptr<VolumeTaskSession> session) const;
 
     virtual std::shared_ptr<CheckpointSnapshot> ReadCheckpointSnapshot(
         std::shared_ptr<VolumeTaskSession> session) const;
     virtual bool ReadLatestHashingTable(std::shared_ptr<VolumeTaskSession> session) const;
 
 private:
-    bool CheckLastUpdateTimer();
-
-private:
-    std::chrono::steady_clock::time_point   m_lastUpdate { std::chrono::steady_clock::now() };
+    bool CheckLastUpdateTimer(SessionPtr session) const;
 };
 
 }
@@ -14,6 +14,9 @@
 #include "native/TaskResourceManager.h"
 #include "VolumeUtils.h"
 
+#include <mutex>
+#include <vector>
+
 namespace volumeprotect {
 namespace task {
 
@@ -29,6 +32,12 @@ public:
 
     TaskStatistics  GetStatistics() const override;
 
+    void            Abort() override;
+
+    bool            SetRateLimit(const IORateLimit& rateLimit) override;
+
+    std::vector<uint64_t> GetMismatchedBlocks() const override;
+
     VolumeRestoreTask(const VolumeRestoreConfig& restoreConfig, const VolumeCopyMeta& volumeCopyMeta);
 
     ~VolumeRestoreTask();
@@ -42,10 +51,27 @@ private:
 
     bool WaitSessionTerminate(std::shared_ptr<VolumeTaskSession> session);
 
+    bool WaitSessionExecutors(
+        std::shared_ptr<VolumeTaskSession> session, std::shared_ptr<VolumeTaskSession> runningSession);
+
     virtual bool InitRestoreSessionContext(std::shared_ptr<VolumeTaskSession> session) const;
 
     virtual bool InitRestoreSessionTaskExecutor(std::shared_ptr<VolumeTaskSession> session) const;
 
+    // verify restore only
+    bool InitVerifySessionContext(std::shared_ptr<VolumeTaskSession> session) const;
+
+    void RestoreSessionMismatchedBlocks(std::shared_ptr<VolumeTaskSession> session) const;
+
+    void CollectSessionMismatchedBlocks(std::shared_ptr<VolumeTaskSession> session);
+
+    // differential restore only
+    bool CompareSessionVolume(std::shared_ptr<VolumeTaskSession> session);
+
+    std::shared_ptr<VolumeTaskSession> NewCompareSession(std::shared_ptr<VolumeTaskSession> session) const;
+
+    virtual bool InitCompareSessionTaskExecutor(std::shared_ptr<VolumeTaskSession> compareSession) const;
+
     void ClearAllCheckpoints() const;
 
 protected:
@@ -57,6 +83,14 @@ protected:
     SessionQueue                            m_sessionQueue;
     std::shared_ptr<TaskResourceManager>    m_resourceManager;
     std::vector<std::string>                m_checkpointFiles;
+    std::shared_ptr<TaskEventNotifier>      m_notifier;
+    // reader/hasher/writer of all sessions run on the shared executor, limited by this group
+    std::shared_ptr<ExecutorGroup>          m_executorGroup;
+    std::shared_ptr<IORateLimiter>          m_readLimiter;
+    std::shared_ptr<IORateLimiter>          m_writeLimiter;
+    // volume block index of blocks restored mismatch with the copy, collected once a session completes
+    mutable std::mutex                      m_mismatchMutex;
+    std::vector<uint64_t>                   m_mismatchedBlocks;
 };
 
 }
@@ -0,0 +1,67 @@
+/**
+ * @file VolumeZeroCopyBackupTask.h
+ * @brief Provide zero copy implement for CopyFormat::IMAGE/BIN full backup without checksum.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_ZERO_COPY_BACKUP_TASK_HEADER
+#define VOLUMEBACKUP_ZERO_COPY_BACKUP_TASK_HEADER
+
+#include "VolumeProtector.h"
+#include "VolumeProtectTaskContext.h"
+#include "native/TaskResourceManager.h"
+#include "VolumeUtils.h"
+#include "native/RawIO.h"
+#include "ZeroCopySessionTrait.h"
+#include <queue>
+
+namespace volumeprotect {
+namespace task {
+
+/**
+ * @brief Control volume zero copy backup procedure, volume data is moved to copy file inside kernel
+ */
+class VolumeZeroCopyBackupTask : public VolumeProtectTask, public ZeroCopySessionTrait {
+public:
+    bool            Start() override;
+
+    TaskStatistics  GetStatistics() const override;
+
+    VolumeZeroCopyBackupTask(const VolumeBackupConfig& backupConfig, uint64_t volumeSize);
+
+    ~VolumeZeroCopyBackupTask();
+
+    // zero copy backup only works for full backup of image/bin copy without checksum, sparse file or skipping blocks,
+    // and buffered I/O without rate limit or I/O priority
+    static bool IsZeroCopySupported(const VolumeBackupConfig& backupConfig);
+
+private:
+    bool Prepare(); // split session and save meta
+
+    void ThreadFunc();
+
+    bool PerformZeroCopyBackup(
+        std::shared_ptr<volumeprotect::rawio::RawDataReader> volumeDataReader,
+        std::shared_ptr<volumeprotect::rawio::RawDataWriter> copyDataWriter,
+        const VolumeTaskSharedConfig& sessionConfig);
+
+    bool IsZeroCopyAborted() const override;
+
+    void ClearAllCheckpoints() const;
+
+protected:
+    uint64_t                                            m_volumeSize;
+    std::shared_ptr<VolumeBackupConfig>                 m_backupConfig;
+    std::queue<VolumeTaskSharedConfig>                  m_sessionQueue;
+    std::thread                                         m_thread;
+
+    std::shared_ptr<TaskResourceManager>                m_resourceManager;
+    std::vector<std::string>                            m_checkpointFiles;
+};
+
+}
+}
+
+#endif
@@ -14,6 +14,7 @@
 #include "native/TaskResourceManager.h"
 #include "VolumeUtils.h"
 #include "native/RawIO.h"
+#include "ZeroCopySessionTrait.h"
 #include <queue>
 
 namespace volumeprotect {
@@ -22,7 +23,7 @@ namespace task {
 /**
  * @brief Control control volume restore procedure
  */
-class VolumeZeroCopyRestoreTask : public VolumeProtectTask, public TaskStatisticTrait {
+class VolumeZeroCopyRestoreTask : public VolumeProtectTask, public ZeroCopySessionTrait {
 public:
     using SessionQueue = std::queue<VolumeTaskSession>;
 
@@ -44,6 +45,10 @@ private:
         std::shared_ptr<volumeprotect::rawio::RawDataWriter> volumeDataWriter,
         const VolumeTaskSharedConfig& sessionConfig);
 
+    bool IsZeroCopyAborted() const override;
+
+    void ClearAllCheckpoints() const;
+
 protected:
     uint64_t                                            m_volumeSize;
     std::shared_ptr<VolumeRestoreConfig>                m_restoreConfig;
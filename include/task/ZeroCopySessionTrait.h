@@ -0,0 +1,69 @@
+/**
+ * @file ZeroCopySessionTrait.h
+ * @brief Copy data of a session between volume and copy file inside kernel.
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifndef VOLUMEBACKUP_ZERO_COPY_SESSION_TRAIT_HEADER
+#define VOLUMEBACKUP_ZERO_COPY_SESSION_TRAIT_HEADER
+
+#include "VolumeProtector.h"
+#include "VolumeProtectTaskContext.h"
+#include "native/RawIO.h"
+
+namespace volumeprotect {
+namespace task {
+
+/**
+ * @brief ZeroCopySessionTrait provides the trait of zero copy backup/restore session.
+ *  Session is split into ranges aligned to block size, each range is copied by a thread with copy_file_range,
+ *  or splice through a pipe if not supported between the files, data never enters user space.
+ *  Blocks copied are recorded in a bitmap saved as checkpoint snapshot periodically, blocks recorded in the
+ *  checkpoint of the session are skipped on restart.
+ */
+class ZeroCopySessionTrait : public TaskStatisticTrait {
+protected:
+    /**
+     * @brief copy blocks of session not written yet from source to target, block until all ranges are done
+     * @param sourceShift offset in source file is volume offset minus sourceShift
+     * @param targetShift offset in target file is volume offset minus targetShift
+     * @param threadNum number of threads copying ranges of the session
+     */
+    bool PerformZeroCopySession(
+        std::shared_ptr<rawio::RawDataReader>   sourceReader,
+        std::shared_ptr<rawio::RawDataWriter>   targetWriter,
+        const VolumeTaskSharedConfig&           sessionConfig,
+        uint64_t                                sourceShift,
+        uint64_t                                targetShift,
+        uint32_t                                threadNum);
+
+    // threads of running session stop once it returns true
+    virtual bool IsZeroCopyAborted() const = 0;
+
+private:
+    // copy length bytes from volume offset, called by threads of a session concurrently
+    bool CopyRange(
+        HandleType                              sourceHandle,
+        HandleType                              targetHandle,
+        const VolumeTaskSharedConfig&           sessionConfig,
+        uint64_t                                sourceShift,
+        uint64_t                                targetShift,
+        uint64_t                                volumeOffset,
+        uint64_t                                length);
+
+    std::shared_ptr<Bitmap> RestoreSessionBitmap(const VolumeTaskSharedConfig& sessionConfig) const;
+
+    bool SaveSessionCheckpoint(
+        std::shared_ptr<rawio::RawDataWriter>   targetWriter,
+        const VolumeTaskSharedConfig&           sessionConfig) const;
+
+private:
+    std::shared_ptr<Bitmap>                     m_writtenBitmap;    // blocks written of running session
+};
+
+}
+}
+
+#endif
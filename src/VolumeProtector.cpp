@@ -7,8 +7,11 @@
 #include "VolumeProtector.h"
 #include "common/VolumeProtectMacros.h"
 #include "VolumeBackupTask.h"
+#include "VolumeZeroCopyBackupTask.h"
 #include "VolumeZeroCopyRestoreTask.h"
 #include "VolumeRestoreTask.h"
+#include "VolumeBackupScheduler.h"
+#include "BlockBufferPool.h"
 #include "VolumeUtils.h"
 #include "native/FileSystemAPI.h"
 #include <memory>
@@ -20,6 +23,16 @@ using namespace volumeprotect::fsapi;
 
 namespace {
     constexpr auto VOLUME_NAME_LEN_MAX = 32;
+
+    // io_uring reader/writer only perform buffered I/O, other cache mode can't be applied to them
+    bool ValidateIOOption(IOEngine ioEngine, IOCacheMode ioCacheMode)
+    {
+        if (ioEngine == IOEngine::IO_URING && ioCacheMode != IOCacheMode::BUFFERED) {
+            ERRLOG("cache mode %d is not supported by io_uring engine", static_cast<int>(ioCacheMode));
+            return false;
+        }
+        return true;
+    }
 }
 
 /**
@@ -69,7 +82,9 @@ static std::unordered_map<int, std::string> g_statusStringTable {
  * volumecopy.meta.json saves meta data (format, sessions) of the copy and it's critical for the copy to mount/restore
  */
 
-std::unique_ptr<VolumeProtectTask> VolumeProtectTask::BuildBackupTask(const VolumeBackupConfig& backupConfig)
+// volume size read is returned, so that the scheduler estimates memory of the same size the task is built with
+static std::unique_ptr<VolumeProtectTask> BuildVolumeBackupTask(
+    const VolumeBackupConfig& backupConfig, uint64_t& volumeSize)
 {
     // fill missing BackupConfig fields
     VolumeBackupConfig finalBackupConfig = backupConfig;
@@ -82,8 +97,12 @@ std::unique_ptr<VolumeProtectTask> VolumeProtectTask::BuildBackupTask(const Volu
             backupConfig.copyName.c_str(), finalBackupConfig.copyName.c_str());
     }
 
+    if (!ValidateIOOption(backupConfig.ioEngine, backupConfig.ioCacheMode)) {
+        return nullptr;
+    }
+
     // 2. check volume size
-    uint64_t volumeSize = 0;
+    volumeSize = 0;
     try {
         volumeSize = fsapi::ReadVolumeSize(backupConfig.volumePath);
     } catch (const SystemApiException& e) {
@@ -103,11 +122,29 @@ std::unique_ptr<VolumeProtectTask> VolumeProtectTask::BuildBackupTask(const Volu
         return nullptr;
     }
 
+    if (finalBackupConfig.enableZeroCopy) {
+        if (VolumeZeroCopyBackupTask::IsZeroCopySupported(finalBackupConfig)) {
+            return exstd::make_unique<VolumeZeroCopyBackupTask>(finalBackupConfig, volumeSize);
+        }
+        WARNLOG("zero copy requires full backup of image/bin copy with hasher and block skipping disabled, "
+            "buffered I/O without rate limit or I/O priority, fallback to regular backup");
+    }
+
     return exstd::make_unique<VolumeBackupTask>(finalBackupConfig, volumeSize);
 }
 
+std::unique_ptr<VolumeProtectTask> VolumeProtectTask::BuildBackupTask(const VolumeBackupConfig& backupConfig)
+{
+    uint64_t volumeSize = 0;
+    return BuildVolumeBackupTask(backupConfig, volumeSize);
+}
+
 std::unique_ptr<VolumeProtectTask> VolumeProtectTask::BuildRestoreTask(const VolumeRestoreConfig& restoreConfig)
 {
+    if (!ValidateIOOption(restoreConfig.ioEngine, restoreConfig.ioCacheMode)) {
+        return nullptr;
+    }
+
     // 1. check volume size
     uint64_t volumeSize = 0;
     try {
@@ -139,16 +176,57 @@ std::unique_ptr<VolumeProtectTask> VolumeProtectTask::BuildRestoreTask(const Vol
     }
 
     if (restoreConfig.enableZeroCopy) {
-        if (static_cast<CopyFormat>(volumeCopyMeta.copyFormat) != CopyFormat::IMAGE) {
-            ERRLOG("zero copy only supported by CopyFormat::IMAGE copy");
+        CopyFormat copyFormat = static_cast<CopyFormat>(volumeCopyMeta.copyFormat);
+        if (copyFormat != CopyFormat::IMAGE && copyFormat != CopyFormat::BIN) {
+            ERRLOG("zero copy only supported by CopyFormat::IMAGE or CopyFormat::BIN copy");
             return nullptr;
         }
+        if (restoreConfig.differentialRestore || restoreConfig.verifyRestore) {
+            WARNLOG("differential/verify restore not supported by zero copy restore, volume is restored entirely");
+        }
         return exstd::make_unique<VolumeZeroCopyRestoreTask>(restoreConfig, volumeCopyMeta);
     }
 
     return exstd::make_unique<VolumeRestoreTask>(restoreConfig, volumeCopyMeta);
 }
 
+std::unique_ptr<VolumeProtectTask> VolumeProtectTask::BuildBackupScheduler(
+    const VolumeBackupSchedulerConfig& schedulerConfig)
+{
+    std::vector<std::shared_ptr<ScheduledBackupTask>> tasks;
+    for (const VolumeBackupConfig& backupConfig : schedulerConfig.backupConfigs) {
+        auto scheduledTask = std::make_shared<ScheduledBackupTask>();
+        uint64_t volumeSize = 0;
+        scheduledTask->task = BuildVolumeBackupTask(backupConfig, volumeSize);
+        if (scheduledTask->task == nullptr) {
+            ERRLOG("failed to build backup task of volume %s", backupConfig.volumePath.c_str());
+            return nullptr;
+        }
+        scheduledTask->volumePath = backupConfig.volumePath;
+        scheduledTask->devices = VolumeBackupScheduler::ResolveVolumeDevices(backupConfig.volumePath);
+        scheduledTask->memory = VolumeBackupScheduler::EstimateTaskMemory(backupConfig, volumeSize);
+        tasks.push_back(scheduledTask);
+    }
+    return exstd::make_unique<VolumeBackupScheduler>(schedulerConfig, tasks);
+}
+
+void VolumeProtectTask::ConfigureBufferPool(const BufferPoolConfig& bufferPoolConfig)
+{
+    BlockBufferPool::Instance().Configure(bufferPoolConfig);
+}
+
+// rate limit is not supported by default
+bool VolumeProtectTask::SetRateLimit(const IORateLimit& rateLimit)
+{
+    (void)rateLimit;
+    return false;
+}
+
+std::vector<uint64_t> VolumeProtectTask::GetMismatchedBlocks() const
+{
+    return {};
+}
+
 void StatefulTask::Abort()
 {
     m_abort = true;
@@ -293,4 +371,12 @@ bool IsTaskFailed(void* task)
 bool IsTaskTerminated(void* task)
 {
     return reinterpret_cast<VolumeProtectTask*>(task)->IsTerminated();
-}
\ No newline at end of file
+}
+
+bool SetTaskRateLimit(void* task, uint64_t readBytesPerSecond, uint64_t writeBytesPerSecond)
+{
+    IORateLimit rateLimit {};
+    rateLimit.readBytesPerSecond = readBytesPerSecond;
+    rateLimit.writeBytesPerSecond = writeBytesPerSecond;
+    return reinterpret_cast<VolumeProtectTask*>(task)->SetRateLimit(rateLimit);
+}
@@ -0,0 +1,966 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include <cstring>
+#include <openssl/evp.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Logger.h"
+#include "common/BlockHash.h"
+
+using namespace volumeprotect;
+
+namespace {
+
+/*
+ * common utils
+ */
+inline uint32_t Swap32(uint32_t x)
+{
+    return ((x << 24) & 0xff000000U) | ((x << 8) & 0x00ff0000U) | ((x >> 8) & 0x0000ff00U) | ((x >> 24) & 0x000000ffU);
+}
+
+inline uint64_t Swap64(uint64_t x)
+{
+    return (static_cast<uint64_t>(Swap32(static_cast<uint32_t>(x))) << 32) | Swap32(static_cast<uint32_t>(x >> 32));
+}
+
+inline bool IsBigEndianHost()
+{
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+    return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+#else
+    return false;
+#endif
+}
+
+inline uint32_t Read32LE(const uint8_t* ptr)
+{
+    uint32_t value = 0;
+    ::memcpy(&value, ptr, sizeof(value));
+    return IsBigEndianHost() ? Swap32(value) : value;
+}
+
+inline uint64_t Read64LE(const uint8_t* ptr)
+{
+    uint64_t value = 0;
+    ::memcpy(&value, ptr, sizeof(value));
+    return IsBigEndianHost() ? Swap64(value) : value;
+}
+
+inline void Write32LE(uint8_t* ptr, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        ptr[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline void Write32BE(uint8_t* ptr, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        ptr[i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+    }
+}
+
+inline void Write64BE(uint8_t* ptr, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) {
+        ptr[i] = static_cast<uint8_t>(value >> (56 - 8 * i));
+    }
+}
+
+inline uint32_t Rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+inline uint32_t Rotr32(uint32_t x, int r)
+{
+    return (x >> r) | (x << (32 - r));
+}
+
+/*
+ * xxHash3 128bits, port of the scalar path of XXH3_128bits() from xxHash 0.8 (BSD 2-Clause, Yann Collet)
+ */
+const uint32_t XXH_PRIME32_1 = 0x9E3779B1U;
+const uint32_t XXH_PRIME32_2 = 0x85EBCA77U;
+const uint32_t XXH_PRIME32_3 = 0xC2B2AE3DU;
+const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+const uint64_t XXH_PRIME_MX1 = 0x165667919E3779F9ULL;
+const uint64_t XXH_PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+const uint64_t XXH_STRIPE_LEN = 64;
+const uint64_t XXH_SECRET_CONSUME_RATE = 8;
+const uint64_t XXH_ACC_NB = 8;
+const uint64_t XXH_SECRET_SIZE = 192;
+const uint64_t XXH_SECRET_SIZE_MIN = 136;
+const uint64_t XXH_SECRET_LASTACC_START = 7;
+const uint64_t XXH_SECRET_MERGEACCS_START = 11;
+const uint64_t XXH_MIDSIZE_MAX = 240;
+const uint64_t XXH_MIDSIZE_STARTOFFSET = 3;
+const uint64_t XXH_MIDSIZE_LASTOFFSET = 17;
+
+const uint8_t XXH_SECRET[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct XXH128Hash {
+    uint64_t low64;
+    uint64_t high64;
+};
+
+inline XXH128Hash Mult64To128(uint64_t lhs, uint64_t rhs)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = static_cast<unsigned __int128>(lhs) * rhs;
+    return XXH128Hash { static_cast<uint64_t>(product), static_cast<uint64_t>(product >> 64) };
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high = 0;
+    uint64_t low = _umul128(lhs, rhs, &high);
+    return XXH128Hash { low, high };
+#else
+    uint64_t loLo = (lhs & 0xFFFFFFFFULL) * (rhs & 0xFFFFFFFFULL);
+    uint64_t hiLo = (lhs >> 32) * (rhs & 0xFFFFFFFFULL);
+    uint64_t loHi = (lhs & 0xFFFFFFFFULL) * (rhs >> 32);
+    uint64_t hiHi = (lhs >> 32) * (rhs >> 32);
+    uint64_t cross = (loLo >> 32) + (hiLo & 0xFFFFFFFFULL) + loHi;
+    uint64_t upper = (hiLo >> 32) + (cross >> 32) + hiHi;
+    uint64_t lower = (cross << 32) | (loLo & 0xFFFFFFFFULL);
+    return XXH128Hash { lower, upper };
+#endif
+}
+
+inline uint64_t Mul128Fold64(uint64_t lhs, uint64_t rhs)
+{
+    XXH128Hash product = Mult64To128(lhs, rhs);
+    return product.low64 ^ product.high64;
+}
+
+inline uint64_t XorShift64(uint64_t v, int shift)
+{
+    return v ^ (v >> shift);
+}
+
+inline uint64_t XXH64Avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t XXH3Avalanche(uint64_t h)
+{
+    h = XorShift64(h, 37);
+    h *= XXH_PRIME_MX1;
+    h = XorShift64(h, 32);
+    return h;
+}
+
+inline uint64_t XXH3Mix16B(const uint8_t* input, const uint8_t* secret, uint64_t seed)
+{
+    return Mul128Fold64(
+        Read64LE(input) ^ (Read64LE(secret) + seed),
+        Read64LE(input + 8) ^ (Read64LE(secret + 8) - seed));
+}
+
+inline void XXH128Mix32B(
+    XXH128Hash& acc, const uint8_t* input1, const uint8_t* input2, const uint8_t* secret, uint64_t seed)
+{
+    acc.low64 += XXH3Mix16B(input1, secret, seed);
+    acc.low64 ^= Read64LE(input2) + Read64LE(input2 + 8);
+    acc.high64 += XXH3Mix16B(input2, secret + 16, seed);
+    acc.high64 ^= Read64LE(input1) + Read64LE(input1 + 8);
+}
+
+XXH128Hash XXH3Len1To3(const uint8_t* input, uint64_t len, const uint8_t* secret)
+{
+    uint8_t c1 = input[0];
+    uint8_t c2 = input[len >> 1];
+    uint8_t c3 = input[len - 1];
+    uint32_t combinedl = (static_cast<uint32_t>(c1) << 16) | (static_cast<uint32_t>(c2) << 24)
+        | (static_cast<uint32_t>(c3) << 0) | (static_cast<uint32_t>(len) << 8);
+    uint32_t combinedh = Rotl32(Swap32(combinedl), 13);
+    uint64_t bitflipl = static_cast<uint64_t>(Read32LE(secret) ^ Read32LE(secret + 4));
+    uint64_t bitfliph = static_cast<uint64_t>(Read32LE(secret + 8) ^ Read32LE(secret + 12));
+    return XXH128Hash { XXH64Avalanche(combinedl ^ bitflipl), XXH64Avalanche(combinedh ^ bitfliph) };
+}
+
+XXH128Hash XXH3Len4To8(const uint8_t* input, uint64_t len, const uint8_t* secret)
+{
+    uint32_t inputLo = Read32LE(input);
+    uint32_t inputHi = Read32LE(input + len - 4);
+    uint64_t input64 = inputLo + (static_cast<uint64_t>(inputHi) << 32);
+    uint64_t bitflip = Read64LE(secret + 16) ^ Read64LE(secret + 24);
+    uint64_t keyed = input64 ^ bitflip;
+    XXH128Hash m128 = Mult64To128(keyed, XXH_PRIME64_1 + (len << 2));
+    m128.high64 += (m128.low64 << 1);
+    m128.low64 ^= (m128.high64 >> 3);
+    m128.low64 = XorShift64(m128.low64, 35);
+    m128.low64 *= XXH_PRIME_MX2;
+    m128.low64 = XorShift64(m128.low64, 28);
+    m128.high64 = XXH3Avalanche(m128.high64);
+    return m128;
+}
+
+XXH128Hash XXH3Len9To16(const uint8_t* input, uint64_t len, const uint8_t* secret)
+{
+    uint64_t bitflipl = Read64LE(secret + 32) ^ Read64LE(secret + 40);
+    uint64_t bitfliph = Read64LE(secret + 48) ^ Read64LE(secret + 56);
+    uint64_t inputLo = Read64LE(input);
+    uint64_t inputHi = Read64LE(input + len - 8);
+    XXH128Hash m128 = Mult64To128(inputLo ^ inputHi ^ bitflipl, XXH_PRIME64_1);
+    m128.low64 += static_cast<uint64_t>(len - 1) << 54;
+    inputHi ^= bitfliph;
+    m128.high64 += inputHi + static_cast<uint64_t>(static_cast<uint32_t>(inputHi)) * (XXH_PRIME32_2 - 1);
+    m128.low64 ^= Swap64(m128.high64);
+    XXH128Hash h128 = Mult64To128(m128.low64, XXH_PRIME64_2);
+    h128.high64 += m128.high64 * XXH_PRIME64_2;
+    h128.low64 = XXH3Avalanche(h128.low64);
+    h128.high64 = XXH3Avalanche(h128.high64);
+    return h128;
+}
+
+XXH128Hash XXH3Len0To16(const uint8_t* input, uint64_t len, const uint8_t* secret)
+{
+    if (len > 8) {
+        return XXH3Len9To16(input, len, secret);
+    }
+    if (len >= 4) {
+        return XXH3Len4To8(input, len, secret);
+    }
+    if (len > 0) {
+        return XXH3Len1To3(input, len, secret);
+    }
+    return XXH128Hash {
+        XXH64Avalanche(Read64LE(secret + 64) ^ Read64LE(secret + 72)),
+        XXH64Avalanche(Read64LE(secret + 80) ^ Read64LE(secret + 88))
+    };
+}
+
+XXH128Hash XXH3FinalizeMidsize(const XXH128Hash& acc, uint64_t len)
+{
+    XXH128Hash h128 {};
+    h128.low64 = acc.low64 + acc.high64;
+    h128.high64 = (acc.low64 * XXH_PRIME64_1) + (acc.high64 * XXH_PRIME64_4) + (len * XXH_PRIME64_2);
+    h128.low64 = XXH3Avalanche(h128.low64);
+    h128.high64 = 0ULL - XXH3Avalanche(h128.high64);
+    return h128;
+}
+
+XXH128Hash XXH3Len17To128(const uint8_t* input, uint64_t len, const uint8_t* secret)
+{
+    XXH128Hash acc { len * XXH_PRIME64_1, 0 };
+    if (len > 32) {
+        if (len > 64) {
+            if (len > 96) {
+                XXH128Mix32B(acc, input + 48, input + len - 64, secret + 96, 0);
+            }
+            XXH128Mix32B(acc, input + 32, input + len - 48, secret + 64, 0);
+        }
+        XXH128Mix32B(acc, input + 16, input + len - 32, secret + 32, 0);
+    }
+    XXH128Mix32B(acc, input, input + len - 16, secret, 0);
+    return XXH3FinalizeMidsize(acc, len);
+}
+
+XXH128Hash XXH3Len129To240(const uint8_t* input, uint64_t len, const uint8_t* secret)
+{
+    uint64_t nbRounds = len / 32;
+    XXH128Hash acc { len * XXH_PRIME64_1, 0 };
+    uint64_t i = 0;
+    for (i = 0; i < 4; ++i) {
+        XXH128Mix32B(acc, input + 32 * i, input + 32 * i + 16, secret + 32 * i, 0);
+    }
+    acc.low64 = XXH3Avalanche(acc.low64);
+    acc.high64 = XXH3Avalanche(acc.high64);
+    for (i = 4; i < nbRounds; ++i) {
+        XXH128Mix32B(acc, input + 32 * i, input + 32 * i + 16, secret + XXH_MIDSIZE_STARTOFFSET + 32 * (i - 4), 0);
+    }
+    // last bytes
+    XXH128Mix32B(acc, input + len - 16, input + len - 32,
+        secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LASTOFFSET - 16, 0);
+    return XXH3FinalizeMidsize(acc, len);
+}
+
+inline void XXH3Accumulate512(uint64_t* acc, const uint8_t* input, const uint8_t* secret)
+{
+    for (uint64_t i = 0; i < XXH_ACC_NB; ++i) {
+        uint64_t dataVal = Read64LE(input + 8 * i);
+        uint64_t dataKey = dataVal ^ Read64LE(secret + 8 * i);
+        acc[i ^ 1] += dataVal;
+        acc[i] += (dataKey & 0xFFFFFFFFULL) * (dataKey >> 32);
+    }
+}
+
+inline void XXH3ScrambleAcc(uint64_t* acc, const uint8_t* secret)
+{
+    for (uint64_t i = 0; i < XXH_ACC_NB; ++i) {
+        uint64_t acc64 = acc[i];
+        acc64 = XorShift64(acc64, 47);
+        acc64 ^= Read64LE(secret + 8 * i);
+        acc64 *= XXH_PRIME32_1;
+        acc[i] = acc64;
+    }
+}
+
+inline void XXH3Accumulate(uint64_t* acc, const uint8_t* input, const uint8_t* secret, uint64_t nbStripes)
+{
+    for (uint64_t n = 0; n < nbStripes; ++n) {
+        XXH3Accumulate512(acc, input + n * XXH_STRIPE_LEN, secret + n * XXH_SECRET_CONSUME_RATE);
+    }
+}
+
+uint64_t XXH3MergeAccs(const uint64_t* acc, const uint8_t* secret, uint64_t start)
+{
+    uint64_t result = start;
+    for (int i = 0; i < 4; ++i) {
+        result += Mul128Fold64(acc[2 * i] ^ Read64LE(secret + 16 * i), acc[2 * i + 1] ^ Read64LE(secret + 16 * i + 8));
+    }
+    return XXH3Avalanche(result);
+}
+
+XXH128Hash XXH3HashLong(const uint8_t* input, uint64_t len, const uint8_t* secret)
+{
+    uint64_t acc[XXH_ACC_NB] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+    uint64_t nbStripesPerBlock = (XXH_SECRET_SIZE - XXH_STRIPE_LEN) / XXH_SECRET_CONSUME_RATE;
+    uint64_t blockLen = XXH_STRIPE_LEN * nbStripesPerBlock;
+    uint64_t nbBlocks = (len - 1) / blockLen;
+    for (uint64_t n = 0; n < nbBlocks; ++n) {
+        XXH3Accumulate(acc, input + n * blockLen, secret, nbStripesPerBlock);
+        XXH3ScrambleAcc(acc, secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+    }
+    // last partial block
+    uint64_t nbStripes = ((len - 1) - (blockLen * nbBlocks)) / XXH_STRIPE_LEN;
+    XXH3Accumulate(acc, input + nbBlocks * blockLen, secret, nbStripes);
+    // last stripe
+    XXH3Accumulate512(acc, input + len - XXH_STRIPE_LEN,
+        secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC_START);
+    return XXH128Hash {
+        XXH3MergeAccs(acc, secret + XXH_SECRET_MERGEACCS_START, len * XXH_PRIME64_1),
+        XXH3MergeAccs(acc, secret + XXH_SECRET_SIZE - sizeof(acc) - XXH_SECRET_MERGEACCS_START,
+            ~(len * XXH_PRIME64_2))
+    };
+}
+
+/*
+ * BLAKE3, port of the reference implementation (CC0/Apache 2.0, Jack O'Connor, Samuel Neves, et al.)
+ */
+const uint32_t BLAKE3_BLOCK_LEN = 64;
+const uint32_t BLAKE3_CHUNK_LEN = 1024;
+const uint32_t BLAKE3_MAX_DEPTH = 54;
+const uint32_t BLAKE3_CHUNK_START = 1U << 0;
+const uint32_t BLAKE3_CHUNK_END = 1U << 1;
+const uint32_t BLAKE3_PARENT = 1U << 2;
+const uint32_t BLAKE3_ROOT = 1U << 3;
+
+const uint32_t BLAKE3_IV[8] = {
+    0x6A09E667U, 0xBB67AE85U, 0x3C6EF372U, 0xA54FF53AU, 0x510E527FU, 0x9B05688CU, 0x1F83D9ABU, 0x5BE0CD19U
+};
+
+const uint8_t BLAKE3_MSG_SCHEDULE[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+#define BLAKE3_G(a, b, c, d, x, y)          \
+    do {                                    \
+        a = a + b + (x);                    \
+        d = Rotr32(d ^ a, 16);              \
+        c = c + d;                          \
+        b = Rotr32(b ^ c, 12);              \
+        a = a + b + (y);                    \
+        d = Rotr32(d ^ a, 8);               \
+        c = c + d;                          \
+        b = Rotr32(b ^ c, 7);               \
+    } while (0)
+
+#define BLAKE3_ROUND(r)                                                                 \
+    do {                                                                                \
+        /* mix the columns */                                                           \
+        BLAKE3_G(s0, s4, s8, s12, m[BLAKE3_MSG_SCHEDULE[r][0]], m[BLAKE3_MSG_SCHEDULE[r][1]]);      \
+        BLAKE3_G(s1, s5, s9, s13, m[BLAKE3_MSG_SCHEDULE[r][2]], m[BLAKE3_MSG_SCHEDULE[r][3]]);      \
+        BLAKE3_G(s2, s6, s10, s14, m[BLAKE3_MSG_SCHEDULE[r][4]], m[BLAKE3_MSG_SCHEDULE[r][5]]);     \
+        BLAKE3_G(s3, s7, s11, s15, m[BLAKE3_MSG_SCHEDULE[r][6]], m[BLAKE3_MSG_SCHEDULE[r][7]]);     \
+        /* mix the diagonals */                                                         \
+        BLAKE3_G(s0, s5, s10, s15, m[BLAKE3_MSG_SCHEDULE[r][8]], m[BLAKE3_MSG_SCHEDULE[r][9]]);     \
+        BLAKE3_G(s1, s6, s11, s12, m[BLAKE3_MSG_SCHEDULE[r][10]], m[BLAKE3_MSG_SCHEDULE[r][11]]);   \
+        BLAKE3_G(s2, s7, s8, s13, m[BLAKE3_MSG_SCHEDULE[r][12]], m[BLAKE3_MSG_SCHEDULE[r][13]]);    \
+        BLAKE3_G(s3, s4, s9, s14, m[BLAKE3_MSG_SCHEDULE[r][14]], m[BLAKE3_MSG_SCHEDULE[r][15]]);    \
+    } while (0)
+
+/**
+ * compress a 64 bytes block (zero padded) into 8 words chaining value, state is kept in locals to stay in registers
+ */
+void Blake3Compress(
+    const uint32_t cv[8], const uint8_t block[BLAKE3_BLOCK_LEN],
+    uint8_t blockLen, uint64_t counter, uint32_t flags, uint32_t out[8])
+{
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) {
+        m[i] = Read32LE(block + 4 * i);
+    }
+    uint32_t s0 = cv[0], s1 = cv[1], s2 = cv[2], s3 = cv[3], s4 = cv[4], s5 = cv[5], s6 = cv[6], s7 = cv[7];
+    uint32_t s8 = BLAKE3_IV[0], s9 = BLAKE3_IV[1], s10 = BLAKE3_IV[2], s11 = BLAKE3_IV[3];
+    uint32_t s12 = static_cast<uint32_t>(counter);
+    uint32_t s13 = static_cast<uint32_t>(counter >> 32);
+    uint32_t s14 = blockLen;
+    uint32_t s15 = flags;
+    // unrolled with constant message schedule, so that message words can be kept in registers
+    BLAKE3_ROUND(0);
+    BLAKE3_ROUND(1);
+    BLAKE3_ROUND(2);
+    BLAKE3_ROUND(3);
+    BLAKE3_ROUND(4);
+    BLAKE3_ROUND(5);
+    BLAKE3_ROUND(6);
+    out[0] = s0 ^ s8;
+    out[1] = s1 ^ s9;
+    out[2] = s2 ^ s10;
+    out[3] = s3 ^ s11;
+    out[4] = s4 ^ s12;
+    out[5] = s5 ^ s13;
+    out[6] = s6 ^ s14;
+    out[7] = s7 ^ s15;
+}
+
+#undef BLAKE3_ROUND
+#undef BLAKE3_G
+
+/**
+ * compress a chunk (at most 1024 bytes) into chaining value,
+ * flags of the last block is returned by lastBlock/lastBlockLen/lastFlags and not compressed
+ * so that the caller can decide to finalize it as root or not.
+ */
+void Blake3ChunkPrepare(
+    const uint8_t* input, uint64_t len, uint64_t chunkCounter,
+    uint32_t cv[8], uint8_t lastBlock[BLAKE3_BLOCK_LEN], uint8_t& lastBlockLen, uint32_t& lastFlags)
+{
+    ::memcpy(cv, BLAKE3_IV, sizeof(BLAKE3_IV));
+    uint32_t startFlag = BLAKE3_CHUNK_START;
+    while (len > BLAKE3_BLOCK_LEN) {
+        Blake3Compress(cv, input, BLAKE3_BLOCK_LEN, chunkCounter, startFlag, cv);
+        startFlag = 0;
+        input += BLAKE3_BLOCK_LEN;
+        len -= BLAKE3_BLOCK_LEN;
+    }
+    ::memset(lastBlock, 0, BLAKE3_BLOCK_LEN);
+    ::memcpy(lastBlock, input, static_cast<std::size_t>(len));
+    lastBlockLen = static_cast<uint8_t>(len);
+    lastFlags = startFlag | BLAKE3_CHUNK_END;
+}
+
+void Blake3ParentBlock(const uint32_t left[8], const uint32_t right[8], uint8_t block[BLAKE3_BLOCK_LEN])
+{
+    for (int i = 0; i < 8; ++i) {
+        Write32LE(block + 4 * i, left[i]);
+        Write32LE(block + 32 + 4 * i, right[i]);
+    }
+}
+
+// push chaining value of a complete chunk, merge subtrees while the total chunk count is a multiple of 2^n
+void Blake3PushChunkCv(uint32_t cvStack[][8], uint32_t& cvStackLen, uint32_t cv[8], uint64_t totalChunks)
+{
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    for (; (totalChunks & 1) == 0; totalChunks >>= 1) {
+        --cvStackLen;
+        Blake3ParentBlock(cvStack[cvStackLen], cv, block);
+        Blake3Compress(BLAKE3_IV, block, BLAKE3_BLOCK_LEN, 0, BLAKE3_PARENT, cv);
+    }
+    ::memcpy(cvStack[cvStackLen++], cv, sizeof(uint32_t) * 8);
+}
+
+#ifdef __SSE2__
+const uint32_t BLAKE3_SIMD_DEGREE = 4;
+
+inline __m128i Rotr128(__m128i x, int r)
+{
+    return _mm_or_si128(_mm_srli_epi32(x, r), _mm_slli_epi32(x, 32 - r));
+}
+
+#define BLAKE3_G4(a, b, c, d, x, y)                             \
+    do {                                                        \
+        a = _mm_add_epi32(_mm_add_epi32(a, b), (x));            \
+        d = Rotr128(_mm_xor_si128(d, a), 16);                   \
+        c = _mm_add_epi32(c, d);                                \
+        b = Rotr128(_mm_xor_si128(b, c), 12);                   \
+        a = _mm_add_epi32(_mm_add_epi32(a, b), (y));            \
+        d = Rotr128(_mm_xor_si128(d, a), 8);                    \
+        c = _mm_add_epi32(c, d);                                \
+        b = Rotr128(_mm_xor_si128(b, c), 7);                    \
+    } while (0)
+
+#define BLAKE3_ROUND4(r)                                                                \
+    do {                                                                                \
+        BLAKE3_G4(s0, s4, s8, s12, m[BLAKE3_MSG_SCHEDULE[r][0]], m[BLAKE3_MSG_SCHEDULE[r][1]]);     \
+        BLAKE3_G4(s1, s5, s9, s13, m[BLAKE3_MSG_SCHEDULE[r][2]], m[BLAKE3_MSG_SCHEDULE[r][3]]);     \
+        BLAKE3_G4(s2, s6, s10, s14, m[BLAKE3_MSG_SCHEDULE[r][4]], m[BLAKE3_MSG_SCHEDULE[r][5]]);    \
+        BLAKE3_G4(s3, s7, s11, s15, m[BLAKE3_MSG_SCHEDULE[r][6]], m[BLAKE3_MSG_SCHEDULE[r][7]]);    \
+        BLAKE3_G4(s0, s5, s10, s15, m[BLAKE3_MSG_SCHEDULE[r][8]], m[BLAKE3_MSG_SCHEDULE[r][9]]);    \
+        BLAKE3_G4(s1, s6, s11, s12, m[BLAKE3_MSG_SCHEDULE[r][10]], m[BLAKE3_MSG_SCHEDULE[r][11]]);  \
+        BLAKE3_G4(s2, s7, s8, s13, m[BLAKE3_MSG_SCHEDULE[r][12]], m[BLAKE3_MSG_SCHEDULE[r][13]]);   \
+        BLAKE3_G4(s3, s4, s9, s14, m[BLAKE3_MSG_SCHEDULE[r][14]], m[BLAKE3_MSG_SCHEDULE[r][15]]);   \
+    } while (0)
+
+/**
+ * hash 4 complete chunks in parallel (one chunk per 32bits lane), the same idea as blake3_hash_many of upstream,
+ * lane i of the state vector k holds state word k of chunk i.
+ */
+void Blake3HashChunks4(const uint8_t* input, uint64_t chunkCounter, uint32_t cvs[BLAKE3_SIMD_DEGREE][8])
+{
+    __m128i h[8];
+    for (int i = 0; i < 8; ++i) {
+        h[i] = _mm_set1_epi32(static_cast<int>(BLAKE3_IV[i]));
+    }
+    const __m128i counterLow = _mm_setr_epi32(
+        static_cast<int>(chunkCounter), static_cast<int>(chunkCounter + 1),
+        static_cast<int>(chunkCounter + 2), static_cast<int>(chunkCounter + 3));
+    const __m128i counterHigh = _mm_setr_epi32(
+        static_cast<int>((chunkCounter) >> 32), static_cast<int>((chunkCounter + 1) >> 32),
+        static_cast<int>((chunkCounter + 2) >> 32), static_cast<int>((chunkCounter + 3) >> 32));
+    const __m128i blockLen = _mm_set1_epi32(static_cast<int>(BLAKE3_BLOCK_LEN));
+    for (uint32_t blockIndex = 0; blockIndex < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++blockIndex) {
+        // transpose message words, m[k] holds message word k of the block of all 4 chunks
+        __m128i m[16];
+        for (int k = 0; k < 16; k += 4) {
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                input + 0 * BLAKE3_CHUNK_LEN + blockIndex * BLAKE3_BLOCK_LEN + 4 * k));
+            __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                input + 1 * BLAKE3_CHUNK_LEN + blockIndex * BLAKE3_BLOCK_LEN + 4 * k));
+            __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                input + 2 * BLAKE3_CHUNK_LEN + blockIndex * BLAKE3_BLOCK_LEN + 4 * k));
+            __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                input + 3 * BLAKE3_CHUNK_LEN + blockIndex * BLAKE3_BLOCK_LEN + 4 * k));
+            __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+            __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+            __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+            __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+            m[k + 0] = _mm_unpacklo_epi64(t0, t1);
+            m[k + 1] = _mm_unpackhi_epi64(t0, t1);
+            m[k + 2] = _mm_unpacklo_epi64(t2, t3);
+            m[k + 3] = _mm_unpackhi_epi64(t2, t3);
+        }
+        uint32_t flags = (blockIndex == 0 ? BLAKE3_CHUNK_START : 0)
+            | (blockIndex == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? BLAKE3_CHUNK_END : 0);
+        __m128i s0 = h[0], s1 = h[1], s2 = h[2], s3 = h[3], s4 = h[4], s5 = h[5], s6 = h[6], s7 = h[7];
+        __m128i s8 = _mm_set1_epi32(static_cast<int>(BLAKE3_IV[0]));
+        __m128i s9 = _mm_set1_epi32(static_cast<int>(BLAKE3_IV[1]));
+        __m128i s10 = _mm_set1_epi32(static_cast<int>(BLAKE3_IV[2]));
+        __m128i s11 = _mm_set1_epi32(static_cast<int>(BLAKE3_IV[3]));
+        __m128i s12 = counterLow;
+        __m128i s13 = counterHigh;
+        __m128i s14 = blockLen;
+        __m128i s15 = _mm_set1_epi32(static_cast<int>(flags));
+        BLAKE3_ROUND4(0);
+        BLAKE3_ROUND4(1);
+        BLAKE3_ROUND4(2);
+        BLAKE3_ROUND4(3);
+        BLAKE3_ROUND4(4);
+        BLAKE3_ROUND4(5);
+        BLAKE3_ROUND4(6);
+        h[0] = _mm_xor_si128(s0, s8);
+        h[1] = _mm_xor_si128(s1, s9);
+        h[2] = _mm_xor_si128(s2, s10);
+        h[3] = _mm_xor_si128(s3, s11);
+        h[4] = _mm_xor_si128(s4, s12);
+        h[5] = _mm_xor_si128(s5, s13);
+        h[6] = _mm_xor_si128(s6, s14);
+        h[7] = _mm_xor_si128(s7, s15);
+    }
+    uint32_t lanes[8][BLAKE3_SIMD_DEGREE];
+    for (int i = 0; i < 8; ++i) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes[i]), h[i]);
+    }
+    for (uint32_t chunk = 0; chunk < BLAKE3_SIMD_DEGREE; ++chunk) {
+        for (int i = 0; i < 8; ++i) {
+            cvs[chunk][i] = lanes[i][chunk];
+        }
+    }
+}
+
+#undef BLAKE3_ROUND4
+#undef BLAKE3_G4
+#endif
+
+/*
+ * CRC32C (Castagnoli polynomial 0x82F63B78 reflected), slicing-by-8 if SSE4.2 is not available
+ */
+const uint32_t CRC32C_POLY = 0x82F63B78U;
+
+struct Crc32cTable {
+    uint32_t table[8][256];
+
+    Crc32cTable()
+    {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t crc = n;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            table[0][n] = crc;
+        }
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t crc = table[0][n];
+            for (int k = 1; k < 8; ++k) {
+                crc = table[0][crc & 0xff] ^ (crc >> 8);
+                table[k][n] = crc;
+            }
+        }
+    }
+};
+
+uint32_t Crc32cUpdate(uint32_t crc, const uint8_t* data, uint64_t len)
+{
+#ifdef __SSE4_2__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        crc64 = _mm_crc32_u64(crc64, Read64LE(data));
+        data += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --len;
+    }
+    return crc;
+#else
+    static const Crc32cTable crcTable;
+    const uint32_t (*t)[256] = crcTable.table;
+    while (len >= 8) {
+        uint64_t word = Read64LE(data) ^ crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff]
+            ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+        --len;
+    }
+    return crc;
+#endif
+}
+
+/*
+ * zero block detection
+ */
+const uint64_t ZERO_TEST_STRIDE = 64;
+
+// test ZERO_TEST_STRIDE bytes with a single branch, lanes are OR-ed together before testing
+inline bool IsZeroStride(const uint8_t* data)
+{
+#if defined(__AVX2__)
+    __m256i v = _mm256_or_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32)));
+    return _mm256_testz_si256(v, v) != 0;
+#elif defined(__SSE2__)
+    __m128i v = _mm_or_si128(
+        _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16))),
+        _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48))));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xFFFF;
+#else
+    uint64_t acc = 0;
+    for (uint64_t i = 0; i < ZERO_TEST_STRIDE; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        ::memcpy(&word, data + i, sizeof(word));
+        acc |= word;
+    }
+    return acc == 0;
+#endif
+}
+
+}
+
+bool blockhash::IsZeroBlock(const uint8_t* data, uint64_t len)
+{
+    uint64_t offset = 0;
+    // non-zero block usually fails at the first stride, so the loop exits early
+    for (; offset + ZERO_TEST_STRIDE <= len; offset += ZERO_TEST_STRIDE) {
+        if (!IsZeroStride(data + offset)) {
+            return false;
+        }
+    }
+    for (; offset < len; ++offset) {
+        if (data[offset] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t blockhash::DigestSize(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+        case HashAlgorithm::SHA256: return SHA256_CHECKSUM_SIZE;
+        case HashAlgorithm::XXH3_128: return XXH3_128_CHECKSUM_SIZE;
+        case HashAlgorithm::BLAKE3: return BLAKE3_CHECKSUM_SIZE;
+        case HashAlgorithm::CRC32C: return CRC32C_CHECKSUM_SIZE;
+        default: return 0;
+    }
+}
+
+std::string blockhash::AlgorithmName(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+        case HashAlgorithm::SHA256: return "SHA256";
+        case HashAlgorithm::XXH3_128: return "XXH3_128";
+        case HashAlgorithm::BLAKE3: return "BLAKE3";
+        case HashAlgorithm::CRC32C: return "CRC32C";
+        default: return "UNKNOWN";
+    }
+}
+
+bool blockhash::ParseAlgorithm(const std::string& name, HashAlgorithm& algorithm)
+{
+    const HashAlgorithm algorithms[] = {
+        HashAlgorithm::SHA256, HashAlgorithm::XXH3_128, HashAlgorithm::BLAKE3, HashAlgorithm::CRC32C };
+    for (HashAlgorithm candidate : algorithms) {
+        if (AlgorithmName(candidate) == name) {
+            algorithm = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool blockhash::ComputeDigest(
+    HashAlgorithm algorithm, const uint8_t* data, uint64_t len, uint8_t* output, uint32_t outputLen)
+{
+    if (DigestSize(algorithm) == 0 || DigestSize(algorithm) != outputLen) {
+        ERRLOG("invalid hash algorithm %d or digest size %u", static_cast<int>(algorithm), outputLen);
+        return false;
+    }
+    switch (algorithm) {
+        case HashAlgorithm::SHA256: return ComputeSHA256(data, len, output);
+        case HashAlgorithm::XXH3_128: ComputeXXH3_128(data, len, output); return true;
+        case HashAlgorithm::BLAKE3: ComputeBLAKE3(data, len, output); return true;
+        case HashAlgorithm::CRC32C: ComputeCRC32C(data, len, output); return true;
+        default: return false;
+    }
+}
+
+bool blockhash::ComputeSHA256(const uint8_t* data, uint64_t len, uint8_t* output)
+{
+    EVP_MD_CTX *mdctx = nullptr;
+    unsigned int mdLen = 0;
+
+    if ((mdctx = EVP_MD_CTX_new()) == nullptr) {
+        ERRLOG("Memory allocation failed");
+        return false;
+    }
+
+    bool success = EVP_DigestInit_ex(mdctx, EVP_sha256(), nullptr) == 1
+        && EVP_DigestUpdate(mdctx, data, len) == 1
+        && EVP_DigestFinal_ex(mdctx, output, &mdLen) == 1;
+    EVP_MD_CTX_free(mdctx);
+    return success && mdLen == SHA256_CHECKSUM_SIZE;
+}
+
+void blockhash::ComputeXXH3_128(const uint8_t* data, uint64_t len, uint8_t* output)
+{
+    XXH128Hash hash {};
+    if (len <= 16) {
+        hash = XXH3Len0To16(data, len, XXH_SECRET);
+    } else if (len <= 128) {
+        hash = XXH3Len17To128(data, len, XXH_SECRET);
+    } else if (len <= XXH_MIDSIZE_MAX) {
+        hash = XXH3Len129To240(data, len, XXH_SECRET);
+    } else {
+        hash = XXH3HashLong(data, len, XXH_SECRET);
+    }
+    // canonical representation, same as XXH128_canonicalFromHash
+    Write64BE(output, hash.high64);
+    Write64BE(output + 8, hash.low64);
+}
+
+void blockhash::ComputeBLAKE3(const uint8_t* data, uint64_t len, uint8_t* output)
+{
+    // stack of chaining values of complete subtrees
+    uint32_t cvStack[BLAKE3_MAX_DEPTH][8];
+    uint32_t cvStackLen = 0;
+    uint64_t chunkCounter = 0;
+    uint32_t cv[8];
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    uint8_t blockLen = 0;
+    uint32_t flags = 0;
+
+#ifdef __SSE2__
+    // always leave at least one chunk to the scalar path, the last chunk need to be finalized as root
+    while (len > BLAKE3_SIMD_DEGREE * BLAKE3_CHUNK_LEN) {
+        uint32_t cvs[BLAKE3_SIMD_DEGREE][8];
+        Blake3HashChunks4(data, chunkCounter, cvs);
+        for (uint32_t i = 0; i < BLAKE3_SIMD_DEGREE; ++i) {
+            Blake3PushChunkCv(cvStack, cvStackLen, cvs[i], ++chunkCounter);
+        }
+        data += BLAKE3_SIMD_DEGREE * BLAKE3_CHUNK_LEN;
+        len -= BLAKE3_SIMD_DEGREE * BLAKE3_CHUNK_LEN;
+    }
+#endif
+    while (len > BLAKE3_CHUNK_LEN) {
+        Blake3ChunkPrepare(data, BLAKE3_CHUNK_LEN, chunkCounter, cv, block, blockLen, flags);
+        Blake3Compress(cv, block, blockLen, chunkCounter, flags, cv);
+        Blake3PushChunkCv(cvStack, cvStackLen, cv, ++chunkCounter);
+        data += BLAKE3_CHUNK_LEN;
+        len -= BLAKE3_CHUNK_LEN;
+    }
+    // the last chunk (may be empty), keep it's last block uncompressed to be finalized as root
+    Blake3ChunkPrepare(data, len, chunkCounter, cv, block, blockLen, flags);
+    while (cvStackLen > 0) {
+        uint32_t chunkCv[8];
+        Blake3Compress(cv, block, blockLen, chunkCounter, flags, chunkCv);
+        --cvStackLen;
+        Blake3ParentBlock(cvStack[cvStackLen], chunkCv, block);
+        ::memcpy(cv, BLAKE3_IV, sizeof(BLAKE3_IV));
+        blockLen = BLAKE3_BLOCK_LEN;
+        chunkCounter = 0;
+        flags = BLAKE3_PARENT;
+    }
+    uint32_t rootCv[8];
+    Blake3Compress(cv, block, blockLen, 0, flags | BLAKE3_ROOT, rootCv);
+    for (int i = 0; i < 8; ++i) {
+        Write32LE(output + 4 * i, rootCv[i]);
+    }
+}
+
+void blockhash::ComputeCRC32C(const uint8_t* data, uint64_t len, uint8_t* output)
+{
+    uint32_t crc = Crc32cUpdate(0xFFFFFFFFU, data, len) ^ 0xFFFFFFFFU;
+    Write32BE(output, crc);
+}
+
+blockhash::DigestContext::DigestContext(HashAlgorithm algorithm)
+    : m_algorithm(algorithm), m_digestSize(blockhash::DigestSize(algorithm))
+{
+    if (m_algorithm != HashAlgorithm::SHA256) {
+        return;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    // pre-fetch explicitly, EVP_sha256() will be implicitly fetched on each EVP_DigestInit_ex in OpenSSL 3
+    m_md = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+    m_mdFetched = (m_md != nullptr);
+#endif
+    if (m_md == nullptr) {
+        m_md = EVP_sha256();
+    }
+    m_mdctx = EVP_MD_CTX_new();
+    if (m_mdctx == nullptr) {
+        ERRLOG("failed to allocate EVP_MD_CTX");
+    }
+    m_lanes = SHA256MultiBufferLanes();
+}
+
+blockhash::DigestContext::~DigestContext()
+{
+    if (m_mdctx != nullptr) {
+        EVP_MD_CTX_free(m_mdctx);
+        m_mdctx = nullptr;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (m_mdFetched) {
+        EVP_MD_free(const_cast<EVP_MD*>(m_md));
+    }
+#endif
+    m_md = nullptr;
+}
+
+bool blockhash::DigestContext::Ok() const
+{
+    return m_digestSize != 0 && (m_algorithm != HashAlgorithm::SHA256 || m_mdctx != nullptr);
+}
+
+uint32_t blockhash::DigestContext::DigestSize() const
+{
+    return m_digestSize;
+}
+
+uint32_t blockhash::DigestContext::MaxBatchSize() const
+{
+    return m_lanes > 1 ? m_lanes : 1;
+}
+
+bool blockhash::DigestContext::Compute(const uint8_t* data, uint64_t len, uint8_t* output)
+{
+    if (m_algorithm != HashAlgorithm::SHA256) {
+        return ComputeDigest(m_algorithm, data, len, output, m_digestSize);
+    }
+    unsigned int mdLen = 0;
+    if (m_mdctx == nullptr
+        || EVP_DigestInit_ex(m_mdctx, m_md, nullptr) != 1
+        || EVP_DigestUpdate(m_mdctx, data, len) != 1
+        || EVP_DigestFinal_ex(m_mdctx, output, &mdLen) != 1) {
+        ERRLOG("failed to compute SHA256 digest");
+        return false;
+    }
+    return mdLen == SHA256_CHECKSUM_SIZE;
+}
+
+/**
+ * hash continuous blocks with the same length together, blocks failed to be grouped fallback to Compute one by one
+ */
+bool blockhash::DigestContext::ComputeBatch(
+    const uint8_t* const data[], const uint64_t len[], uint8_t* const output[], uint32_t count)
+{
+    uint32_t index = 0;
+    while (index < count) {
+        uint32_t groupSize = 1;
+        while (groupSize < m_lanes && index + groupSize < count && len[index + groupSize] == len[index]) {
+            ++groupSize;
+        }
+        if (groupSize > 1) {
+            if (!ComputeSHA256MultiBuffer(data + index, len[index], output + index, groupSize)) {
+                return false;
+            }
+        } else if (!Compute(data[index], len[index], output[index])) {
+            return false;
+        }
+        index += groupSize;
+    }
+    return true;
+}
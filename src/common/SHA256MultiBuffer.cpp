@@ -0,0 +1,399 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include <cstring>
+
+#include "common/BlockHash.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VOLUMEPROTECT_SHA256_MB_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA256_MB_TARGET(isa)
+#else
+#include <cpuid.h>
+#define SHA256_MB_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+using namespace volumeprotect;
+
+/**
+ * Multi-buffer SHA256: hash several equal length buffers at once.
+ * SHA-NI:  sha256rnds2 has a latency of several cycles but can be issued every cycle,
+ *          interleaving rounds of 2 independent messages keep the SHA unit busy.
+ * AVX2:    each 32bits lane of a 256bits register holds the state word of one message, 8 messages in parallel.
+ * Only full 64 bytes blocks are fed to the kernel, the tail and padding of all messages are built in a
+ * per-lane buffer and processed by another kernel call since all messages share the same length.
+ */
+namespace {
+
+const uint32_t SHA256_BLOCK_LEN = 64;
+const uint32_t SHA256_NI_LANES = 2;
+const uint32_t SHA256_AVX2_LANES = 8;
+
+const uint32_t SHA256_IV[8] = {
+    0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U, 0xa54ff53aU, 0x510e527fU, 0x9b05688cU, 0x1f83d9abU, 0x5be0cd19U
+};
+
+#ifdef VOLUMEPROTECT_SHA256_MB_X86
+
+alignas(64) const uint32_t SHA256_K[64] = {
+    0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+    0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+    0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+    0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+    0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+    0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+    0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+    0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U,
+};
+
+enum class Sha256Kernel {
+    NONE,
+    SHA_NI,
+    AVX2
+};
+
+void CpuidCount(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+    int info[4] = { 0 };
+    __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int i = 0; i < 4; ++i) {
+        regs[i] = static_cast<uint32_t>(info[i]);
+    }
+#else
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    __get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+}
+
+uint64_t ReadXCR0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax = 0;
+    uint32_t edx = 0;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+Sha256Kernel DetectSha256Kernel()
+{
+    uint32_t leaf0[4];
+    CpuidCount(0, 0, leaf0);
+    if (leaf0[0] < 7) {
+        return Sha256Kernel::NONE;
+    }
+    uint32_t leaf1[4];
+    uint32_t leaf7[4];
+    CpuidCount(1, 0, leaf1);
+    CpuidCount(7, 0, leaf7);
+    bool ssse3 = (leaf1[2] & (1U << 9)) != 0;
+    bool sse41 = (leaf1[2] & (1U << 19)) != 0;
+    bool osxsave = (leaf1[2] & (1U << 27)) != 0;
+    bool avx = (leaf1[2] & (1U << 28)) != 0;
+    bool avx2 = (leaf7[1] & (1U << 5)) != 0;
+    bool sha = (leaf7[1] & (1U << 29)) != 0;
+    if (sha && ssse3 && sse41) {
+        return Sha256Kernel::SHA_NI;
+    }
+    // AVX registers state must be saved by OS
+    if (avx2 && avx && osxsave && (ReadXCR0() & 0x6) == 0x6) {
+        return Sha256Kernel::AVX2;
+    }
+    return Sha256Kernel::NONE;
+}
+
+Sha256Kernel ActiveSha256Kernel()
+{
+    static const Sha256Kernel kernel = DetectSha256Kernel();
+    return kernel;
+}
+
+/*
+ * SHA-NI kernel, 4 rounds per step, message schedule is computed 3 steps ahead by sha256msg1/sha256msg2.
+ * Lanes are unrolled by hand, so that the two independent dependency chains are interleaved without relying on
+ * the compiler to unroll loops.
+ */
+#define SHA256_NI_LANE(i, l, cur, prev, next)                                                       \
+    do {                                                                                            \
+        if ((i) < 4) {                                                                              \
+            cur##l = _mm_shuffle_epi8(_mm_loadu_si128(                                              \
+                reinterpret_cast<const __m128i*>(data##l + 16 * (i))), byteSwapMask);               \
+        }                                                                                           \
+        __m128i msg##l = _mm_add_epi32(cur##l, k);                                                  \
+        state1##l = _mm_sha256rnds2_epu32(state1##l, state0##l, msg##l);                            \
+        if ((i) >= 3 && (i) <= 14) {                                                                \
+            next##l = _mm_sha256msg2_epu32(                                                         \
+                _mm_add_epi32(next##l, _mm_alignr_epi8(cur##l, prev##l, 4)), cur##l);               \
+        }                                                                                           \
+        msg##l = _mm_shuffle_epi32(msg##l, 0x0E);                                                   \
+        state0##l = _mm_sha256rnds2_epu32(state0##l, state1##l, msg##l);                            \
+        if ((i) >= 1 && (i) <= 12) {                                                                \
+            prev##l = _mm_sha256msg1_epu32(prev##l, cur##l);                                        \
+        }                                                                                           \
+    } while (0)
+
+#define SHA256_NI_STEP(i, cur, prev, next)                                                          \
+    do {                                                                                            \
+        const __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(SHA256_K + 4 * (i)));     \
+        SHA256_NI_LANE(i, A, cur, prev, next);                                                      \
+        SHA256_NI_LANE(i, B, cur, prev, next);                                                      \
+    } while (0)
+
+SHA256_MB_TARGET("sha,sse4.1,ssse3")
+inline void Sha256NiLoadState(const uint32_t state[8], __m128i& abef, __m128i& cdgh)
+{
+    // reorder state words into ABEF/CDGH layout required by sha256rnds2
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+    abef = _mm_alignr_epi8(tmp, efgh, 8);
+    cdgh = _mm_blend_epi16(efgh, tmp, 0xF0);
+}
+
+SHA256_MB_TARGET("sha,sse4.1,ssse3")
+inline void Sha256NiStoreState(uint32_t state[8], __m128i abef, __m128i cdgh)
+{
+    __m128i tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+SHA256_MB_TARGET("sha,sse4.1,ssse3")
+void Sha256NiBlocks(uint32_t states[][8], const uint8_t* const input[], uint64_t blocks)
+{
+    const __m128i byteSwapMask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0A;
+    __m128i state1A;
+    __m128i state0B;
+    __m128i state1B;
+    Sha256NiLoadState(states[0], state0A, state1A);
+    Sha256NiLoadState(states[1], state0B, state1B);
+    const uint8_t* dataA = input[0];
+    const uint8_t* dataB = input[1];
+    for (uint64_t block = 0; block < blocks; ++block) {
+        __m128i abefSaveA = state0A;
+        __m128i cdghSaveA = state1A;
+        __m128i abefSaveB = state0B;
+        __m128i cdghSaveB = state1B;
+        __m128i msg0A, msg1A, msg2A, msg3A;
+        __m128i msg0B, msg1B, msg2B, msg3B;
+        SHA256_NI_STEP(0, msg0, msg3, msg1);
+        SHA256_NI_STEP(1, msg1, msg0, msg2);
+        SHA256_NI_STEP(2, msg2, msg1, msg3);
+        SHA256_NI_STEP(3, msg3, msg2, msg0);
+        SHA256_NI_STEP(4, msg0, msg3, msg1);
+        SHA256_NI_STEP(5, msg1, msg0, msg2);
+        SHA256_NI_STEP(6, msg2, msg1, msg3);
+        SHA256_NI_STEP(7, msg3, msg2, msg0);
+        SHA256_NI_STEP(8, msg0, msg3, msg1);
+        SHA256_NI_STEP(9, msg1, msg0, msg2);
+        SHA256_NI_STEP(10, msg2, msg1, msg3);
+        SHA256_NI_STEP(11, msg3, msg2, msg0);
+        SHA256_NI_STEP(12, msg0, msg3, msg1);
+        SHA256_NI_STEP(13, msg1, msg0, msg2);
+        SHA256_NI_STEP(14, msg2, msg1, msg3);
+        SHA256_NI_STEP(15, msg3, msg2, msg0);
+        state0A = _mm_add_epi32(state0A, abefSaveA);
+        state1A = _mm_add_epi32(state1A, cdghSaveA);
+        state0B = _mm_add_epi32(state0B, abefSaveB);
+        state1B = _mm_add_epi32(state1B, cdghSaveB);
+        dataA += SHA256_BLOCK_LEN;
+        dataB += SHA256_BLOCK_LEN;
+    }
+    Sha256NiStoreState(states[0], state0A, state1A);
+    Sha256NiStoreState(states[1], state0B, state1B);
+}
+
+#undef SHA256_NI_STEP
+#undef SHA256_NI_LANE
+
+/*
+ * AVX2 kernel, lane l of vector k holds the state word (or message word) k of message l
+ */
+SHA256_MB_TARGET("avx2")
+inline __m256i Rotr256(__m256i x, int r)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, r), _mm256_slli_epi32(x, 32 - r));
+}
+
+// transpose 8 rows of 8 words, row l hold 8 continuous words of message l
+SHA256_MB_TARGET("avx2")
+inline void Transpose8x8(__m256i rows[8])
+{
+    __m256i t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+    __m256i t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+    __m256i t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+    rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+SHA256_MB_TARGET("avx2")
+void Sha256Avx2Blocks(uint32_t states[][8], const uint8_t* const input[], uint64_t blocks)
+{
+    const __m256i byteSwapMask = _mm256_set_epi64x(
+        0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL, 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m256i state[8];
+    for (int k = 0; k < 8; ++k) {
+        state[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(states[k]));
+    }
+    Transpose8x8(state);
+    for (uint64_t block = 0; block < blocks; ++block) {
+        __m256i w[16];
+        for (int half = 0; half < 2; ++half) {
+            for (uint32_t l = 0; l < SHA256_AVX2_LANES; ++l) {
+                w[8 * half + l] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                    input[l] + block * SHA256_BLOCK_LEN + 32 * half));
+            }
+            Transpose8x8(w + 8 * half);
+        }
+        for (int i = 0; i < 16; ++i) {
+            w[i] = _mm256_shuffle_epi8(w[i], byteSwapMask);
+        }
+        __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+        __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            if (i >= 16) {
+                __m256i w15 = w[(i - 15) & 15];
+                __m256i w2 = w[(i - 2) & 15];
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(Rotr256(w15, 7), Rotr256(w15, 18)),
+                    _mm256_srli_epi32(w15, 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(Rotr256(w2, 17), Rotr256(w2, 19)),
+                    _mm256_srli_epi32(w2, 10));
+                w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0),
+                    _mm256_add_epi32(w[(i - 7) & 15], s1));
+            }
+            __m256i bigSigma1 = _mm256_xor_si256(_mm256_xor_si256(Rotr256(e, 6), Rotr256(e, 11)), Rotr256(e, 25));
+            __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            __m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(h, bigSigma1),
+                _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32(static_cast<int>(SHA256_K[i]))), w[i & 15]));
+            __m256i bigSigma0 = _mm256_xor_si256(_mm256_xor_si256(Rotr256(a, 2), Rotr256(a, 13)), Rotr256(a, 22));
+            __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+            __m256i temp2 = _mm256_add_epi32(bigSigma0, maj);
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, temp1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(temp1, temp2);
+        }
+        state[0] = _mm256_add_epi32(state[0], a);
+        state[1] = _mm256_add_epi32(state[1], b);
+        state[2] = _mm256_add_epi32(state[2], c);
+        state[3] = _mm256_add_epi32(state[3], d);
+        state[4] = _mm256_add_epi32(state[4], e);
+        state[5] = _mm256_add_epi32(state[5], f);
+        state[6] = _mm256_add_epi32(state[6], g);
+        state[7] = _mm256_add_epi32(state[7], h);
+    }
+    Transpose8x8(state);
+    for (int k = 0; k < 8; ++k) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(states[k]), state[k]);
+    }
+}
+
+void Sha256KernelBlocks(Sha256Kernel kernel, uint32_t states[][8], const uint8_t* const input[], uint64_t blocks)
+{
+    if (kernel == Sha256Kernel::SHA_NI) {
+        Sha256NiBlocks(states, input, blocks);
+    } else {
+        Sha256Avx2Blocks(states, input, blocks);
+    }
+}
+
+#endif
+
+}
+
+uint32_t blockhash::SHA256MultiBufferLanes()
+{
+#ifdef VOLUMEPROTECT_SHA256_MB_X86
+    switch (ActiveSha256Kernel()) {
+        case Sha256Kernel::SHA_NI: return SHA256_NI_LANES;
+        case Sha256Kernel::AVX2: return SHA256_AVX2_LANES;
+        default: return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
+bool blockhash::ComputeSHA256MultiBuffer(
+    const uint8_t* const data[], uint64_t len, uint8_t* const output[], uint32_t count)
+{
+#ifdef VOLUMEPROTECT_SHA256_MB_X86
+    Sha256Kernel kernel = ActiveSha256Kernel();
+    uint32_t lanes = SHA256MultiBufferLanes();
+    if (kernel == Sha256Kernel::NONE || count == 0 || count > lanes) {
+        return false;
+    }
+    // unused lanes hash a dummy message of the same length, results are dropped
+    uint32_t states[SHA256_AVX2_LANES][8];
+    const uint8_t* input[SHA256_AVX2_LANES];
+    for (uint32_t l = 0; l < lanes; ++l) {
+        ::memcpy(states[l], SHA256_IV, sizeof(SHA256_IV));
+        input[l] = data[l < count ? l : 0];
+    }
+    uint64_t fullBlocks = len / SHA256_BLOCK_LEN;
+    Sha256KernelBlocks(kernel, states, input, fullBlocks);
+    // tail and padding: 0x80, zeros, 64bits big endian bit length, 1 or 2 blocks
+    uint64_t tailLen = len % SHA256_BLOCK_LEN;
+    uint64_t paddedLen = (tailLen + 1 + 8 <= SHA256_BLOCK_LEN) ? SHA256_BLOCK_LEN : 2 * SHA256_BLOCK_LEN;
+    uint8_t tails[SHA256_AVX2_LANES][2 * SHA256_BLOCK_LEN];
+    uint64_t bitLen = len * 8;
+    for (uint32_t l = 0; l < lanes; ++l) {
+        ::memset(tails[l], 0, sizeof(tails[l]));
+        ::memcpy(tails[l], input[l] + fullBlocks * SHA256_BLOCK_LEN, static_cast<std::size_t>(tailLen));
+        tails[l][tailLen] = 0x80;
+        for (int i = 0; i < 8; ++i) {
+            tails[l][paddedLen - 1 - i] = static_cast<uint8_t>(bitLen >> (8 * i));
+        }
+        input[l] = tails[l];
+    }
+    Sha256KernelBlocks(kernel, states, input, paddedLen / SHA256_BLOCK_LEN);
+    for (uint32_t l = 0; l < count; ++l) {
+        for (int k = 0; k < 8; ++k) {
+            for (int i = 0; i < 4; ++i) {
+                output[l][4 * k + i] = static_cast<uint8_t>(states[l][k] >> (24 - 8 * i));
+            }
+        }
+    }
+    return true;
+#else
+    (void)data;
+    (void)len;
+    (void)output;
+    (void)count;
+    return false;
+#endif
+}
@@ -26,6 +26,15 @@ std::string common::GetChecksumBinPath(
     return common::PathJoin(copyMetaDirPath, filename);
 }
 
+std::string common::GetSubBlockChecksumBinPath(
+    const std::string&  copyMetaDirPath,
+    const std::string&  copyName,
+    int                 sessionIndex)
+{
+    std::string filename = copyName + "." + std::to_string(sessionIndex) + SUB_BLOCK_CHECKSUM_BINARY_FILENAME_EXTENSION;
+    return common::PathJoin(copyMetaDirPath, filename);
+}
+
 std::string common::GetCopyDataFilePath(
     const std::string&  copyDataDirPath,
     const std::string&  copyName,
@@ -59,6 +68,24 @@ std::string common::GetWriterBitmapFilePath(
     return common::PathJoin(checkpointDirPath, filename);
 }
 
+std::string common::GetCheckpointJournalFilePath(
+    const std::string&  checkpointDirPath,
+    const std::string&  copyName,
+    int                 sessionIndex)
+{
+    std::string filename = copyName + "." + std::to_string(sessionIndex) + CHECKPOINT_JOURNAL_FILENAME_EXTENSION;
+    return common::PathJoin(checkpointDirPath, filename);
+}
+
+std::string common::GetRestoredChecksumFilePath(
+    const std::string&  checkpointDirPath,
+    const std::string&  copyName,
+    int                 sessionIndex)
+{
+    std::string filename = copyName + "." + std::to_string(sessionIndex) + RESTORED_CHECKSUM_FILENAME_EXTENSION;
+    return common::PathJoin(checkpointDirPath, filename);
+}
+
 std::string common::GetFileName(const std::string& fullpath)
 {
     auto pos = fullpath.find_last_of("/\\");
@@ -0,0 +1,119 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "Logger.h"
+#include "common/VolumeProtectMacros.h"
+#include "native/ChangedBlockTracking.h"
+
+#ifdef __linux__
+#include "native/linux/DmEraChangedBlockProvider.h"
+#endif
+
+using namespace volumeprotect;
+using namespace volumeprotect::fsapi;
+using namespace volumeprotect::cbt;
+
+namespace {
+    // parse decimal or 0x prefixed hexadecimal number
+    bool ParseUInt64(const std::string& str, uint64_t& value)
+    {
+        if (str.empty() || str[0] == '-') {
+            return false;
+        }
+        try {
+            size_t pos = 0;
+            value = std::stoull(str, &pos, 0);
+            return pos == str.size();
+        } catch (const std::exception& e) {
+            return false;
+        }
+    }
+}
+
+std::unique_ptr<ChangedBlockProvider> ChangedBlockProvider::Build(ChangedBlockTracking type, const std::string& source)
+{
+    if (type == ChangedBlockTracking::FILE) {
+        return exstd::make_unique<FileChangedBlockProvider>(source);
+    }
+#ifdef __linux__
+    if (type == ChangedBlockTracking::DM_ERA) {
+        return exstd::make_unique<DmEraChangedBlockProvider>(source);
+    }
+#endif
+    WARNLOG("changed block tracking type %d not supported", static_cast<int>(type));
+    return nullptr;
+}
+
+void cbt::NormalizeExtents(std::vector<VolumeExtent>& extents)
+{
+    std::sort(extents.begin(), extents.end(),
+        [](const VolumeExtent& lhs, const VolumeExtent& rhs) { return lhs.offset < rhs.offset; });
+    std::vector<VolumeExtent> merged;
+    for (const VolumeExtent& extent : extents) {
+        if (extent.length == 0) {
+            continue;
+        }
+        if (!merged.empty() && merged.back().offset + merged.back().length >= extent.offset) {
+            merged.back().length = std::max(merged.back().offset + merged.back().length,
+                extent.offset + extent.length) - merged.back().offset;
+            continue;
+        }
+        merged.push_back(extent);
+    }
+    extents.swap(merged);
+}
+
+FileChangedBlockProvider::FileChangedBlockProvider(const std::string& filePath)
+    : m_filePath(filePath)
+{}
+
+std::string FileChangedBlockProvider::Name() const
+{
+    return "file";
+}
+
+bool FileChangedBlockProvider::CurrentToken(std::string& token)
+{
+    token.clear();
+    return true;
+}
+
+bool FileChangedBlockProvider::ListChangedExtents(
+    const std::string& sinceToken, std::vector<VolumeExtent>& changedExtents)
+{
+    std::ifstream file(m_filePath);
+    if (!file.is_open()) {
+        ERRLOG("failed to open changed range file %s", m_filePath.c_str());
+        return false;
+    }
+    changedExtents.clear();
+    std::string line;
+    uint64_t lineNum = 0;
+    while (std::getline(file, line)) {
+        ++lineNum;
+        std::istringstream lineStream(line);
+        std::string first;
+        if (!(lineStream >> first) || first[0] == '#') {
+            continue;
+        }
+        VolumeExtent extent {};
+        std::string second;
+        std::string trailing;
+        if (!ParseUInt64(first, extent.offset) || !(lineStream >> second) || !ParseUInt64(second, extent.length)
+            || (lineStream >> trailing)) {
+            ERRLOG("invalid changed range at line %llu of %s", lineNum, m_filePath.c_str());
+            return false;
+        }
+        changedExtents.push_back(extent);
+    }
+    NormalizeExtents(changedExtents);
+    INFOLOG("%llu changed extents loaded from %s", changedExtents.size(), m_filePath.c_str());
+    return true;
+}
@@ -22,6 +22,9 @@
 #include <sys/mount.h>
 #include <mntent.h>
 #include <linux/fs.h>
+#include <climits>
+#include <cstdlib>
+#include <set>
 #endif
 
 #ifdef _WIN32
@@ -55,6 +58,7 @@ using namespace volumeprotect::fsapi;
 namespace {
     constexpr auto DEFAULT_PROCESSORS_NUM = 4;
     constexpr auto DEFAULT_MKDIR_MASK = 0755;
+    constexpr auto MAX_SYSFS_SLAVES_DEPTH = 8;
 }
 
 #ifdef _WIN32
@@ -169,33 +173,44 @@ uint8_t* fsapi::ReadBinaryBuffer(const std::string& filepath, uint64_t length)
         WARNLOG("read empty binary file %s", filepath.c_str());
         return nullptr;
     }
+    uint8_t* buffer = new (std::nothrow) uint8_t[length];
+    if (buffer == nullptr) {
+        ERRLOG("failed to malloc buffer, size = %llu", length);
+        return nullptr;
+    }
+    if (!ReadBinaryBuffer(filepath, buffer, length)) {
+        delete[] buffer;
+        return nullptr;
+    }
+    return buffer;
+}
+
+bool fsapi::ReadBinaryBuffer(const std::string& filepath, uint8_t* buffer, uint64_t length)
+{
+    if (length == 0 || buffer == nullptr) {
+        WARNLOG("read empty binary file %s", filepath.c_str());
+        return false;
+    }
     try {
         std::ifstream binFile(filepath, std::ios::binary);
         if (!binFile.is_open()) {
             ERRLOG("bin file %s open failed, errno: %d", filepath.c_str(), errno);
-            return nullptr;
+            return false;
         }
-        uint8_t* buffer = new (std::nothrow) uint8_t[length];
         memset(buffer, 0, sizeof(uint8_t) * length);
-        if (buffer == nullptr) {
-            ERRLOG("failed to malloc buffer, size = %llu", length);
-            binFile.close();
-            return nullptr;
-        }
         binFile.read(reinterpret_cast<char*>(buffer), length);
         if (binFile.fail() && IsCritialReadError(binFile, filepath)) {
             ERRLOG("failed to read %llu bytes from %s", length, filepath.c_str());
-            delete[] buffer;
             binFile.close();
-            return nullptr;
+            return false;
         }
         binFile.close();
-        return buffer;
+        return true;
     } catch (const std::exception& e) {
         ERRLOG("failed to read checksum bin %s, exception %s", filepath.c_str(), e.what());
-        return nullptr;
+        return false;
     }
-    return nullptr;
+    return false;
 }
 
 /**
@@ -369,6 +384,62 @@ bool fsapi::RemoveFile(const std::string& filepath)
 #endif
 }
 
+bool fsapi::SyncFile(const std::string& filepath)
+{
+#ifdef POSIXAPI
+    int fd = ::open(filepath.c_str(), O_RDWR);
+    if (fd == -1) {
+        ERRLOG("failed to open file %s to sync, errno: %d", filepath.c_str(), errno);
+        return false;
+    }
+    bool success = (::fsync(fd) == 0);
+    if (!success) {
+        ERRLOG("failed to sync file %s, errno: %d", filepath.c_str(), errno);
+    }
+    ::close(fd);
+    return success;
+#endif
+#ifdef _WIN32
+    HANDLE hFile = CreateFileW(
+        Utf8ToUtf16(filepath).c_str(),
+        GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        ERRLOG("failed to open file %s to sync, error: %d", filepath.c_str(), ::GetLastError());
+        return false;
+    }
+    bool success = ::FlushFileBuffers(hFile);
+    if (!success) {
+        ERRLOG("failed to sync file %s, error: %d", filepath.c_str(), ::GetLastError());
+    }
+    ::CloseHandle(hFile);
+    return success;
+#endif
+}
+
+std::string fsapi::CanonicalPath(const std::string& path)
+{
+#ifdef POSIXAPI
+    char resolvedPath[PATH_MAX] = { '\0' };
+    if (::realpath(path.c_str(), resolvedPath) == nullptr) {
+        return path;
+    }
+    return std::string(resolvedPath);
+#endif
+#ifdef _WIN32
+    wchar_t resolvedPath[MAX_PATH] = { L'\0' };
+    DWORD length = ::GetFullPathNameW(Utf8ToUtf16(path).c_str(), MAX_PATH, resolvedPath, nullptr);
+    if (length == 0 || length >= MAX_PATH) {
+        return path;
+    }
+    return Utf16ToUtf8(std::wstring(resolvedPath, length));
+#endif
+}
+
 uint32_t fsapi::ProcessorsNum()
 {
 #ifdef POSIXAPI
@@ -402,4 +473,55 @@ uint64_t fsapi::ReadSectorSizeLinux(const std::string& devicePath)
     return sectorSize;
 }
 
+static std::string BaseName(const std::string& path)
+{
+    std::size_t pos = path.find_last_of('/');
+    return (pos == std::string::npos) ? path : path.substr(pos + 1);
+}
+
+static std::vector<std::string> ListDirectoryEntries(const std::string& dirPath)
+{
+    std::vector<std::string> entries;
+    DIR* dir = ::opendir(dirPath.c_str());
+    if (dir == nullptr) {
+        return entries;
+    }
+    struct dirent* entry = nullptr;
+    while ((entry = ::readdir(dir)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            entries.push_back(name);
+        }
+    }
+    ::closedir(dir);
+    return entries;
+}
+
+static void ResolveSysfsDisks(
+    const std::string& sysfsRoot, const std::string& blockName, int depth, std::set<std::string>& disks)
+{
+    std::string classDir = sysfsRoot + "/class/block/" + blockName;
+    std::vector<std::string> slaves = ListDirectoryEntries(classDir + "/slaves");
+    if (!slaves.empty() && depth < MAX_SYSFS_SLAVES_DEPTH) {
+        for (const std::string& slave : slaves) {
+            ResolveSysfsDisks(sysfsRoot, slave, depth + 1, disks);
+        }
+        return;
+    }
+    if (fsapi::IsFileExists(classDir + "/partition")) {
+        // partition directory is located under directory of the disk in /sys/devices
+        std::string devicePath = fsapi::CanonicalPath(classDir);
+        disks.insert(BaseName(devicePath.substr(0, devicePath.find_last_of('/'))));
+        return;
+    }
+    disks.insert(blockName);
+}
+
+std::vector<std::string> fsapi::ResolvePhysicalDisksLinux(const std::string& devicePath, const std::string& sysfsRoot)
+{
+    std::set<std::string> disks;
+    ResolveSysfsDisks(sysfsRoot, BaseName(fsapi::CanonicalPath(devicePath)), 0, disks);
+    return std::vector<std::string>(disks.begin(), disks.end());
+}
+
 #endif
\ No newline at end of file
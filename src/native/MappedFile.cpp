@@ -0,0 +1,284 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include "common/VolumeProtectMacros.h"
+
+#ifdef POSIXAPI
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <locale>
+#include <codecvt>
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#endif
+
+#include <vector>
+
+#include "Logger.h"
+#include "native/MappedFile.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::fsapi;
+
+namespace {
+    constexpr uint64_t BITS_PER_WORD = 64;
+#ifdef _WIN32
+    constexpr uint64_t WIN32_PAGE_SIZE = 4096;
+    constexpr int NUM32 = 32;
+#endif
+}
+
+#ifdef _WIN32
+static std::wstring Utf8ToUtf16(const std::string& str)
+{
+    using ConvertTypeX = std::codecvt_utf8_utf16<wchar_t>;
+    std::wstring_convert<ConvertTypeX> converterX;
+    std::wstring wstr = converterX.from_bytes(str);
+    return wstr;
+}
+#endif
+
+std::shared_ptr<MappedFile> MappedFile::Open(
+    const std::string& filepath, uint64_t size, bool writable, bool truncate)
+{
+    if (size == 0) {
+        ERRLOG("failed to map empty range of %s", filepath.c_str());
+        return nullptr;
+    }
+    std::shared_ptr<MappedFile> mappedFile(new MappedFile(filepath, size, writable));
+    if (!mappedFile->Map(truncate)) {
+        return nullptr;
+    }
+    DBGLOG("map %llu bytes of %s, writable %d", size, filepath.c_str(), writable);
+    return mappedFile;
+}
+
+MappedFile::MappedFile(const std::string& filepath, uint64_t size, bool writable)
+  : m_filepath(filepath), m_size(size), m_writable(writable)
+{}
+
+uint8_t* MappedFile::Ptr() const
+{
+    return m_ptr;
+}
+
+uint64_t MappedFile::Size() const
+{
+    return m_size;
+}
+
+void MappedFile::MarkDirty(uint64_t offset, uint64_t length)
+{
+    if (!m_writable || length == 0 || offset >= m_size) {
+        return;
+    }
+    uint64_t firstPage = offset / m_pageSize;
+    uint64_t lastPage = (std::min(offset + length, m_size) - 1) / m_pageSize;
+    for (uint64_t page = firstPage; page <= lastPage; ++page) {
+        uint64_t mask = 1ULL << (page % BITS_PER_WORD);
+        // skip the atomic write if already marked, pages of a table are marked by many blocks
+        if ((m_dirtyWords[page / BITS_PER_WORD].load(std::memory_order_relaxed) & mask) == 0) {
+            m_dirtyWords[page / BITS_PER_WORD].fetch_or(mask);
+        }
+    }
+}
+
+/**
+ * @brief pages marked are cleared before written back, pages modified and marked meanwhile are kept for next time,
+ *  adjacent dirty pages are merged into one range. Pages are marked again if failed, to be retried next time.
+ */
+bool MappedFile::Flush()
+{
+    if (!m_writable) {
+        return true;
+    }
+    uint64_t pageNum = (m_size + m_pageSize - 1) / m_pageSize;
+    uint64_t rangeBegin = 0;
+    uint64_t rangePages = 0;
+    uint64_t flushedPages = 0;
+    bool success = true;
+    std::vector<uint64_t> flushingWords(m_wordNum, 0);
+    for (uint64_t wordIndex = 0; wordIndex < m_wordNum; ++wordIndex) {
+        uint64_t word = (m_dirtyWords[wordIndex].load(std::memory_order_relaxed) == 0) ? 0 :
+            m_dirtyWords[wordIndex].exchange(0);
+        flushingWords[wordIndex] = word;
+        for (uint64_t bit = 0; bit < BITS_PER_WORD; ++bit) {
+            uint64_t page = wordIndex * BITS_PER_WORD + bit;
+            if (((word >> bit) & 1ULL) != 0) {
+                rangeBegin = (rangePages == 0) ? page : rangeBegin;
+                ++rangePages;
+                continue;
+            }
+            if (rangePages != 0) {
+                success = FlushRange(rangeBegin * m_pageSize, rangePages * m_pageSize) && success;
+                flushedPages += rangePages;
+                rangePages = 0;
+            }
+            if (word >> bit == 0) {
+                break;
+            }
+        }
+    }
+    if (rangePages != 0) {
+        success = FlushRange(rangeBegin * m_pageSize, rangePages * m_pageSize) && success;
+        flushedPages += rangePages;
+    }
+#ifdef _WIN32
+    success = success && ::FlushFileBuffers(m_fileHandle);
+#endif
+    if (!success) {
+        for (uint64_t wordIndex = 0; wordIndex < m_wordNum; ++wordIndex) {
+            if (flushingWords[wordIndex] != 0) {
+                m_dirtyWords[wordIndex].fetch_or(flushingWords[wordIndex]);
+            }
+        }
+        ERRLOG("failed to flush dirty pages of %s", m_filepath.c_str());
+        return false;
+    }
+    DBGLOG("flush %llu/%llu dirty pages of %s", flushedPages, pageNum, m_filepath.c_str());
+    return success;
+}
+
+#ifdef POSIXAPI
+MappedFile::~MappedFile()
+{
+    if (m_ptr != nullptr) {
+        ::munmap(m_ptr, m_size);
+        m_ptr = nullptr;
+    }
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool MappedFile::Map(bool truncate)
+{
+    int flags = m_writable ? (O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0)) : O_RDONLY;
+    m_fd = ::open(m_filepath.c_str(), flags, 0644);
+    if (m_fd == -1) {
+        ERRLOG("failed to open %s to map, errno %d", m_filepath.c_str(), errno);
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(m_fd, &st) != 0) {
+        ERRLOG("failed to stat %s, errno %d", m_filepath.c_str(), errno);
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(st.st_size);
+    if (!m_writable && fileSize < m_size) {
+        ERRLOG("file %s of %llu bytes is too small to map %llu bytes", m_filepath.c_str(), fileSize, m_size);
+        return false;
+    }
+    // grown part of the file reads as zero
+    if (m_writable && fileSize != m_size && ::ftruncate(m_fd, static_cast<off_t>(m_size)) != 0) {
+        ERRLOG("failed to resize %s to %llu bytes, errno %d", m_filepath.c_str(), m_size, errno);
+        return false;
+    }
+    int prot = m_writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* ptr = ::mmap(nullptr, m_size, prot, MAP_SHARED, m_fd, 0);
+    if (ptr == MAP_FAILED) {
+        ERRLOG("failed to map %llu bytes of %s, errno %d", m_size, m_filepath.c_str(), errno);
+        return false;
+    }
+    m_ptr = static_cast<uint8_t*>(ptr);
+    m_pageSize = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+    m_wordNum = ((m_size + m_pageSize - 1) / m_pageSize + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    m_dirtyWords.reset(new std::atomic<uint64_t>[m_wordNum]);
+    for (uint64_t i = 0; i < m_wordNum; ++i) {
+        m_dirtyWords[i].store(0);
+    }
+    return true;
+}
+
+bool MappedFile::FlushRange(uint64_t offset, uint64_t length)
+{
+    length = std::min(length, m_size - offset);
+    if (::msync(m_ptr + offset, length, MS_SYNC) != 0) {
+        ERRLOG("failed to msync range [%llu, %llu) of %s, errno %d",
+            offset, offset + length, m_filepath.c_str(), errno);
+        return false;
+    }
+    return true;
+}
+#endif
+
+#ifdef _WIN32
+MappedFile::~MappedFile()
+{
+    if (m_ptr != nullptr) {
+        ::UnmapViewOfFile(m_ptr);
+        m_ptr = nullptr;
+    }
+    if (m_mappingHandle != nullptr) {
+        ::CloseHandle(m_mappingHandle);
+        m_mappingHandle = nullptr;
+    }
+    if (m_fileHandle != nullptr && m_fileHandle != INVALID_HANDLE_VALUE) {
+        ::CloseHandle(m_fileHandle);
+        m_fileHandle = nullptr;
+    }
+}
+
+bool MappedFile::Map(bool truncate)
+{
+    DWORD access = m_writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+    DWORD disposition = m_writable ? (truncate ? CREATE_ALWAYS : OPEN_ALWAYS) : OPEN_EXISTING;
+    m_fileHandle = ::CreateFileW(Utf8ToUtf16(m_filepath).c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_fileHandle == INVALID_HANDLE_VALUE) {
+        ERRLOG("failed to open %s to map, error %d", m_filepath.c_str(), ::GetLastError());
+        return false;
+    }
+    LARGE_INTEGER fileSize {};
+    if (!::GetFileSizeEx(m_fileHandle, &fileSize)) {
+        ERRLOG("failed to get size of %s, error %d", m_filepath.c_str(), ::GetLastError());
+        return false;
+    }
+    if (!m_writable && static_cast<uint64_t>(fileSize.QuadPart) < m_size) {
+        ERRLOG("file %s of %llu bytes is too small to map %llu bytes", m_filepath.c_str(), fileSize.QuadPart, m_size);
+        return false;
+    }
+    // file is extended to the size of mapping, grown part reads as zero
+    m_mappingHandle = ::CreateFileMappingW(m_fileHandle, nullptr, m_writable ? PAGE_READWRITE : PAGE_READONLY,
+        static_cast<DWORD>(m_size >> NUM32), static_cast<DWORD>(m_size & 0xFFFFFFFF), nullptr);
+    if (m_mappingHandle == nullptr) {
+        ERRLOG("failed to create mapping of %s, error %d", m_filepath.c_str(), ::GetLastError());
+        return false;
+    }
+    m_ptr = static_cast<uint8_t*>(::MapViewOfFile(m_mappingHandle,
+        m_writable ? (FILE_MAP_READ | FILE_MAP_WRITE) : FILE_MAP_READ, 0, 0, m_size));
+    if (m_ptr == nullptr) {
+        ERRLOG("failed to map %llu bytes of %s, error %d", m_size, m_filepath.c_str(), ::GetLastError());
+        return false;
+    }
+    m_pageSize = WIN32_PAGE_SIZE;
+    m_wordNum = ((m_size + m_pageSize - 1) / m_pageSize + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    m_dirtyWords.reset(new std::atomic<uint64_t>[m_wordNum]);
+    for (uint64_t i = 0; i < m_wordNum; ++i) {
+        m_dirtyWords[i].store(0);
+    }
+    return true;
+}
+
+bool MappedFile::FlushRange(uint64_t offset, uint64_t length)
+{
+    length = std::min(length, m_size - offset);
+    if (!::FlushViewOfFile(m_ptr + offset, static_cast<SIZE_T>(length))) {
+        ERRLOG("failed to flush range [%llu, %llu) of %s, error %d",
+            offset, offset + length, m_filepath.c_str(), ::GetLastError());
+        return false;
+    }
+    return true;
+}
+#endif
@@ -30,8 +30,72 @@ using OsPlatformRawDataReader = rawio::posix::PosixRawDataReader;
 using OsPlatformRawDataWriter = rawio::posix::PosixRawDataWriter;
 #endif
 
+#ifdef VOLUMEPROTECT_IO_URING
+#include "linux/IOUringRawIO.h"
+#endif
+
 namespace {
     constexpr auto DUMMY_SESSION_INDEX = 999;
+
+// build async reader if I/O engine specified is supported, otherwise fallback to OsPlatformRawDataReader,
+// return nullptr if cache mode specified can't be applied to the async reader
+std::shared_ptr<RawDataReader> OpenOsPlatformRawDataReader(
+    const std::string& path, int flag, uint64_t shiftOffset, const RawIOOption& option)
+{
+#ifdef VOLUMEPROTECT_IO_URING
+    if (option.ioEngine == IOEngine::IO_URING) {
+        if (option.cacheMode != IOCacheMode::BUFFERED) {
+            ERRLOG("cache mode %d is not supported by io_uring reader", static_cast<int>(option.cacheMode));
+            return nullptr;
+        }
+        auto asyncReader = std::make_shared<rawio::posix::IOUringRawDataReader>(
+            path, option.queueDepth, flag, shiftOffset);
+        if (asyncReader->Ok()) {
+            return asyncReader;
+        }
+        WARNLOG("failed to init io_uring reader for %s, error = %u, fallback to sync I/O",
+            path.c_str(), asyncReader->Error());
+    }
+#endif
+    if (option.ioEngine != IOEngine::SYNC) {
+        DBGLOG("I/O engine %d not supported for reader, use sync I/O", static_cast<int>(option.ioEngine));
+    }
+#ifdef POSIXAPI
+    return std::make_shared<OsPlatformRawDataReader>(path, flag, shiftOffset, option.cacheMode);
+#else
+    return std::make_shared<OsPlatformRawDataReader>(path, flag, shiftOffset);
+#endif
+}
+
+// build async writer if I/O engine specified is supported, otherwise fallback to OsPlatformRawDataWriter,
+// return nullptr if cache mode specified can't be applied to the async writer
+std::shared_ptr<RawDataWriter> OpenOsPlatformRawDataWriter(
+    const std::string& path, int flag, uint64_t shiftOffset, const RawIOOption& option)
+{
+#ifdef VOLUMEPROTECT_IO_URING
+    if (option.ioEngine == IOEngine::IO_URING) {
+        if (option.cacheMode != IOCacheMode::BUFFERED) {
+            ERRLOG("cache mode %d is not supported by io_uring writer", static_cast<int>(option.cacheMode));
+            return nullptr;
+        }
+        auto asyncWriter = std::make_shared<rawio::posix::IOUringRawDataWriter>(
+            path, option.queueDepth, flag, shiftOffset);
+        if (asyncWriter->Ok()) {
+            return asyncWriter;
+        }
+        WARNLOG("failed to init io_uring writer for %s, error = %u, fallback to sync I/O",
+            path.c_str(), asyncWriter->Error());
+    }
+#endif
+    if (option.ioEngine != IOEngine::SYNC) {
+        DBGLOG("I/O engine %d not supported for writer, use sync I/O", static_cast<int>(option.ioEngine));
+    }
+#ifdef POSIXAPI
+    return std::make_shared<OsPlatformRawDataWriter>(path, flag, shiftOffset, option.cacheMode);
+#else
+    return std::make_shared<OsPlatformRawDataWriter>(path, flag, shiftOffset);
+#endif
+}
 }
 
 std::shared_ptr<rawio::RawDataReader> rawio::OpenRawDataCopyReader(const SessionCopyRawIOParam& param)
@@ -41,10 +105,10 @@ std::shared_ptr<rawio::RawDataReader> rawio::OpenRawDataCopyReader(const Session
 
     switch (static_cast<int>(copyFormat)) {
         case static_cast<int>(CopyFormat::BIN): {
-            return std::make_shared<OsPlatformRawDataReader>(copyFilePath, -1, param.volumeOffset);
+            return OpenOsPlatformRawDataReader(copyFilePath, -1, param.volumeOffset, param.ioOption);
         }
         case static_cast<int>(CopyFormat::IMAGE): {
-            return std::make_shared<OsPlatformRawDataReader>(copyFilePath, 0, 0);
+            return OpenOsPlatformRawDataReader(copyFilePath, 0, 0, param.ioOption);
         }
 #ifdef _WIN32
         case static_cast<int>(CopyFormat::VHD_FIXED):
@@ -68,10 +132,10 @@ std::shared_ptr<RawDataWriter> rawio::OpenRawDataCopyWriter(const SessionCopyRaw
 
     switch (static_cast<int>(copyFormat)) {
         case static_cast<int>(CopyFormat::BIN): {
-            return std::make_shared<OsPlatformRawDataWriter>(copyFilePath, -1, param.volumeOffset);
+            return OpenOsPlatformRawDataWriter(copyFilePath, -1, param.volumeOffset, param.ioOption);
         }
         case static_cast<int>(CopyFormat::IMAGE): {
-            return std::make_shared<OsPlatformRawDataWriter>(copyFilePath, 0, 0);
+            return OpenOsPlatformRawDataWriter(copyFilePath, 0, 0, param.ioOption);
         }
 #ifdef _WIN32
         case static_cast<int>(CopyFormat::VHD_FIXED):
@@ -92,7 +156,19 @@ std::shared_ptr<RawDataReader> rawio::OpenRawDataVolumeReader(const std::string&
     return std::make_shared<OsPlatformRawDataReader>(volumePath, 0, 0);
 }
 
+std::shared_ptr<RawDataReader> rawio::OpenRawDataVolumeReader(
+    const std::string& volumePath, const RawIOOption& option)
+{
+    return OpenOsPlatformRawDataReader(volumePath, 0, 0, option);
+}
+
 std::shared_ptr<RawDataWriter> rawio::OpenRawDataVolumeWriter(const std::string& volumePath)
 {
     return std::make_shared<OsPlatformRawDataWriter>(volumePath, 0, 0);
+}
+
+std::shared_ptr<RawDataWriter> rawio::OpenRawDataVolumeWriter(
+    const std::string& volumePath, const RawIOOption& option)
+{
+    return OpenOsPlatformRawDataWriter(volumePath, 0, 0, option);
 }
\ No newline at end of file
@@ -53,6 +53,7 @@ static std::vector<std::pair<std::string, uint64_t>> SplitFragmentBinaryBackupCo
         std::string fragmentFilePath = common::GetCopyDataFilePath(
             copyDataDirPath, copyName, CopyFormat::BIN, sessionIndex);
         fragmentFiles.emplace_back(fragmentFilePath, sessionSize);
+        ++sessionIndex;
     }
     return fragmentFiles;
 }
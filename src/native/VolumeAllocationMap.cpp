@@ -0,0 +1,50 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include "Logger.h"
+#include "common/VolumeProtectMacros.h"
+#include "native/RawIO.h"
+#include "native/VolumeAllocationMap.h"
+
+#ifdef __linux__
+#include "native/linux/BlockProbeUtils.h"
+#include "native/linux/LinuxAllocationMapProvider.h"
+#endif
+
+using namespace volumeprotect;
+using namespace volumeprotect::fsapi;
+
+std::unique_ptr<AllocationMapProvider> AllocationMapProvider::Build(const std::string& volumePath)
+{
+    std::shared_ptr<rawio::RawDataReader> dataReader = rawio::OpenRawDataVolumeReader(volumePath);
+    if (dataReader == nullptr || !dataReader->Ok()) {
+        ERRLOG("failed to open %s to read allocation map", volumePath.c_str());
+        return nullptr;
+    }
+#ifdef __linux__
+    std::string fsType = linuxmountutil::BlockProbeLookup(volumePath, linuxmountutil::BLKID_PROBE_TAG_TYPE);
+    INFOLOG("volume %s filesystem type: %s", volumePath.c_str(), fsType.c_str());
+    if (fsType == "ext2" || fsType == "ext3" || fsType == "ext4") {
+        return exstd::make_unique<Ext4AllocationMapProvider>(dataReader);
+    }
+    if (fsType == "xfs") {
+        return exstd::make_unique<XfsAllocationMapProvider>(dataReader);
+    }
+#endif
+    WARNLOG("allocation map of volume %s not supported, use generic provider", volumePath.c_str());
+    return exstd::make_unique<GenericAllocationMapProvider>();
+}
+
+std::string GenericAllocationMapProvider::FileSystemType() const
+{
+    return "";
+}
+
+bool GenericAllocationMapProvider::ListFreeExtents(std::vector<VolumeExtent>& freeExtents)
+{
+    freeExtents.clear();
+    return true;
+}
@@ -41,6 +41,8 @@ namespace {
     const std::string DM_DEVICE_UUID_PATH_PREFIX = "/dev/mapper/by-uuid/";
     const std::string DM_DEVICE_PATH_PREFIX = "/dev/dm-";
     const int UUID_BUFFER_MAX = 36 + 1; // 36bytes uuid with 1 \0 terminator
+    const uint32_t DM_STATUS_BUFFER_SIZE = 16 * 1024;
+    const uint32_t DM_STATUS_BUFFER_MAX = 1024 * 1024;
 };
 
 static int DM_ALIGN(int x)
@@ -403,4 +405,72 @@ bool devicemapper::GetDevicePathByName(const std::string& name, std::string& dmD
     return true;
 }
 
-#endif
\ No newline at end of file
+bool devicemapper::GetTableStatus(const std::string& name, bool tableParams, std::vector<DmTargetStatus>& targets)
+{
+    int dmControlFd = GetDmControlFd();
+    if (dmControlFd < 0) {
+        return false;
+    }
+    // retry with a larger buffer if the status of all targets can not be filled in
+    for (uint32_t bufferSize = DM_STATUS_BUFFER_SIZE; bufferSize <= DM_STATUS_BUFFER_MAX; bufferSize *= 2) {
+        std::string ioctlBuffer(bufferSize, 0);
+        struct dm_ioctl* io = reinterpret_cast<struct dm_ioctl*>(&ioctlBuffer[0]);
+        InitDmIoctlStruct(*io, name);
+        io->data_size = bufferSize;
+        io->data_start = sizeof(struct dm_ioctl);
+        if (tableParams) {
+            io->flags |= DM_STATUS_TABLE_FLAG;
+        }
+        if (::ioctl(dmControlFd, DM_TABLE_STATUS, io) < 0) {
+            ::close(dmControlFd);
+            return false;
+        }
+        if ((io->flags & DM_BUFFER_FULL_FLAG) != 0) {
+            continue;
+        }
+        targets.clear();
+        uint32_t cursor = io->data_start;
+        for (uint32_t i = 0; i < io->target_count; ++i) {
+            if (cursor + sizeof(struct dm_target_spec) > io->data_size) {
+                ::close(dmControlFd);
+                return false;
+            }
+            const struct dm_target_spec* spec = reinterpret_cast<const struct dm_target_spec*>(&ioctlBuffer[cursor]);
+            DmTargetStatus status {};
+            status.startSector = spec->sector_start;
+            status.sectorsCount = spec->length;
+            status.targetType = std::string(spec->target_type, ::strnlen(spec->target_type, DM_MAX_TYPE_NAME));
+            status.params = std::string(&ioctlBuffer[cursor + sizeof(struct dm_target_spec)]);
+            targets.push_back(status);
+            // 'next' of the spec returned by DM_TABLE_STATUS is relative to the start of data
+            cursor = io->data_start + spec->next;
+        }
+        ::close(dmControlFd);
+        return true;
+    }
+    ::close(dmControlFd);
+    return false;
+}
+
+bool devicemapper::SendMessage(const std::string& name, const std::string& message, uint64_t sector)
+{
+    int dmControlFd = GetDmControlFd();
+    if (dmControlFd < 0) {
+        return false;
+    }
+    std::string ioctlBuffer(sizeof(struct dm_ioctl) + sizeof(struct dm_target_msg), 0);
+    ioctlBuffer += message;
+    ioctlBuffer.push_back('\0');
+    ioctlBuffer.resize(DM_ALIGN(ioctlBuffer.size()), '\0');
+    struct dm_ioctl* io = reinterpret_cast<struct dm_ioctl*>(&ioctlBuffer[0]);
+    InitDmIoctlStruct(*io, name);
+    io->data_size = ioctlBuffer.size();
+    io->data_start = sizeof(struct dm_ioctl);
+    struct dm_target_msg* msg = reinterpret_cast<struct dm_target_msg*>(&ioctlBuffer[sizeof(struct dm_ioctl)]);
+    msg->sector = sector;
+    bool ret = ::ioctl(dmControlFd, DM_TARGET_MSG, io) == 0;
+    ::close(dmControlFd);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,348 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifdef __linux__
+
+#include <sstream>
+
+#include "Logger.h"
+#include "common/VolumeProtectMacros.h"
+#include "native/linux/DeviceMapperControl.h"
+#include "native/linux/DmEraChangedBlockProvider.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::fsapi;
+using namespace volumeprotect::cbt;
+
+namespace {
+    // dm-era on-disk layout, all fields are little endian
+    const uint64_t ERA_SUPERBLOCK_LOCATION = 0;
+    const uint32_t ERA_METADATA_BLOCK_SIZE = 4096;
+    const uint32_t ERA_METADATA_BLOCK_SECTORS = ERA_METADATA_BLOCK_SIZE / 512;
+    const uint64_t ERA_SUPERBLOCK_MAGIC = 2126579579;
+    const uint32_t ERA_SB_MAGIC_OFFSET = 32;
+    const uint32_t ERA_SB_DATA_BLOCK_SIZE_OFFSET = 172;
+    const uint32_t ERA_SB_METADATA_BLOCK_SIZE_OFFSET = 176;
+    const uint32_t ERA_SB_NR_BLOCKS_OFFSET = 180;
+    const uint32_t ERA_SB_CURRENT_ERA_OFFSET = 184;
+    const uint32_t ERA_SB_WRITESET_TREE_ROOT_OFFSET = 200;
+    const uint32_t ERA_SB_ERA_ARRAY_ROOT_OFFSET = 208;
+    const uint32_t ERA_SB_METADATA_SNAP_OFFSET = 216;
+    const uint32_t ERA_WRITESET_VALUE_SIZE = 12;        // packed { __le32 nr_bits; __le64 root; }
+    const uint32_t ERA_ARRAY_VALUE_SIZE = 4;            // __le32 era
+    const uint32_t ERA_BITSET_WORD_SIZE = 8;            // bitset is an array of __le64
+    const uint32_t ERA_BITSET_WORD_BITS = 64;
+
+    // persistent-data btree and array
+    const uint32_t BTREE_NODE_HEADER_SIZE = 32;
+    const uint32_t BTREE_INTERNAL_NODE = 1;
+    const uint32_t BTREE_LEAF_NODE = 2;
+    const uint32_t BTREE_KEY_SIZE = 8;
+    const uint32_t BTREE_MAX_DEPTH = 16;
+    const uint32_t ARRAY_BLOCK_HEADER_SIZE = 24;
+
+    const uint32_t SECTOR_SIZE = 512;
+    const std::string DEV_BLOCK_PATH_PREFIX = "/dev/block/";
+
+    inline uint32_t LE32(const uint8_t* p)
+    {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+            (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    inline uint64_t LE64(const uint8_t* p)
+    {
+        return static_cast<uint64_t>(LE32(p)) | (static_cast<uint64_t>(LE32(p + 4)) << 32);
+    }
+
+    bool ParseEra(const std::string& str, uint32_t& era)
+    {
+        try {
+            size_t pos = 0;
+            unsigned long value = std::stoul(str, &pos);
+            if (pos != str.size() || value > UINT32_MAX) {
+                return false;
+            }
+            era = static_cast<uint32_t>(value);
+            return true;
+        } catch (const std::exception& e) {
+            return false;
+        }
+    }
+
+    // dm-era with single target mapping the whole device is required
+    bool GetEraTarget(const std::string& dmName, bool tableParams, devicemapper::DmTargetStatus& target)
+    {
+        std::vector<devicemapper::DmTargetStatus> targets;
+        if (!devicemapper::GetTableStatus(dmName, tableParams, targets)) {
+            ERRLOG("failed to get status of dm device %s", dmName.c_str());
+            return false;
+        }
+        if (targets.size() != 1 || targets[0].targetType != "era" || targets[0].startSector != 0) {
+            ERRLOG("dm device %s is not a single era target", dmName.c_str());
+            return false;
+        }
+        target = targets[0];
+        return true;
+    }
+}
+
+// implement DmEraMetadataParser
+DmEraMetadataParser::DmEraMetadataParser(std::shared_ptr<rawio::RawDataReader> metadataReader)
+    : m_metadataReader(metadataReader)
+{}
+
+bool DmEraMetadataParser::ReadMetadataBlock(uint64_t blocknr, std::vector<uint8_t>& block)
+{
+    ErrCodeType errorCode = 0;
+    block.resize(ERA_METADATA_BLOCK_SIZE);
+    if (!m_metadataReader->Read(blocknr * ERA_METADATA_BLOCK_SIZE, block.data(),
+        static_cast<int>(ERA_METADATA_BLOCK_SIZE), errorCode)) {
+        ERRLOG("failed to read era metadata block %llu, error = %u", blocknr, errorCode);
+        return false;
+    }
+    return true;
+}
+
+bool DmEraMetadataParser::ReadSuperBlock(uint64_t blocknr, SuperBlock& superBlock)
+{
+    std::vector<uint8_t> sb;
+    if (!ReadMetadataBlock(blocknr, sb)) {
+        return false;
+    }
+    if (LE64(&sb[ERA_SB_MAGIC_OFFSET]) != ERA_SUPERBLOCK_MAGIC) {
+        ERRLOG("invalid era superblock magic %llu at block %llu", LE64(&sb[ERA_SB_MAGIC_OFFSET]), blocknr);
+        return false;
+    }
+    if (LE32(&sb[ERA_SB_METADATA_BLOCK_SIZE_OFFSET]) != ERA_METADATA_BLOCK_SECTORS) {
+        ERRLOG("unsupported era metadata block size %u", LE32(&sb[ERA_SB_METADATA_BLOCK_SIZE_OFFSET]));
+        return false;
+    }
+    superBlock.dataBlockSize = LE32(&sb[ERA_SB_DATA_BLOCK_SIZE_OFFSET]);
+    superBlock.nrBlocks = LE32(&sb[ERA_SB_NR_BLOCKS_OFFSET]);
+    superBlock.currentEra = LE32(&sb[ERA_SB_CURRENT_ERA_OFFSET]);
+    superBlock.writesetTreeRoot = LE64(&sb[ERA_SB_WRITESET_TREE_ROOT_OFFSET]);
+    superBlock.eraArrayRoot = LE64(&sb[ERA_SB_ERA_ARRAY_ROOT_OFFSET]);
+    superBlock.metadataSnap = LE64(&sb[ERA_SB_METADATA_SNAP_OFFSET]);
+    if (superBlock.dataBlockSize == 0) {
+        ERRLOG("invalid era data block size 0");
+        return false;
+    }
+    return true;
+}
+
+bool DmEraMetadataParser::WalkBtree(uint64_t blocknr, uint32_t valueSize, uint32_t depth, const BtreeVisitor& visitor)
+{
+    if (depth > BTREE_MAX_DEPTH) {
+        ERRLOG("btree too deep at block %llu", blocknr);
+        return false;
+    }
+    std::vector<uint8_t> node;
+    if (!ReadMetadataBlock(blocknr, node)) {
+        return false;
+    }
+    uint32_t flags = LE32(&node[4]);
+    uint32_t nrEntries = LE32(&node[16]);
+    uint32_t maxEntries = LE32(&node[20]);
+    uint32_t nodeValueSize = LE32(&node[24]);
+    bool isLeaf = (flags & BTREE_LEAF_NODE) != 0;
+    uint32_t expectedValueSize = isLeaf ? valueSize : BTREE_KEY_SIZE;
+    if ((flags & (BTREE_INTERNAL_NODE | BTREE_LEAF_NODE)) == 0 || nodeValueSize != expectedValueSize ||
+        nrEntries > maxEntries ||
+        BTREE_NODE_HEADER_SIZE + static_cast<uint64_t>(maxEntries) * (BTREE_KEY_SIZE + nodeValueSize)
+            > ERA_METADATA_BLOCK_SIZE) {
+        ERRLOG("invalid btree node %llu, flags %u, entries %u/%u, value size %u",
+            blocknr, flags, nrEntries, maxEntries, nodeValueSize);
+        return false;
+    }
+    const uint8_t* keys = &node[BTREE_NODE_HEADER_SIZE];
+    const uint8_t* values = keys + static_cast<uint64_t>(maxEntries) * BTREE_KEY_SIZE;
+    for (uint32_t i = 0; i < nrEntries; ++i) {
+        const uint8_t* value = values + static_cast<uint64_t>(i) * nodeValueSize;
+        if (isLeaf) {
+            if (!visitor(LE64(keys + i * BTREE_KEY_SIZE), value)) {
+                return false;
+            }
+        } else if (!WalkBtree(LE64(value), valueSize, depth + 1, visitor)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// array is a btree mapping block index to array blocks, visitor is called with index of each entry
+bool DmEraMetadataParser::WalkArray(uint64_t root, uint32_t valueSize, const BtreeVisitor& visitor)
+{
+    return WalkBtree(root, BTREE_KEY_SIZE, 0, [&](uint64_t arrayBlockIndex, const uint8_t* value) {
+        std::vector<uint8_t> arrayBlock;
+        if (!ReadMetadataBlock(LE64(value), arrayBlock)) {
+            return false;
+        }
+        uint32_t maxEntries = LE32(&arrayBlock[4]);
+        uint32_t nrEntries = LE32(&arrayBlock[8]);
+        uint32_t blockValueSize = LE32(&arrayBlock[12]);
+        if (blockValueSize != valueSize || nrEntries > maxEntries ||
+            ARRAY_BLOCK_HEADER_SIZE + static_cast<uint64_t>(maxEntries) * valueSize > ERA_METADATA_BLOCK_SIZE) {
+            ERRLOG("invalid array block %llu, entries %u/%u, value size %u",
+                LE64(value), nrEntries, maxEntries, blockValueSize);
+            return false;
+        }
+        for (uint32_t i = 0; i < nrEntries; ++i) {
+            if (!visitor(arrayBlockIndex * maxEntries + i, &arrayBlock[ARRAY_BLOCK_HEADER_SIZE + i * valueSize])) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+bool DmEraMetadataParser::ListChangedExtents(uint32_t sinceEra, std::vector<VolumeExtent>& changedExtents)
+{
+    SuperBlock superBlock {};
+    if (!ReadSuperBlock(ERA_SUPERBLOCK_LOCATION, superBlock)) {
+        return false;
+    }
+    if (superBlock.metadataSnap == ERA_SUPERBLOCK_LOCATION) {
+        ERRLOG("era metadata snapshot not taken");
+        return false;
+    }
+    SuperBlock snapshot {};
+    if (!ReadSuperBlock(superBlock.metadataSnap, snapshot)) {
+        return false;
+    }
+    INFOLOG("era metadata snapshot at block %llu, current era %u, blocks %u, block size %u sectors",
+        superBlock.metadataSnap, snapshot.currentEra, snapshot.nrBlocks, snapshot.dataBlockSize);
+    std::vector<bool> changed(snapshot.nrBlocks, false);
+    // 1. writesets archived but not digested yet
+    auto visitWriteset = [&](uint64_t era, const uint8_t* value) {
+        if (era < sinceEra) {
+            return true;
+        }
+        uint32_t nrBits = std::min(LE32(value), snapshot.nrBlocks);
+        auto visitWord = [&](uint64_t index, const uint8_t* word) {
+            uint64_t bits = LE64(word);
+            for (uint64_t bit = 0; bits != 0 && bit < ERA_BITSET_WORD_BITS; ++bit, bits >>= 1) {
+                uint64_t block = index * ERA_BITSET_WORD_BITS + bit;
+                if ((bits & 1) != 0 && block < nrBits) {
+                    changed[block] = true;
+                }
+            }
+            return true;
+        };
+        return WalkArray(LE64(value + sizeof(uint32_t)), ERA_BITSET_WORD_SIZE, visitWord);
+    };
+    bool ret = WalkBtree(snapshot.writesetTreeRoot, ERA_WRITESET_VALUE_SIZE, 0, visitWriteset);
+    // 2. era of the last write of each block, digested from writesets
+    ret = ret && WalkArray(snapshot.eraArrayRoot, ERA_ARRAY_VALUE_SIZE, [&](uint64_t block, const uint8_t* value) {
+        if (block < snapshot.nrBlocks && LE32(value) >= sinceEra) {
+            changed[block] = true;
+        }
+        return true;
+    });
+    if (!ret) {
+        ERRLOG("failed to walk era metadata snapshot");
+        return false;
+    }
+    changedExtents.clear();
+    uint64_t blockBytes = static_cast<uint64_t>(snapshot.dataBlockSize) * SECTOR_SIZE;
+    for (uint64_t block = 0; block < snapshot.nrBlocks; ++block) {
+        if (!changed[block]) {
+            continue;
+        }
+        uint64_t offset = block * blockBytes;
+        if (!changedExtents.empty() && changedExtents.back().offset + changedExtents.back().length == offset) {
+            changedExtents.back().length += blockBytes;
+        } else {
+            changedExtents.push_back(VolumeExtent { offset, blockBytes });
+        }
+    }
+    return true;
+}
+
+// implement DmEraChangedBlockProvider
+DmEraChangedBlockProvider::DmEraChangedBlockProvider(const std::string& dmName)
+    : m_dmName(dmName)
+{}
+
+std::string DmEraChangedBlockProvider::Name() const
+{
+    return "dm-era";
+}
+
+// status of era target: <metadata block size> <#used metadata blocks>/<#total> <current era> <held root | ->
+bool DmEraChangedBlockProvider::CurrentToken(std::string& token)
+{
+    devicemapper::DmTargetStatus target {};
+    if (!GetEraTarget(m_dmName, false, target)) {
+        return false;
+    }
+    std::istringstream statusStream(target.params);
+    std::string metadataBlockSize;
+    std::string usage;
+    std::string currentEra;
+    uint32_t era = 0;
+    if (!(statusStream >> metadataBlockSize >> usage >> currentEra) || !ParseEra(currentEra, era)) {
+        ERRLOG("invalid era status %s of dm device %s", target.params.c_str(), m_dmName.c_str());
+        return false;
+    }
+    token = std::to_string(era);
+    return true;
+}
+
+// table params of era target: <metadata dev> <origin dev> <block size>, device is formated as major:minor
+bool DmEraChangedBlockProvider::GetMetadataDevicePath(std::string& metadataDevicePath) const
+{
+    devicemapper::DmTargetStatus target {};
+    if (!GetEraTarget(m_dmName, true, target)) {
+        return false;
+    }
+    std::istringstream tableStream(target.params);
+    std::string metadataDevice;
+    if (!(tableStream >> metadataDevice) || metadataDevice.find(':') == std::string::npos) {
+        ERRLOG("invalid era table %s of dm device %s", target.params.c_str(), m_dmName.c_str());
+        return false;
+    }
+    metadataDevicePath = DEV_BLOCK_PATH_PREFIX + metadataDevice;
+    return true;
+}
+
+bool DmEraChangedBlockProvider::ListChangedExtents(
+    const std::string& sinceToken, std::vector<VolumeExtent>& changedExtents)
+{
+    uint32_t sinceEra = 0;
+    if (!ParseEra(sinceToken, sinceEra)) {
+        ERRLOG("invalid era token \"%s\"", sinceToken.c_str());
+        return false;
+    }
+    std::string metadataDevicePath;
+    if (!GetMetadataDevicePath(metadataDevicePath)) {
+        return false;
+    }
+    // metadata is written by kernel bypassing page cache of the metadata device, so read it with direct I/O
+    std::shared_ptr<rawio::RawDataReader> metadataReader = rawio::OpenRawDataVolumeReader(metadataDevicePath,
+        rawio::RawIOOption { IOEngine::SYNC, 1, IOCacheMode::DIRECT });
+    if (metadataReader == nullptr || !metadataReader->Ok()) {
+        ERRLOG("failed to open era metadata device %s", metadataDevicePath.c_str());
+        return false;
+    }
+    // snapshot may be left by a crashed backup, only one snapshot can be held at the same time
+    if (!devicemapper::SendMessage(m_dmName, "take_metadata_snap")) {
+        WARNLOG("failed to take era metadata snapshot of %s, drop the stale one and retry", m_dmName.c_str());
+        if (!devicemapper::SendMessage(m_dmName, "drop_metadata_snap") ||
+            !devicemapper::SendMessage(m_dmName, "take_metadata_snap")) {
+            ERRLOG("failed to take era metadata snapshot of %s", m_dmName.c_str());
+            return false;
+        }
+    }
+    DmEraMetadataParser parser(metadataReader);
+    bool ret = parser.ListChangedExtents(sinceEra, changedExtents);
+    if (!devicemapper::SendMessage(m_dmName, "drop_metadata_snap")) {
+        WARNLOG("failed to drop era metadata snapshot of %s", m_dmName.c_str());
+    }
+    return ret;
+}
+
+#endif
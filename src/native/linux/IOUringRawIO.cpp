@@ -0,0 +1,520 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include "RawIO.h"
+#include "common/VolumeProtectMacros.h"
+
+#if defined(POSIXAPI) && defined(VOLUMEPROTECT_IO_URING)
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "Logger.h"
+#include "linux/IOUringRawIO.h"
+#include "linux/PosixRawIO.h"
+
+namespace {
+    const int INVALID_POSIX_FD_VALUE = -1;
+    const uint32_t MAX_IO_URING_QUEUE_DEPTH = 4096;
+}
+
+using namespace volumeprotect;
+using namespace volumeprotect::rawio;
+using namespace volumeprotect::rawio::posix;
+
+namespace volumeprotect {
+namespace rawio {
+namespace posix {
+
+/**
+ * @brief Minimal io_uring wrapper using raw syscall, no liburing dependency.
+ *  Each request occupies a slot until it's reaped, short read/write will be resubmitted for the remaining bytes.
+ */
+class IOUringQueue {
+public:
+    explicit IOUringQueue(uint32_t queueDepth);
+    ~IOUringQueue();
+    bool Ok() const;
+    ErrCodeType Error() const;
+    bool Submit(uint8_t opcode, int fd, uint64_t key, uint64_t offset, uint8_t* buffer, int length,
+        ErrCodeType& errorCode);
+    bool Reap(AsyncIOResult& result, bool wait);
+    uint32_t InFlight() const;
+    uint32_t QueueDepth() const;
+
+private:
+    struct Request {
+        uint8_t     opcode;
+        int         fd;
+        uint64_t    key;
+        uint64_t    offset;
+        uint8_t*    buffer;
+        uint32_t    length;
+        uint32_t    transferred;
+    };
+
+    bool Setup();
+    void PrepareEntry(uint32_t slot);
+    bool Enter(uint32_t minComplete, ErrCodeType& errorCode);
+    bool CompleteEntry(const struct io_uring_cqe& cqe, AsyncIOResult& result);
+    void ReleaseSlot(uint32_t slot);
+
+private:
+    int                     m_ringFd        { INVALID_POSIX_FD_VALUE };
+    ErrCodeType             m_error         { 0 };
+    uint32_t                m_queueDepth    { 0 };
+    uint32_t                m_unsubmitted   { 0 };  // entries queued to sq ring but not submitted yet
+    // mmaped ring buffers
+    void*                   m_sqRingPtr     { MAP_FAILED };
+    size_t                  m_sqRingSize    { 0 };
+    void*                   m_cqRingPtr     { MAP_FAILED };
+    size_t                  m_cqRingSize    { 0 };
+    struct io_uring_sqe*    m_sqes          { static_cast<struct io_uring_sqe*>(MAP_FAILED) };
+    size_t                  m_sqesSize      { 0 };
+    uint32_t*               m_sqTail        { nullptr };
+    uint32_t*               m_sqMask        { nullptr };
+    uint32_t*               m_sqArray       { nullptr };
+    uint32_t*               m_cqHead        { nullptr };
+    uint32_t*               m_cqTail        { nullptr };
+    uint32_t*               m_cqMask        { nullptr };
+    struct io_uring_cqe*    m_cqes          { nullptr };
+    // request slots, slot index is used as user_data of sqe
+    std::vector<Request>    m_requests;
+    std::vector<uint32_t>   m_freeSlots;
+};
+
+}
+}
+}
+
+IOUringQueue::IOUringQueue(uint32_t queueDepth)
+{
+    m_queueDepth = std::max(1U, std::min(queueDepth, MAX_IO_URING_QUEUE_DEPTH));
+    if (!Setup()) {
+        ERRLOG("failed to setup io_uring with queue depth %u, error = %u", m_queueDepth, m_error);
+        return;
+    }
+    m_requests.resize(m_queueDepth);
+    for (uint32_t slot = m_queueDepth; slot > 0; --slot) {
+        m_freeSlots.push_back(slot - 1);
+    }
+}
+
+IOUringQueue::~IOUringQueue()
+{
+    if (m_sqes != MAP_FAILED) {
+        ::munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRingPtr != MAP_FAILED && m_cqRingPtr != m_sqRingPtr) {
+        ::munmap(m_cqRingPtr, m_cqRingSize);
+    }
+    if (m_sqRingPtr != MAP_FAILED) {
+        ::munmap(m_sqRingPtr, m_sqRingSize);
+    }
+    if (m_ringFd >= 0) {
+        ::close(m_ringFd);
+        m_ringFd = INVALID_POSIX_FD_VALUE;
+    }
+}
+
+bool IOUringQueue::Setup()
+{
+    struct io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    m_ringFd = static_cast<int>(::syscall(__NR_io_uring_setup, m_queueDepth, &params));
+    if (m_ringFd < 0) {
+        m_error = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        m_sqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+        m_cqRingSize = m_sqRingSize;
+    }
+    m_sqRingPtr = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    if (m_sqRingPtr == MAP_FAILED) {
+        m_error = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    m_cqRingPtr = singleMmap ? m_sqRingPtr : ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+    if (m_cqRingPtr == MAP_FAILED) {
+        m_error = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = static_cast<struct io_uring_sqe*>(::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES));
+    if (m_sqes == MAP_FAILED) {
+        m_error = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    uint8_t* sqRing = static_cast<uint8_t*>(m_sqRingPtr);
+    m_sqTail = reinterpret_cast<uint32_t*>(sqRing + params.sq_off.tail);
+    m_sqMask = reinterpret_cast<uint32_t*>(sqRing + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<uint32_t*>(sqRing + params.sq_off.array);
+    uint8_t* cqRing = static_cast<uint8_t*>(m_cqRingPtr);
+    m_cqHead = reinterpret_cast<uint32_t*>(cqRing + params.cq_off.head);
+    m_cqTail = reinterpret_cast<uint32_t*>(cqRing + params.cq_off.tail);
+    m_cqMask = reinterpret_cast<uint32_t*>(cqRing + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe*>(cqRing + params.cq_off.cqes);
+    DBGLOG("io_uring setup, fd = %d, sq entries = %u, cq entries = %u",
+        m_ringFd, params.sq_entries, params.cq_entries);
+    return true;
+}
+
+bool IOUringQueue::Ok() const
+{
+    return m_ringFd >= 0 && m_error == 0;
+}
+
+ErrCodeType IOUringQueue::Error() const
+{
+    return m_error;
+}
+
+uint32_t IOUringQueue::InFlight() const
+{
+    return m_queueDepth - static_cast<uint32_t>(m_freeSlots.size());
+}
+
+uint32_t IOUringQueue::QueueDepth() const
+{
+    return m_queueDepth;
+}
+
+bool IOUringQueue::Submit(
+    uint8_t         opcode,
+    int             fd,
+    uint64_t        key,
+    uint64_t        offset,
+    uint8_t*        buffer,
+    int             length,
+    ErrCodeType&    errorCode)
+{
+    if (!Ok()) {
+        errorCode = m_error;
+        return false;
+    }
+    if (length <= 0) {
+        errorCode = static_cast<ErrCodeType>(EINVAL);
+        return false;
+    }
+    if (m_freeSlots.empty()) {
+        errorCode = static_cast<ErrCodeType>(EAGAIN);
+        return false;
+    }
+    uint32_t slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    m_requests[slot] = Request { opcode, fd, key, offset, buffer, static_cast<uint32_t>(length), 0 };
+    PrepareEntry(slot);
+    if (!Enter(0, errorCode)) {
+        // entry is already visible to kernel and can not be revoked, the queue is unusable from now on
+        m_error = errorCode;
+        return false;
+    }
+    return true;
+}
+
+bool IOUringQueue::Reap(AsyncIOResult& result, bool wait)
+{
+    while (InFlight() > 0) {
+        uint32_t head = *m_cqHead;
+        uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            struct io_uring_cqe cqe = m_cqes[head & *m_cqMask];
+            __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+            if (CompleteEntry(cqe, result)) {
+                return true;
+            }
+            continue;   // short read/write resubmitted
+        }
+        if (!wait && m_unsubmitted == 0) {
+            return false;
+        }
+        ErrCodeType errorCode = 0;
+        if (!Enter(wait ? 1 : 0, errorCode)) {
+            ERRLOG("io_uring enter failed, error = %u", errorCode);
+            m_error = errorCode;
+            return false;
+        }
+    }
+    return false;
+}
+
+void IOUringQueue::PrepareEntry(uint32_t slot)
+{
+    const Request& request = m_requests[slot];
+    uint32_t tail = *m_sqTail;
+    uint32_t index = tail & *m_sqMask;
+    struct io_uring_sqe* sqe = &m_sqes[index];
+    ::memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = request.opcode;
+    sqe->fd = request.fd;
+    sqe->off = request.offset + request.transferred;
+    sqe->addr = reinterpret_cast<uint64_t>(request.buffer + request.transferred);
+    sqe->len = request.length - request.transferred;
+    sqe->user_data = slot;
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++m_unsubmitted;
+}
+
+bool IOUringQueue::Enter(uint32_t minComplete, ErrCodeType& errorCode)
+{
+    unsigned int flags = (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int ret = static_cast<int>(::syscall(__NR_io_uring_enter, m_ringFd, m_unsubmitted, minComplete,
+            flags, nullptr, 0));
+        if (ret >= 0) {
+            m_unsubmitted -= std::min(m_unsubmitted, static_cast<uint32_t>(ret));
+            return true;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno == EAGAIN || errno == EBUSY) && minComplete == 0) {
+            // kernel is short of resource, entries remain in sq ring and will be submitted next time
+            return true;
+        }
+        errorCode = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+}
+
+bool IOUringQueue::CompleteEntry(const struct io_uring_cqe& cqe, AsyncIOResult& result)
+{
+    uint32_t slot = static_cast<uint32_t>(cqe.user_data);
+    Request& request = m_requests[slot];
+    if (cqe.res <= 0) {
+        // zero bytes transferred is treated as I/O error, short read/write is not expected for volume/copy
+        result = AsyncIOResult {
+            request.key, request.transferred, static_cast<ErrCodeType>(cqe.res < 0 ? -cqe.res : EIO) };
+        ReleaseSlot(slot);
+        return true;
+    }
+    request.transferred += static_cast<uint32_t>(cqe.res);
+    if (request.transferred < request.length) {
+        DBGLOG("short io_uring request, key = %llu, %u/%u bytes transferred, resubmit",
+            request.key, request.transferred, request.length);
+        PrepareEntry(slot);
+        return false;
+    }
+    result = AsyncIOResult { request.key, request.transferred, 0 };
+    ReleaseSlot(slot);
+    return true;
+}
+
+void IOUringQueue::ReleaseSlot(uint32_t slot)
+{
+    m_freeSlots.push_back(slot);
+}
+
+IOUringRawDataReader::IOUringRawDataReader(
+    const std::string& path, uint32_t queueDepth, int flag, uint64_t shiftOffset)
+    : m_flag(flag), m_shiftOffset(shiftOffset)
+{
+    m_fd = ::open(path.c_str(), O_RDONLY);
+    if (m_fd < 0) {
+        m_error = static_cast<ErrCodeType>(errno);
+        return;
+    }
+    m_queue = exstd::make_unique<IOUringQueue>(queueDepth);
+}
+
+IOUringRawDataReader::~IOUringRawDataReader()
+{
+    m_queue.reset();
+    if (m_fd < 0) {
+        return;
+    }
+    ::close(m_fd);
+    m_fd = INVALID_POSIX_FD_VALUE;
+}
+
+bool IOUringRawDataReader::Read(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
+{
+    if (m_flag > 0) {
+        offset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        offset -= m_shiftOffset;
+    }
+    int ret = ::pread(m_fd, buffer, length, offset);
+    if (ret <= 0 || ret != length) {
+        errorCode = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    return true;
+}
+
+bool IOUringRawDataReader::Submit(uint64_t key, uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
+{
+    if (m_flag > 0) {
+        offset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        offset -= m_shiftOffset;
+    }
+    return m_queue->Submit(IORING_OP_READ, m_fd, key, offset, buffer, length, errorCode);
+}
+
+bool IOUringRawDataReader::Reap(AsyncIOResult& result, bool wait)
+{
+    return m_queue->Reap(result, wait);
+}
+
+uint32_t IOUringRawDataReader::InFlight() const
+{
+    return m_queue->InFlight();
+}
+
+uint32_t IOUringRawDataReader::QueueDepth() const
+{
+    return m_queue->QueueDepth();
+}
+
+bool IOUringRawDataReader::Ok()
+{
+    return m_fd > 0 && m_queue != nullptr && m_queue->Ok();
+}
+
+HandleType IOUringRawDataReader::Handle()
+{
+    return Ok() ? m_fd : -1;
+}
+
+ErrCodeType IOUringRawDataReader::Error()
+{
+    if (m_error != 0 || m_queue == nullptr) {
+        return m_error;
+    }
+    return m_queue->Error();
+}
+
+bool IOUringRawDataReader::NextDataRange(uint64_t offset, uint64_t length, uint64_t& dataOffset, uint64_t& dataLength)
+{
+    uint64_t fileOffset = offset;
+    if (m_flag > 0) {
+        fileOffset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        fileOffset -= m_shiftOffset;
+    }
+    if (!SeekDataRange(m_fd, fileOffset, length, dataOffset, dataLength)) {
+        return false;
+    }
+    dataOffset = dataOffset - fileOffset + offset;
+    return true;
+}
+
+IOUringRawDataWriter::IOUringRawDataWriter(
+    const std::string& path, uint32_t queueDepth, int flag, uint64_t shiftOffset)
+    : m_flag(flag), m_shiftOffset(shiftOffset)
+{
+    m_fd = ::open(path.c_str(), O_RDWR | O_EXCL, S_IRUSR | S_IWUSR);
+    if (m_fd < 0) {
+        m_error = static_cast<ErrCodeType>(errno);
+        return;
+    }
+    m_queue = exstd::make_unique<IOUringQueue>(queueDepth);
+}
+
+IOUringRawDataWriter::~IOUringRawDataWriter()
+{
+    m_queue.reset();
+    if (m_fd < 0) {
+        return;
+    }
+    ::close(m_fd);
+    m_fd = INVALID_POSIX_FD_VALUE;
+}
+
+bool IOUringRawDataWriter::Write(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
+{
+    if (m_flag > 0) {
+        offset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        offset -= m_shiftOffset;
+    }
+    int ret = ::pwrite(m_fd, buffer, length, offset);
+    if (ret <= 0 || ret != length) {
+        errorCode = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    return true;
+}
+
+bool IOUringRawDataWriter::Submit(uint64_t key, uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
+{
+    if (m_flag > 0) {
+        offset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        offset -= m_shiftOffset;
+    }
+    return m_queue->Submit(IORING_OP_WRITE, m_fd, key, offset, buffer, length, errorCode);
+}
+
+bool IOUringRawDataWriter::Reap(AsyncIOResult& result, bool wait)
+{
+    return m_queue->Reap(result, wait);
+}
+
+uint32_t IOUringRawDataWriter::InFlight() const
+{
+    return m_queue->InFlight();
+}
+
+uint32_t IOUringRawDataWriter::QueueDepth() const
+{
+    return m_queue->QueueDepth();
+}
+
+bool IOUringRawDataWriter::Ok()
+{
+    return m_fd > 0 && m_queue != nullptr && m_queue->Ok();
+}
+
+HandleType IOUringRawDataWriter::Handle()
+{
+    return Ok() ? m_fd : -1;
+}
+
+bool IOUringRawDataWriter::Flush()
+{
+    if (m_fd < 0) {
+        return false;
+    }
+    ::fsync(m_fd);
+    return true;
+}
+
+ErrCodeType IOUringRawDataWriter::Error()
+{
+    if (m_error != 0 || m_queue == nullptr) {
+        return m_error;
+    }
+    return m_queue->Error();
+}
+
+bool IOUringRawDataWriter::PunchHole(uint64_t offset, uint64_t length, ErrCodeType& errorCode)
+{
+    if (m_flag > 0) {
+        offset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        offset -= m_shiftOffset;
+    }
+    return PunchHoleRange(m_fd, offset, length, errorCode);
+}
+
+#endif
@@ -0,0 +1,415 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#ifdef __linux__
+
+#include "Logger.h"
+#include "common/VolumeProtectMacros.h"
+#include "native/linux/LinuxAllocationMapProvider.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::fsapi;
+
+namespace {
+    // ext2/3/4 on-disk layout
+    const uint64_t EXT4_SUPERBLOCK_OFFSET = 1024;
+    const uint32_t EXT4_SUPERBLOCK_SIZE = 1024;
+    const uint16_t EXT4_SUPER_MAGIC = 0xEF53;
+    const uint32_t EXT4_MAX_LOG_BLOCK_SIZE = 6; // 64KB
+    const uint32_t EXT4_GOOD_OLD_INODE_SIZE = 128;
+    const uint32_t EXT4_MIN_DESC_SIZE = 32;
+    const uint32_t EXT4_MIN_DESC_SIZE_64BIT = 64;
+    const uint32_t EXT4_FEATURE_COMPAT_SPARSE_SUPER2 = 0x0200;
+    const uint32_t EXT4_FEATURE_INCOMPAT_META_BG = 0x0010;
+    const uint32_t EXT4_FEATURE_INCOMPAT_64BIT = 0x0080;
+    const uint32_t EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER = 0x0001;
+    const uint16_t EXT4_BG_BLOCK_UNINIT = 0x0002;
+
+    // xfs on-disk layout, all fields are big endian
+    const uint32_t XFS_SB_READ_SIZE = 512;
+    const uint32_t XFS_SB_MAGIC = 0x58465342;           // "XFSB"
+    const uint32_t XFS_AGF_MAGIC = 0x58414746;          // "XAGF"
+    const uint32_t XFS_ABTB_MAGIC = 0x41425442;         // "ABTB", bnobt block magic
+    const uint32_t XFS_ABTB_CRC_MAGIC = 0x41423342;     // "AB3B", bnobt block magic of v5 filesystem
+    const uint16_t XFS_SB_VERSION_NUMBITS = 0x000F;
+    const uint16_t XFS_SB_VERSION_5 = 5;
+    const uint32_t XFS_BTREE_SBLOCK_LEN = 16;
+    const uint32_t XFS_BTREE_SBLOCK_CRC_LEN = 56;
+    const uint32_t XFS_ALLOC_REC_LEN = 8;               // key has the same length as record
+    const uint32_t XFS_ALLOC_PTR_LEN = 4;
+    const uint32_t XFS_BTREE_MAX_LEVELS = 20;
+
+    inline uint16_t LE16(const uint8_t* p)
+    {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    inline uint32_t LE32(const uint8_t* p)
+    {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+            (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    inline uint16_t BE16(const uint8_t* p)
+    {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    inline uint32_t BE32(const uint8_t* p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+            (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+    }
+
+    inline uint64_t BE64(const uint8_t* p)
+    {
+        return (static_cast<uint64_t>(BE32(p)) << 32) | static_cast<uint64_t>(BE32(p + 4));
+    }
+
+    // append extent, merge with the last one if continuous
+    void AppendExtent(std::vector<VolumeExtent>& extents, uint64_t offset, uint64_t length)
+    {
+        if (!extents.empty() && extents.back().offset + extents.back().length == offset) {
+            extents.back().length += length;
+            return;
+        }
+        extents.push_back(VolumeExtent { offset, length });
+    }
+
+    bool IsPowerOf(uint64_t num, uint64_t base)
+    {
+        uint64_t power = base;
+        while (power < num) {
+            power *= base;
+        }
+        return power == num;
+    }
+}
+
+Ext4AllocationMapProvider::Ext4AllocationMapProvider(std::shared_ptr<rawio::RawDataReader> dataReader)
+    : m_dataReader(dataReader)
+{}
+
+std::string Ext4AllocationMapProvider::FileSystemType() const
+{
+    return "ext4";
+}
+
+bool Ext4AllocationMapProvider::ReadBytes(uint64_t offset, uint8_t* buffer, uint32_t length)
+{
+    ErrCodeType errorCode = 0;
+    if (!m_dataReader->Read(offset, buffer, static_cast<int>(length), errorCode)) {
+        ERRLOG("failed to read %u bytes at offset %llu, error = %u", length, offset, errorCode);
+        return false;
+    }
+    return true;
+}
+
+bool Ext4AllocationMapProvider::ReadSuperBlock()
+{
+    std::vector<uint8_t> sb(EXT4_SUPERBLOCK_SIZE, 0);
+    if (!ReadBytes(EXT4_SUPERBLOCK_OFFSET, sb.data(), EXT4_SUPERBLOCK_SIZE)) {
+        return false;
+    }
+    if (LE16(&sb[0x38]) != EXT4_SUPER_MAGIC) {
+        ERRLOG("invalid ext4 superblock magic 0x%x", LE16(&sb[0x38]));
+        return false;
+    }
+    uint32_t logBlockSize = LE32(&sb[0x18]);
+    if (logBlockSize > EXT4_MAX_LOG_BLOCK_SIZE) {
+        ERRLOG("invalid ext4 log block size %u", logBlockSize);
+        return false;
+    }
+    m_blockSize = 1024ULL << logBlockSize;
+    m_featureCompat = LE32(&sb[0x5C]);
+    m_featureIncompat = LE32(&sb[0x60]);
+    m_featureRoCompat = LE32(&sb[0x64]);
+    bool is64Bit = (m_featureIncompat & EXT4_FEATURE_INCOMPAT_64BIT) != 0;
+    m_blocksCount = LE32(&sb[0x04]);
+    if (is64Bit) {
+        m_blocksCount |= static_cast<uint64_t>(LE32(&sb[0x150])) << 32;
+    }
+    m_firstDataBlock = LE32(&sb[0x14]);
+    m_blocksPerGroup = LE32(&sb[0x20]);
+    m_inodesPerGroup = LE32(&sb[0x28]);
+    m_inodeSize = (LE32(&sb[0x4C]) == 0) ? EXT4_GOOD_OLD_INODE_SIZE : LE16(&sb[0x58]);
+    m_descSize = is64Bit ? LE16(&sb[0xFE]) : EXT4_MIN_DESC_SIZE;
+    m_reservedGdtBlocks = LE16(&sb[0xCE]);
+    m_backupGroups[0] = LE32(&sb[0x24C]);
+    m_backupGroups[1] = LE32(&sb[0x250]);
+    if (m_blocksPerGroup == 0 || m_blocksPerGroup > m_blockSize * 8 || m_blocksCount <= m_firstDataBlock ||
+        m_inodeSize == 0 || m_descSize < EXT4_MIN_DESC_SIZE || (is64Bit && m_descSize < EXT4_MIN_DESC_SIZE_64BIT)) {
+        ERRLOG("invalid ext4 superblock, blocks per group %llu, blocks count %llu, desc size %llu",
+            m_blocksPerGroup, m_blocksCount, m_descSize);
+        return false;
+    }
+    if ((m_featureIncompat & EXT4_FEATURE_INCOMPAT_META_BG) != 0) {
+        WARNLOG("ext4 with meta_bg feature is not supported");
+        return false;
+    }
+    m_groupsCount = (m_blocksCount - m_firstDataBlock + m_blocksPerGroup - 1) / m_blocksPerGroup;
+    m_gdtBlocks = (m_groupsCount * m_descSize + m_blockSize - 1) / m_blockSize;
+    m_inodeTableBlocks = (m_inodesPerGroup * m_inodeSize + m_blockSize - 1) / m_blockSize;
+    INFOLOG("ext4 block size %llu, blocks count %llu, groups count %llu",
+        m_blockSize, m_blocksCount, m_groupsCount);
+    return true;
+}
+
+bool Ext4AllocationMapProvider::ReadGroupDescriptors(std::vector<GroupDescriptor>& descriptors)
+{
+    bool is64Bit = (m_featureIncompat & EXT4_FEATURE_INCOMPAT_64BIT) != 0;
+    std::vector<uint8_t> gdt(m_gdtBlocks * m_blockSize, 0);
+    if (!ReadBytes((m_firstDataBlock + 1) * m_blockSize, gdt.data(), static_cast<uint32_t>(gdt.size()))) {
+        return false;
+    }
+    descriptors.clear();
+    for (uint64_t group = 0; group < m_groupsCount; ++group) {
+        const uint8_t* desc = &gdt[group * m_descSize];
+        GroupDescriptor descriptor {};
+        descriptor.blockBitmap = LE32(desc + 0x00);
+        descriptor.inodeBitmap = LE32(desc + 0x04);
+        descriptor.inodeTable = LE32(desc + 0x08);
+        descriptor.flags = LE16(desc + 0x12);
+        if (is64Bit) {
+            descriptor.blockBitmap |= static_cast<uint64_t>(LE32(desc + 0x20)) << 32;
+            descriptor.inodeBitmap |= static_cast<uint64_t>(LE32(desc + 0x24)) << 32;
+            descriptor.inodeTable |= static_cast<uint64_t>(LE32(desc + 0x28)) << 32;
+        }
+        if (descriptor.blockBitmap >= m_blocksCount) {
+            ERRLOG("invalid block bitmap location %llu of group %llu", descriptor.blockBitmap, group);
+            return false;
+        }
+        descriptors.push_back(descriptor);
+    }
+    return true;
+}
+
+bool Ext4AllocationMapProvider::GroupHasSuperBlock(uint64_t group) const
+{
+    if (group == 0) {
+        return true;
+    }
+    if ((m_featureCompat & EXT4_FEATURE_COMPAT_SPARSE_SUPER2) != 0) {
+        return group == m_backupGroups[0] || group == m_backupGroups[1];
+    }
+    if ((m_featureRoCompat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER) == 0 || group == 1) {
+        return true;
+    }
+    return IsPowerOf(group, 3) || IsPowerOf(group, 5) || IsPowerOf(group, 7);
+}
+
+bool Ext4AllocationMapProvider::ReadGroupBitmap(
+    uint64_t group,
+    const std::vector<GroupDescriptor>& descriptors,
+    const std::vector<std::pair<uint64_t, uint64_t>>& metadataBlocks,
+    std::vector<uint8_t>& bitmap)
+{
+    const GroupDescriptor& descriptor = descriptors[group];
+    uint64_t bitmapBytes = (m_blocksPerGroup + 7) / 8;
+    bitmap.assign(bitmapBytes, 0);
+    if ((descriptor.flags & EXT4_BG_BLOCK_UNINIT) == 0) {
+        return ReadBytes(descriptor.blockBitmap * m_blockSize, bitmap.data(), static_cast<uint32_t>(bitmapBytes));
+    }
+    // bitmap not initialized, mark the metadata blocks located in this group as used
+    auto markUsed = [&](uint64_t start, uint64_t count) {
+        for (uint64_t i = start; i < start + count && i < m_blocksPerGroup; ++i) {
+            bitmap[i / 8] |= static_cast<uint8_t>(1U << (i % 8));
+        }
+    };
+    if (GroupHasSuperBlock(group)) {
+        markUsed(0, 1 + m_gdtBlocks + m_reservedGdtBlocks);
+    }
+    uint64_t groupStart = m_firstDataBlock + group * m_blocksPerGroup;
+    uint64_t groupEnd = groupStart + m_blocksPerGroup;
+    uint64_t searchStart = (groupStart > m_inodeTableBlocks) ? groupStart - m_inodeTableBlocks : 0;
+    auto it = std::lower_bound(metadataBlocks.begin(), metadataBlocks.end(),
+        std::make_pair(searchStart, static_cast<uint64_t>(0)));
+    for (; it != metadataBlocks.end() && it->first < groupEnd; ++it) {
+        uint64_t start = std::max(it->first, groupStart);
+        uint64_t end = std::min(it->first + it->second, groupEnd);
+        if (start < end) {
+            markUsed(start - groupStart, end - start);
+        }
+    }
+    return true;
+}
+
+bool Ext4AllocationMapProvider::ListFreeExtents(std::vector<VolumeExtent>& freeExtents)
+{
+    freeExtents.clear();
+    std::vector<GroupDescriptor> descriptors;
+    if (!ReadSuperBlock() || !ReadGroupDescriptors(descriptors)) {
+        return false;
+    }
+    // block bitmaps and inode tables of all groups, may be located in other groups if flex_bg enabled
+    std::vector<std::pair<uint64_t, uint64_t>> metadataBlocks;
+    for (const GroupDescriptor& descriptor : descriptors) {
+        metadataBlocks.emplace_back(descriptor.blockBitmap, 1);
+        metadataBlocks.emplace_back(descriptor.inodeBitmap, 1);
+        metadataBlocks.emplace_back(descriptor.inodeTable, m_inodeTableBlocks);
+    }
+    std::sort(metadataBlocks.begin(), metadataBlocks.end());
+
+    std::vector<uint8_t> bitmap;
+    for (uint64_t group = 0; group < m_groupsCount; ++group) {
+        if (!ReadGroupBitmap(group, descriptors, metadataBlocks, bitmap)) {
+            ERRLOG("failed to read block bitmap of group %llu", group);
+            return false;
+        }
+        uint64_t groupStart = m_firstDataBlock + group * m_blocksPerGroup;
+        uint64_t groupBlocks = std::min(m_blocksPerGroup, m_blocksCount - groupStart);
+        uint64_t i = 0;
+        while (i < groupBlocks) {
+            if (i % 8 == 0 && i + 8 <= groupBlocks && bitmap[i / 8] == 0xFF) {
+                i += 8; // fast path, skip 8 allocated blocks
+                continue;
+            }
+            if ((bitmap[i / 8] & (1U << (i % 8))) != 0) {
+                ++i;
+                continue;
+            }
+            uint64_t runStart = i;
+            while (i < groupBlocks && (bitmap[i / 8] & (1U << (i % 8))) == 0) {
+                ++i;
+            }
+            AppendExtent(freeExtents, (groupStart + runStart) * m_blockSize, (i - runStart) * m_blockSize);
+        }
+    }
+    INFOLOG("ext4 free extents loaded, count %llu", freeExtents.size());
+    return true;
+}
+
+XfsAllocationMapProvider::XfsAllocationMapProvider(std::shared_ptr<rawio::RawDataReader> dataReader)
+    : m_dataReader(dataReader)
+{}
+
+std::string XfsAllocationMapProvider::FileSystemType() const
+{
+    return "xfs";
+}
+
+bool XfsAllocationMapProvider::ReadBytes(uint64_t offset, uint8_t* buffer, uint32_t length)
+{
+    ErrCodeType errorCode = 0;
+    if (!m_dataReader->Read(offset, buffer, static_cast<int>(length), errorCode)) {
+        ERRLOG("failed to read %u bytes at offset %llu, error = %u", length, offset, errorCode);
+        return false;
+    }
+    return true;
+}
+
+bool XfsAllocationMapProvider::ReadSuperBlock()
+{
+    std::vector<uint8_t> sb(XFS_SB_READ_SIZE, 0);
+    if (!ReadBytes(0, sb.data(), XFS_SB_READ_SIZE)) {
+        return false;
+    }
+    if (BE32(&sb[0x00]) != XFS_SB_MAGIC) {
+        ERRLOG("invalid xfs superblock magic 0x%x", BE32(&sb[0x00]));
+        return false;
+    }
+    m_blockSize = BE32(&sb[0x04]);
+    m_dataBlocks = BE64(&sb[0x08]);
+    m_agBlocks = BE32(&sb[0x54]);
+    m_agCount = BE32(&sb[0x58]);
+    m_crcEnabled = (BE16(&sb[0x64]) & XFS_SB_VERSION_NUMBITS) == XFS_SB_VERSION_5;
+    m_sectorSize = BE16(&sb[0x66]);
+    if (m_blockSize < 512 || m_blockSize > 64 * ONE_KB || m_agBlocks == 0 || m_agCount == 0 ||
+        m_sectorSize < 512 || m_sectorSize > m_blockSize) {
+        ERRLOG("invalid xfs superblock, block size %llu, ag blocks %u, ag count %u, sector size %u",
+            m_blockSize, m_agBlocks, m_agCount, m_sectorSize);
+        return false;
+    }
+    INFOLOG("xfs block size %llu, data blocks %llu, ag blocks %u, ag count %u, v5 %d",
+        m_blockSize, m_dataBlocks, m_agBlocks, m_agCount, m_crcEnabled);
+    return true;
+}
+
+bool XfsAllocationMapProvider::WalkFreeSpaceBtree(
+    uint32_t agno,
+    uint32_t agbno,
+    uint32_t expectedLevel,
+    std::vector<VolumeExtent>& freeExtents,
+    uint64_t& blocksVisited)
+{
+    if (agbno >= m_agBlocks || ++blocksVisited > m_agBlocks) {
+        ERRLOG("invalid bnobt block %u of ag %u", agbno, agno);
+        return false;
+    }
+    uint64_t agStartBlock = static_cast<uint64_t>(agno) * m_agBlocks;
+    std::vector<uint8_t> block(m_blockSize, 0);
+    if (!ReadBytes((agStartBlock + agbno) * m_blockSize, block.data(), static_cast<uint32_t>(m_blockSize))) {
+        return false;
+    }
+    uint32_t magic = BE32(&block[0]);
+    uint32_t level = BE16(&block[4]);
+    uint32_t numrecs = BE16(&block[6]);
+    uint32_t headerLen = m_crcEnabled ? XFS_BTREE_SBLOCK_CRC_LEN : XFS_BTREE_SBLOCK_LEN;
+    if (magic != (m_crcEnabled ? XFS_ABTB_CRC_MAGIC : XFS_ABTB_MAGIC) || level != expectedLevel) {
+        ERRLOG("invalid bnobt block %u of ag %u, magic 0x%x, level %u", agbno, agno, magic, level);
+        return false;
+    }
+    if (level == 0) {
+        uint32_t maxrecs = (m_blockSize - headerLen) / XFS_ALLOC_REC_LEN;
+        if (numrecs > maxrecs) {
+            return false;
+        }
+        for (uint32_t i = 0; i < numrecs; ++i) {
+            const uint8_t* rec = &block[headerLen + i * XFS_ALLOC_REC_LEN];
+            uint64_t startBlock = agStartBlock + BE32(rec);
+            uint64_t blockCount = BE32(rec + 4);
+            if (startBlock + blockCount > m_dataBlocks) {
+                ERRLOG("free extent (%llu, %llu) out of range", startBlock, blockCount);
+                return false;
+            }
+            AppendExtent(freeExtents, startBlock * m_blockSize, blockCount * m_blockSize);
+        }
+        return true;
+    }
+    uint32_t maxrecs = (m_blockSize - headerLen) / (XFS_ALLOC_REC_LEN + XFS_ALLOC_PTR_LEN);
+    if (numrecs > maxrecs) {
+        return false;
+    }
+    const uint8_t* ptrs = &block[headerLen + maxrecs * XFS_ALLOC_REC_LEN];
+    for (uint32_t i = 0; i < numrecs; ++i) {
+        if (!WalkFreeSpaceBtree(agno, BE32(ptrs + i * XFS_ALLOC_PTR_LEN), level - 1, freeExtents, blocksVisited)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool XfsAllocationMapProvider::ListFreeExtents(std::vector<VolumeExtent>& freeExtents)
+{
+    freeExtents.clear();
+    if (!ReadSuperBlock()) {
+        return false;
+    }
+    std::vector<uint8_t> agf(m_sectorSize, 0);
+    for (uint32_t agno = 0; agno < m_agCount; ++agno) {
+        // AGF locates at the second sector of each AG
+        uint64_t agfOffset = static_cast<uint64_t>(agno) * m_agBlocks * m_blockSize + m_sectorSize;
+        if (!ReadBytes(agfOffset, agf.data(), m_sectorSize)) {
+            return false;
+        }
+        uint32_t bnoRoot = BE32(&agf[16]);
+        uint32_t bnoLevel = BE32(&agf[28]);
+        if (BE32(&agf[0]) != XFS_AGF_MAGIC || BE32(&agf[8]) != agno ||
+            bnoLevel == 0 || bnoLevel > XFS_BTREE_MAX_LEVELS) {
+            ERRLOG("invalid AGF of ag %u, bnobt root %u, level %u", agno, bnoRoot, bnoLevel);
+            return false;
+        }
+        uint64_t blocksVisited = 0;
+        if (!WalkFreeSpaceBtree(agno, bnoRoot, bnoLevel - 1, freeExtents, blocksVisited)) {
+            ERRLOG("failed to walk bnobt of ag %u", agno);
+            return false;
+        }
+    }
+    INFOLOG("xfs free extents loaded, count %llu", freeExtents.size());
+    return true;
+}
+
+#endif
@@ -17,21 +17,118 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <cstdlib>
+#include <algorithm>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
+#include "Logger.h"
+#include "native/FileSystemAPI.h"
 #include "linux/PosixRawIO.h"
 
 namespace {
     const int INVALID_POSIX_FD_VALUE = -1;
+
+    bool IsDirectIOAligned(uint64_t offset, const uint8_t* buffer, int length, uint32_t alignment)
+    {
+        return offset % alignment == 0 && static_cast<uint64_t>(length) % alignment == 0 &&
+            reinterpret_cast<uintptr_t>(buffer) % alignment == 0;
+    }
+
+    // open file with O_DIRECT if direct I/O specified, fallback to buffered I/O if not supported
+    int OpenWithCacheMode(const std::string& path, int openFlag, volumeprotect::IOCacheMode& cacheMode)
+    {
+#ifdef O_DIRECT
+        if (cacheMode == volumeprotect::IOCacheMode::DIRECT) {
+            int fd = ::open(path.c_str(), openFlag | O_DIRECT, S_IRUSR | S_IWUSR);
+            if (fd >= 0) {
+                return fd;
+            }
+            WARNLOG("failed to open %s with O_DIRECT, error = %d, fallback to buffered I/O", path.c_str(), errno);
+        }
+#endif
+        if (cacheMode == volumeprotect::IOCacheMode::DIRECT) {
+            cacheMode = volumeprotect::IOCacheMode::BUFFERED;
+        }
+        return ::open(path.c_str(), openFlag, S_IRUSR | S_IWUSR);
+    }
 }
 
 using namespace volumeprotect;
 using namespace volumeprotect::rawio;
 using namespace volumeprotect::rawio::posix;
 
-PosixRawDataReader::PosixRawDataReader(const std::string& path, int flag, uint64_t shiftOffset)
-    : m_flag(flag), m_shiftOffset(shiftOffset)
+bool posix::SeekDataRange(int fd, uint64_t offset, uint64_t length, uint64_t& dataOffset, uint64_t& dataLength)
 {
-    m_fd = ::open(path.c_str(), O_RDONLY);
+    uint64_t end = offset + length;
+    dataOffset = offset;
+    dataLength = length;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t dataBegin = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (dataBegin < 0) {
+        if (errno != ENXIO) {
+            return false;
+        }
+        // no data from offset to the end of file
+        dataOffset = end;
+        dataLength = 0;
+        return true;
+    }
+    if (static_cast<uint64_t>(dataBegin) >= end) {
+        dataOffset = end;
+        dataLength = 0;
+        return true;
+    }
+    off_t holeBegin = ::lseek(fd, dataBegin, SEEK_HOLE);
+    if (holeBegin < 0) {
+        return false;
+    }
+    dataOffset = static_cast<uint64_t>(dataBegin);
+    dataLength = std::min(end, static_cast<uint64_t>(holeBegin)) - dataOffset;
+#endif
+    return true;
+}
+
+bool posix::PunchHoleRange(int fd, uint64_t offset, uint64_t length, ErrCodeType& errorCode)
+{
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        errorCode = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+#ifdef BLKZEROOUT
+    if (S_ISBLK(st.st_mode)) {
+        // BLKDISCARD is not used since discarded range is not guaranteed to read as zero
+        uint64_t range[2] = { offset, length };
+        if (::ioctl(fd, BLKZEROOUT, &range) != 0) {
+            errorCode = static_cast<ErrCodeType>(errno);
+            return false;
+        }
+        return true;
+    }
+#endif
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+    if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        static_cast<off_t>(offset), static_cast<off_t>(length)) != 0) {
+        errorCode = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    return true;
+#else
+    errorCode = static_cast<ErrCodeType>(EOPNOTSUPP);
+    return false;
+#endif
+}
+
+PosixRawDataReader::PosixRawDataReader(
+    const std::string& path, int flag, uint64_t shiftOffset, IOCacheMode cacheMode)
+    : m_flag(flag), m_shiftOffset(shiftOffset), m_cacheMode(cacheMode)
+{
+    m_fd = OpenWithCacheMode(path, O_RDONLY, m_cacheMode);
+    if (m_cacheMode == IOCacheMode::DIRECT) {
+        m_alignment = DirectIOAlignment(path);
+    }
 }
 
 bool PosixRawDataReader::Read(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
@@ -41,12 +138,43 @@ bool PosixRawDataReader::Read(uint64_t offset, uint8_t* buffer, int length, ErrC
     } else if (m_flag < 0) {
         offset -= m_shiftOffset;
     }
-    ::lseek(m_fd, offset, SEEK_SET);
-    int ret = ::read(m_fd, buffer, length);
+    if (m_cacheMode == IOCacheMode::DIRECT && !IsDirectIOAligned(offset, buffer, length, m_alignment)) {
+        return ReadUnaligned(offset, buffer, length, errorCode);
+    }
+    // use pread to avoid lseek syscall, also allow concurrent read on the same fd
+    int ret = ::pread(m_fd, buffer, length, offset);
     if (ret <= 0 || ret != length) {
         errorCode = static_cast<ErrCodeType>(errno);
         return false;
     }
+#ifdef POSIX_FADV_DONTNEED
+    if (m_cacheMode == IOCacheMode::DROP_BEHIND) {
+        // pages behind the read cursor will never be read again
+        ::posix_fadvise(m_fd, offset, length, POSIX_FADV_DONTNEED);
+    }
+#endif
+    return true;
+}
+
+bool PosixRawDataReader::ReadUnaligned(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
+{
+    uint64_t alignedOffset = offset / m_alignment * m_alignment;
+    uint64_t end = offset + static_cast<uint64_t>(length);
+    uint64_t alignedLength = (end - alignedOffset + m_alignment - 1) / m_alignment * m_alignment;
+    void* bounceBuffer = nullptr;
+    if (::posix_memalign(&bounceBuffer, m_alignment, alignedLength) != 0) {
+        errorCode = static_cast<ErrCodeType>(ENOMEM);
+        return false;
+    }
+    // unaligned tail block, read may stop at the end of file
+    ssize_t ret = ::pread(m_fd, bounceBuffer, alignedLength, alignedOffset);
+    if (ret < 0 || static_cast<uint64_t>(ret) < end - alignedOffset) {
+        errorCode = static_cast<ErrCodeType>(ret < 0 ? errno : EIO);
+        ::free(bounceBuffer);
+        return false;
+    }
+    ::memcpy(buffer, static_cast<uint8_t*>(bounceBuffer) + (offset - alignedOffset), length);
+    ::free(bounceBuffer);
     return true;
 }
 
@@ -65,6 +193,21 @@ HandleType PosixRawDataReader::Handle()
     return Ok() ? m_fd : -1;
 }
 
+bool PosixRawDataReader::NextDataRange(uint64_t offset, uint64_t length, uint64_t& dataOffset, uint64_t& dataLength)
+{
+    uint64_t fileOffset = offset;
+    if (m_flag > 0) {
+        fileOffset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        fileOffset -= m_shiftOffset;
+    }
+    if (!SeekDataRange(m_fd, fileOffset, length, dataOffset, dataLength)) {
+        return false;
+    }
+    dataOffset = dataOffset - fileOffset + offset;
+    return true;
+}
+
 PosixRawDataReader::~PosixRawDataReader()
 {
     if (m_fd < 0) {
@@ -74,10 +217,14 @@ PosixRawDataReader::~PosixRawDataReader()
     m_fd = INVALID_POSIX_FD_VALUE;
 }
 
-PosixRawDataWriter::PosixRawDataWriter(const std::string& path, int flag, uint64_t shiftOffset)
-    : m_flag(flag), m_shiftOffset(shiftOffset)
+PosixRawDataWriter::PosixRawDataWriter(
+    const std::string& path, int flag, uint64_t shiftOffset, IOCacheMode cacheMode)
+    : m_flag(flag), m_shiftOffset(shiftOffset), m_path(path), m_cacheMode(cacheMode)
 {
-    m_fd = ::open(path.c_str(), O_RDWR | O_EXCL, S_IRUSR | S_IWUSR);
+    m_fd = OpenWithCacheMode(path, O_RDWR | O_EXCL, m_cacheMode);
+    if (m_cacheMode == IOCacheMode::DIRECT) {
+        m_alignment = DirectIOAlignment(path);
+    }
 }
 
 bool PosixRawDataWriter::Write(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
@@ -87,15 +234,53 @@ bool PosixRawDataWriter::Write(uint64_t offset, uint8_t* buffer, int length, Err
     } else if (m_flag < 0) {
         offset -= m_shiftOffset;
     }
-    ::lseek(m_fd, offset, SEEK_SET);
-    int ret = ::write(m_fd, buffer, length);
+    if (m_cacheMode == IOCacheMode::DIRECT && !IsDirectIOAligned(offset, buffer, length, m_alignment)) {
+        return WriteUnaligned(offset, buffer, length, errorCode);
+    }
+    int ret = ::pwrite(m_fd, buffer, length, offset);
     if (ret <= 0 || ret != length) {
         errorCode = static_cast<ErrCodeType>(errno);
         return false;
     }
+    if (m_cacheMode == IOCacheMode::DROP_BEHIND) {
+        DropBehind(offset, length);
+    }
     return true;
 }
 
+// padding the tail block may extend the file, so unaligned range is written without O_DIRECT
+bool PosixRawDataWriter::WriteUnaligned(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode)
+{
+    if (m_bufferedFd < 0) {
+        m_bufferedFd = ::open(m_path.c_str(), O_RDWR);
+        if (m_bufferedFd < 0) {
+            errorCode = static_cast<ErrCodeType>(errno);
+            return false;
+        }
+    }
+    int ret = ::pwrite(m_bufferedFd, buffer, length, offset);
+    if (ret <= 0 || ret != length) {
+        errorCode = static_cast<ErrCodeType>(errno);
+        return false;
+    }
+    return true;
+}
+
+void PosixRawDataWriter::DropBehind(uint64_t offset, int length)
+{
+#ifdef __linux__
+    ::sync_file_range(m_fd, offset, length, SYNC_FILE_RANGE_WRITE);
+    if (m_lastWriteLength != 0) {
+        // dirty pages can not be dropped, wait for writeback of the last range to complete
+        ::sync_file_range(m_fd, m_lastWriteOffset, m_lastWriteLength,
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        ::posix_fadvise(m_fd, m_lastWriteOffset, m_lastWriteLength, POSIX_FADV_DONTNEED);
+    }
+    m_lastWriteOffset = offset;
+    m_lastWriteLength = static_cast<uint64_t>(length);
+#endif
+}
+
 bool PosixRawDataWriter::Ok()
 {
     return m_fd > 0;
@@ -111,6 +296,9 @@ bool PosixRawDataWriter::Flush()
     if (!Ok()) {
         return false;
     }
+    if (m_bufferedFd >= 0) {
+        ::fsync(m_bufferedFd);
+    }
     ::fsync(m_fd);
     return true;
 }
@@ -120,8 +308,22 @@ ErrCodeType PosixRawDataWriter::Error()
     return static_cast<ErrCodeType>(errno);
 }
 
+bool PosixRawDataWriter::PunchHole(uint64_t offset, uint64_t length, ErrCodeType& errorCode)
+{
+    if (m_flag > 0) {
+        offset += m_shiftOffset;
+    } else if (m_flag < 0) {
+        offset -= m_shiftOffset;
+    }
+    return PunchHoleRange(m_fd, offset, length, errorCode);
+}
+
 PosixRawDataWriter::~PosixRawDataWriter()
 {
+    if (m_bufferedFd >= 0) {
+        ::close(m_bufferedFd);
+        m_bufferedFd = INVALID_POSIX_FD_VALUE;
+    }
     if (m_fd < 0) {
         return;
     }
@@ -146,4 +348,21 @@ bool volumeprotect::rawio::TruncateCreateFile(
     return true;
 }
 
+uint32_t volumeprotect::rawio::DirectIOAlignment(const std::string& path)
+{
+    uint32_t alignment = DEFAULT_DIRECT_IO_ALIGNMENT;
+#ifdef __linux__
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0 || !S_ISBLK(st.st_mode)) {
+        return alignment;
+    }
+    try {
+        alignment = std::max(alignment, static_cast<uint32_t>(fsapi::ReadSectorSizeLinux(path)));
+    } catch (const fsapi::SystemApiException& e) {
+        WARNLOG("failed to read sector size of %s, %s", path.c_str(), e.what());
+    }
+#endif
+    return alignment;
+}
+
 #endif
\ No newline at end of file
@@ -517,6 +517,12 @@ bool rawio::TruncateCreateFile(const std::string& path, uint64_t size, ErrCodeTy
     return true;
 }
 
+// unbuffered I/O is not used on windows yet, keep buffers page aligned
+uint32_t rawio::DirectIOAlignment(const std::string& path)
+{
+    return DEFAULT_DIRECT_IO_ALIGNMENT;
+}
+
 static DWORD CreateVirtualDiskFile(const std::string& filePath, uint64_t maxinumSize, DWORD deviceID, bool dynamic)
 {
     VIRTUAL_STORAGE_TYPE virtualStorageType;
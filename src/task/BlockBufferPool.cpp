@@ -0,0 +1,186 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "Logger.h"
+#include "BlockBufferPool.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::task;
+
+namespace {
+    const uint64_t HUGE_PAGE_SIZE = 2 * ONE_MB;
+
+#ifdef __linux__
+    // MPOL_LOCAL defined in linux/mempolicy.h, allocate on the node of the cpu triggering the page fault
+    const int LOCAL_NUMA_POLICY = 4;
+#endif
+
+    uint64_t RoundUp(uint64_t size, uint64_t unit)
+    {
+        return (size + unit - 1) / unit * unit;
+    }
+}
+
+BlockBufferPool& BlockBufferPool::Instance()
+{
+    static BlockBufferPool pool;
+    return pool;
+}
+
+BlockBufferPool::~BlockBufferPool()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    DropCachedRegions();
+}
+
+void BlockBufferPool::Configure(const BufferPoolConfig& config)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    INFOLOG("configure buffer pool, hugePages %d, lockMemory %d, prefault %d, numaLocal %d, maxCachedBytes %llu",
+        config.hugePages, config.lockMemory, config.prefault, config.numaLocal, config.maxCachedBytes);
+    m_config = config;
+    DropCachedRegions();
+}
+
+uint8_t* BlockBufferPool::Lease(uint64_t size, uint64_t& capacity)
+{
+    capacity = SizeClass(std::max<uint64_t>(size, 1));
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        auto it = m_cachedRegions.find(capacity);
+        if (it != m_cachedRegions.end()) {
+            uint8_t* ptr = it->second;
+            m_cachedRegions.erase(it);
+            m_cachedBytes -= capacity;
+            DBGLOG("lease cached region %p of %llu bytes", ptr, capacity);
+            return ptr;
+        }
+    }
+    return MapRegion(capacity);
+}
+
+void BlockBufferPool::Release(uint8_t* ptr, uint64_t capacity)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_cachedBytes + capacity <= m_config.maxCachedBytes) {
+            m_cachedRegions.emplace(capacity, ptr);
+            m_cachedBytes += capacity;
+            return;
+        }
+    }
+    UnmapRegion(ptr, capacity);
+}
+
+uint64_t BlockBufferPool::CachedBytes() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_cachedBytes;
+}
+
+uint64_t BlockBufferPool::SizeClass(uint64_t size) const
+{
+    return (size >= HUGE_PAGE_SIZE) ? RoundUp(size, HUGE_PAGE_SIZE) : RoundUp(size, BUFFER_POOL_REGION_ALIGNMENT);
+}
+
+#ifdef __linux__
+uint8_t* BlockBufferPool::MapRegion(uint64_t capacity) const
+{
+    BufferPoolConfig config {};
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        config = m_config;
+    }
+    void* ptr = MAP_FAILED;
+    uint64_t pageSize = BUFFER_POOL_REGION_ALIGNMENT;
+    if (config.hugePages && capacity % HUGE_PAGE_SIZE == 0) {
+        ptr = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) {
+            DBGLOG("no hugetlb page reserved for %llu bytes, errno %d, use transparent hugepages", capacity, errno);
+        } else {
+            pageSize = HUGE_PAGE_SIZE;
+        }
+    }
+    if (ptr == MAP_FAILED) {
+        ptr = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            ERRLOG("failed to map region of %llu bytes, errno %d", capacity, errno);
+            return nullptr;
+        }
+        if (config.hugePages && capacity >= HUGE_PAGE_SIZE && ::madvise(ptr, capacity, MADV_HUGEPAGE) != 0) {
+            DBGLOG("transparent hugepages not available, errno %d", errno);
+        }
+    }
+    // memory policy must be set before pages are faulted
+    if (config.numaLocal && ::syscall(SYS_mbind, ptr, capacity, LOCAL_NUMA_POLICY, nullptr, 0, 0) != 0) {
+        WARNLOG("failed to bind region %p to local numa node, errno %d", ptr, errno);
+    }
+    uint8_t* region = static_cast<uint8_t*>(ptr);
+    if (config.prefault) {
+        for (uint64_t offset = 0; offset < capacity; offset += pageSize) {
+            region[offset] = 0;
+        }
+    }
+    if (config.lockMemory && ::mlock(ptr, capacity) != 0) {
+        WARNLOG("failed to lock region %p of %llu bytes, errno %d", ptr, capacity, errno);
+    }
+    DBGLOG("map region %p of %llu bytes, page size %llu", ptr, capacity, pageSize);
+    return region;
+}
+
+void BlockBufferPool::UnmapRegion(uint8_t* ptr, uint64_t capacity) const
+{
+    if (::munmap(ptr, capacity) != 0) {
+        ERRLOG("failed to unmap region %p of %llu bytes, errno %d", ptr, capacity, errno);
+    }
+}
+#elif defined(_WIN32)
+uint8_t* BlockBufferPool::MapRegion(uint64_t capacity) const
+{
+    return static_cast<uint8_t*>(::_aligned_malloc(capacity, BUFFER_POOL_REGION_ALIGNMENT));
+}
+
+void BlockBufferPool::UnmapRegion(uint8_t* ptr, uint64_t capacity) const
+{
+    (void)capacity;
+    ::_aligned_free(ptr);
+}
+#else
+uint8_t* BlockBufferPool::MapRegion(uint64_t capacity) const
+{
+    void* ptr = nullptr;
+    return (::posix_memalign(&ptr, BUFFER_POOL_REGION_ALIGNMENT, capacity) == 0) ? static_cast<uint8_t*>(ptr) : nullptr;
+}
+
+void BlockBufferPool::UnmapRegion(uint8_t* ptr, uint64_t capacity) const
+{
+    (void)capacity;
+    ::free(ptr);
+}
+#endif
+
+// must be called with m_mutex held
+void BlockBufferPool::DropCachedRegions()
+{
+    for (const std::pair<const uint64_t, uint8_t*>& region : m_cachedRegions) {
+        UnmapRegion(region.second, region.first);
+    }
+    m_cachedRegions.clear();
+    m_cachedBytes = 0;
+}
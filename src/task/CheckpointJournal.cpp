@@ -0,0 +1,312 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Logger.h"
+#include "native/FileSystemAPI.h"
+#include "CheckpointJournal.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::task;
+
+namespace {
+    const uint32_t JOURNAL_MAGIC = 0x4A434256;  // "VBCJ"
+    const uint32_t JOURNAL_VERSION = 1;
+    const uint32_t RECORD_MAGIC = 0x52434256;   // "VBCR"
+    // header: magic, version, record size, reserved (uint32 each), number of blocks (uint64)
+    const uint64_t JOURNAL_HEADER_SIZE = 24;
+    // record: magic, flags (uint32 each), block index (uint64), followed by digests
+    const uint32_t RECORD_HEADER_SIZE = 16;
+    const uint32_t RECORD_FLAG_WRITTEN = 1;
+    const uint64_t PENDING_WRITTEN_FLAG = 1ULL << 63;
+    // each commit flushes the copy/volume written, don't do it too often
+    const auto JOURNAL_COMMIT_INTERVAL = std::chrono::seconds(5);
+
+    template<typename T>
+    void Store(uint8_t* buffer, uint64_t offset, T value)
+    {
+        memcpy(buffer + offset, &value, sizeof(T));
+    }
+
+    template<typename T>
+    T Load(const uint8_t* buffer, uint64_t offset)
+    {
+        T value {};
+        memcpy(&value, buffer + offset, sizeof(T));
+        return value;
+    }
+
+    std::shared_ptr<Bitmap> CopyBitmap(const Bitmap& bitmap)
+    {
+        uint8_t* buffer = new uint8_t[bitmap.Capacity()];
+        bitmap.CopyTo(buffer);
+        return std::make_shared<Bitmap>(buffer, bitmap.Capacity());
+    }
+}
+
+std::shared_ptr<CheckpointJournal> CheckpointJournal::Open(
+    const std::string&  filepath,
+    uint64_t            numBlocks,
+    uint32_t            checksumSize,
+    uint32_t            subChecksumSize)
+{
+    std::shared_ptr<CheckpointJournal> journal(
+        new CheckpointJournal(filepath, numBlocks, checksumSize, subChecksumSize));
+    if (!journal->OpenFile()) {
+        return nullptr;
+    }
+    return journal;
+}
+
+CheckpointJournal::CheckpointJournal(
+    const std::string&  filepath,
+    uint64_t            numBlocks,
+    uint32_t            checksumSize,
+    uint32_t            subChecksumSize)
+  : m_filepath(filepath),
+    m_numBlocks(numBlocks),
+    m_checksumSize(checksumSize),
+    m_subChecksumSize(subChecksumSize),
+    m_recordSize(RECORD_HEADER_SIZE + checksumSize + subChecksumSize),
+    m_processedBitmap(std::make_shared<Bitmap>(numBlocks)),
+    m_writtenBitmap(std::make_shared<Bitmap>(numBlocks))
+{
+    // a full snapshot is both bitmaps and the checksum tables
+    m_compactThreshold = JOURNAL_HEADER_SIZE + 2 * m_processedBitmap->Capacity() +
+        numBlocks * (checksumSize + subChecksumSize);
+}
+
+CheckpointJournal::~CheckpointJournal()
+{
+    if (m_file != nullptr) {
+        ::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void CheckpointJournal::Append(uint64_t index, bool written)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_pending.push_back(written ? (index | PENDING_WRITTEN_FLAG) : index);
+}
+
+bool CheckpointJournal::IsCommitDue() const
+{
+    return std::chrono::steady_clock::now() - m_lastCommit >= JOURNAL_COMMIT_INTERVAL;
+}
+
+void CheckpointJournal::Seal()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_sealed.empty()) {
+        m_sealed.swap(m_pending);
+        return;
+    }
+    // previous commit failed, retry along with blocks appended since then
+    m_sealed.insert(m_sealed.end(), m_pending.begin(), m_pending.end());
+    m_pending.clear();
+}
+
+bool CheckpointJournal::Commit(const BlockHashingContext* hashingContext)
+{
+    m_lastCommit = std::chrono::steady_clock::now();
+    if (m_sealed.empty()) {
+        return true;
+    }
+    uint64_t length = m_sealed.size() * m_recordSize;
+    std::vector<uint8_t> buffer(length, 0);
+    uint64_t offset = 0;
+    for (uint64_t entry : m_sealed) {
+        uint64_t index = entry & ~PENDING_WRITTEN_FLAG;
+        Store<uint32_t>(buffer.data(), offset, RECORD_MAGIC);
+        Store<uint32_t>(buffer.data(), offset + sizeof(uint32_t),
+            ((entry & PENDING_WRITTEN_FLAG) != 0) ? RECORD_FLAG_WRITTEN : 0);
+        Store<uint64_t>(buffer.data(), offset + sizeof(uint32_t) + sizeof(uint32_t), index);
+        uint8_t* digest = buffer.data() + offset + RECORD_HEADER_SIZE;
+        if (m_checksumSize != 0 && hashingContext != nullptr && hashingContext->lastestTable != nullptr) {
+            memcpy(digest, hashingContext->lastestTable + index * m_checksumSize, m_checksumSize);
+        }
+        if (m_subChecksumSize != 0 && hashingContext != nullptr && hashingContext->subLastestTable != nullptr) {
+            memcpy(digest + m_checksumSize,
+                hashingContext->subLastestTable + index * m_subChecksumSize, m_subChecksumSize);
+        }
+        offset += m_recordSize;
+    }
+    if (!WriteDurable(buffer.data(), length)) {
+        ERRLOG("failed to commit %llu records to journal %s", m_sealed.size(), m_filepath.c_str());
+        return false;
+    }
+    for (uint64_t entry : m_sealed) {
+        uint64_t index = entry & ~PENDING_WRITTEN_FLAG;
+        m_processedBitmap->Set(index);
+        if ((entry & PENDING_WRITTEN_FLAG) != 0) {
+            m_writtenBitmap->Set(index);
+        }
+    }
+    DBGLOG("commit %llu records to journal %s, size %llu", m_sealed.size(), m_filepath.c_str(), m_fileSize);
+    m_sealed.clear();
+    return true;
+}
+
+bool CheckpointJournal::NeedCompaction() const
+{
+    return m_fileSize > m_compactThreshold;
+}
+
+std::shared_ptr<CheckpointSnapshot> CheckpointJournal::TakeCommittedSnapshot() const
+{
+    auto checkpointSnapshot = std::make_shared<CheckpointSnapshot>(m_processedBitmap->Capacity());
+    m_processedBitmap->CopyTo(checkpointSnapshot->processedBitmapBuffer);
+    m_writtenBitmap->CopyTo(checkpointSnapshot->writtenBitmapBuffer);
+    return checkpointSnapshot;
+}
+
+bool CheckpointJournal::Truncate()
+{
+    DBGLOG("truncate journal %s of %llu bytes", m_filepath.c_str(), m_fileSize);
+    return TruncateFile(JOURNAL_HEADER_SIZE);
+}
+
+bool CheckpointJournal::Reset()
+{
+    INFOLOG("reset journal %s", m_filepath.c_str());
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_pending.clear();
+    }
+    m_sealed.clear();
+    m_processedBitmap = std::make_shared<Bitmap>(m_numBlocks);
+    m_writtenBitmap = std::make_shared<Bitmap>(m_numBlocks);
+    return TruncateFile(0) && WriteHeader();
+}
+
+bool CheckpointJournal::Replay(Bitmap& processedBitmap, Bitmap& writtenBitmap, BlockHashingContext* hashingContext)
+{
+    uint8_t* buffer = fsapi::ReadBinaryBuffer(m_filepath, m_fileSize);
+    if (buffer == nullptr) {
+        ERRLOG("failed to read journal %s, size %llu", m_filepath.c_str(), m_fileSize);
+        return false;
+    }
+    std::unique_ptr<uint8_t[]> defer(buffer);
+    if (Load<uint32_t>(buffer, 0) != JOURNAL_MAGIC ||
+        Load<uint32_t>(buffer, sizeof(uint32_t)) != JOURNAL_VERSION ||
+        Load<uint32_t>(buffer, sizeof(uint32_t) + sizeof(uint32_t)) != m_recordSize ||
+        Load<uint64_t>(buffer, JOURNAL_HEADER_SIZE - sizeof(uint64_t)) != m_numBlocks) {
+        ERRLOG("journal %s doesn't match session, record size %u, blocks %llu",
+            m_filepath.c_str(), m_recordSize, m_numBlocks);
+        return false;
+    }
+    uint64_t offset = JOURNAL_HEADER_SIZE;
+    uint64_t records = 0;
+    for (; offset + m_recordSize <= m_fileSize; offset += m_recordSize, ++records) {
+        uint32_t flags = Load<uint32_t>(buffer, offset + sizeof(uint32_t));
+        uint64_t index = Load<uint64_t>(buffer, offset + sizeof(uint32_t) + sizeof(uint32_t));
+        if (Load<uint32_t>(buffer, offset) != RECORD_MAGIC || index >= m_numBlocks) {
+            break;
+        }
+        const uint8_t* digest = buffer + offset + RECORD_HEADER_SIZE;
+        if (m_checksumSize != 0 && hashingContext != nullptr && hashingContext->lastestTable != nullptr) {
+            memcpy(hashingContext->lastestTable + index * m_checksumSize, digest, m_checksumSize);
+            hashingContext->MarkLastestDirty(index * m_checksumSize, m_checksumSize);
+        }
+        if (m_subChecksumSize != 0 && hashingContext != nullptr && hashingContext->subLastestTable != nullptr) {
+            memcpy(hashingContext->subLastestTable + index * m_subChecksumSize,
+                digest + m_checksumSize, m_subChecksumSize);
+            hashingContext->MarkSubLastestDirty(index * m_subChecksumSize, m_subChecksumSize);
+        }
+        processedBitmap.Set(index);
+        if ((flags & RECORD_FLAG_WRITTEN) != 0) {
+            writtenBitmap.Set(index);
+        }
+    }
+    INFOLOG("replay %llu records from journal %s", records, m_filepath.c_str());
+    if (offset != m_fileSize) {
+        // records appended after a torn one would never be replayed
+        WARNLOG("drop %llu bytes at tail of journal %s", m_fileSize - offset, m_filepath.c_str());
+        if (!TruncateFile(offset)) {
+            return false;
+        }
+    }
+    m_processedBitmap = CopyBitmap(processedBitmap);
+    m_writtenBitmap = CopyBitmap(writtenBitmap);
+    return true;
+}
+
+bool CheckpointJournal::Empty() const
+{
+    return m_fileSize <= JOURNAL_HEADER_SIZE;
+}
+
+bool CheckpointJournal::OpenFile()
+{
+    m_file = ::fopen(m_filepath.c_str(), "ab");
+    if (m_file == nullptr) {
+        ERRLOG("failed to open journal %s, errno %d", m_filepath.c_str(), errno);
+        return false;
+    }
+    m_fileSize = fsapi::GetFileSize(m_filepath);
+    if (m_fileSize < JOURNAL_HEADER_SIZE) {
+        return TruncateFile(0) && WriteHeader();
+    }
+    return true;
+}
+
+bool CheckpointJournal::WriteHeader()
+{
+    uint8_t header[JOURNAL_HEADER_SIZE] = { 0 };
+    Store<uint32_t>(header, 0, JOURNAL_MAGIC);
+    Store<uint32_t>(header, sizeof(uint32_t), JOURNAL_VERSION);
+    Store<uint32_t>(header, sizeof(uint32_t) + sizeof(uint32_t), m_recordSize);
+    Store<uint64_t>(header, JOURNAL_HEADER_SIZE - sizeof(uint64_t), m_numBlocks);
+    return WriteDurable(header, JOURNAL_HEADER_SIZE);
+}
+
+// append and fdatasync, tail written partially is truncated on failure
+bool CheckpointJournal::WriteDurable(const uint8_t* buffer, uint64_t length)
+{
+    bool success = ::fwrite(buffer, 1, length, m_file) == length && ::fflush(m_file) == 0;
+#ifdef _WIN32
+    success = success && ::_commit(::_fileno(m_file)) == 0;
+#elif defined(__linux__)
+    success = success && ::fdatasync(::fileno(m_file)) == 0;
+#else
+    success = success && ::fsync(::fileno(m_file)) == 0;
+#endif
+    if (!success) {
+        ERRLOG("failed to write %llu bytes to journal %s, errno %d", length, m_filepath.c_str(), errno);
+        ::clearerr(m_file);
+        TruncateFile(m_fileSize);
+        return false;
+    }
+    m_fileSize += length;
+    return true;
+}
+
+bool CheckpointJournal::TruncateFile(uint64_t length)
+{
+    ::fflush(m_file);
+#ifdef _WIN32
+    bool success = ::_chsize_s(::_fileno(m_file), static_cast<int64_t>(length)) == 0 &&
+        ::_commit(::_fileno(m_file)) == 0;
+#else
+    bool success = ::ftruncate(::fileno(m_file), static_cast<off_t>(length)) == 0 &&
+        ::fsync(::fileno(m_file)) == 0;
+#endif
+    if (!success) {
+        ERRLOG("failed to truncate journal %s to %llu bytes, errno %d", m_filepath.c_str(), length, errno);
+        return false;
+    }
+    m_fileSize = length;
+    return true;
+}
@@ -0,0 +1,169 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include <cerrno>
+#include <algorithm>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "Logger.h"
+#include "IORateLimiter.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::task;
+
+namespace {
+    // max time the bucket can run ahead of now, keep it small to pace I/O smoothly
+    const auto BURST_TOLERANCE = std::chrono::milliseconds(10);
+    const auto ADAPTIVE_WINDOW = std::chrono::milliseconds(200);
+    const uint64_t MIN_ADAPTIVE_BYTES_PER_SECOND = ONE_MB;
+
+#ifdef __linux__
+    // defined in linux/ioprio.h, which is not available on older distributions
+    const int IOPRIO_WHO_PROCESS = 1;
+    const int IOPRIO_CLASS_SHIFT = 13;
+    const int IOPRIO_CLASS_BE = 2;
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_BE_LOWEST_LEVEL = 7;
+
+    thread_local IOPriority g_threadIOPriority = IOPriority::NORMAL;
+#endif
+
+    // time to transfer amount at rate per second
+    std::chrono::nanoseconds CostOf(uint64_t amount, uint64_t ratePerSecond)
+    {
+        return std::chrono::nanoseconds(static_cast<int64_t>(
+            static_cast<double>(amount) * 1000000000.0 / static_cast<double>(ratePerSecond)));
+    }
+}
+
+IORateLimiter::IORateLimiter(uint64_t bytesPerSecond, uint64_t opsPerSecond, uint32_t latencyThresholdUs)
+{
+    SetLimit(bytesPerSecond, opsPerSecond, latencyThresholdUs);
+}
+
+void IORateLimiter::SetLimit(uint64_t bytesPerSecond, uint64_t opsPerSecond, uint32_t latencyThresholdUs)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto now = Clock::now();
+    m_bytesPerSecond = bytesPerSecond;
+    m_opsPerSecond = opsPerSecond;
+    m_latencyThresholdUs = latencyThresholdUs;
+    // debt charged under the previous limit may take too long to pay off under the new one
+    m_bytesRefillTime = now;
+    m_opsRefillTime = now;
+    m_adaptiveBytesPerSecond = 0;
+    m_windowStart = now;
+    m_windowBytes = 0;
+    m_windowLatencyUs = 0;
+    m_windowSamples = 0;
+}
+
+bool IORateLimiter::Admit()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto deadline = Clock::now() + BURST_TOLERANCE;
+    return (EffectiveBytesPerSecondLocked() == 0 || m_bytesRefillTime <= deadline) &&
+        (m_opsPerSecond == 0 || m_opsRefillTime <= deadline);
+}
+
+void IORateLimiter::Consume(uint64_t bytes, uint64_t ops)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto now = Clock::now();
+    uint64_t bytesPerSecond = EffectiveBytesPerSecondLocked();
+    if (bytesPerSecond != 0) {
+        m_bytesRefillTime = std::max(m_bytesRefillTime, now) + CostOf(bytes, bytesPerSecond);
+    }
+    if (m_opsPerSecond != 0) {
+        m_opsRefillTime = std::max(m_opsRefillTime, now) + CostOf(ops, m_opsPerSecond);
+    }
+    m_windowBytes += bytes;
+}
+
+void IORateLimiter::RecordLatency(std::chrono::microseconds latency)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_latencyThresholdUs == 0) {
+        return;
+    }
+    m_windowLatencyUs += static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+    ++m_windowSamples;
+    auto now = Clock::now();
+    if (now - m_windowStart >= ADAPTIVE_WINDOW) {
+        AdjustAdaptiveRate(now);
+    }
+}
+
+uint64_t IORateLimiter::EffectiveBytesPerSecond() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return EffectiveBytesPerSecondLocked();
+}
+
+uint64_t IORateLimiter::EffectiveBytesPerSecondLocked() const
+{
+    return (m_adaptiveBytesPerSecond != 0) ? m_adaptiveBytesPerSecond : m_bytesPerSecond;
+}
+
+/**
+ * @brief multiplicative decrease while average latency of the window is above threshold, additive increase otherwise.
+ *  The adaptive limit is dropped once it reaches the configured one, or doubles the observed rate if not configured.
+ */
+void IORateLimiter::AdjustAdaptiveRate(Clock::time_point now)
+{
+    uint64_t elapsedUs = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - m_windowStart).count());
+    uint64_t observedBytesPerSecond = m_windowBytes * 1000000 / std::max<uint64_t>(elapsedUs, 1);
+    uint64_t averageLatencyUs = m_windowLatencyUs / m_windowSamples;
+    if (averageLatencyUs > m_latencyThresholdUs) {
+        uint64_t base = EffectiveBytesPerSecondLocked();
+        if (base == 0 || base > observedBytesPerSecond) {
+            // limit not reached, backing off from it takes no effect
+            base = observedBytesPerSecond;
+        }
+        m_adaptiveBytesPerSecond = std::max(MIN_ADAPTIVE_BYTES_PER_SECOND, base / 4 * 3);
+        DBGLOG("average latency %lluus exceeds %uus, back off to %llu bytes/s",
+            averageLatencyUs, m_latencyThresholdUs, m_adaptiveBytesPerSecond);
+    } else if (m_adaptiveBytesPerSecond != 0) {
+        m_adaptiveBytesPerSecond += std::max(MIN_ADAPTIVE_BYTES_PER_SECOND, m_adaptiveBytesPerSecond / 8);
+        if ((m_bytesPerSecond != 0 && m_adaptiveBytesPerSecond >= m_bytesPerSecond) ||
+            (m_bytesPerSecond == 0 && m_adaptiveBytesPerSecond >= observedBytesPerSecond * 2)) {
+            DBGLOG("average latency %lluus recovered, drop adaptive limit", averageLatencyUs);
+            m_adaptiveBytesPerSecond = 0;
+        }
+    }
+    m_windowStart = now;
+    m_windowBytes = 0;
+    m_windowLatencyUs = 0;
+    m_windowSamples = 0;
+}
+
+void volumeprotect::task::ApplyThreadIOPriority(IOPriority priority)
+{
+#ifdef __linux__
+    if (priority == g_threadIOPriority) {
+        return;
+    }
+    // priority value 0 resets the thread to the default derived from cpu nice value
+    int ioprio = 0;
+    if (priority == IOPriority::LOW) {
+        ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | IOPRIO_BE_LOWEST_LEVEL;
+    } else if (priority == IOPriority::IDLE) {
+        ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+    }
+    if (::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) != 0) {
+        WARNLOG("failed to set I/O priority %d of thread, errno %d", static_cast<int>(priority), errno);
+    }
+    // don't retry on failure, the I/O is still done under the previous priority
+    g_threadIOPriority = priority;
+#else
+    (void)priority;
+#endif
+}
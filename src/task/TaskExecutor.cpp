@@ -0,0 +1,330 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include <algorithm>
+
+#include "Logger.h"
+#include "TaskExecutor.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::task;
+
+namespace {
+    const uint32_t MIN_EXECUTOR_WORKER_NUM = 4;
+    const auto MIN_WAIT_BACKOFF = std::chrono::microseconds(50);
+    const auto MAX_WAIT_BACKOFF = std::chrono::microseconds(2000);
+    const auto MAX_IDLE_INTERVAL = std::chrono::milliseconds(100);
+    // routine waiting for an event is also retried in this interval to check conditions not signaled (abort)
+    const auto MAX_EVENT_WAIT = std::chrono::milliseconds(100);
+
+    // event the routine running on the worker thread is going to wait for, set by TaskExecutor::WaitFor
+    thread_local std::shared_ptr<ExecutorEvent> g_waitEvent;
+    thread_local uint64_t g_waitSequence = 0;
+
+    uint32_t DefaultExecutorWorkerNum()
+    {
+        return std::max(MIN_EXECUTOR_WORKER_NUM, std::thread::hardware_concurrency());
+    }
+}
+
+ExecutorGroup::ExecutorGroup(uint32_t maxConcurrency)
+    : m_maxConcurrency(maxConcurrency)
+{}
+
+bool ExecutorGroup::TryAcquire()
+{
+    uint32_t running = m_running.load();
+    do {
+        if (m_maxConcurrency != 0 && running >= m_maxConcurrency) {
+            return false;
+        }
+    } while (!m_running.compare_exchange_weak(running, running + 1));
+    return true;
+}
+
+void ExecutorGroup::Release()
+{
+    --m_running;
+}
+
+uint64_t ExecutorEvent::Sequence() const
+{
+    return m_sequence.load();
+}
+
+// pairs with ParkOnEvent: either the waiter is seen here, or the waiter see the sequence changed
+void ExecutorEvent::Notify()
+{
+    ++m_sequence;
+    if (m_waiters.load() == 0) {
+        return;
+    }
+    TaskExecutor* executor = m_executor.load();
+    if (executor != nullptr) {
+        executor->Wake(this);
+    }
+}
+
+ExecutorJob::ExecutorJob(StepRoutine routine, std::shared_ptr<ExecutorGroup> group)
+    : m_routine(routine), m_group(group)
+{}
+
+void ExecutorJob::Wait()
+{
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_cv.wait(lk, [&]() { return m_done; });
+}
+
+bool ExecutorJob::IsDone() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_done;
+}
+
+void ExecutorJob::MarkDone()
+{
+    // release resources captured by the routine before the waiter is woken up
+    m_routine = nullptr;
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_done = true;
+    m_cv.notify_all();
+}
+
+TaskExecutor& TaskExecutor::Instance()
+{
+    static TaskExecutor executor(DefaultExecutorWorkerNum());
+    return executor;
+}
+
+TaskExecutor::TaskExecutor(uint32_t workerNum)
+{
+    workerNum = std::max(1U, workerNum);
+    for (uint32_t workerID = 0; workerID < workerNum; ++workerID) {
+        m_queues.emplace_back(new WorkerQueue());
+    }
+    for (uint32_t workerID = 0; workerID < workerNum; ++workerID) {
+        m_workers.emplace_back(&TaskExecutor::WorkerThread, this, workerID);
+    }
+}
+
+TaskExecutor::~TaskExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (std::thread& worker : m_workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    while (!m_parked.empty()) {
+        Unpark(m_parked.size() - 1);
+    }
+}
+
+std::shared_ptr<ExecutorJob> TaskExecutor::Submit(StepRoutine routine, std::shared_ptr<ExecutorGroup> group)
+{
+    auto job = std::make_shared<ExecutorJob>(routine, group);
+    Push(m_nextQueue++ % m_queues.size(), job);
+    return job;
+}
+
+uint32_t TaskExecutor::WorkerNum() const
+{
+    return static_cast<uint32_t>(m_workers.size());
+}
+
+StepResult TaskExecutor::WaitFor(std::shared_ptr<ExecutorEvent> event, uint64_t sequence)
+{
+    g_waitEvent = event;
+    g_waitSequence = sequence;
+    return StepResult::WAIT;
+}
+
+void TaskExecutor::WorkerThread(uint32_t workerID)
+{
+    while (true) {
+        std::shared_ptr<ExecutorJob> job = PopLocal(workerID);
+        if (job == nullptr) {
+            job = Steal(workerID);
+        }
+        if (job == nullptr) {
+            job = PopParked();
+        }
+        if (job != nullptr) {
+            RunJob(workerID, job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (m_stop) {
+            return;
+        }
+        m_cv.wait_until(lk, NextWakeTime(), [&]() { return m_stop || m_readyJobs.load() != 0; });
+    }
+}
+
+void TaskExecutor::RunJob(uint32_t workerID, std::shared_ptr<ExecutorJob> job)
+{
+    if (job->m_group != nullptr && !job->m_group->TryAcquire()) {
+        // concurrency limit of the task reached, retry later
+        job->m_backoff = MIN_WAIT_BACKOFF;
+        Park(job);
+        return;
+    }
+    g_waitEvent = nullptr;
+    StepResult result = job->m_routine();
+    if (job->m_group != nullptr) {
+        job->m_group->Release();
+    }
+    switch (result) {
+        case StepResult::CONTINUE: {
+            job->m_backoff = std::chrono::microseconds(0);
+            Push(workerID, job);
+            break;
+        }
+        case StepResult::WAIT: {
+            if (g_waitEvent != nullptr) {
+                job->m_backoff = std::chrono::microseconds(0);
+                ParkOnEvent(workerID, job, g_waitEvent, g_waitSequence);
+                g_waitEvent = nullptr;
+                break;
+            }
+            job->m_backoff = std::min(MAX_WAIT_BACKOFF, std::max(MIN_WAIT_BACKOFF, job->m_backoff * 2));
+            Park(job);
+            break;
+        }
+        case StepResult::DONE: {
+            job->MarkDone();
+            break;
+        }
+    }
+}
+
+void TaskExecutor::Push(uint32_t workerID, std::shared_ptr<ExecutorJob> job)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_queues[workerID]->mutex);
+        m_queues[workerID]->jobs.push_back(job);
+        ++m_readyJobs;
+    }
+    // lock to avoid missing the notification by a worker going to wait
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_cv.notify_one();
+}
+
+void TaskExecutor::Park(std::shared_ptr<ExecutorJob> job)
+{
+    job->m_wakeTime = std::chrono::steady_clock::now() + job->m_backoff;
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_parked.push_back(job);
+}
+
+void TaskExecutor::ParkOnEvent(uint32_t workerID, std::shared_ptr<ExecutorJob> job,
+    std::shared_ptr<ExecutorEvent> event, uint64_t sequence)
+{
+    event->m_executor.store(this);
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        ++event->m_waiters;
+        if (event->m_sequence.load() == sequence) {
+            job->m_waitEvent = event;
+            job->m_wakeTime = std::chrono::steady_clock::now() + MAX_EVENT_WAIT;
+            m_parked.push_back(job);
+            return;
+        }
+        --event->m_waiters;
+    }
+    // notified after the routine checked the condition, retry at once
+    Push(workerID, job);
+}
+
+// move routines parked on the event to run queues
+void TaskExecutor::Wake(const ExecutorEvent* event)
+{
+    std::vector<std::shared_ptr<ExecutorJob>> jobs;
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        std::size_t i = 0;
+        while (i < m_parked.size()) {
+            if (m_parked[i]->m_waitEvent.get() == event) {
+                jobs.push_back(Unpark(i));
+            } else {
+                ++i;
+            }
+        }
+    }
+    for (std::shared_ptr<ExecutorJob>& job : jobs) {
+        Push(m_nextQueue++ % m_queues.size(), job);
+    }
+}
+
+// must be called with m_mutex held, the last parked job is moved to index
+std::shared_ptr<ExecutorJob> TaskExecutor::Unpark(std::size_t index)
+{
+    std::shared_ptr<ExecutorJob> job = m_parked[index];
+    m_parked[index] = m_parked.back();
+    m_parked.pop_back();
+    if (job->m_waitEvent != nullptr) {
+        --job->m_waitEvent->m_waiters;
+        job->m_waitEvent.reset();
+    }
+    return job;
+}
+
+// owner pops from front so that routines requeued by itself run in turn
+std::shared_ptr<ExecutorJob> TaskExecutor::PopLocal(uint32_t workerID)
+{
+    WorkerQueue& queue = *m_queues[workerID];
+    std::lock_guard<std::mutex> lk(queue.mutex);
+    if (queue.jobs.empty()) {
+        return nullptr;
+    }
+    std::shared_ptr<ExecutorJob> job = queue.jobs.front();
+    queue.jobs.pop_front();
+    --m_readyJobs;
+    return job;
+}
+
+// steal from back of other workers' queue, starting from the next worker
+std::shared_ptr<ExecutorJob> TaskExecutor::Steal(uint32_t workerID)
+{
+    for (std::size_t i = 1; i < m_queues.size(); ++i) {
+        WorkerQueue& queue = *m_queues[(workerID + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lk(queue.mutex);
+        if (queue.jobs.empty()) {
+            continue;
+        }
+        std::shared_ptr<ExecutorJob> job = queue.jobs.back();
+        queue.jobs.pop_back();
+        --m_readyJobs;
+        return job;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<ExecutorJob> TaskExecutor::PopParked()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (std::size_t i = 0; i < m_parked.size(); ++i) {
+        if (m_parked[i]->m_wakeTime <= now) {
+            return Unpark(i);
+        }
+    }
+    return nullptr;
+}
+
+// must be called with m_mutex held
+std::chrono::steady_clock::time_point TaskExecutor::NextWakeTime() const
+{
+    auto wakeTime = std::chrono::steady_clock::now() + MAX_IDLE_INTERVAL;
+    for (const std::shared_ptr<ExecutorJob>& job : m_parked) {
+        wakeTime = std::min(wakeTime, job->m_wakeTime);
+    }
+    return wakeTime;
+}
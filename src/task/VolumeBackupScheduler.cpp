@@ -0,0 +1,216 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include "Logger.h"
+#include "BlockHash.h"
+#include "native/FileSystemAPI.h"
+#include "VolumeBackupScheduler.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::task;
+
+namespace {
+    // backup tasks don't notify the scheduler, their status is polled
+    constexpr auto SCHEDULER_CHECK_INTERVAL = std::chrono::milliseconds(100);
+}
+
+VolumeBackupScheduler::VolumeBackupScheduler(
+    const VolumeBackupSchedulerConfig& schedulerConfig,
+    std::vector<std::shared_ptr<ScheduledBackupTask>> tasks)
+  : m_maxRunningTasks(std::max(schedulerConfig.maxRunningTasks, 1U)),
+    m_maxTasksPerDevice(std::max(schedulerConfig.maxTasksPerDevice, 1U)),
+    m_memoryBudget(schedulerConfig.memoryBudget),
+    m_tasks(tasks),
+    m_notifier(std::make_shared<TaskEventNotifier>())
+{}
+
+VolumeBackupScheduler::~VolumeBackupScheduler()
+{
+    DBGLOG("destroy volume backup scheduler, wait scheduler thread to join");
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool VolumeBackupScheduler::Start()
+{
+    AssertTaskNotStarted();
+    m_status = TaskStatus::RUNNING;
+    m_thread = std::thread(&VolumeBackupScheduler::ThreadFunc, this);
+    return true;
+}
+
+TaskStatistics VolumeBackupScheduler::GetStatistics() const
+{
+    TaskStatistics statistics {};
+    for (const std::shared_ptr<ScheduledBackupTask>& scheduledTask : m_tasks) {
+        statistics = statistics + scheduledTask->task->GetStatistics();
+    }
+    return statistics;
+}
+
+void VolumeBackupScheduler::Abort()
+{
+    StatefulTask::Abort();
+    m_notifier->Notify();
+}
+
+// each task keeps its own limiters, so the limit applies to every task rather than to all of them together
+bool VolumeBackupScheduler::SetRateLimit(const IORateLimit& rateLimit)
+{
+    bool success = true;
+    for (const std::shared_ptr<ScheduledBackupTask>& scheduledTask : m_tasks) {
+        success = scheduledTask->task->SetRateLimit(rateLimit) && success;
+    }
+    return success;
+}
+
+uint64_t VolumeBackupScheduler::EstimateTaskMemory(const VolumeBackupConfig& backupConfig, uint64_t volumeSize)
+{
+    uint64_t blockSize = std::max(backupConfig.blockSize, 1U);
+    uint64_t sessionSize = std::max(std::min(backupConfig.sessionSize, volumeSize), blockSize);
+    uint64_t sessionNum = (volumeSize + sessionSize - 1) / sessionSize;
+    uint64_t sessionBlocks = (sessionSize + blockSize - 1) / blockSize;
+    // pages of mapped tables are reclaimable and not counted
+    uint64_t tableCount = (backupConfig.backupType == BackupType::FOREVER_INC) ? 2 : 1;
+    tableCount = backupConfig.mapChecksumTable ? 0 : tableCount;
+    uint64_t checksumTableSize = backupConfig.hasherEnabled ?
+        sessionBlocks * blockhash::DigestSize(backupConfig.hashAlgorithm) : 0;
+    uint64_t subBlocksPerBlock = SubBlocksPerBlock(backupConfig.blockSize, backupConfig.subBlockSize);
+    uint64_t subChecksumTableSize = backupConfig.hasherEnabled ?
+        sessionBlocks * SUB_BLOCK_CHECKSUM_SIZE * subBlocksPerBlock : 0;
+    uint64_t sessionMemory = DEFAULT_ALLOCATOR_BLOCK_NUM * blockSize +
+        tableCount * (checksumTableSize + subChecksumTableSize);
+    if (backupConfig.sessionMemoryBudget != 0) {
+        // sessions overlap as long as memory budget of the task allows
+        return std::max(sessionMemory, std::min(backupConfig.sessionMemoryBudget, sessionMemory * sessionNum));
+    }
+    return sessionMemory * std::max(std::min<uint64_t>(backupConfig.sessionConcurrency, sessionNum), 1LU);
+}
+
+std::vector<std::string> VolumeBackupScheduler::ResolveVolumeDevices(const std::string& volumePath)
+{
+#ifdef __linux__
+    std::vector<std::string> devices = fsapi::ResolvePhysicalDisksLinux(volumePath);
+    if (!devices.empty()) {
+        return devices;
+    }
+#endif
+    return { volumePath };
+}
+
+void VolumeBackupScheduler::ThreadFunc()
+{
+    DBGLOG("start scheduler thread, %llu backup tasks", m_tasks.size());
+    while (true) {
+        if (m_abort) {
+            AbortRunningTasks();
+            m_status = TaskStatus::ABORTED;
+            return;
+        }
+        PollRunningTasks();
+        StartPendingTasks();
+        if (m_runningTasks.empty()) {
+            // tasks are always startable when nothing is running, so no task is pending
+            break;
+        }
+        m_notifier->WaitFor(SCHEDULER_CHECK_INTERVAL);
+    }
+    m_status = TaskStatus::SUCCEED;
+    for (const std::shared_ptr<ScheduledBackupTask>& scheduledTask : m_tasks) {
+        if (scheduledTask->task->GetStatus() != TaskStatus::SUCCEED) {
+            ERRLOG("backup task of volume %s terminated with status %s",
+                scheduledTask->volumePath.c_str(), scheduledTask->task->GetStatusString().c_str());
+            m_errorCode = scheduledTask->task->GetErrorCode();
+            m_status = TaskStatus::FAILED;
+            break;
+        }
+    }
+    INFOLOG("scheduler thread terminated with status %s", GetStatusString().c_str());
+}
+
+/**
+ * @brief a task can start if it doesn't exceed any limit,
+ *  the first pending task can always start if nothing is running, even if it exceeds the memory budget alone
+ */
+bool VolumeBackupScheduler::CanStartTask(const ScheduledBackupTask& scheduledTask) const
+{
+    if (m_runningTasks.empty()) {
+        return true;
+    }
+    if (m_runningTasks.size() >= m_maxRunningTasks) {
+        return false;
+    }
+    if (m_memoryBudget != 0 && m_runningMemory + scheduledTask.memory > m_memoryBudget) {
+        return false;
+    }
+    for (const std::string& device : scheduledTask.devices) {
+        auto it = m_deviceRunningTasks.find(device);
+        if (it != m_deviceRunningTasks.end() && it->second >= m_maxTasksPerDevice) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VolumeBackupScheduler::StartPendingTasks()
+{
+    for (const std::shared_ptr<ScheduledBackupTask>& scheduledTask : m_tasks) {
+        if (scheduledTask->started || !CanStartTask(*scheduledTask)) {
+            continue;
+        }
+        scheduledTask->started = true;
+        if (!scheduledTask->task->Start()) {
+            ERRLOG("failed to start backup task of volume %s", scheduledTask->volumePath.c_str());
+            continue;
+        }
+        INFOLOG("backup task of volume %s started, estimated memory %llu",
+            scheduledTask->volumePath.c_str(), scheduledTask->memory);
+        for (const std::string& device : scheduledTask->devices) {
+            ++m_deviceRunningTasks[device];
+        }
+        m_runningMemory += scheduledTask->memory;
+        m_runningTasks.push_back(scheduledTask);
+    }
+}
+
+void VolumeBackupScheduler::PollRunningTasks()
+{
+    auto it = m_runningTasks.begin();
+    while (it != m_runningTasks.end()) {
+        if (!(*it)->task->IsTerminated()) {
+            ++it;
+            continue;
+        }
+        INFOLOG("backup task of volume %s terminated with status %s",
+            (*it)->volumePath.c_str(), (*it)->task->GetStatusString().c_str());
+        ReleaseTaskResources(**it);
+        it = m_runningTasks.erase(it);
+    }
+}
+
+void VolumeBackupScheduler::AbortRunningTasks()
+{
+    for (const std::shared_ptr<ScheduledBackupTask>& scheduledTask : m_runningTasks) {
+        scheduledTask->task->Abort();
+    }
+    while (!m_runningTasks.empty()) {
+        PollRunningTasks();
+        if (!m_runningTasks.empty()) {
+            std::this_thread::sleep_for(SCHEDULER_CHECK_INTERVAL);
+        }
+    }
+}
+
+void VolumeBackupScheduler::ReleaseTaskResources(const ScheduledBackupTask& scheduledTask)
+{
+    for (const std::string& device : scheduledTask.devices) {
+        if (--m_deviceRunningTasks[device] == 0) {
+            m_deviceRunningTasks.erase(device);
+        }
+    }
+    m_runningMemory -= scheduledTask.memory;
+}
@@ -11,8 +11,10 @@
 #include "VolumeBlockReader.h"
 #include "VolumeBlockHasher.h"
 #include "VolumeBlockWriter.h"
-#include "BlockingQueue.h"
+#include "RingQueue.h"
+#include "BlockHash.h"
 #include "native/FileSystemAPI.h"
+#include "native/RawIO.h"
 #include "VolumeBackupTask.h"
 
 using namespace volumeprotect;
@@ -20,7 +22,8 @@ using namespace volumeprotect::common;
 using namespace volumeprotect::task;
 
 namespace {
-    constexpr auto TASK_CHECK_SLEEP_INTERVAL = std::chrono::seconds(1);
+    // main thread is woken up by session events, statistics and checkpoint are refreshed on timeout
+    constexpr auto TASK_STATISTICS_REFRESH_INTERVAL = std::chrono::milliseconds(100);
 }
 
 VolumeBackupTask::VolumeBackupTask(const VolumeBackupConfig& backupConfig, uint64_t volumeSize)
@@ -33,7 +36,13 @@ VolumeBackupTask::VolumeBackupTask(const VolumeBackupConfig& backupConfig, uint6
         backupConfig.copyName,
         volumeSize,
         backupConfig.sessionSize
-    }))
+    })),
+    m_notifier(std::make_shared<TaskEventNotifier>()),
+    m_executorGroup(std::make_shared<ExecutorGroup>(backupConfig.stageConcurrency)),
+    m_readLimiter(std::make_shared<IORateLimiter>(backupConfig.rateLimit.readBytesPerSecond,
+        backupConfig.rateLimit.readOpsPerSecond, backupConfig.rateLimit.readLatencyThresholdUs)),
+    m_writeLimiter(std::make_shared<IORateLimiter>(backupConfig.rateLimit.writeBytesPerSecond,
+        backupConfig.rateLimit.writeOpsPerSecond))
 {}
 
 VolumeBackupTask::~VolumeBackupTask()
@@ -66,6 +75,25 @@ TaskStatistics VolumeBackupTask::GetStatistics() const
     return m_completedSessionStatistics + m_currentSessionStatistics;
 }
 
+// wake up main thread to abort running sessions immediately
+void VolumeBackupTask::Abort()
+{
+    StatefulTask::Abort();
+    m_notifier->Notify();
+}
+
+// limiters are shared by all sessions, new limit takes effect on the next I/O
+bool VolumeBackupTask::SetRateLimit(const IORateLimit& rateLimit)
+{
+    INFOLOG("set rate limit, read %llu bytes/s %llu ops/s, write %llu bytes/s %llu ops/s, read latency threshold %uus",
+        rateLimit.readBytesPerSecond, rateLimit.readOpsPerSecond,
+        rateLimit.writeBytesPerSecond, rateLimit.writeOpsPerSecond, rateLimit.readLatencyThresholdUs);
+    m_readLimiter->SetLimit(
+        rateLimit.readBytesPerSecond, rateLimit.readOpsPerSecond, rateLimit.readLatencyThresholdUs);
+    m_writeLimiter->SetLimit(rateLimit.writeBytesPerSecond, rateLimit.writeOpsPerSecond);
+    return true;
+}
+
 bool VolumeBackupTask::IsIncrementBackup() const
 {
     return m_backupConfig->backupType == BackupType::FOREVER_INC;
@@ -83,6 +111,20 @@ bool VolumeBackupTask::Prepare()
     volumeCopyMeta.volumeSize = m_volumeSize;
     volumeCopyMeta.blockSize = DEFAULT_BLOCK_SIZE;
     volumeCopyMeta.volumePath = volumePath;
+    volumeCopyMeta.hashAlgorithm = static_cast<int>(m_backupConfig->hashAlgorithm);
+    volumeCopyMeta.checksumSize = blockhash::DigestSize(m_backupConfig->hashAlgorithm);
+    if (volumeCopyMeta.checksumSize == 0) {
+        ERRLOG("invalid hash algorithm %d", static_cast<int>(m_backupConfig->hashAlgorithm));
+        return false;
+    }
+    uint32_t subBlocksPerBlock = SubBlocksPerBlock(m_backupConfig->blockSize, m_backupConfig->subBlockSize);
+    if (subBlocksPerBlock > MAX_SUB_BLOCKS_PER_BLOCK) {
+        ERRLOG("sub-block size %u too small for block size %u",
+            m_backupConfig->subBlockSize, m_backupConfig->blockSize);
+        return false;
+    }
+    volumeCopyMeta.subBlockSize = (m_backupConfig->hasherEnabled && subBlocksPerBlock != 0) ?
+        m_backupConfig->subBlockSize : 0;
 
     // prepare backup resource
     if (!m_resourceManager->PrepareCopyResource()) {
@@ -95,6 +137,22 @@ bool VolumeBackupTask::Prepare()
         ERRLOG("failed to validate increment backup");
         return false;
     }
+    m_subBlockSize = volumeCopyMeta.subBlockSize;
+    m_prevSubBlockChecksumAvailable = IsIncrementBackup() && m_subBlockSize != 0 && IsPreviousSubBlockChecksumMatched();
+
+    // load allocation map of filesystem, fallback to read all blocks if failed
+    if (m_backupConfig->skipUnallocatedBlock && !LoadVolumeFreeExtents()) {
+        WARNLOG("failed to load allocation map of %s, all blocks will be read", volumePath.c_str());
+        m_freeExtents.clear();
+    }
+
+    // list changed ranges since previous copy from CBT source, fallback to read all blocks if failed
+    volumeCopyMeta.cbtType = static_cast<int>(m_backupConfig->cbtType);
+    if (m_backupConfig->cbtType != ChangedBlockTracking::NONE && !LoadChangedExtents(volumeCopyMeta.cbtToken)) {
+        WARNLOG("changed block tracking of %s not available, all blocks will be read", volumePath.c_str());
+        m_changedExtents.clear();
+        m_changedExtentsAvailable = false;
+    }
 
     // 2. split session
     int sessionIndex = 0;
@@ -119,6 +177,10 @@ bool VolumeBackupTask::Prepare()
         std::string writerBitmapPath = common::GetWriterBitmapFilePath(
             m_backupConfig->checkpointDirPath, m_backupConfig->copyName, sessionIndex);
         m_checkpointFiles.emplace_back(writerBitmapPath);
+        if (m_backupConfig->checkpointMode == CheckpointMode::JOURNAL) {
+            m_checkpointFiles.emplace_back(common::GetCheckpointJournalFilePath(
+                m_backupConfig->checkpointDirPath, m_backupConfig->copyName, sessionIndex));
+        }
         sessionOffset += sessionSize;
         ++sessionIndex;
     }
@@ -145,13 +207,26 @@ VolumeTaskSession VolumeBackupTask::NewVolumeTaskSession(
         prevChecksumBinPath = common::GetChecksumBinPath(
             m_backupConfig->prevCopyMetaDirPath, m_backupConfig->copyName, sessionIndex);
     }
+    std::string lastestSubChecksumBinPath = "";
+    std::string prevSubChecksumBinPath = "";
+    if (m_subBlockSize != 0) {
+        lastestSubChecksumBinPath = common::GetSubBlockChecksumBinPath(
+            m_backupConfig->outputCopyMetaDirPath, m_backupConfig->copyName, sessionIndex);
+    }
+    if (m_prevSubBlockChecksumAvailable) {
+        prevSubChecksumBinPath = common::GetSubBlockChecksumBinPath(
+            m_backupConfig->prevCopyMetaDirPath, m_backupConfig->copyName, sessionIndex);
+    }
 
     VolumeTaskSession session {};
     session.sharedConfig = std::make_shared<VolumeTaskSharedConfig>();
     session.sharedConfig->copyFormat = m_backupConfig->copyFormat;
     session.sharedConfig->volumePath = m_backupConfig->volumePath;
     session.sharedConfig->hasherEnabled = m_backupConfig->hasherEnabled;
-    session.sharedConfig->hasherWorkerNum = m_backupConfig->hasherNum;
+    // hasher workers are divided among concurrent sessions to keep the total number of hashing routines
+    session.sharedConfig->hasherWorkerNum = std::max(
+        m_backupConfig->hasherNum / std::max(m_backupConfig->sessionConcurrency, 1U), 1U);
+    session.sharedConfig->readerWorkerNum = m_backupConfig->readerNum;
     session.sharedConfig->blockSize = m_backupConfig->blockSize;
     session.sharedConfig->sessionOffset = sessionOffset;
     session.sharedConfig->sessionSize = sessionSize;
@@ -160,7 +235,23 @@ VolumeTaskSession VolumeBackupTask::NewVolumeTaskSession(
     session.sharedConfig->copyFilePath = copyFilePath;
     session.sharedConfig->checkpointFilePath = writerBitmapPath;
     session.sharedConfig->checkpointEnabled = m_backupConfig->enableCheckpoint;
+    if (m_backupConfig->checkpointMode == CheckpointMode::JOURNAL) {
+        session.sharedConfig->checkpointJournalPath = common::GetCheckpointJournalFilePath(
+            m_backupConfig->checkpointDirPath, m_backupConfig->copyName, sessionIndex);
+    }
+    session.sharedConfig->mapChecksumTable = m_backupConfig->mapChecksumTable;
     session.sharedConfig->skipEmptyBlock = m_backupConfig->skipEmptyBlock;
+    // block became zero since previous copy need to be deallocated, otherwise stale data remains in copy file
+    session.sharedConfig->punchZeroBlock =
+        m_backupConfig->skipEmptyBlock && m_backupConfig->backupType == BackupType::FOREVER_INC;
+    session.sharedConfig->hashAlgorithm = m_backupConfig->hashAlgorithm;
+    session.sharedConfig->subBlockSize = m_subBlockSize;
+    session.sharedConfig->lastestSubChecksumBinPath = lastestSubChecksumBinPath;
+    session.sharedConfig->prevSubChecksumBinPath = prevSubChecksumBinPath;
+    session.sharedConfig->ioEngine = m_backupConfig->ioEngine;
+    session.sharedConfig->ioQueueDepth = m_backupConfig->ioQueueDepth;
+    session.sharedConfig->ioCacheMode = m_backupConfig->ioCacheMode;
+    session.sharedConfig->ioPriority = m_backupConfig->ioPriority;
     return session;
 }
 
@@ -197,14 +288,25 @@ bool VolumeBackupTask::InitBackupSessionContext(std::shared_ptr<VolumeTaskSessio
     session->sharedContext = std::make_shared<VolumeTaskSharedContext>();
     session->sharedContext->counter = std::make_shared<SessionCounter>();
     session->sharedContext->allocator = std::make_shared<VolumeBlockAllocator>(
-        session->sharedConfig->blockSize, DEFAULT_ALLOCATOR_BLOCK_NUM);
-    session->sharedContext->hashingQueue = std::make_shared<BlockingQueue<VolumeConsumeBlock>>(DEFAULT_QUEUE_SIZE);
-    session->sharedContext->writeQueue = std::make_shared<BlockingQueue<VolumeConsumeBlock>>(DEFAULT_QUEUE_SIZE);
+        session->sharedConfig->blockSize,
+        DEFAULT_ALLOCATOR_BLOCK_NUM,
+        rawio::DirectIOAlignment(session->sharedConfig->volumePath));
+    session->sharedContext->InitHashingQueue(DEFAULT_QUEUE_SIZE);
+    session->sharedContext->InitWriteQueue(DEFAULT_QUEUE_SIZE);
+    session->sharedContext->notifier = m_notifier;
+    session->sharedContext->executorGroup = m_executorGroup;
+    session->sharedContext->readLimiter = m_readLimiter;
+    session->sharedContext->writeLimiter = m_writeLimiter;
     if (!InitHashingContext(session)) {
         ERRLOG("failed to init hashing context");
         return false;
     }
     InitSessionBitmap(session);
+    if (!InitSessionAllocatedBitmap(session)) {
+        ERRLOG("failed to init checksum of unallocated blocks");
+        return false;
+    }
+    InitSessionChangedBitmap(session);
     // 2. restore checkpoint if restarted
     RestoreSessionCheckpoint(session);
     // 3. check and init task executor
@@ -237,66 +339,127 @@ bool VolumeBackupTask::StartBackupSession(std::shared_ptr<VolumeTaskSession> ses
     return true;
 }
 
+/**
+ * @brief Sessions are started as soon as the concurrency and memory budget allow, a slot of concurrency is released
+ *  once the reader of the session completes, so the next session can be prepared while the previous one drains.
+ */
 void VolumeBackupTask::ThreadFunc()
 {
     DBGLOG("start task main thread");
-    while (!m_sessionQueue.empty()) {
+    std::vector<std::shared_ptr<VolumeTaskSession>> runningSessions;
+    auto abortRunningSessions = [&runningSessions]() {
+        for (const std::shared_ptr<VolumeTaskSession>& runningSession : runningSessions) {
+            runningSession->Abort();
+        }
+    };
+    while (!m_sessionQueue.empty() || !runningSessions.empty()) {
         if (m_abort) {
+            abortRunningSessions();
             m_status = TaskStatus::ABORTED;
             return;
         }
-        // pop a session from session queue to init a new session
-        std::shared_ptr<VolumeTaskSession> session = std::make_shared<VolumeTaskSession>(m_sessionQueue.front());
-        m_sessionQueue.pop();
-        if (!InitBackupSessionContext(session)) {
-            m_status = TaskStatus::FAILED;
-            return;
+        while (!m_sessionQueue.empty() && CanStartNextSession(runningSessions)) {
+            // pop a session from session queue to init a new session
+            std::shared_ptr<VolumeTaskSession> session = std::make_shared<VolumeTaskSession>(m_sessionQueue.front());
+            m_sessionQueue.pop();
+            if (!InitBackupSessionContext(session)) {
+                abortRunningSessions();
+                m_status = TaskStatus::FAILED;
+                return;
+            }
+            RestoreSessionCheckpoint(session);
+            if (!StartBackupSession(session)) {
+                session->Abort();
+                abortRunningSessions();
+                m_status = TaskStatus::FAILED;
+                return;
+            }
+            INFOLOG("backup session offset %llu started, %llu sessions running",
+                session->sharedConfig->sessionOffset, runningSessions.size() + 1);
+            runningSessions.push_back(session);
         }
-        RestoreSessionCheckpoint(session);
-        if (!StartBackupSession(session)) {
-            session->Abort();
-            m_status = TaskStatus::FAILED;
-            return;
-        }
-        if (!WaitSessionTerminate(session)) {
+        if (!PollRunningSessions(runningSessions)) {
             // fail and exit
+            abortRunningSessions();
             return;
         }
+        if (!runningSessions.empty()) {
+            m_notifier->WaitFor(TASK_STATISTICS_REFRESH_INTERVAL);
+        }
     }
     ClearAllCheckpoints();
     m_status = TaskStatus::SUCCEED;
     return;
 }
 
-bool VolumeBackupTask::WaitSessionTerminate(std::shared_ptr<VolumeTaskSession> session)
+// check all running sessions, remove the completed ones, return false if any session failed
+bool VolumeBackupTask::PollRunningSessions(std::vector<std::shared_ptr<VolumeTaskSession>>& runningSessions)
 {
-    // block the thread
-    auto counter = session->sharedContext->counter;
-    while (true) {
-        if (m_abort) {
-            session->Abort();
-            m_status = TaskStatus::ABORTED;
-            return false;
-        }
+    std::vector<std::shared_ptr<VolumeTaskSession>> completedSessions;
+    for (auto it = runningSessions.begin(); it != runningSessions.end();) {
+        std::shared_ptr<VolumeTaskSession> session = *it;
         if (session->IsFailed()) {
-            ERRLOG("backup session failed");
+            ERRLOG("backup session offset %llu failed", session->sharedConfig->sessionOffset);
             m_errorCode = session->GetErrorCode();
             m_status = TaskStatus::FAILED;
             return false;
         }
-        if (session->IsTerminated())  {
-            break;
+        if (!session->IsTerminated()) {
+            RefreshSessionCheckpoint(session);
+            ++it;
+            continue;
         }
-        UpdateRunningSessionStatistics(session);
-        RefreshSessionCheckpoint(session);
-        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+        CompleteSession(session);
+        completedSessions.push_back(session);
+        it = runningSessions.erase(it);
     }
-    DBGLOG("backup session complete successfully");
+    UpdateConcurrentSessionStatistics(runningSessions, completedSessions);
+    return true;
+}
+
+void VolumeBackupTask::CompleteSession(std::shared_ptr<VolumeTaskSession> session)
+{
+    DBGLOG("backup session offset %llu complete successfully", session->sharedConfig->sessionOffset);
     FlushSessionLatestHashingTable(session);
     FlushSessionWriter(session);
     FlushSessionBitmap(session);
-    UpdateCompletedSessionStatistics(session);
-    return true;
+}
+
+bool VolumeBackupTask::CanStartNextSession(const std::vector<std::shared_ptr<VolumeTaskSession>>& runningSessions) const
+{
+    if (runningSessions.empty()) {
+        return true;
+    }
+    uint32_t concurrency = std::max(m_backupConfig->sessionConcurrency, 1U);
+    uint32_t readingSessions = 0;
+    uint64_t usedMemory = 0;
+    for (const std::shared_ptr<VolumeTaskSession>& session : runningSessions) {
+        if (!session->readerTask->IsTerminated()) {
+            ++readingSessions;
+        }
+        usedMemory += EstimateSessionMemory(*session);
+    }
+    if (readingSessions >= concurrency) {
+        return false;
+    }
+    // without memory budget, sessions drained by hasher/writer still occupy the slot
+    if (m_backupConfig->sessionMemoryBudget == 0) {
+        return runningSessions.size() < concurrency;
+    }
+    return usedMemory + EstimateSessionMemory(m_sessionQueue.front()) <= m_backupConfig->sessionMemoryBudget;
+}
+
+// memory of block buffers and checksum tables held by a session until it completes, pages of mapped tables are
+// reclaimable and not counted
+uint64_t VolumeBackupTask::EstimateSessionMemory(const VolumeTaskSession& session) const
+{
+    auto sharedConfig = session.sharedConfig;
+    uint64_t tableCount = sharedConfig->mapChecksumTable ? 0 : (IsIncrementBackup() ? 2 : 1);
+    uint64_t checksumTableSize = session.TotalBlocks() * blockhash::DigestSize(sharedConfig->hashAlgorithm);
+    uint64_t subChecksumTableSize = session.TotalBlocks() * SUB_BLOCK_CHECKSUM_SIZE *
+        SubBlocksPerBlock(sharedConfig->blockSize, sharedConfig->subBlockSize);
+    return static_cast<uint64_t>(DEFAULT_ALLOCATOR_BLOCK_NUM) * sharedConfig->blockSize +
+        tableCount * (checksumTableSize + subChecksumTableSize);
 }
 
 bool VolumeBackupTask::InitHashingContext(std::shared_ptr<VolumeTaskSession> session) const
@@ -304,37 +467,118 @@ bool VolumeBackupTask::InitHashingContext(std::shared_ptr<VolumeTaskSession> ses
     // 1. allocate checksum table
     auto sharedConfig = session->sharedConfig;
     auto sharedContext = session->sharedContext;
-    uint64_t lastestChecksumTableSize = session->TotalBlocks() * SHA256_CHECKSUM_SIZE;
+    uint64_t lastestChecksumTableSize = session->TotalBlocks() * blockhash::DigestSize(sharedConfig->hashAlgorithm);
     uint64_t prevChecksumTableSize = lastestChecksumTableSize;
+    uint64_t subChecksumTableSize = session->TotalBlocks() * SUB_BLOCK_CHECKSUM_SIZE *
+        SubBlocksPerBlock(sharedConfig->blockSize, sharedConfig->subBlockSize);
+    if (sharedConfig->mapChecksumTable && InitMappedHashingContext(session)) {
+        return true;
+    }
     try {
         sharedContext->hashingContext = IsIncrementBackup() ?
             std::make_shared<BlockHashingContext>(prevChecksumTableSize, lastestChecksumTableSize)
             : std::make_shared<BlockHashingContext>(lastestChecksumTableSize);
+        if (subChecksumTableSize != 0) {
+            sharedContext->hashingContext->AllocSubBlockTable(subChecksumTableSize);
+        }
     } catch (const std::exception& e) {
-        ERRLOG("failed to malloc BlockHashingContext, length: %llu, message: %s", lastestChecksumTableSize, e.what());
+        ERRLOG("failed to malloc BlockHashingContext, length: %llu, sub-block length: %llu, message: %s",
+            lastestChecksumTableSize, subChecksumTableSize, e.what());
         return false;
     }
     // 2. load previous checksum table from file if increment backup
     if (IsIncrementBackup() && !LoadSessionPreviousCopyChecksum(session)) {
         return false;
     }
+    // 3. sub-block checksum of previous copy is optional, changed blocks are written entirely without it
+    if (!sharedConfig->prevSubChecksumBinPath.empty() && !LoadSessionPreviousSubBlockChecksum(session)) {
+        WARNLOG("previous sub-block checksum not available, changed blocks will be written entirely");
+    }
     return true;
 }
 
+/**
+ * @brief Latest tables are mapped from the meta files they are saved to, previous tables are mapped read-only from
+ *  meta files of previous copy, so pages are loaded on demand and flushing a checkpoint only writes back pages of
+ *  blocks hashed since the previous one. Content of latest tables is kept if the session is restarted.
+ * @return false if any table failed to map, caller falls back to heap tables
+ */
+bool VolumeBackupTask::InitMappedHashingContext(std::shared_ptr<VolumeTaskSession> session) const
+{
+    auto sharedConfig = session->sharedConfig;
+    uint64_t lastestChecksumTableSize = session->TotalBlocks() * blockhash::DigestSize(sharedConfig->hashAlgorithm);
+    uint64_t subChecksumTableSize = session->TotalBlocks() * SUB_BLOCK_CHECKSUM_SIZE *
+        SubBlocksPerBlock(sharedConfig->blockSize, sharedConfig->subBlockSize);
+    // latest table truncated and mapped shared with the previous one of the same file always compares equal
+    if (IsIncrementBackup() && fsapi::CanonicalPath(sharedConfig->lastestChecksumBinPath)
+        == fsapi::CanonicalPath(sharedConfig->prevChecksumBinPath)) {
+        WARNLOG("latest checksum table %s overwrites the previous one, use heap memory instead",
+            sharedConfig->lastestChecksumBinPath.c_str());
+        return false;
+    }
+    bool truncate = !(IsCheckpointEnabled(session) && IsSessionRestarted(session));
+    auto hashingContext = std::make_shared<BlockHashingContext>();
+    if (!hashingContext->MapLastestTable(sharedConfig->lastestChecksumBinPath, lastestChecksumTableSize, truncate)
+        || (subChecksumTableSize != 0 && !hashingContext->MapSubLastestTable(
+            sharedConfig->lastestSubChecksumBinPath, subChecksumTableSize, truncate))) {
+        WARNLOG("failed to map latest checksum table, use heap memory instead");
+        return false;
+    }
+    if (IsIncrementBackup() && !hashingContext->MapPreviousTable(sharedConfig->prevChecksumBinPath,
+        lastestChecksumTableSize)) {
+        WARNLOG("failed to map previous checksum table, use heap memory instead");
+        return false;
+    }
+    if (!sharedConfig->prevSubChecksumBinPath.empty()
+        && !hashingContext->MapSubPreviousTable(sharedConfig->prevSubChecksumBinPath, subChecksumTableSize)) {
+        WARNLOG("previous sub-block checksum not available, changed blocks will be written entirely");
+    }
+    session->sharedContext->hashingContext = hashingContext;
+    return true;
+}
+
+// read into the table allocated, without an intermediate buffer of the same size
 bool VolumeBackupTask::LoadSessionPreviousCopyChecksum(std::shared_ptr<VolumeTaskSession> session) const
 {
     auto sharedConfig = session->sharedConfig;
     uint32_t blockCount = static_cast<uint32_t>(sharedConfig->sessionSize / sharedConfig->blockSize);
-    uint64_t lastestChecksumTableSize = blockCount * SHA256_CHECKSUM_SIZE;
+    uint64_t lastestChecksumTableSize = blockCount * blockhash::DigestSize(sharedConfig->hashAlgorithm);
     uint64_t prevChecksumTableSize = lastestChecksumTableSize;
-    uint8_t* buffer = fsapi::ReadBinaryBuffer(session->sharedConfig->prevChecksumBinPath, prevChecksumTableSize);
+    if (!fsapi::ReadBinaryBuffer(sharedConfig->prevChecksumBinPath,
+        session->sharedContext->hashingContext->previousTable, prevChecksumTableSize)) {
+        ERRLOG("failed to read previous checksum from %s", sharedConfig->prevChecksumBinPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool VolumeBackupTask::LoadSessionPreviousSubBlockChecksum(std::shared_ptr<VolumeTaskSession> session) const
+{
+    auto hashingContext = session->sharedContext->hashingContext;
+    std::string prevSubChecksumBinPath = session->sharedConfig->prevSubChecksumBinPath;
+    uint8_t* buffer = fsapi::ReadBinaryBuffer(prevSubChecksumBinPath, hashingContext->subLastestSize);
     if (buffer == nullptr) {
-        ERRLOG("failed to read previous checksum from %s", session->sharedConfig->prevChecksumBinPath.c_str());
+        ERRLOG("failed to read previous sub-block checksum from %s", prevSubChecksumBinPath.c_str());
+        return false;
+    }
+    // take the ownership of buffer
+    hashingContext->subPreviousTable = buffer;
+    hashingContext->subPreviousSize = hashingContext->subLastestSize;
+    return true;
+}
+
+bool VolumeBackupTask::IsPreviousSubBlockChecksumMatched() const
+{
+    VolumeCopyMeta volumeCopyMeta {};
+    if (!common::ReadVolumeCopyMeta(m_backupConfig->prevCopyMetaDirPath, m_backupConfig->copyName, volumeCopyMeta)) {
+        WARNLOG("failed to read previous copy meta in %s", m_backupConfig->prevCopyMetaDirPath.c_str());
+        return false;
+    }
+    if (volumeCopyMeta.subBlockSize != m_subBlockSize) {
+        WARNLOG("previous sub-block size %u mismatch with %u, changed blocks will be written entirely",
+            volumeCopyMeta.subBlockSize, m_subBlockSize);
         return false;
     }
-    memcpy(session->sharedContext->hashingContext->previousTable, buffer, sizeof(uint8_t) * prevChecksumTableSize);
-    delete[] buffer;
-    buffer = nullptr;
     return true;
 }
 
@@ -362,6 +606,19 @@ bool VolumeBackupTask::ValidateIncrementBackup() const
             m_backupConfig->blockSize, volumeCopyMeta.blockSize);
         return false;
     }
+    if (volumeCopyMeta.checksumSize == 0) {
+        ERRLOG("previous copy in %s has no checksum, it can't be the base of increment backup",
+            m_backupConfig->prevCopyMetaDirPath.c_str());
+        return false;
+    }
+    uint32_t checksumSize = blockhash::DigestSize(m_backupConfig->hashAlgorithm);
+    if (static_cast<int>(m_backupConfig->hashAlgorithm) != volumeCopyMeta.hashAlgorithm
+        || checksumSize != volumeCopyMeta.checksumSize) {
+        ERRLOG("increment backup hash algorithm mismatch! (previous: %d/%u latest: %d/%u)",
+            volumeCopyMeta.hashAlgorithm, volumeCopyMeta.checksumSize,
+            static_cast<int>(m_backupConfig->hashAlgorithm), checksumSize);
+        return false;
+    }
     return true;
 }
 
@@ -375,4 +632,219 @@ void VolumeBackupTask::ClearAllCheckpoints() const
         INFOLOG("remove checkpoint file %s", checkpointFile.c_str());
         fsapi::RemoveFile(checkpointFile);
     }
-}
\ No newline at end of file
+}
+
+bool VolumeBackupTask::LoadVolumeFreeExtents()
+{
+    std::unique_ptr<fsapi::AllocationMapProvider> provider =
+        fsapi::AllocationMapProvider::Build(m_backupConfig->volumePath);
+    if (provider == nullptr || !provider->ListFreeExtents(m_freeExtents)) {
+        return false;
+    }
+    uint64_t freeBytes = 0;
+    for (const fsapi::VolumeExtent& extent : m_freeExtents) {
+        freeBytes += extent.length;
+    }
+    INFOLOG("volume %s (%s) has %llu free extents, %llu/%llu bytes free", m_backupConfig->volumePath.c_str(),
+        provider->FileSystemType().c_str(), m_freeExtents.size(), freeBytes, m_volumeSize);
+    return true;
+}
+
+/**
+ * @brief mark blocks of the session which are not entirely covered by free extents as allocated,
+ *  unallocated blocks are filled with checksum of their copy data since they will not be read
+ */
+bool VolumeBackupTask::InitSessionAllocatedBitmap(std::shared_ptr<VolumeTaskSession> session) const
+{
+    if (m_freeExtents.empty()) {
+        return true;
+    }
+    uint64_t sessionOffset = session->sharedConfig->sessionOffset;
+    uint64_t sessionSize = session->sharedConfig->sessionSize;
+    uint64_t blockSize = session->sharedConfig->blockSize;
+    uint64_t numBlocks = session->TotalBlocks();
+    // count free bytes of each block
+    std::vector<uint32_t> blockFreeBytes(numBlocks, 0);
+    auto it = std::lower_bound(m_freeExtents.begin(), m_freeExtents.end(), sessionOffset,
+        [](const fsapi::VolumeExtent& extent, uint64_t offset) { return extent.offset + extent.length <= offset; });
+    for (; it != m_freeExtents.end() && it->offset < sessionOffset + sessionSize; ++it) {
+        uint64_t start = std::max(it->offset, sessionOffset) - sessionOffset;
+        uint64_t end = std::min(it->offset + it->length, sessionOffset + sessionSize) - sessionOffset;
+        while (start < end) {
+            uint64_t blockEnd = std::min((start / blockSize + 1) * blockSize, end);
+            blockFreeBytes[start / blockSize] += static_cast<uint32_t>(blockEnd - start);
+            start = blockEnd;
+        }
+    }
+    session->sharedContext->allocatedBitmap = std::make_shared<Bitmap>(numBlocks);
+    uint64_t allocatedBlocks = 0;
+    for (uint64_t index = 0; index < numBlocks; ++index) {
+        uint64_t blockLength = std::min(blockSize, sessionSize - index * blockSize);
+        if (blockFreeBytes[index] < blockLength) {
+            session->sharedContext->allocatedBitmap->Set(index);
+            ++allocatedBlocks;
+        }
+    }
+    INFOLOG("session offset %llu has %llu/%llu blocks allocated", sessionOffset, allocatedBlocks, numBlocks);
+    return FillUnallocatedBlockChecksum(session);
+}
+
+/**
+ * @brief unallocated blocks keep data of previous copy in forever increment backup, or remain zero in copy of full
+ *  backup, their checksum are inherited from previous copy or computed from zero data, so verify/differential
+ *  restore won't treat them as mismatched
+ */
+bool VolumeBackupTask::FillUnallocatedBlockChecksum(std::shared_ptr<VolumeTaskSession> session) const
+{
+    auto hashingContext = session->sharedContext->hashingContext;
+    std::shared_ptr<Bitmap> allocatedBitmap = session->sharedContext->allocatedBitmap;
+    uint64_t sessionSize = session->sharedConfig->sessionSize;
+    uint64_t blockSize = session->sharedConfig->blockSize;
+    uint64_t numBlocks = session->TotalBlocks();
+    uint32_t checksumSize = blockhash::DigestSize(session->sharedConfig->hashAlgorithm);
+    uint64_t subChecksumSize = SUB_BLOCK_CHECKSUM_SIZE *
+        SubBlocksPerBlock(session->sharedConfig->blockSize, session->sharedConfig->subBlockSize);
+    bool subTableAvailable = hashingContext->subLastestTable != nullptr && subChecksumSize != 0;
+    std::vector<uint8_t> zeroChecksum;
+    std::vector<uint8_t> zeroSubChecksum(subChecksumSize, 0);
+    uint64_t zeroChecksumLength = 0; // length of zero block the checksum computed from
+    for (uint64_t index = allocatedBitmap->NextUnset(0);
+        index < numBlocks;
+        index = allocatedBitmap->NextUnset(index + 1)) {
+        uint8_t* checksum = hashingContext->lastestTable + index * checksumSize;
+        uint8_t* subChecksum = subTableAvailable ? hashingContext->subLastestTable + index * subChecksumSize : nullptr;
+        if (hashingContext->previousTable != nullptr) {
+            memcpy(checksum, hashingContext->previousTable + index * checksumSize, checksumSize);
+            if (subChecksum != nullptr && hashingContext->subPreviousTable != nullptr) {
+                memcpy(subChecksum, hashingContext->subPreviousTable + index * subChecksumSize, subChecksumSize);
+            }
+        } else {
+            uint64_t blockLength = std::min(blockSize, sessionSize - index * blockSize);
+            if (blockLength != zeroChecksumLength && !ComputeZeroBlockChecksum(
+                session->sharedConfig, blockLength, zeroChecksum, zeroSubChecksum)) {
+                return false;
+            }
+            zeroChecksumLength = blockLength;
+            memcpy(checksum, zeroChecksum.data(), checksumSize);
+            if (subChecksum != nullptr) {
+                memcpy(subChecksum, zeroSubChecksum.data(), subChecksumSize);
+            }
+        }
+        hashingContext->MarkLastestDirty(index * checksumSize, checksumSize);
+        if (subChecksum != nullptr) {
+            hashingContext->MarkSubLastestDirty(index * subChecksumSize, subChecksumSize);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief compute checksum and sub-block checksum of zero data of blockLength, sub-block checksum is laid out as
+ *  VolumeBlockHasher does, digest truncated to SUB_BLOCK_CHECKSUM_SIZE bytes and unused entries left zero
+ */
+bool VolumeBackupTask::ComputeZeroBlockChecksum(
+    std::shared_ptr<VolumeTaskSharedConfig> sharedConfig,
+    uint64_t blockLength,
+    std::vector<uint8_t>& checksum,
+    std::vector<uint8_t>& subChecksum) const
+{
+    blockhash::DigestContext digestContext(sharedConfig->hashAlgorithm);
+    std::vector<uint8_t> zeroData(blockLength, 0);
+    checksum.assign(digestContext.DigestSize(), 0);
+    if (!digestContext.Ok() || !digestContext.Compute(zeroData.data(), blockLength, checksum.data())) {
+        ERRLOG("failed to compute checksum of zero block, length %llu", blockLength);
+        return false;
+    }
+    std::fill(subChecksum.begin(), subChecksum.end(), 0);
+    if (subChecksum.empty()) {
+        return true;
+    }
+    uint64_t subBlockSize = sharedConfig->subBlockSize;
+    std::vector<uint8_t> digest(digestContext.DigestSize(), 0);
+    uint32_t copySize = std::min(SUB_BLOCK_CHECKSUM_SIZE, digestContext.DigestSize());
+    for (uint64_t offset = 0; offset < blockLength; offset += subBlockSize) {
+        if (!digestContext.Compute(zeroData.data(), std::min(subBlockSize, blockLength - offset), digest.data())) {
+            ERRLOG("failed to compute sub-block checksum of zero block, length %llu", blockLength);
+            return false;
+        }
+        memcpy(subChecksum.data() + offset / subBlockSize * SUB_BLOCK_CHECKSUM_SIZE, digest.data(), copySize);
+    }
+    return true;
+}
+
+// token must be taken before the volume is read, writes during backup will be reported to the next backup
+bool VolumeBackupTask::LoadChangedExtents(std::string& currentToken)
+{
+    std::unique_ptr<cbt::ChangedBlockProvider> provider =
+        cbt::ChangedBlockProvider::Build(m_backupConfig->cbtType, m_backupConfig->cbtSource);
+    if (provider == nullptr || !provider->CurrentToken(currentToken)) {
+        ERRLOG("failed to get current token of CBT source %s", m_backupConfig->cbtSource.c_str());
+        return false;
+    }
+    if (!IsIncrementBackup()) {
+        return true;
+    }
+    VolumeCopyMeta volumeCopyMeta {};
+    if (!common::ReadVolumeCopyMeta(m_backupConfig->prevCopyMetaDirPath, m_backupConfig->copyName, volumeCopyMeta)) {
+        ERRLOG("failed to read previous copy meta in %s", m_backupConfig->prevCopyMetaDirPath.c_str());
+        return false;
+    }
+    if (volumeCopyMeta.cbtType != static_cast<int>(m_backupConfig->cbtType)) {
+        WARNLOG("previous copy is not generated with CBT type %d", static_cast<int>(m_backupConfig->cbtType));
+        return false;
+    }
+    if (!provider->ListChangedExtents(volumeCopyMeta.cbtToken, m_changedExtents)) {
+        return false;
+    }
+    m_changedExtentsAvailable = true;
+    uint64_t changedBytes = 0;
+    for (const fsapi::VolumeExtent& extent : m_changedExtents) {
+        changedBytes += extent.length;
+    }
+    INFOLOG("volume %s (%s) has %llu changed extents, %llu/%llu bytes changed since token \"%s\"",
+        m_backupConfig->volumePath.c_str(), provider->Name().c_str(), m_changedExtents.size(),
+        changedBytes, m_volumeSize, volumeCopyMeta.cbtToken.c_str());
+    return true;
+}
+
+/**
+ * @brief mark blocks of the session overlapped with changed extents as changed,
+ *  unchanged blocks inherit checksum from the previous copy since they will not be read
+ */
+void VolumeBackupTask::InitSessionChangedBitmap(std::shared_ptr<VolumeTaskSession> session) const
+{
+    if (!m_changedExtentsAvailable) {
+        return;
+    }
+    uint64_t sessionOffset = session->sharedConfig->sessionOffset;
+    uint64_t sessionSize = session->sharedConfig->sessionSize;
+    uint64_t blockSize = session->sharedConfig->blockSize;
+    uint64_t numBlocks = session->TotalBlocks();
+    session->sharedContext->changedBitmap = std::make_shared<Bitmap>(numBlocks);
+    auto it = std::lower_bound(m_changedExtents.begin(), m_changedExtents.end(), sessionOffset,
+        [](const fsapi::VolumeExtent& extent, uint64_t offset) { return extent.offset + extent.length <= offset; });
+    for (; it != m_changedExtents.end() && it->offset < sessionOffset + sessionSize; ++it) {
+        uint64_t start = std::max(it->offset, sessionOffset) - sessionOffset;
+        uint64_t end = std::min(it->offset + it->length, sessionOffset + sessionSize) - sessionOffset;
+        session->sharedContext->changedBitmap->SetRange(start / blockSize, (end + blockSize - 1) / blockSize);
+    }
+    auto hashingContext = session->sharedContext->hashingContext;
+    uint32_t checksumSize = blockhash::DigestSize(session->sharedConfig->hashAlgorithm);
+    uint64_t subChecksumSize = SUB_BLOCK_CHECKSUM_SIZE *
+        SubBlocksPerBlock(session->sharedConfig->blockSize, session->sharedConfig->subBlockSize);
+    std::shared_ptr<Bitmap> changedBitmap = session->sharedContext->changedBitmap;
+    uint64_t changedBlocks = changedBitmap->TotalSetCount();
+    for (uint64_t index = changedBitmap->NextUnset(0);
+        index < numBlocks;
+        index = changedBitmap->NextUnset(index + 1)) {
+        memcpy(hashingContext->lastestTable + index * checksumSize,
+            hashingContext->previousTable + index * checksumSize, checksumSize);
+        hashingContext->MarkLastestDirty(index * checksumSize, checksumSize);
+        if (hashingContext->subLastestTable != nullptr && hashingContext->subPreviousTable != nullptr) {
+            memcpy(hashingContext->subLastestTable + index * subChecksumSize,
+                hashingContext->subPreviousTable + index * subChecksumSize, subChecksumSize);
+            hashingContext->MarkSubLastestDirty(index * subChecksumSize, subChecksumSize);
+        }
+    }
+    INFOLOG("session offset %llu has %llu/%llu blocks changed", sessionOffset, changedBlocks, numBlocks);
+}
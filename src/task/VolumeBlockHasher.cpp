@@ -6,14 +6,18 @@
 
 #include "VolumeProtector.h"
 #include <cstring>
-#include <openssl/evp.h>
+#include <algorithm>
 
 #include "Logger.h"
+#include "BlockHash.h"
 #include "VolumeProtectTaskContext.h"
+#include "CheckpointJournal.h"
 #include "VolumeBlockHasher.h"
 
 namespace {
     const uint32_t MAX_HASHER_WORKER_NUM = 32;
+    const uint32_t MAX_HASHER_BATCH_SIZE = 8; // max blocks popped at once for multi-buffer hashing
+    const uint32_t MAX_CHECKSUM_SIZE = 32; // largest digest size of all hash algorithms
 }
 
 using namespace volumeprotect;
@@ -22,10 +26,8 @@ using namespace volumeprotect::task;
 VolumeBlockHasher::~VolumeBlockHasher()
 {
     DBGLOG("destroy VolumeBlockHasher");
-    for (std::shared_ptr<std::thread>& worker: m_workers) {
-        if (worker->joinable()) {
-            worker->join();
-        }
+    for (std::shared_ptr<ExecutorJob>& worker: m_workers) {
+        worker->Wait();
     }
     // won't free hashing table here
 }
@@ -40,13 +42,20 @@ std::shared_ptr<VolumeBlockHasher> VolumeBlockHasher::BuildHasher(
     param.sharedContext = sharedContext;
     param.workerThreadNum = sharedConfig->hasherWorkerNum;
     param.forwardMode = mode;
-    param.singleChecksumSize = SHA256_CHECKSUM_SIZE;
+    param.hashAlgorithm = sharedConfig->hashAlgorithm;
+    param.singleChecksumSize = blockhash::DigestSize(sharedConfig->hashAlgorithm);
+    param.subBlockSize = sharedConfig->subBlockSize;
+    if (param.singleChecksumSize == 0) {
+        ERRLOG("unsupported hash algorithm %d", static_cast<int>(sharedConfig->hashAlgorithm));
+        return nullptr;
+    }
 
     return std::make_shared<VolumeBlockHasher>(param);
 }
 
 VolumeBlockHasher::VolumeBlockHasher(const VolumeBlockHasherParam& param)
   : m_singleChecksumSize(param.singleChecksumSize),
+    m_hashAlgorithm(param.hashAlgorithm),
     m_forwardMode(param.forwardMode),
     m_workerThreadNum(param.workerThreadNum),
     m_sharedConfig(param.sharedConfig),
@@ -57,7 +66,18 @@ VolumeBlockHasher::VolumeBlockHasher(const VolumeBlockHasherParam& param)
     m_prevChecksumTable = m_sharedContext->hashingContext->previousTable;
     m_lastestChecksumTableSize = m_sharedContext->hashingContext->lastestSize;
     m_prevChecksumTableSize = m_sharedContext->hashingContext->previousSize;
-    DBGLOG("block hasher using checksum size %u", m_singleChecksumSize);
+    m_subLastestChecksumTable = m_sharedContext->hashingContext->subLastestTable;
+    m_subPrevChecksumTable = m_sharedContext->hashingContext->subPreviousTable;
+    if (m_subLastestChecksumTable != nullptr) {
+        m_subBlockSize = param.subBlockSize;
+        m_subBlocksPerBlock = SubBlocksPerBlock(m_sharedConfig->blockSize, m_subBlockSize);
+    }
+    if (m_subBlocksPerBlock > MAX_SUB_BLOCKS_PER_BLOCK) {
+        WARNLOG("sub-block size %u too small, sub-block checksum disabled", m_subBlockSize);
+        m_subBlocksPerBlock = 0;
+    }
+    DBGLOG("block hasher using algorithm %s, checksum size %u, sub-blocks per block %u",
+        blockhash::AlgorithmName(m_hashAlgorithm).c_str(), m_singleChecksumSize, m_subBlocksPerBlock);
 }
 
 bool VolumeBlockHasher::Start()
@@ -75,92 +95,272 @@ bool VolumeBlockHasher::Start()
         return false;
     }
     m_status = TaskStatus::RUNNING;
+    m_workersRunning = m_workerThreadNum;
     for (uint32_t i = 0; i < m_workerThreadNum; i++) {
-        m_workers.emplace_back(std::make_shared<std::thread>(&VolumeBlockHasher::WorkerThread, this, i));
+        auto worker = std::make_shared<HasherWorker>();
+        worker->workerID = i;
+        worker->digestContext = exstd::make_unique<blockhash::DigestContext>(m_hashAlgorithm);
+        worker->batchSize = std::min(worker->digestContext->MaxBatchSize(), MAX_HASHER_BATCH_SIZE);
+        DBGLOG("hasher worker[%u] started, batch size %u", i, worker->batchSize);
+        m_hasherWorkers.push_back(worker);
+        m_workers.push_back(TaskExecutor::Instance().Submit(
+            [this, worker]() { return WorkerStep(*worker); }, m_sharedContext->executorGroup));
     }
     return true;
 }
 
-void VolumeBlockHasher::WorkerThread(uint32_t workerID)
+/**
+ * @brief hash one batch of blocks, never block on the hashing queue or write queue
+ */
+StepResult VolumeBlockHasher::WorkerStep(HasherWorker& worker)
 {
-    VolumeConsumeBlock consumeBlock {};
-    m_workersRunning++;
-    DBGLOG("hasher worker[%lu] started, total worker running: %lu", workerID, m_workersRunning.load());
-    while (true) {
-        DBGLOG("hasher worker[%d] thread check", workerID);
-        if (m_abort) {
-            m_status = TaskStatus::ABORTED;
-            break;
+    DBGLOG("hasher worker[%u] check", worker.workerID);
+    if (m_abort) {
+        worker.status = TaskStatus::ABORTED;
+        HandleWorkerTerminate(worker);
+        return StepResult::DONE;
+    }
+    uint64_t writeSequence = m_sharedContext->writeQueueEvent->Sequence();
+    if (!PushPendingBlocks(worker)) {
+        return TaskExecutor::WaitFor(m_sharedContext->writeQueueEvent, writeSequence);
+    }
+    std::vector<VolumeConsumeBlock>& batch = worker.batch;
+    uint64_t hashingSequence = m_sharedContext->hashingQueueEvent->Sequence();
+    if (m_sharedContext->hashingQueue->TryBlockingPopBatch(batch, worker.batchSize) == 0) {
+        if (!m_sharedContext->hashingQueue->Drained()) {
+            return TaskExecutor::WaitFor(m_sharedContext->hashingQueueEvent, hashingSequence);
         }
+        worker.status = TaskStatus::SUCCEED; // queue has been finished
+        HandleWorkerTerminate(worker);
+        return StepResult::DONE;
+    }
+    DBGLOG("hasher worker[%u] computing %llu blocks from block[%llu]", worker.workerID, batch.size(), batch[0].index);
+    // compute latest hash
+    if (!worker.digestContext->Ok() || !ComputeChecksumBatch(*worker.digestContext, batch)) {
+        ERRLOG("hasher worker[%u] failed to compute checksum of block[%llu]", worker.workerID, batch[0].index);
+        for (const VolumeConsumeBlock& consumeBlock : batch) {
+            m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        }
+        worker.status = TaskStatus::FAILED;
+        HandleWorkerTerminate(worker);
+        return StepResult::DONE;
+    }
+    for (const VolumeConsumeBlock& consumeBlock : batch) {
+        ForwardBlock(worker, consumeBlock);
+    }
+    return StepResult::CONTINUE;
+}
 
-        if (!m_sharedContext->hashingQueue->BlockingPop(consumeBlock)) {
-            m_status = TaskStatus::SUCCEED;
-            break; // queue has been finished
+// return false if write queue is still full
+bool VolumeBlockHasher::PushPendingBlocks(HasherWorker& worker)
+{
+    while (!worker.pendingBlocks.empty()) {
+        if (!m_sharedContext->writeQueue->TryBlockingPush(worker.pendingBlocks.front())) {
+            return false;
         }
-        uint64_t index = consumeBlock.index;
-        DBGLOG("hasher worker[%d] computing block[%llu]", workerID, index);
-        // compute latest hash
-        ComputeSHA256(
-            consumeBlock.ptr,
-            consumeBlock.length,
-            m_lastestChecksumTable + index * m_singleChecksumSize,
-            m_singleChecksumSize);
-
-        ++m_sharedContext->counter->blocksHashed;
-        uint32_t offset = m_singleChecksumSize * static_cast<uint32_t>(index);
-        if (m_forwardMode == HasherForwardMode::DIFF) {
-            // diff with previous hash
-            if (::memcmp(m_prevChecksumTable + offset, m_lastestChecksumTable + offset, m_singleChecksumSize) == 0) {
-                // drop the block and free
-                DBGLOG("block[%llu] checksum remain unchanged, block dropped", index);
-                m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
-                m_sharedContext->processedBitmap->Set(index);
-                continue;
+        worker.pendingBlocks.pop_front();
+    }
+    return true;
+}
+
+bool VolumeBlockHasher::ComputeChecksumBatch(
+    blockhash::DigestContext& digestContext, std::vector<VolumeConsumeBlock>& batch)
+{
+    const uint8_t* data[MAX_HASHER_BATCH_SIZE];
+    uint64_t len[MAX_HASHER_BATCH_SIZE];
+    uint8_t* output[MAX_HASHER_BATCH_SIZE];
+    uint32_t count = 0;
+    for (VolumeConsumeBlock& consumeBlock : batch) {
+        uint8_t* checksum = m_lastestChecksumTable + consumeBlock.index * m_singleChecksumSize;
+        consumeBlock.zero = consumeBlock.zero || blockhash::IsZeroBlock(consumeBlock.ptr, consumeBlock.length);
+        if (consumeBlock.zero) {
+            // checksum of zero block remains the digest of zero data, so checksum table is compatible
+            if (!ZeroDigest(digestContext, consumeBlock.ptr, consumeBlock.length, checksum)) {
+                return false;
             }
+            continue;
         }
-        DBGLOG("block[%llu] checksum changed, push to writer", index);
-        m_sharedContext->counter->bytesToWrite += consumeBlock.length;
-        m_sharedContext->writeQueue->BlockingPush(consumeBlock);
+        data[count] = consumeBlock.ptr;
+        len[count] = consumeBlock.length;
+        output[count] = checksum;
+        ++count;
     }
-    INFOLOG("hasher worker[%lu] terminated with status %s", workerID, GetStatusString().c_str());
-    HandleWorkerTerminate();
-    return;
+    if (count != 0 && !digestContext.ComputeBatch(data, len, output, count)) {
+        return false;
+    }
+    auto hashingContext = m_sharedContext->hashingContext;
+    for (const VolumeConsumeBlock& consumeBlock : batch) {
+        hashingContext->MarkLastestDirty(consumeBlock.index * m_singleChecksumSize, m_singleChecksumSize);
+    }
+    if (m_subBlocksPerBlock == 0) {
+        return true;
+    }
+    uint64_t subChecksumSize = m_subBlocksPerBlock * SUB_BLOCK_CHECKSUM_SIZE;
+    for (const VolumeConsumeBlock& consumeBlock : batch) {
+        uint64_t offset = consumeBlock.index * subChecksumSize;
+        if (m_forwardMode == HasherForwardMode::DIFF && m_subPrevChecksumTable != nullptr
+            && !IsBlockChanged(consumeBlock.index)) {
+            // sub-blocks of unchanged block remain unchanged
+            ::memcpy(m_subLastestChecksumTable + offset, m_subPrevChecksumTable + offset, subChecksumSize);
+        } else if (!ComputeSubBlockChecksum(digestContext, consumeBlock)) {
+            return false;
+        }
+        hashingContext->MarkSubLastestDirty(offset, subChecksumSize);
+    }
+    return true;
 }
 
-void VolumeBlockHasher::ComputeSHA256(uint8_t* data, uint32_t len, uint8_t* output, uint32_t outputLen)
+/**
+ * @brief compute checksum of each sub-block, digest is truncated to SUB_BLOCK_CHECKSUM_SIZE bytes
+ *  (zero padded if digest is shorter), the last sub-block may be shorter than others
+ */
+bool VolumeBlockHasher::ComputeSubBlockChecksum(
+    blockhash::DigestContext& digestContext, const VolumeConsumeBlock& consumeBlock)
 {
-    EVP_MD_CTX *mdctx = nullptr;
-    const EVP_MD *md = nullptr;
-    unsigned char mdValue[EVP_MAX_MD_SIZE] = { 0 };
-    unsigned int mdLen;
+    uint8_t digests[MAX_SUB_BLOCKS_PER_BLOCK][MAX_CHECKSUM_SIZE];
+    const uint8_t* data[MAX_SUB_BLOCKS_PER_BLOCK];
+    uint64_t len[MAX_SUB_BLOCKS_PER_BLOCK];
+    uint8_t* output[MAX_SUB_BLOCKS_PER_BLOCK];
+    uint32_t count = (consumeBlock.length + m_subBlockSize - 1) / m_subBlockSize;
+    for (uint32_t i = 0; i < count; ++i) {
+        data[i] = consumeBlock.ptr + i * m_subBlockSize;
+        len[i] = std::min(m_subBlockSize, consumeBlock.length - i * m_subBlockSize);
+        output[i] = digests[i];
+    }
+    if (consumeBlock.zero) {
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!ZeroDigest(digestContext, data[i], len[i], output[i])) {
+                return false;
+            }
+        }
+    } else if (!digestContext.ComputeBatch(data, len, output, count)) {
+        return false;
+    }
+    uint8_t* table = m_subLastestChecksumTable + consumeBlock.index * m_subBlocksPerBlock * SUB_BLOCK_CHECKSUM_SIZE;
+    uint32_t copySize = std::min(SUB_BLOCK_CHECKSUM_SIZE, m_singleChecksumSize);
+    ::memset(table, 0, m_subBlocksPerBlock * SUB_BLOCK_CHECKSUM_SIZE);
+    for (uint32_t i = 0; i < count; ++i) {
+        ::memcpy(table + i * SUB_BLOCK_CHECKSUM_SIZE, digests[i], copySize);
+    }
+    return true;
+}
 
-    if ((md = EVP_get_digestbyname("SHA256")) == nullptr) {
-        ERRLOG("Unknown message digest SHA256");
-        return;
+bool VolumeBlockHasher::ZeroDigest(
+    blockhash::DigestContext& digestContext, const uint8_t* zeroData, uint64_t length, uint8_t* output)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_zeroDigestMutex);
+        auto it = m_zeroDigests.find(length);
+        if (it != m_zeroDigests.end()) {
+            ::memcpy(output, it->second.data(), it->second.size());
+            return true;
+        }
     }
+    if (!digestContext.Compute(zeroData, length, output)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lk(m_zeroDigestMutex);
+    m_zeroDigests[length].assign(output, output + m_singleChecksumSize);
+    return true;
+}
 
-    if ((mdctx = EVP_MD_CTX_new()) == nullptr) {
-        ERRLOG("Memory allocation failed");
-        return;
+bool VolumeBlockHasher::IsBlockChanged(uint64_t index) const
+{
+    uint64_t offset = m_singleChecksumSize * index;
+    return ::memcmp(m_prevChecksumTable + offset, m_lastestChecksumTable + offset, m_singleChecksumSize) != 0;
+}
+
+/**
+ * @brief diff sub-block checksum of a changed block with the previous one
+ * @return mask of changed sub-blocks, 0 if the whole block need to be written
+ */
+uint64_t VolumeBlockHasher::ChangedSubBlockMask(const VolumeConsumeBlock& consumeBlock) const
+{
+    if (m_subBlocksPerBlock == 0 || m_subPrevChecksumTable == nullptr) {
+        return 0;
+    }
+    uint64_t offset = consumeBlock.index * m_subBlocksPerBlock * SUB_BLOCK_CHECKSUM_SIZE;
+    uint32_t count = (consumeBlock.length + m_subBlockSize - 1) / m_subBlockSize;
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (::memcmp(m_subPrevChecksumTable + offset + i * SUB_BLOCK_CHECKSUM_SIZE,
+            m_subLastestChecksumTable + offset + i * SUB_BLOCK_CHECKSUM_SIZE, SUB_BLOCK_CHECKSUM_SIZE) != 0) {
+            mask |= (1ULL << i);
+        }
     }
+    uint64_t fullMask = (count == MAX_SUB_BLOCKS_PER_BLOCK) ? ~0ULL : ((1ULL << count) - 1);
+    // write the whole block if all sub-blocks changed, or if the change is not detected by truncated checksum
+    return (mask == fullMask) ? 0 : mask;
+}
 
-    EVP_DigestInit_ex(mdctx, md, nullptr);
-    EVP_DigestUpdate(mdctx, data, len);
-    EVP_DigestFinal_ex(mdctx, mdValue, &mdLen);
-    assert(mdLen == outputLen);
-    memcpy(output, mdValue, mdLen);
-    EVP_MD_CTX_free(mdctx);
-    return;
+void VolumeBlockHasher::ForwardBlock(HasherWorker& worker, const VolumeConsumeBlock& consumeBlock)
+{
+    uint64_t index = consumeBlock.index;
+    ++m_sharedContext->counter->blocksHashed;
+    VolumeConsumeBlock forwardBlock = consumeBlock;
+    if (m_forwardMode == HasherForwardMode::VERIFY && IsBlockChanged(index)) {
+        WARNLOG("block[%llu] checksum mismatch with copy", index);
+        m_sharedContext->mismatchedBitmap->Set(index);
+    }
+    // diff with previous hash
+    if ((m_forwardMode == HasherForwardMode::DIFF || m_forwardMode == HasherForwardMode::COMPARE)
+        && !IsBlockChanged(index)) {
+        // drop the block and free
+        DBGLOG("block[%llu] checksum remain unchanged, block dropped", index);
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        m_sharedContext->processedBitmap->Set(index);
+        if (m_sharedContext->checkpointJournal != nullptr) {
+            m_sharedContext->checkpointJournal->Append(index, false);
+        }
+        return;
+    }
+    if (m_forwardMode == HasherForwardMode::COMPARE) {
+        // block of target volume will be overwritten by the one read from copy later
+        DBGLOG("block[%llu] checksum mismatch with copy, block dropped", index);
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        m_sharedContext->mismatchedBitmap->Set(index);
+        return;
+    }
+    if (m_forwardMode == HasherForwardMode::DIFF) {
+        forwardBlock.dirtyMask = ChangedSubBlockMask(consumeBlock);
+    }
+    DBGLOG("block[%llu] checksum changed, dirty mask %llx, push to writer", index, forwardBlock.dirtyMask);
+    m_sharedContext->counter->bytesToWrite += DirtyLength(forwardBlock, m_subBlockSize);
+    worker.pendingBlocks.push_back(forwardBlock);
+    PushPendingBlocks(worker);
 }
 
-void VolumeBlockHasher::HandleWorkerTerminate()
+/**
+ * @brief the last terminated worker decide the final status of hasher and finish the queue,
+ *  hasher remains running until then since other workers may still be forwarding blocks
+ */
+void VolumeBlockHasher::HandleWorkerTerminate(HasherWorker& worker)
 {
-    m_workersRunning--;
-    if (m_workersRunning != 0) {
-        INFOLOG("one hasher worker exit, left workers: %d", m_workersRunning.load());
+    INFOLOG("hasher worker[%u] terminated with status %d", worker.workerID, static_cast<int>(worker.status));
+    for (const VolumeConsumeBlock& consumeBlock : worker.pendingBlocks) {
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+    }
+    worker.pendingBlocks.clear();
+    uint32_t workersLeft = --m_workersRunning;
+    if (workersLeft != 0) {
+        INFOLOG("one hasher worker exit, left workers: %u", workersLeft);
         return;
     }
+    TaskStatus status = TaskStatus::SUCCEED;
+    for (const std::shared_ptr<HasherWorker>& hasherWorker : m_hasherWorkers) {
+        if (hasherWorker->status == TaskStatus::FAILED) {
+            status = TaskStatus::FAILED;
+            break;
+        }
+        if (hasherWorker->status == TaskStatus::ABORTED) {
+            status = TaskStatus::ABORTED;
+        }
+    }
     INFOLOG("hasher workers all terminated");
     m_sharedContext->writeQueue->Finish();
+    m_status = status;
+    if (m_sharedContext->notifier != nullptr) {
+        m_sharedContext->notifier->Notify();
+    }
     return;
 }
@@ -8,13 +8,20 @@
 #include "VolumeProtector.h"
 #include "native/RawIO.h"
 #include "VolumeBlockReader.h"
+#include <cstring>
 
 using namespace volumeprotect;
 using namespace volumeprotect::task;
 using namespace volumeprotect::rawio;
 
 namespace {
-    constexpr auto FETCH_BLOCK_BUFFER_SLEEP_INTERVAL = std::chrono::milliseconds(100);
+    const uint32_t MAX_READER_WORKER_NUM = 32;
+    const auto FETCH_BUFFER_TIMEOUT = std::chrono::seconds(60);
+
+    uint32_t ReaderWorkerNum(const VolumeTaskSharedConfig& sharedConfig)
+    {
+        return std::max(1U, std::min(sharedConfig.readerWorkerNum, MAX_READER_WORKER_NUM));
+    }
 }
 
 // build a reader reading from volume (block device)
@@ -23,24 +30,30 @@ std::shared_ptr<VolumeBlockReader> VolumeBlockReader::BuildVolumeReader(
     std::shared_ptr<VolumeTaskSharedContext> sharedContext)
 {
     std::string volumePath = sharedConfig->volumePath;
+    RawIOOption ioOption { sharedConfig->ioEngine, sharedConfig->ioQueueDepth, sharedConfig->ioCacheMode };
 
-    std::shared_ptr<RawDataReader> dataReader = rawio::OpenRawDataVolumeReader(volumePath);
-    if (dataReader == nullptr) {
-        ERRLOG("failed to build volume data reader");
-        return nullptr;
-    }
-    if (!dataReader->Ok()) {
-        ERRLOG("failed to init volume data reader, path = %s, error = %u",
-            volumePath.c_str(), dataReader->Error());
-        return nullptr;
+    std::vector<std::shared_ptr<RawDataReader>> dataReaders;
+    for (uint32_t workerID = 0; workerID < ReaderWorkerNum(*sharedConfig); ++workerID) {
+        std::shared_ptr<RawDataReader> dataReader = rawio::OpenRawDataVolumeReader(volumePath, ioOption);
+        if (dataReader == nullptr) {
+            ERRLOG("failed to build volume data reader");
+            return nullptr;
+        }
+        if (!dataReader->Ok()) {
+            ERRLOG("failed to init volume data reader, path = %s, error = %u",
+                volumePath.c_str(), dataReader->Error());
+            return nullptr;
+        }
+        dataReaders.push_back(dataReader);
     }
     VolumeBlockReaderParam param {
         SourceType::VOLUME,
         volumePath,
         sharedConfig->sessionOffset,
-        dataReader,
+        dataReaders.front(),
         sharedConfig,
-        sharedContext
+        sharedContext,
+        std::vector<std::shared_ptr<RawDataReader>>(dataReaders.begin() + 1, dataReaders.end())
     };
     return std::make_shared<VolumeBlockReader>(param);
 }
@@ -57,24 +70,31 @@ std::shared_ptr<VolumeBlockReader> VolumeBlockReader::BuildCopyReader(
     sessionIOParam.volumeOffset = sharedConfig->sessionOffset;
     sessionIOParam.length = sharedConfig->sessionSize;
     sessionIOParam.copyFilePath = sharedConfig->copyFilePath;
+    sessionIOParam.ioOption = RawIOOption {
+        sharedConfig->ioEngine, sharedConfig->ioQueueDepth, sharedConfig->ioCacheMode };
 
-    std::shared_ptr<RawDataReader> dataReader = rawio::OpenRawDataCopyReader(sessionIOParam);
-    if (dataReader == nullptr) {
-        ERRLOG("failed to build copy data reader");
-        return nullptr;
-    }
-    if (!dataReader->Ok()) {
-        ERRLOG("failed to init copy data reader, format = %d, copyfile = %s, error = %u",
-            sharedConfig->copyFormat, sharedConfig->copyFilePath.c_str(), dataReader->Error());
-        return nullptr;
+    std::vector<std::shared_ptr<RawDataReader>> dataReaders;
+    for (uint32_t workerID = 0; workerID < ReaderWorkerNum(*sharedConfig); ++workerID) {
+        std::shared_ptr<RawDataReader> dataReader = rawio::OpenRawDataCopyReader(sessionIOParam);
+        if (dataReader == nullptr) {
+            ERRLOG("failed to build copy data reader");
+            return nullptr;
+        }
+        if (!dataReader->Ok()) {
+            ERRLOG("failed to init copy data reader, format = %d, copyfile = %s, error = %u",
+                sharedConfig->copyFormat, sharedConfig->copyFilePath.c_str(), dataReader->Error());
+            return nullptr;
+        }
+        dataReaders.push_back(dataReader);
     }
     VolumeBlockReaderParam param {
         SourceType::COPYFILE,
         copyFilePath,
         sharedConfig->sessionOffset,
-        dataReader,
+        dataReaders.front(),
         sharedConfig,
-        sharedContext
+        sharedContext,
+        std::vector<std::shared_ptr<RawDataReader>>(dataReaders.begin() + 1, dataReaders.end())
     };
     return std::make_shared<VolumeBlockReader>(param);
 }
@@ -83,24 +103,43 @@ bool VolumeBlockReader::Start()
 {
     AssertTaskNotStarted();
     m_status = TaskStatus::RUNNING;
-    // check data reader
-    if (!m_dataReader || !m_dataReader->Ok()) {
-        ERRLOG("invalid dataReader %p, path = %s", m_dataReader.get(), m_sourcePath.c_str());
-        m_status = TaskStatus::FAILED;
-        return false;
+    // check data reader of each worker
+    for (const std::shared_ptr<ReaderWorker>& worker : m_readerWorkers) {
+        if (!worker->dataReader || !worker->dataReader->Ok()) {
+            ERRLOG("invalid dataReader %p of worker[%u], path = %s",
+                worker->dataReader.get(), worker->workerID, m_sourcePath.c_str());
+            m_status = TaskStatus::FAILED;
+            return false;
+        }
+    }
+    m_sharedContext->counter->bytesToRead = BytesToRead();
+    if (m_sourceType == SourceType::COPYFILE) {
+        InitHoleBitmap();
+    }
+    m_workersRunning = static_cast<uint32_t>(m_readerWorkers.size());
+    for (const std::shared_ptr<ReaderWorker>& worker : m_readerWorkers) {
+        worker->currentIndex = InitCurrentIndex(*worker); // used to locate position of a block within a session
+        // read from currentOffset
+        DBGLOG("reader worker[%u] start from index: %llu/%llu, to read %llu bytes from base offset: %llu",
+            worker->workerID, worker->currentIndex, m_maxIndex, m_sharedConfig->sessionSize, m_baseOffset);
+        if (worker->asyncDataReader != nullptr) {
+            INFOLOG("reader worker[%u] use async I/O, queue depth %u",
+                worker->workerID, worker->asyncDataReader->QueueDepth());
+        }
+        m_workers.push_back(TaskExecutor::Instance().Submit([this, worker]() {
+            return (worker->asyncDataReader != nullptr) ? AsyncReadStep(*worker) : ReadStep(*worker);
+        }, m_sharedContext->executorGroup));
     }
-    m_sharedContext->counter->bytesToRead = m_sharedConfig->sessionSize;
-    m_readerThread = std::thread(&VolumeBlockReader::MainThread, this);
     return true;
 }
 
 VolumeBlockReader::~VolumeBlockReader()
 {
     DBGLOG("destroy VolumeBlockReader");
-    if (m_readerThread.joinable()) {
-        m_readerThread.join();
+    for (std::shared_ptr<ExecutorJob>& worker: m_workers) {
+        worker->Wait();
     }
-    m_dataReader.reset();
+    m_readerWorkers.clear();
 }
 
 VolumeBlockReader::VolumeBlockReader(const VolumeBlockReaderParam& param)
@@ -108,15 +147,23 @@ VolumeBlockReader::VolumeBlockReader(const VolumeBlockReaderParam& param)
     m_sourcePath(param.sourcePath),
     m_baseOffset(param.sourceOffset),
     m_sharedConfig(param.sharedConfig),
-    m_sharedContext(param.sharedContext),
-    m_dataReader(param.dataReader)
+    m_sharedContext(param.sharedContext)
 {
     uint64_t numBlocks = m_sharedConfig->sessionSize / m_sharedConfig->blockSize;
     if (m_sharedConfig->sessionSize % m_sharedConfig->blockSize != 0) {
         numBlocks++;
     }
-    m_currentIndex = 0;
     m_maxIndex = (numBlocks == 0) ? 0 : numBlocks - 1;
+
+    std::vector<std::shared_ptr<RawDataReader>> dataReaders { param.dataReader };
+    dataReaders.insert(dataReaders.end(), param.extraDataReaders.begin(), param.extraDataReaders.end());
+    for (const std::shared_ptr<RawDataReader>& dataReader : dataReaders) {
+        auto worker = std::make_shared<ReaderWorker>();
+        worker->workerID = static_cast<uint32_t>(m_readerWorkers.size());
+        worker->dataReader = dataReader;
+        worker->asyncDataReader = std::dynamic_pointer_cast<AsyncRawDataReader>(dataReader);
+        m_readerWorkers.push_back(worker);
+    }
 }
 
 void VolumeBlockReader::Pause()
@@ -132,147 +179,458 @@ void VolumeBlockReader::Resume()
 }
 
 /**
- * @brief redirect current index from checkpoint bitmap
+ * @brief redirect current index from checkpoint bitmap, align to the first index belongs to the worker
  */
-uint64_t VolumeBlockReader::InitCurrentIndex() const
+uint64_t VolumeBlockReader::InitCurrentIndex(const ReaderWorker& worker) const
 {
+    uint64_t workerNum = m_readerWorkers.size();
     uint64_t index = 0;
     if (m_sharedConfig->checkpointEnabled) {
         index = m_sharedContext->processedBitmap->FirstIndexUnset();
         INFOLOG("init index to %llu from ProcessedBitmap for continuation", index);
     }
-    return index;
+    return index + (worker.workerID + workerNum - index % workerNum) % workerNum;
 }
 
-void VolumeBlockReader::MainThread()
+/**
+ * @brief read one block, never block on the hashing/write queue or the allocator
+ */
+StepResult VolumeBlockReader::ReadStep(ReaderWorker& worker)
 {
-    // Open the device file for reading
-    m_currentIndex = InitCurrentIndex(); // used to locate position of a block within a session
-    // read from currentOffset
-    DBGLOG("reader start from index: %llu/%llu, to read %llu bytes from base offset: %llu",
-        m_currentIndex, m_maxIndex, m_sharedConfig->sessionSize, m_baseOffset);
-
-    while (true) {
-        DBGLOG("reader thread check, processing index %llu/%llu", m_currentIndex, m_maxIndex);
-        if (IsReadCompleted()) { // read completed
-            m_status = TaskStatus::SUCCEED;
+    DBGLOG("reader worker[%u] check, processing index %llu/%llu", worker.workerID, worker.currentIndex, m_maxIndex);
+    ApplyThreadIOPriority(m_sharedConfig->ioPriority);
+    if (m_failed) {
+        return TerminateWorker(worker, TaskStatus::FAILED);
+    }
+    if (m_abort) {
+        return TerminateWorker(worker, TaskStatus::ABORTED);
+    }
+    uint64_t forwardSequence = ForwardQueueEvent()->Sequence();
+    if (!PushPendingBlocks(worker)) {
+        return TaskExecutor::WaitFor(ForwardQueueEvent(), forwardSequence);
+    }
+    if (IsReadCompleted(worker)) { // read completed
+        return TerminateWorker(worker, TaskStatus::SUCCEED);
+    }
+    if (m_pause) {
+        DBGLOG("reader is paused, waiting...");
+        return StepResult::WAIT;
+    }
+    if (SkipReadingBlock(worker)) {
+        RevertNextBlock(worker);
+        return StepResult::CONTINUE;
+    }
+    if (IsReadThrottled()) {
+        return StepResult::WAIT;
+    }
+    std::shared_ptr<ExecutorEvent> freeEvent = m_sharedContext->allocator->FreeEvent();
+    uint64_t freeSequence = freeEvent->Sequence();
+    uint8_t* buffer = FetchBlockBuffer(worker);
+    if (buffer == nullptr) {
+        return m_failed ? TerminateWorker(worker, TaskStatus::FAILED) : TaskExecutor::WaitFor(freeEvent, freeSequence);
+    }
+    if (IsHoleBlock(worker.currentIndex)) {
+        PushHoleBlock(worker, buffer);
+        RevertNextBlock(worker);
+        return StepResult::CONTINUE;
+    }
+    uint32_t nBytesReaded = 0;
+    if (!ReadBlock(worker, buffer, nBytesReaded)) {
+        m_sharedContext->allocator->BlockFree(buffer);
+        return TerminateWorker(worker, TaskStatus::FAILED);
+    }
+    // push readed block to queue (convert to reader offset to sessionOffset)
+    uint64_t consumeBlockOffset = worker.currentIndex * m_sharedConfig->blockSize + m_sharedConfig->sessionOffset;
+    PushForward(worker, VolumeConsumeBlock { buffer, worker.currentIndex, consumeBlockOffset, nBytesReaded, 0, false });
+    RevertNextBlock(worker);
+    return StepResult::CONTINUE;
+}
+
+/**
+ * @brief keep up to queue depth read requests in flight, push blocks forward in order of completion.
+ *  Only wait for read completions, never block on the hashing/write queue or the allocator.
+ */
+StepResult VolumeBlockReader::AsyncReadStep(ReaderWorker& worker)
+{
+    std::shared_ptr<AsyncRawDataReader> asyncDataReader = worker.asyncDataReader;
+    AsyncIOResult result {};
+    DBGLOG("reader worker[%u] check, processing index %llu/%llu, %u in flight",
+        worker.workerID, worker.currentIndex, m_maxIndex, asyncDataReader->InFlight());
+    ApplyThreadIOPriority(m_sharedConfig->ioPriority);
+    if (m_failed) {
+        return TerminateWorker(worker, TaskStatus::FAILED);
+    }
+    if (m_abort) {
+        return TerminateWorker(worker, TaskStatus::ABORTED);
+    }
+    uint64_t forwardSequence = ForwardQueueEvent()->Sequence();
+    if (!PushPendingBlocks(worker)) {
+        return TaskExecutor::WaitFor(ForwardQueueEvent(), forwardSequence);
+    }
+    if (IsReadCompleted(worker) && asyncDataReader->InFlight() == 0) {
+        return TerminateWorker(worker, TaskStatus::SUCCEED);
+    }
+    // submit as many blocks as buffer and rate limit allow
+    bool bufferUnavailable = false;
+    bool throttled = false;
+    std::shared_ptr<ExecutorEvent> freeEvent = m_sharedContext->allocator->FreeEvent();
+    uint64_t freeSequence = 0;
+    while (!m_pause && !IsReadCompleted(worker) && asyncDataReader->InFlight() < asyncDataReader->QueueDepth()) {
+        if (SkipReadingBlock(worker)) {
+            RevertNextBlock(worker);
+            continue;
+        }
+        if (IsReadThrottled()) {
+            throttled = true;
             break;
         }
-        if (m_failed) {
-            m_status = TaskStatus::FAILED;
+        // only time out waiting for buffer if there is nothing to reap
+        freeSequence = freeEvent->Sequence();
+        uint8_t* buffer = (asyncDataReader->InFlight() == 0) ?
+            FetchBlockBuffer(worker) : m_sharedContext->allocator->BlockAlloc();
+        if (buffer == nullptr) {
+            bufferUnavailable = true;
             break;
         }
-        if (m_abort) {
-            m_status = TaskStatus::ABORTED;
+        if (IsHoleBlock(worker.currentIndex)) {
+            PushHoleBlock(worker, buffer);
+            RevertNextBlock(worker);
+            if (!worker.pendingBlocks.empty()) {
+                break; // wait for queue space
+            }
+            continue;
+        }
+        if (!SubmitReadBlock(worker, buffer)) {
             break;
         }
+        RevertNextBlock(worker);
+    }
+    if (m_failed) {
+        return TerminateWorker(worker, TaskStatus::FAILED);
+    }
+    if (asyncDataReader->InFlight() == 0) {
         if (m_pause) {
             DBGLOG("reader is paused, waiting...");
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-            continue;
         }
-        if (SkipReadingBlock()) {
-            RevertNextBlock();
-            continue;
+        if (bufferUnavailable && !m_pause) {
+            return TaskExecutor::WaitFor(freeEvent, freeSequence);
         }
-        uint8_t* buffer = FetchBlockBuffer(std::chrono::seconds(60));
-        if (buffer == nullptr) {
-            m_status = TaskStatus::FAILED;
+        return (m_pause || throttled) ? StepResult::WAIT : StepResult::CONTINUE;
+    }
+    // wait for at least one completion, then reap the rest completed without blocking
+    bool wait = true;
+    while (asyncDataReader->Reap(result, wait)) {
+        HandleReadCompletion(worker, result);
+        wait = false;
+    }
+    if (wait && asyncDataReader->InFlight() != 0) {
+        ERRLOG("failed to reap read request, error code = %u", asyncDataReader->Error());
+        HandleReadError(asyncDataReader->Error());
+    }
+    return StepResult::CONTINUE;
+}
+
+StepResult VolumeBlockReader::TerminateWorker(ReaderWorker& worker, TaskStatus status)
+{
+    worker.status = status;
+    if (worker.asyncDataReader != nullptr) {
+        DrainInflightBlocks(worker);
+    }
+    for (const VolumeConsumeBlock& consumeBlock : worker.pendingBlocks) {
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+    }
+    worker.pendingBlocks.clear();
+    INFOLOG("reader worker[%u] terminated with status %d", worker.workerID, static_cast<int>(worker.status));
+    HandleWorkerTerminate(worker);
+    return StepResult::DONE;
+}
+
+/**
+ * @brief the last terminated worker decide the final status of reader and finish the queue
+ */
+void VolumeBlockReader::HandleWorkerTerminate(const ReaderWorker& worker)
+{
+    std::lock_guard<std::mutex> lk(m_workerMutex);
+    if (--m_workersRunning != 0) {
+        return;
+    }
+    TaskStatus status = TaskStatus::SUCCEED;
+    for (const std::shared_ptr<ReaderWorker>& readerWorker : m_readerWorkers) {
+        if (readerWorker->status == TaskStatus::FAILED) {
+            status = TaskStatus::FAILED;
             break;
         }
-        uint32_t nBytesReaded = 0;
-        if (!ReadBlock(buffer, nBytesReaded)) {
-            m_status = TaskStatus::FAILED;
-            break;
+        if (readerWorker->status == TaskStatus::ABORTED) {
+            status = TaskStatus::ABORTED;
         }
-        // push readed block to queue (convert to reader offset to sessionOffset)
-        uint64_t consumeBlockOffset = m_currentIndex * m_sharedConfig->blockSize + m_sharedConfig->sessionOffset;
-        BlockingPushForward(VolumeConsumeBlock { buffer, m_currentIndex, consumeBlockOffset, nBytesReaded });
-        RevertNextBlock();
     }
     // handle terminiation (success/fail/aborted)
     m_sharedConfig->hasherEnabled ? m_sharedContext->hashingQueue->Finish() : m_sharedContext->writeQueue->Finish();
+    m_status = status;
     INFOLOG("reader thread terminated with status %s", GetStatusString().c_str());
-    return;
+    if (m_sharedContext->notifier != nullptr) {
+        m_sharedContext->notifier->Notify();
+    }
 }
 
-void VolumeBlockReader::BlockingPushForward(const VolumeConsumeBlock& consumeBlock) const
+void VolumeBlockReader::PushForward(ReaderWorker& worker, const VolumeConsumeBlock& consumeBlock) const
 {
     DBGLOG("reader push consume block (%llu, %llu, %u)",
         consumeBlock.index, consumeBlock.volumeOffset, consumeBlock.length);
-    if (m_sharedConfig->hasherEnabled) {
-        m_sharedContext->hashingQueue->BlockingPush(consumeBlock);
-        ++m_sharedContext->counter->blocksToHash;
-    } else {
-        m_sharedContext->writeQueue->BlockingPush(consumeBlock);
-        m_sharedContext->counter->bytesToWrite += static_cast<uint64_t>(consumeBlock.length);
+    worker.pendingBlocks.push_back(consumeBlock);
+    PushPendingBlocks(worker);
+}
+
+// return false if the queue is still full
+bool VolumeBlockReader::PushPendingBlocks(ReaderWorker& worker) const
+{
+    while (!worker.pendingBlocks.empty()) {
+        const VolumeConsumeBlock& consumeBlock = worker.pendingBlocks.front();
+        if (m_sharedConfig->hasherEnabled) {
+            if (!m_sharedContext->hashingQueue->TryBlockingPush(consumeBlock)) {
+                return false;
+            }
+            ++m_sharedContext->counter->blocksToHash;
+        } else {
+            if (!m_sharedContext->writeQueue->TryBlockingPush(consumeBlock)) {
+                return false;
+            }
+            m_sharedContext->counter->bytesToWrite += static_cast<uint64_t>(consumeBlock.length);
+        }
+        worker.pendingBlocks.pop_front();
     }
-    return;
+    return true;
 }
 
-bool VolumeBlockReader::SkipReadingBlock() const
+std::shared_ptr<ExecutorEvent> VolumeBlockReader::ForwardQueueEvent() const
+{
+    return m_sharedConfig->hasherEnabled ? m_sharedContext->hashingQueueEvent : m_sharedContext->writeQueueEvent;
+}
+
+bool VolumeBlockReader::SkipReadingBlock(const ReaderWorker& worker) const
 {
     if (m_sharedConfig->checkpointEnabled &&
-        m_sharedContext->processedBitmap->Test(m_currentIndex)) {
-        DBGLOG("checkpoint enabled, reader skip reading current index: %llu", m_currentIndex);
+        m_sharedContext->processedBitmap->Test(worker.currentIndex)) {
+        DBGLOG("checkpoint enabled, reader skip reading current index: %llu", worker.currentIndex);
+        return true;
+    }
+    if (IsBlockExcluded(worker.currentIndex)) {
+        DBGLOG("reader skip reading unallocated or unchanged index: %llu", worker.currentIndex);
         return true;
     }
     return false;
 }
 
-bool VolumeBlockReader::IsReadCompleted() const
+// block not allocated by filesystem or not changed since previous copy
+bool VolumeBlockReader::IsBlockExcluded(uint64_t index) const
 {
-    return m_currentIndex > m_maxIndex;
+    return (m_sharedContext->allocatedBitmap != nullptr && !m_sharedContext->allocatedBitmap->Test(index)) ||
+        (m_sharedContext->changedBitmap != nullptr && !m_sharedContext->changedBitmap->Test(index));
 }
 
-void VolumeBlockReader::RevertNextBlock()
+/**
+ * @brief scan data ranges of the copy file by the first worker before reading,
+ *  blocks entirely in holes are left unset if copy file does not support querying holes
+ */
+void VolumeBlockReader::InitHoleBitmap()
 {
-    ++m_currentIndex;
+    std::shared_ptr<RawDataReader> dataReader = m_readerWorkers.front()->dataReader;
+    uint64_t blockSize = m_sharedConfig->blockSize;
+    uint64_t sessionEnd = m_baseOffset + m_sharedConfig->sessionSize;
+    auto holeBitmap = std::make_shared<Bitmap>(m_maxIndex + 1);
+    uint64_t offset = m_baseOffset;
+    while (offset < sessionEnd) {
+        uint64_t dataOffset = 0;
+        uint64_t dataLength = 0;
+        if (!dataReader->NextDataRange(offset, sessionEnd - offset, dataOffset, dataLength)) {
+            WARNLOG("failed to query data range of %s from offset %llu", m_sourcePath.c_str(), offset);
+            break;
+        }
+        // hole in [offset, dataOffset), the tail block may be shorter than block size
+        uint64_t holeBegin = (offset - m_baseOffset + blockSize - 1) / blockSize;
+        uint64_t holeEnd = (dataOffset >= sessionEnd) ? m_maxIndex + 1 : (dataOffset - m_baseOffset) / blockSize;
+        if (holeEnd > holeBegin) {
+            holeBitmap->SetRange(holeBegin, holeEnd);
+        }
+        if (dataLength == 0) {
+            break;
+        }
+        offset = dataOffset + dataLength;
+    }
+    if (holeBitmap->TotalSetCount() != 0) {
+        INFOLOG("%llu of %llu blocks are holes of copy file %s, fill zero without reading",
+            holeBitmap->TotalSetCount(), m_maxIndex + 1, m_sourcePath.c_str());
+        m_holeBitmap = holeBitmap;
+    }
 }
 
-uint8_t* VolumeBlockReader::FetchBlockBuffer(std::chrono::seconds timeout) const
+bool VolumeBlockReader::IsHoleBlock(uint64_t index) const
 {
-    auto start = std::chrono::steady_clock::now();
-    while (true) {
-        uint8_t* buffer = m_sharedContext->allocator->BlockAlloc();
-        if (buffer != nullptr) {
-            return buffer;
-        }
-        auto now = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - start);
-        if (duration.count() >= timeout.count()) {
-            ERRLOG("malloc block buffer timeout! %llu %llu", duration.count(), timeout.count());
-            return nullptr;
+    return m_holeBitmap != nullptr && m_holeBitmap->Test(index);
+}
+
+// hole reads as zero, the block is flagged so that hasher/writer need not to test it again
+void VolumeBlockReader::PushHoleBlock(ReaderWorker& worker, uint8_t* buffer)
+{
+    uint32_t length = CurrentBlockLength(worker);
+    ::memset(buffer, 0, length);
+    m_sharedContext->counter->bytesRead += static_cast<uint64_t>(length);
+    uint64_t consumeBlockOffset = worker.currentIndex * m_sharedConfig->blockSize + m_sharedConfig->sessionOffset;
+    PushForward(worker, VolumeConsumeBlock { buffer, worker.currentIndex, consumeBlockOffset, length, 0, true });
+}
+
+// unallocated or unchanged blocks will never be read, exclude them from bytes to read
+uint64_t VolumeBlockReader::BytesToRead() const
+{
+    if (m_sharedContext->allocatedBitmap == nullptr && m_sharedContext->changedBitmap == nullptr) {
+        return m_sharedConfig->sessionSize;
+    }
+    uint64_t bytesToRead = 0;
+    uint64_t blockSize = m_sharedConfig->blockSize;
+    for (uint64_t index = 0; index * blockSize < m_sharedConfig->sessionSize; ++index) {
+        if (!IsBlockExcluded(index)) {
+            bytesToRead += std::min(m_sharedConfig->sessionSize - index * blockSize, blockSize);
         }
-        DBGLOG("failed to malloc, retry in 100ms");
-        std::this_thread::sleep_for(FETCH_BLOCK_BUFFER_SLEEP_INTERVAL);
+    }
+    return bytesToRead;
+}
+
+bool VolumeBlockReader::IsReadCompleted(const ReaderWorker& worker) const
+{
+    return worker.currentIndex > m_maxIndex;
+}
+
+void VolumeBlockReader::RevertNextBlock(ReaderWorker& worker) const
+{
+    worker.currentIndex += m_readerWorkers.size();
+}
+
+// rate limit of the task reached, the next block can't be read now
+bool VolumeBlockReader::IsReadThrottled() const
+{
+    return m_sharedContext->readLimiter != nullptr && !m_sharedContext->readLimiter->Admit();
+}
+
+// try to alloc a buffer, mark reader failed if no buffer is freed by writer/hasher for a long time
+uint8_t* VolumeBlockReader::FetchBlockBuffer(ReaderWorker& worker)
+{
+    uint8_t* buffer = m_sharedContext->allocator->BlockAlloc();
+    auto now = std::chrono::steady_clock::now();
+    if (buffer != nullptr) {
+        worker.waitingBuffer = false;
+        return buffer;
+    }
+    if (!worker.waitingBuffer) {
+        worker.waitingBuffer = true;
+        worker.waitBufferSince = now;
+    } else if (now - worker.waitBufferSince > FETCH_BUFFER_TIMEOUT) {
+        ERRLOG("malloc block buffer timeout! %llu", static_cast<uint64_t>(FETCH_BUFFER_TIMEOUT.count()));
+        m_failed = true;
     }
     return nullptr;
 }
 
-bool VolumeBlockReader::ReadBlock(uint8_t* buffer, uint32_t& nBytesToRead)
+uint32_t VolumeBlockReader::CurrentBlockLength(const ReaderWorker& worker) const
 {
-    ErrCodeType errorCode = 0;
     uint32_t blockSize = m_sharedConfig->blockSize;
-    uint64_t currentOffset = m_baseOffset + m_currentIndex * m_sharedConfig->blockSize;
-    uint64_t bytesRemain = m_sharedConfig->sessionSize - m_currentIndex * blockSize;
+    uint64_t bytesRemain = m_sharedConfig->sessionSize - worker.currentIndex * blockSize;
     if (bytesRemain < static_cast<uint64_t>(blockSize)) {
-        nBytesToRead = static_cast<uint32_t>(bytesRemain);
-    } else {
-        nBytesToRead = blockSize;
+        return static_cast<uint32_t>(bytesRemain);
     }
+    return blockSize;
+}
+
+bool VolumeBlockReader::ReadBlock(ReaderWorker& worker, uint8_t* buffer, uint32_t& nBytesToRead)
+{
+    ErrCodeType errorCode = 0;
+    uint64_t currentOffset = m_baseOffset + worker.currentIndex * m_sharedConfig->blockSize;
+    nBytesToRead = CurrentBlockLength(worker);
 
-    if (!m_dataReader->Read(currentOffset, buffer, nBytesToRead, errorCode)) {
+    auto issueTime = std::chrono::steady_clock::now();
+    if (!worker.dataReader->Read(currentOffset, buffer, nBytesToRead, errorCode)) {
         ERRLOG("failed to read %u bytes, error code = %u", nBytesToRead, errorCode);
         HandleReadError(errorCode);
         return false;
     }
     m_sharedContext->counter->bytesRead += static_cast<uint64_t>(nBytesToRead);
+    if (m_sharedContext->readLimiter != nullptr) {
+        m_sharedContext->readLimiter->Consume(nBytesToRead);
+        m_sharedContext->readLimiter->RecordLatency(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - issueTime));
+    }
     return true;
 }
 
+bool VolumeBlockReader::SubmitReadBlock(ReaderWorker& worker, uint8_t* buffer)
+{
+    ErrCodeType errorCode = 0;
+    uint64_t currentOffset = m_baseOffset + worker.currentIndex * m_sharedConfig->blockSize;
+    uint32_t nBytesToRead = CurrentBlockLength(worker);
+    if (!worker.asyncDataReader->Submit(worker.currentIndex, currentOffset, buffer, nBytesToRead, errorCode)) {
+        ERRLOG("failed to submit read request of %u bytes, error code = %u", nBytesToRead, errorCode);
+        m_sharedContext->allocator->BlockFree(buffer);
+        HandleReadError(errorCode);
+        return false;
+    }
+    uint64_t consumeBlockOffset = worker.currentIndex * m_sharedConfig->blockSize + m_sharedConfig->sessionOffset;
+    worker.inflightBlocks[worker.currentIndex] =
+        VolumeConsumeBlock { buffer, worker.currentIndex, consumeBlockOffset, nBytesToRead, 0, false };
+    if (m_sharedContext->readLimiter != nullptr) {
+        // charged on submission, so that requests in flight are paced
+        m_sharedContext->readLimiter->Consume(nBytesToRead);
+        worker.inflightSince[worker.currentIndex] = std::chrono::steady_clock::now();
+    }
+    return true;
+}
+
+void VolumeBlockReader::HandleReadCompletion(ReaderWorker& worker, const AsyncIOResult& result)
+{
+    auto it = worker.inflightBlocks.find(result.key);
+    if (it == worker.inflightBlocks.end()) {
+        ERRLOG("unexpected read completion, index %llu", result.key);
+        return;
+    }
+    VolumeConsumeBlock consumeBlock = it->second;
+    worker.inflightBlocks.erase(it);
+    auto issueIt = worker.inflightSince.find(result.key);
+    if (issueIt != worker.inflightSince.end()) {
+        m_sharedContext->readLimiter->RecordLatency(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - issueIt->second));
+        worker.inflightSince.erase(issueIt);
+    }
+    if (result.errorCode != 0 || m_failed || m_abort) {
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        if (result.errorCode != 0) {
+            ERRLOG("failed to read %u bytes of index %llu, error code = %u",
+                consumeBlock.length, consumeBlock.index, result.errorCode);
+            HandleReadError(result.errorCode);
+        }
+        return;
+    }
+    m_sharedContext->counter->bytesRead += static_cast<uint64_t>(consumeBlock.length);
+    PushForward(worker, consumeBlock);
+}
+
+// wait all requests in flight to complete before release the buffers
+void VolumeBlockReader::DrainInflightBlocks(ReaderWorker& worker)
+{
+    AsyncIOResult result {};
+    while (worker.asyncDataReader->InFlight() > 0 && worker.asyncDataReader->Reap(result, true)) {
+        auto it = worker.inflightBlocks.find(result.key);
+        if (it != worker.inflightBlocks.end()) {
+            m_sharedContext->allocator->BlockFree(it->second.ptr);
+            worker.inflightBlocks.erase(it);
+        }
+    }
+    worker.inflightSince.clear();
+    if (!worker.inflightBlocks.empty()) {
+        WARNLOG("%llu read requests still in flight, buffers are not released", worker.inflightBlocks.size());
+    }
+}
+
 void VolumeBlockReader::HandleReadError(ErrCodeType errorCode)
 {
+    std::lock_guard<std::mutex> lk(m_workerMutex);
     m_failed = true;
     m_errorCode = errorCode;
 #ifdef __linux__
@@ -281,4 +639,4 @@ void VolumeBlockReader::HandleReadError(ErrCodeType errorCode)
         VOLUMEPROTECT_ERR_COPY_ACCESS_DENIED : VOLUMEPROTECT_ERR_VOLUME_ACCESS_DENIED;
     }
 #endif
-}
\ No newline at end of file
+}
@@ -9,6 +9,9 @@
 #include "VolumeProtector.h"
 #include "native/RawIO.h"
 #include "VolumeBlockWriter.h"
+#include "CheckpointJournal.h"
+#include "BlockHash.h"
+#include <algorithm>
 
 using namespace volumeprotect;
 using namespace volumeprotect::task;
@@ -26,6 +29,8 @@ std::shared_ptr<VolumeBlockWriter> VolumeBlockWriter::BuildCopyWriter(
     sessionIOParam.volumeOffset = sharedConfig->sessionOffset;
     sessionIOParam.length = sharedConfig->sessionSize;
     sessionIOParam.copyFilePath = sharedConfig->copyFilePath;
+    sessionIOParam.ioOption = RawIOOption {
+        sharedConfig->ioEngine, sharedConfig->ioQueueDepth, sharedConfig->ioCacheMode };
 
     std::shared_ptr<RawDataWriter> dataWriter = rawio::OpenRawDataCopyWriter(sessionIOParam);
     if (dataWriter == nullptr) {
@@ -54,7 +59,8 @@ std::shared_ptr<VolumeBlockWriter> VolumeBlockWriter::BuildVolumeWriter(
 {
     std::string volumePath = sharedConfig->volumePath;
     // check target block device valid to write
-    std::shared_ptr<RawDataWriter> dataWriter = rawio::OpenRawDataVolumeWriter(volumePath);
+    RawIOOption ioOption { sharedConfig->ioEngine, sharedConfig->ioQueueDepth, sharedConfig->ioCacheMode };
+    std::shared_ptr<RawDataWriter> dataWriter = rawio::OpenRawDataVolumeWriter(volumePath, ioOption);
     if (dataWriter == nullptr) {
         ERRLOG("failed to build volume data reader");
         return nullptr;
@@ -84,7 +90,12 @@ bool VolumeBlockWriter::Start()
         m_status = TaskStatus::FAILED;
         return false;
     }
-    m_writerThread = std::thread(&VolumeBlockWriter::MainThread, this);
+    if (m_asyncDataWriter != nullptr) {
+        INFOLOG("writer use async I/O, queue depth %u", m_asyncDataWriter->QueueDepth());
+    }
+    m_writerJob = TaskExecutor::Instance().Submit([this]() {
+        return (m_asyncDataWriter != nullptr) ? AsyncWriteStep() : WriteStep();
+    }, m_sharedContext->executorGroup);
     return true;
 }
 
@@ -96,8 +107,8 @@ bool VolumeBlockWriter::Flush()
 VolumeBlockWriter::~VolumeBlockWriter()
 {
     DBGLOG("destroy VolumeBlockWriter");
-    if (m_writerThread.joinable()) {
-        m_writerThread.join();
+    if (m_writerJob != nullptr) {
+        m_writerJob->Wait();
     }
     m_dataWriter.reset();
 }
@@ -107,74 +118,319 @@ VolumeBlockWriter::VolumeBlockWriter(const VolumeBlockWriterParam& param)
     m_targetPath(param.targetPath),
     m_sharedConfig(param.sharedConfig),
     m_sharedContext(param.sharedContext),
-    m_dataWriter(param.dataWriter)
+    m_dataWriter(param.dataWriter),
+    m_asyncDataWriter(std::dynamic_pointer_cast<AsyncRawDataWriter>(param.dataWriter))
 {}
 
-bool VolumeBlockWriter::NeedToWrite(uint8_t* buffer, int length) const
+bool VolumeBlockWriter::NeedToWrite(const VolumeConsumeBlock& consumeBlock)
 {
-    if (!m_sharedConfig->skipEmptyBlock) {
+    if (!m_sharedConfig->skipEmptyBlock && !m_sharedConfig->punchZeroBlock) {
+        return true;
+    }
+    // zero block has been flagged by hasher if enabled
+    bool zero = consumeBlock.zero ||
+        (!m_sharedConfig->hasherEnabled && blockhash::IsZeroBlock(consumeBlock.ptr, consumeBlock.length));
+    if (!zero) {
         return true;
     }
-    if (buffer[0] == 0 && !::memcmp(buffer, buffer + 1, length - 1)) {
-        // is all zero
+    if (m_sharedConfig->punchZeroBlock) {
+        return !PunchZeroBlock(consumeBlock);
+    }
+    return false;
+}
+
+bool VolumeBlockWriter::PunchZeroBlock(const VolumeConsumeBlock& consumeBlock)
+{
+    ErrCodeType errorCode = 0;
+    if (m_punchHoleFailed) {
+        return false;
+    }
+    if (!m_dataWriter->PunchHole(consumeBlock.volumeOffset, consumeBlock.length, errorCode)) {
+        WARNLOG("failed to punch hole of block[%llu] in %s, error code = %u, write zero data instead",
+            consumeBlock.index, m_targetPath.c_str(), errorCode);
+        m_punchHoleFailed = true;
         return false;
     }
+    DBGLOG("zero block[%llu] (%llu, %u) punched", consumeBlock.index, consumeBlock.volumeOffset, consumeBlock.length);
     return true;
 }
 
-void VolumeBlockWriter::MainThread()
+void VolumeBlockWriter::HandleWriterTerminate()
+{
+    if (m_status == TaskStatus::SUCCEED && m_sharedContext->counter->blockesWriteFailed != 0) {
+        m_status = TaskStatus::FAILED;
+        ERRLOG("%llu blockes failed to write, set writer status to fail",
+            m_sharedContext->counter->blockesWriteFailed.load());
+    }
+    INFOLOG("writer read terminated with status %s", GetStatusString().c_str());
+    if (m_sharedContext->notifier != nullptr) {
+        m_sharedContext->notifier->Notify();
+    }
+    return;
+}
+
+/**
+ * @brief write one block, never block on the write queue
+ */
+StepResult VolumeBlockWriter::WriteStep()
 {
     VolumeConsumeBlock consumeBlock {};
     ErrCodeType errorCode = 0;
-    DBGLOG("writer thread start");
 
-    while (true) {
-        DBGLOG("writer thread check");
-        if (m_abort) {
-            m_status = TaskStatus::ABORTED;
-            break;
+    DBGLOG("writer check");
+    ApplyThreadIOPriority(m_sharedConfig->ioPriority);
+    if (m_abort) {
+        m_status = TaskStatus::ABORTED;
+        HandleWriterTerminate();
+        return StepResult::DONE;
+    }
+    if (IsWriteThrottled()) {
+        return StepResult::WAIT;
+    }
+    uint64_t writeSequence = m_sharedContext->writeQueueEvent->Sequence();
+    if (!m_sharedContext->writeQueue->TryBlockingPop(consumeBlock)) {
+        if (!m_sharedContext->writeQueue->Drained()) {
+            return TaskExecutor::WaitFor(m_sharedContext->writeQueueEvent, writeSequence);
+        }
+        // queue has been finished
+        m_status = TaskStatus::SUCCEED;
+        HandleWriterTerminate();
+        return StepResult::DONE;
+    }
+
+    uint8_t* buffer = consumeBlock.ptr;
+    uint64_t writerOffset = consumeBlock.volumeOffset;
+    uint32_t length = consumeBlock.length;
+    uint64_t index = consumeBlock.index;
+
+    if (m_failed) {
+        DBGLOG("block writer has failed, skip any write request");
+        m_sharedContext->allocator->BlockFree(buffer);
+        ++m_sharedContext->counter->blockesWriteFailed;
+        return StepResult::CONTINUE;
+    }
+
+    DBGLOG("write block[%llu] (%p, %llu, %u) writerOffset = %llu",
+        index, buffer, consumeBlock.volumeOffset, length, writerOffset);
+    bool needToWrite = NeedToWrite(consumeBlock);
+    if (needToWrite && !WriteDirtyRanges(consumeBlock, errorCode)) {
+        ERRLOG("write %d bytes at %llu failed, error code = %u", length, writerOffset, errorCode);
+        m_sharedContext->allocator->BlockFree(buffer);
+        ++m_sharedContext->counter->blockesWriteFailed;
+        HandleWriteError(errorCode);
+        // writer should not terminate (otherwise writer queue may block reader)
+        return StepResult::CONTINUE;
+    }
+    if (needToWrite) {
+        ChargeWrite(consumeBlock);
+    }
+    MarkBlockWritten(consumeBlock);
+    return StepResult::CONTINUE;
+}
+
+/**
+ * @brief keep up to queue depth write requests in flight, block is marked written once its request completed.
+ *  Only wait for write completions, never block on the write queue.
+ */
+StepResult VolumeBlockWriter::AsyncWriteStep()
+{
+    VolumeConsumeBlock consumeBlock {};
+
+    DBGLOG("writer check, %u in flight", m_asyncDataWriter->InFlight());
+    ApplyThreadIOPriority(m_sharedConfig->ioPriority);
+    bool terminate = false;
+    uint64_t writeSequence = m_sharedContext->writeQueueEvent->Sequence();
+    if (m_abort) {
+        m_status = TaskStatus::ABORTED;
+        terminate = true;
+    } else if (IsWriteThrottled()) {
+        if (m_asyncDataWriter->InFlight() != 0) {
+            ReapWriteCompletions(true);
+            return StepResult::CONTINUE;
+        }
+        return StepResult::WAIT;
+    } else if (!m_sharedContext->writeQueue->TryBlockingPop(consumeBlock)) {
+        if (m_asyncDataWriter->InFlight() != 0) {
+            // nothing to submit, reap completions to release buffers to reader
+            ReapWriteCompletions(true);
+            return StepResult::CONTINUE;
+        }
+        if (!m_sharedContext->writeQueue->Drained()) {
+            return TaskExecutor::WaitFor(m_sharedContext->writeQueueEvent, writeSequence);
         }
-        if (!m_sharedContext->writeQueue->BlockingPop(consumeBlock)) {
-            // queue has been finished
-            m_status = TaskStatus::SUCCEED;
-            break;
+        // queue has been finished
+        m_status = TaskStatus::SUCCEED;
+        terminate = true;
+    }
+    if (terminate) {
+        // wait all requests in flight to complete before release the buffers
+        while (m_asyncDataWriter->InFlight() > 0 && ReapWriteCompletions(true)) {}
+        if (!m_inflightBlocks.empty()) {
+            WARNLOG("%llu write requests still in flight, buffers are not released", m_inflightBlocks.size());
         }
+        HandleWriterTerminate();
+        return StepResult::DONE;
+    }
+
+    if (m_failed) {
+        DBGLOG("block writer has failed, skip any write request");
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        ++m_sharedContext->counter->blockesWriteFailed;
+        return StepResult::CONTINUE;
+    }
+    if (!NeedToWrite(consumeBlock)) {
+        MarkBlockWritten(consumeBlock);
+        return StepResult::CONTINUE;
+    }
+    if (m_asyncDataWriter->InFlight() >= m_asyncDataWriter->QueueDepth() && !ReapWriteCompletions(true)) {
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        ++m_sharedContext->counter->blockesWriteFailed;
+        return StepResult::CONTINUE;
+    }
+    SubmitWriteBlock(consumeBlock);
+    ChargeWrite(consumeBlock);
+    ReapWriteCompletions(false);
+    return StepResult::CONTINUE;
+}
+
+// rate limit of the task reached, the next block can't be written now
+bool VolumeBlockWriter::IsWriteThrottled() const
+{
+    return m_sharedContext->writeLimiter != nullptr && !m_sharedContext->writeLimiter->Admit();
+}
 
-        uint8_t* buffer = consumeBlock.ptr;
-        uint64_t writerOffset = consumeBlock.volumeOffset;
-        uint32_t length = consumeBlock.length;
-        uint64_t index = consumeBlock.index;
+// charge bytes of the block actually written, called only if the block is not skipped
+void VolumeBlockWriter::ChargeWrite(const VolumeConsumeBlock& consumeBlock) const
+{
+    if (m_sharedContext->writeLimiter != nullptr) {
+        m_sharedContext->writeLimiter->Consume(DirtyLength(consumeBlock, m_sharedConfig->subBlockSize));
+    }
+}
 
-        if (m_failed) {
-            DBGLOG("block writer has failed, skip any write request");
-            m_sharedContext->allocator->BlockFree(buffer);
-            ++m_sharedContext->counter->blockesWriteFailed;
+/**
+ * @brief write changed sub-blocks of the block, adjacent changed sub-blocks are merged into a single write
+ */
+bool VolumeBlockWriter::WriteDirtyRanges(const VolumeConsumeBlock& consumeBlock, ErrCodeType& errorCode)
+{
+    uint32_t subBlockSize = m_sharedConfig->subBlockSize;
+    if (consumeBlock.dirtyMask == 0 || subBlockSize == 0) {
+        return m_dataWriter->Write(consumeBlock.volumeOffset, consumeBlock.ptr, consumeBlock.length, errorCode);
+    }
+    uint32_t count = std::min(MAX_SUB_BLOCKS_PER_BLOCK, (consumeBlock.length + subBlockSize - 1) / subBlockSize);
+    uint32_t i = 0;
+    while (i < count) {
+        if (((consumeBlock.dirtyMask >> i) & 1ULL) == 0) {
+            ++i;
             continue;
         }
-
-        DBGLOG("write block[%llu] (%p, %llu, %u) writerOffset = %llu",
-            index, buffer, consumeBlock.volumeOffset, length, writerOffset);
-        if (NeedToWrite(buffer, length) &&
-            !m_dataWriter->Write(writerOffset, buffer, length, errorCode)) {
-            ERRLOG("write %d bytes at %llu failed, error code = %u", length, writerOffset, errorCode);
-            m_sharedContext->allocator->BlockFree(buffer);
-            ++m_sharedContext->counter->blockesWriteFailed;
-            HandleWriteError(errorCode);
-            // writer should not return (otherwise writer queue may block reader)
+        uint32_t j = i;
+        while (j < count && ((consumeBlock.dirtyMask >> j) & 1ULL) != 0) {
+            ++j;
+        }
+        uint32_t start = i * subBlockSize;
+        uint32_t end = std::min(j * subBlockSize, consumeBlock.length);
+        DBGLOG("write block[%llu] range [%u, %u)", consumeBlock.index, start, end);
+        if (!m_dataWriter->Write(consumeBlock.volumeOffset + start, consumeBlock.ptr + start, end - start, errorCode)) {
+            return false;
         }
+        i = j;
+    }
+    return true;
+}
 
-        m_sharedContext->writtenBitmap->Set(index);
-        m_sharedContext->processedBitmap->Set(index);
-        m_sharedContext->allocator->BlockFree(buffer);
-        m_sharedContext->counter->bytesWritten += length;
+/**
+ * @brief get the range covering all changed sub-blocks, async writer submit only one request for each block
+ */
+void VolumeBlockWriter::DirtySpan(const VolumeConsumeBlock& consumeBlock, uint32_t& start, uint32_t& length) const
+{
+    uint32_t subBlockSize = m_sharedConfig->subBlockSize;
+    start = 0;
+    length = consumeBlock.length;
+    if (consumeBlock.dirtyMask == 0 || subBlockSize == 0) {
+        return;
     }
-    if (m_status == TaskStatus::SUCCEED && m_sharedContext->counter->blockesWriteFailed != 0) {
-        m_status = TaskStatus::FAILED;
-        ERRLOG("%llu blockes failed to write, set writer status to fail",
-            m_sharedContext->counter->blockesWriteFailed.load());
+    uint32_t first = 0;
+    while (((consumeBlock.dirtyMask >> first) & 1ULL) == 0) {
+        ++first;
     }
-    INFOLOG("writer read terminated with status %s", GetStatusString().c_str());
-    return;
+    uint32_t last = MAX_SUB_BLOCKS_PER_BLOCK - 1;
+    while (((consumeBlock.dirtyMask >> last) & 1ULL) == 0) {
+        --last;
+    }
+    start = std::min(first * subBlockSize, consumeBlock.length);
+    length = std::min((last + 1) * subBlockSize, consumeBlock.length) - start;
+}
+
+void VolumeBlockWriter::SubmitWriteBlock(const VolumeConsumeBlock& consumeBlock)
+{
+    ErrCodeType errorCode = 0;
+    uint32_t start = 0;
+    uint32_t length = 0;
+    DirtySpan(consumeBlock, start, length);
+    DBGLOG("submit write block[%llu] (%p, %llu, %u), range [%u, %u)",
+        consumeBlock.index, consumeBlock.ptr, consumeBlock.volumeOffset, consumeBlock.length, start, start + length);
+    if (!m_asyncDataWriter->Submit(consumeBlock.index, consumeBlock.volumeOffset + start,
+        consumeBlock.ptr + start, length, errorCode)) {
+        ERRLOG("submit write %u bytes at %llu failed, error code = %u",
+            length, consumeBlock.volumeOffset + start, errorCode);
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        ++m_sharedContext->counter->blockesWriteFailed;
+        HandleWriteError(errorCode);
+        return;
+    }
+    m_inflightBlocks[consumeBlock.index] = consumeBlock;
+}
+
+/**
+ * @brief reap completed write requests
+ * @param wait if to wait for at least one request to complete
+ * @return false if failed to wait for completion
+ */
+bool VolumeBlockWriter::ReapWriteCompletions(bool wait)
+{
+    AsyncIOResult result {};
+    bool reaped = false;
+    while (m_asyncDataWriter->Reap(result, wait && !reaped)) {
+        HandleWriteCompletion(result);
+        reaped = true;
+    }
+    if (wait && !reaped && m_asyncDataWriter->InFlight() != 0) {
+        ERRLOG("failed to reap write request, error code = %u", m_asyncDataWriter->Error());
+        HandleWriteError(m_asyncDataWriter->Error());
+        return false;
+    }
+    return true;
+}
+
+void VolumeBlockWriter::HandleWriteCompletion(const AsyncIOResult& result)
+{
+    auto it = m_inflightBlocks.find(result.key);
+    if (it == m_inflightBlocks.end()) {
+        ERRLOG("unexpected write completion, index %llu", result.key);
+        return;
+    }
+    VolumeConsumeBlock consumeBlock = it->second;
+    m_inflightBlocks.erase(it);
+    if (result.errorCode != 0) {
+        ERRLOG("write %u bytes at %llu failed, error code = %u",
+            consumeBlock.length, consumeBlock.volumeOffset, result.errorCode);
+        m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+        ++m_sharedContext->counter->blockesWriteFailed;
+        HandleWriteError(result.errorCode);
+        return;
+    }
+    MarkBlockWritten(consumeBlock);
+}
+
+void VolumeBlockWriter::MarkBlockWritten(const VolumeConsumeBlock& consumeBlock)
+{
+    m_sharedContext->writtenBitmap->Set(consumeBlock.index);
+    m_sharedContext->processedBitmap->Set(consumeBlock.index);
+    if (m_sharedContext->checkpointJournal != nullptr) {
+        m_sharedContext->checkpointJournal->Append(consumeBlock.index, true);
+    }
+    m_sharedContext->allocator->BlockFree(consumeBlock.ptr);
+    m_sharedContext->counter->bytesWritten += DirtyLength(consumeBlock, m_sharedConfig->subBlockSize);
 }
 
 void VolumeBlockWriter::HandleWriteError(ErrCodeType errorCode)
@@ -12,6 +12,14 @@
 #include "VolumeBlockReader.h"
 #include "VolumeBlockWriter.h"
 #include "VolumeBlockHasher.h"
+#include "BlockBufferPool.h"
+#include "CheckpointJournal.h"
+#include "BlockHash.h"
+#include <new>
+#include <algorithm>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 using namespace volumeprotect;
 using namespace volumeprotect::task;
@@ -19,56 +27,177 @@ using namespace volumeprotect::task;
 namespace {
     constexpr uint64_t NUM2 = 2;
     constexpr uint32_t BITS_PER_UINT8 = 8;
-    constexpr uint32_t BITMAP_RSHIFT = 3; // 2^3 = 8
+    constexpr uint32_t BITS_PER_UINT32 = 32;
+    constexpr uint64_t BITS_PER_WORD = 64;
+    constexpr uint64_t BYTES_PER_WORD = 8;
+
+    // value must not be zero
+    inline uint32_t CountTrailingZeros(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index = 0;
+        _BitScanForward64(&index, value);
+        return static_cast<uint32_t>(index);
+#elif defined(_MSC_VER)
+        uint32_t count = 0;
+        while ((value & 1ULL) == 0) {
+            value >>= 1;
+            ++count;
+        }
+        return count;
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    inline uint32_t PopCount(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        return static_cast<uint32_t>(__popcnt64(value));
+#elif defined(_MSC_VER)
+        uint32_t count = 0;
+        for (; value != 0; value &= value - 1) {
+            ++count;
+        }
+        return count;
+#else
+        return static_cast<uint32_t>(__builtin_popcountll(value));
+#endif
+    }
+
+    // replace the heap table with the mapped one
+    bool MapTable(uint8_t*& table, uint64_t& tableSize, std::shared_ptr<fsapi::MappedFile>& tableFile,
+        const std::string& filepath, uint64_t size, bool writable, bool truncate)
+    {
+        std::shared_ptr<fsapi::MappedFile> mappedFile = fsapi::MappedFile::Open(filepath, size, writable, truncate);
+        if (mappedFile == nullptr) {
+            return false;
+        }
+        if (table != nullptr && tableFile == nullptr) {
+            delete[] table;
+        }
+        tableFile = mappedFile;
+        table = mappedFile->Ptr();
+        tableSize = size;
+        return true;
+    }
 }
 
 // implement VolumeBlockAllocator...
 
-VolumeBlockAllocator::VolumeBlockAllocator(uint32_t blockSize, uint32_t blockNum)
+VolumeBlockAllocator::VolumeBlockAllocator(uint32_t blockSize, uint32_t blockNum, uint32_t alignment)
     : m_blockSize(blockSize), m_blockNum(blockNum)
 {
-    m_pool = new uint8_t[blockSize * blockNum];
-    m_allocTable = new bool[blockNum];
-    memset(m_allocTable, 0, blockNum * sizeof(bool));
+    // lease from the process-wide pool, over allocate to align the start of the pool if region alignment isn't enough
+    uint64_t padding = (alignment > BUFFER_POOL_REGION_ALIGNMENT) ? alignment : 0;
+    m_rawPool = BlockBufferPool::Instance().Lease(static_cast<uint64_t>(blockSize) * blockNum + padding, m_rawPoolSize);
+    if (m_rawPool == nullptr) {
+        throw std::bad_alloc();
+    }
+    uintptr_t address = reinterpret_cast<uintptr_t>(m_rawPool);
+    m_pool = m_rawPool + (alignment - address % alignment) % alignment;
+    // link all blocks into free list, index m_blockNum marks the end of list
+    m_nextFree = new std::atomic<uint32_t>[blockNum];
+    for (uint32_t i = 0; i < blockNum; ++i) {
+        m_nextFree[i] = i + 1;
+    }
+    m_freeHead = 0;
 }
 
 VolumeBlockAllocator::~VolumeBlockAllocator()
 {
-    if (m_pool) {
-        delete [] m_pool;
+    if (m_rawPool) {
+        // return to the pool for the next session instead of freeing it
+        BlockBufferPool::Instance().Release(m_rawPool, m_rawPoolSize);
+        m_rawPool = nullptr;
         m_pool = nullptr;
     }
-    if (m_allocTable) {
-        delete [] m_allocTable;
-        m_allocTable = nullptr;
+    if (m_nextFree) {
+        delete [] m_nextFree;
+        m_nextFree = nullptr;
+    }
+}
+
+uint32_t VolumeBlockAllocator::PopFreeIndex()
+{
+    uint64_t head = m_freeHead.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t index = static_cast<uint32_t>(head & UINT32_MAX);
+        if (index >= m_blockNum) {
+            return m_blockNum;
+        }
+        uint32_t next = m_nextFree[index].load(std::memory_order_relaxed);
+        uint64_t newHead = ((head >> BITS_PER_UINT32) + 1) << BITS_PER_UINT32 | next;
+        if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return index;
+        }
+    }
+}
+
+void VolumeBlockAllocator::PushFreeIndex(uint32_t index)
+{
+    uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+    while (true) {
+        m_nextFree[index].store(static_cast<uint32_t>(head & UINT32_MAX), std::memory_order_relaxed);
+        uint64_t newHead = ((head >> BITS_PER_UINT32) + 1) << BITS_PER_UINT32 | index;
+        if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
     }
 }
 
 uint8_t* VolumeBlockAllocator::BlockAlloc()
 {
-    std::lock_guard<std::mutex> lk(m_mutex);
-    for (int i = 0; i < static_cast<int>(m_blockNum); i++) {
-        if (!m_allocTable[i]) {
-            m_allocTable[i] = true;
-            uint8_t* ptr = m_pool + (m_blockSize * i);
-            DBGLOG("BlockAlloc index = %d, address = %p", i, ptr);
-            return ptr;
+    uint32_t index = PopFreeIndex();
+    if (index >= m_blockNum) {
+        return nullptr;
+    }
+    uint8_t* ptr = m_pool + static_cast<uint64_t>(m_blockSize) * index;
+    DBGLOG("BlockAlloc index = %u, address = %p", index, ptr);
+    return ptr;
+}
+
+uint8_t* VolumeBlockAllocator::BlockAllocWait(std::chrono::milliseconds timeout)
+{
+    uint8_t* ptr = BlockAlloc();
+    if (ptr != nullptr) {
+        return ptr;
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lk(m_mutex);
+    // register as waiter before retry, so BlockFree will notify if it push a block after the retry
+    ++m_waiters;
+    while ((ptr = BlockAlloc()) == nullptr) {
+        if (m_freeCond.wait_until(lk, deadline) == std::cv_status::timeout) {
+            ptr = BlockAlloc();
+            break;
         }
     }
-    return nullptr;
+    --m_waiters;
+    return ptr;
 }
 
 void VolumeBlockAllocator::BlockFree(uint8_t* ptr)
 {
-    std::lock_guard<std::mutex> lk(m_mutex);
-    uint64_t index = (ptr - m_pool) / static_cast<uint64_t>(m_blockSize);
+    uint64_t offset = static_cast<uint64_t>(ptr - m_pool);
+    uint64_t index = offset / static_cast<uint64_t>(m_blockSize);
     DBGLOG("BlockFree address = %p, index = %llu", ptr, index);
-    if ((ptr - m_pool) % m_blockSize == 0) {
-        m_allocTable[index] = false;
-        return;
+    if (ptr < m_pool || offset % m_blockSize != 0 || index >= m_blockNum) {
+        // reach err here
+        throw std::runtime_error("BlockFree error: bad address");
     }
-    // reach err here
-    throw std::runtime_error("BlockFree error: bad address");
+    PushFreeIndex(static_cast<uint32_t>(index));
+    if (m_waiters.load() != 0) {
+        // acquire the mutex to make sure the waiter is waiting on the condition variable
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_freeCond.notify_one();
+    }
+    m_freeEvent->Notify();
+}
+
+std::shared_ptr<ExecutorEvent> VolumeBlockAllocator::FreeEvent() const
+{
+    return m_freeEvent;
 }
 
 // implement BlockHashingContext...
@@ -91,34 +220,169 @@ BlockHashingContext::BlockHashingContext(uint64_t lSize)
 
 BlockHashingContext::~BlockHashingContext()
 {
-    if (lastestTable != nullptr) {
+    // tables mapped are unmapped by their files
+    if (lastestTable != nullptr && lastestFile == nullptr) {
         delete[] lastestTable;
         lastestTable = nullptr;
     }
-    if (previousTable == nullptr) {
+    if (previousTable != nullptr && previousFile == nullptr) {
         delete[] previousTable;
         previousTable = nullptr;
     }
+    if (subLastestTable != nullptr && subLastestFile == nullptr) {
+        delete[] subLastestTable;
+        subLastestTable = nullptr;
+    }
+    if (subPreviousTable != nullptr && subPreviousFile == nullptr) {
+        delete[] subPreviousTable;
+        subPreviousTable = nullptr;
+    }
+}
+
+void BlockHashingContext::AllocSubBlockTable(uint64_t lSize)
+{
+    subLastestTable = new uint8_t[lSize];
+    subLastestSize = lSize;
+    memset(subLastestTable, 0, sizeof(uint8_t) * lSize);
+}
+
+bool BlockHashingContext::MapLastestTable(const std::string& filepath, uint64_t lSize, bool truncate)
+{
+    return MapTable(lastestTable, lastestSize, lastestFile, filepath, lSize, true, truncate);
+}
+
+bool BlockHashingContext::MapSubLastestTable(const std::string& filepath, uint64_t lSize, bool truncate)
+{
+    return MapTable(subLastestTable, subLastestSize, subLastestFile, filepath, lSize, true, truncate);
+}
+
+bool BlockHashingContext::MapPreviousTable(const std::string& filepath, uint64_t pSize)
+{
+    return MapTable(previousTable, previousSize, previousFile, filepath, pSize, false, false);
+}
+
+bool BlockHashingContext::MapSubPreviousTable(const std::string& filepath, uint64_t pSize)
+{
+    return MapTable(subPreviousTable, subPreviousSize, subPreviousFile, filepath, pSize, false, false);
+}
+
+bool BlockHashingContext::IsLastestMapped() const
+{
+    return lastestFile != nullptr;
+}
+
+void BlockHashingContext::MarkLastestDirty(uint64_t offset, uint64_t length)
+{
+    if (lastestFile != nullptr) {
+        lastestFile->MarkDirty(offset, length);
+    }
+}
+
+void BlockHashingContext::MarkSubLastestDirty(uint64_t offset, uint64_t length)
+{
+    if (subLastestFile != nullptr) {
+        subLastestFile->MarkDirty(offset, length);
+    }
+}
+
+bool BlockHashingContext::FlushLastest()
+{
+    return (lastestFile == nullptr || lastestFile->Flush()) && (subLastestFile == nullptr || subLastestFile->Flush());
+}
+
+uint32_t task::SubBlocksPerBlock(uint32_t blockSize, uint32_t subBlockSize)
+{
+    if (subBlockSize == 0 || subBlockSize >= blockSize) {
+        return 0;
+    }
+    return (blockSize + subBlockSize - 1) / subBlockSize;
+}
+
+uint32_t task::DirtyLength(const VolumeConsumeBlock& consumeBlock, uint32_t subBlockSize)
+{
+    if (consumeBlock.dirtyMask == 0 || subBlockSize == 0) {
+        return consumeBlock.length;
+    }
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < MAX_SUB_BLOCKS_PER_BLOCK && i * subBlockSize < consumeBlock.length; ++i) {
+        if ((consumeBlock.dirtyMask >> i) & 1ULL) {
+            length += std::min(subBlockSize, consumeBlock.length - i * subBlockSize);
+        }
+    }
+    return length;
 }
 
 // implement Bitmap...
 
 Bitmap::Bitmap(uint64_t size)
 {
-    m_capacity = size / BITS_PER_UINT8 + 1;
-    m_table = new uint8_t[m_capacity]; // avoid using make_unique (requiring CXX14)
-    memset(m_table, 0, sizeof(uint8_t) * m_capacity);
+    Init(size / BITS_PER_UINT8 + 1);
 }
 
 Bitmap::Bitmap(uint8_t* ptr, uint64_t capacity)
-    : m_capacity(capacity), m_table(ptr)
-{}
+{
+    Init(capacity);
+    for (uint64_t wordIndex = 0; wordIndex < m_wordNum; ++wordIndex) {
+        uint64_t word = 0;
+        for (uint64_t byte = 0; byte < BYTES_PER_WORD && wordIndex * BYTES_PER_WORD + byte < capacity; ++byte) {
+            word |= static_cast<uint64_t>(ptr[wordIndex * BYTES_PER_WORD + byte]) << (byte * BITS_PER_UINT8);
+        }
+        if (word != 0) {
+            SetWordBits(wordIndex, word);
+        }
+    }
+    delete[] ptr;
+}
 
 Bitmap::~Bitmap()
 {
-    if (m_table != nullptr) {
-        delete[] m_table;
-        m_table = nullptr;
+    delete[] m_words;
+    delete[] m_fullWords;
+    delete[] m_usedWords;
+    m_words = nullptr;
+    m_fullWords = nullptr;
+    m_usedWords = nullptr;
+}
+
+void Bitmap::Init(uint64_t capacity)
+{
+    m_capacity = capacity;
+    m_wordNum = (capacity + BYTES_PER_WORD - 1) / BYTES_PER_WORD;
+    uint64_t summaryNum = (m_wordNum + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    m_words = new std::atomic<uint64_t>[m_wordNum];
+    m_fullWords = new std::atomic<uint64_t>[summaryNum];
+    m_usedWords = new std::atomic<uint64_t>[summaryNum];
+    for (uint64_t i = 0; i < m_wordNum; ++i) {
+        m_words[i].store(0, std::memory_order_relaxed);
+    }
+    for (uint64_t i = 0; i < summaryNum; ++i) {
+        m_fullWords[i].store(0, std::memory_order_relaxed);
+        m_usedWords[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+// bits of the word within capacity, the last word may be partial
+uint64_t Bitmap::ValidMask(uint64_t wordIndex) const
+{
+    uint64_t bits = m_capacity * BITS_PER_UINT8 - wordIndex * BITS_PER_WORD;
+    return (bits >= BITS_PER_WORD) ? UINT64_MAX : ((1ULL << bits) - 1);
+}
+
+// summary is updated after the word, so a word marked full or used in summary is always full or used
+void Bitmap::SetWordBits(uint64_t wordIndex, uint64_t mask)
+{
+    uint64_t previous = m_words[wordIndex].fetch_or(mask, std::memory_order_acq_rel);
+    uint64_t newBits = mask & ~previous;
+    if (newBits == 0) {
+        return;
+    }
+    m_setCount.fetch_add(PopCount(newBits), std::memory_order_relaxed);
+    uint64_t summaryBit = 1ULL << (wordIndex % BITS_PER_WORD);
+    if (previous == 0) {
+        m_usedWords[wordIndex / BITS_PER_WORD].fetch_or(summaryBit, std::memory_order_release);
+    }
+    if ((previous | mask) == ValidMask(wordIndex)) {
+        m_fullWords[wordIndex / BITS_PER_WORD].fetch_or(summaryBit, std::memory_order_release);
     }
 }
 
@@ -127,7 +391,20 @@ void Bitmap::Set(uint64_t index)
     if (index >= m_capacity * BITS_PER_UINT8) { // illegal argument
         return;
     }
-    m_table[index >> BITMAP_RSHIFT] |= (((uint8_t)1) << (index % BITS_PER_UINT8));
+    SetWordBits(index / BITS_PER_WORD, 1ULL << (index % BITS_PER_WORD));
+}
+
+void Bitmap::SetRange(uint64_t begin, uint64_t end)
+{
+    end = std::min(end, m_capacity * BITS_PER_UINT8);
+    while (begin < end) {
+        uint64_t wordIndex = begin / BITS_PER_WORD;
+        uint64_t wordEnd = std::min(end, (wordIndex + 1) * BITS_PER_WORD);
+        uint64_t bits = wordEnd - begin;
+        uint64_t mask = ((bits >= BITS_PER_WORD) ? UINT64_MAX : ((1ULL << bits) - 1)) << (begin % BITS_PER_WORD);
+        SetWordBits(wordIndex, mask);
+        begin = wordEnd;
+    }
 }
 
 bool Bitmap::Test(uint64_t index) const
@@ -135,17 +412,75 @@ bool Bitmap::Test(uint64_t index) const
     if (index >= m_capacity * BITS_PER_UINT8) { // illegal argument
         return false;
     }
-    return (m_table[index >> BITMAP_RSHIFT] & (((uint8_t)1) << (index % BITS_PER_UINT8))) != 0;
+    uint64_t word = m_words[index / BITS_PER_WORD].load(std::memory_order_acquire);
+    return (word & (1ULL << (index % BITS_PER_WORD))) != 0;
 }
 
-uint64_t Bitmap::FirstIndexUnset() const
+// index of the first word not less than from whose summary bit equals to set, m_wordNum if not found
+uint64_t Bitmap::NextWord(const std::atomic<uint64_t>* summary, uint64_t from, bool set) const
 {
-    for (uint64_t index = 0; index < m_capacity * BITS_PER_UINT8; ++index) {
-        if (!Test(index)) {
-            return index;
+    while (from < m_wordNum) {
+        uint64_t bits = summary[from / BITS_PER_WORD].load(std::memory_order_acquire);
+        bits = (set ? bits : ~bits) & (UINT64_MAX << (from % BITS_PER_WORD));
+        if (bits != 0) {
+            return std::min(m_wordNum, from / BITS_PER_WORD * BITS_PER_WORD + CountTrailingZeros(bits));
+        }
+        from = (from / BITS_PER_WORD + 1) * BITS_PER_WORD;
+    }
+    return m_wordNum;
+}
+
+uint64_t Bitmap::NextSet(uint64_t from) const
+{
+    uint64_t bitNum = m_capacity * BITS_PER_UINT8;
+    if (from >= bitNum) {
+        return bitNum;
+    }
+    uint64_t wordIndex = from / BITS_PER_WORD;
+    uint64_t word = m_words[wordIndex].load(std::memory_order_acquire) & (UINT64_MAX << (from % BITS_PER_WORD));
+    if (word != 0) {
+        return wordIndex * BITS_PER_WORD + CountTrailingZeros(word);
+    }
+    wordIndex = NextWord(m_usedWords, wordIndex + 1, true);
+    if (wordIndex >= m_wordNum) {
+        return bitNum;
+    }
+    return wordIndex * BITS_PER_WORD + CountTrailingZeros(m_words[wordIndex].load(std::memory_order_acquire));
+}
+
+uint64_t Bitmap::NextUnset(uint64_t from) const
+{
+    uint64_t bitNum = m_capacity * BITS_PER_UINT8;
+    if (from >= bitNum) {
+        return bitNum;
+    }
+    uint64_t wordIndex = from / BITS_PER_WORD;
+    uint64_t mask = UINT64_MAX << (from % BITS_PER_WORD);
+    while (wordIndex < m_wordNum) {
+        uint64_t word = ~m_words[wordIndex].load(std::memory_order_acquire) & ValidMask(wordIndex) & mask;
+        if (word != 0) {
+            return wordIndex * BITS_PER_WORD + CountTrailingZeros(word);
         }
+        // the word may become full after summary is checked, keep searching
+        wordIndex = NextWord(m_fullWords, wordIndex + 1, false);
+        mask = UINT64_MAX;
+    }
+    return bitNum;
+}
+
+bool Bitmap::NextSetRange(uint64_t from, uint64_t& begin, uint64_t& end) const
+{
+    begin = NextSet(from);
+    if (begin > MaxIndex()) {
+        return false;
     }
-    return MaxIndex() + 1;
+    end = NextUnset(begin);
+    return true;
+}
+
+uint64_t Bitmap::FirstIndexUnset() const
+{
+    return NextUnset(0);
 }
 
 uint64_t Bitmap::Capacity() const
@@ -160,20 +495,37 @@ uint64_t Bitmap::MaxIndex() const
 
 uint64_t Bitmap::TotalSetCount() const
 {
-    uint64_t totalSetCount = 0;
-    for (uint64_t index = 0; index < m_capacity * BITS_PER_UINT8; ++index) {
-        totalSetCount += Test(index) ? 1 : 0;
-    }
-    return totalSetCount;
+    return m_setCount.load(std::memory_order_relaxed);
 }
 
-const uint8_t* Bitmap::Ptr() const
+void Bitmap::CopyTo(uint8_t* buffer) const
 {
-    return m_table;
+    for (uint64_t wordIndex = 0; wordIndex < m_wordNum; ++wordIndex) {
+        uint64_t word = m_words[wordIndex].load(std::memory_order_acquire);
+        for (uint64_t byte = 0; byte < BYTES_PER_WORD && wordIndex * BYTES_PER_WORD + byte < m_capacity; ++byte) {
+            buffer[wordIndex * BYTES_PER_WORD + byte] = static_cast<uint8_t>(word >> (byte * BITS_PER_UINT8));
+        }
+    }
 }
 
 // implement VolumeTaskSession...
 
+void VolumeTaskSharedContext::InitHashingQueue(std::size_t size)
+{
+    hashingQueueEvent = std::make_shared<ExecutorEvent>();
+    hashingQueue = std::make_shared<RingQueue<VolumeConsumeBlock>>(size);
+    std::shared_ptr<ExecutorEvent> event = hashingQueueEvent;
+    hashingQueue->SetNotifyHook([event]() { event->Notify(); });
+}
+
+void VolumeTaskSharedContext::InitWriteQueue(std::size_t size)
+{
+    writeQueueEvent = std::make_shared<ExecutorEvent>();
+    writeQueue = std::make_shared<RingQueue<VolumeConsumeBlock>>(size);
+    std::shared_ptr<ExecutorEvent> event = writeQueueEvent;
+    writeQueue->SetNotifyHook([event]() { event->Notify(); });
+}
+
 uint64_t VolumeTaskSession::MaxIndex() const
 {
     return TotalBlocks() - 1; // index start from zero
@@ -238,6 +590,25 @@ ErrCodeType VolumeTaskSession::GetErrorCode() const
     return VOLUMEPROTECT_ERR_SUCCESS;
 }
 
+// implement TaskEventNotifier ...
+
+void TaskEventNotifier::Notify()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_pendingEvents;
+    }
+    m_cv.notify_all();
+}
+
+bool TaskEventNotifier::WaitFor(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    bool notified = m_cv.wait_for(lock, timeout, [this]() { return m_pendingEvents != 0; });
+    m_pendingEvents = 0;
+    return notified;
+}
+
 // implement TaskStatisticTrait ...
 
 void TaskStatisticTrait::UpdateRunningSessionStatistics(std::shared_ptr<VolumeTaskSession> session)
@@ -277,6 +648,34 @@ void TaskStatisticTrait::UpdateCompletedSessionStatistics(std::shared_ptr<Volume
     memset(&m_currentSessionStatistics, 0, sizeof(TaskStatistics));
 }
 
+// move completed sessions to completed statistics and sum up running sessions within one lock,
+// so that the statistics of the task never go backwards
+void TaskStatisticTrait::UpdateConcurrentSessionStatistics(
+    const std::vector<std::shared_ptr<VolumeTaskSession>>& runningSessions,
+    const std::vector<std::shared_ptr<VolumeTaskSession>>& completedSessions)
+{
+    std::lock_guard<std::mutex> lock(m_statisticMutex);
+    for (const std::shared_ptr<VolumeTaskSession>& session : completedSessions) {
+        auto counter = session->sharedContext->counter;
+        m_completedSessionStatistics.bytesToRead += counter->bytesToRead;
+        m_completedSessionStatistics.bytesRead += counter->bytesRead;
+        m_completedSessionStatistics.blocksToHash += counter->blocksToHash;
+        m_completedSessionStatistics.blocksHashed += counter->blocksHashed;
+        m_completedSessionStatistics.bytesToWrite += counter->bytesToWrite;
+        m_completedSessionStatistics.bytesWritten += counter->bytesWritten;
+    }
+    memset(&m_currentSessionStatistics, 0, sizeof(TaskStatistics));
+    for (const std::shared_ptr<VolumeTaskSession>& session : runningSessions) {
+        auto counter = session->sharedContext->counter;
+        m_currentSessionStatistics.bytesToRead += counter->bytesToRead;
+        m_currentSessionStatistics.bytesRead += counter->bytesRead;
+        m_currentSessionStatistics.blocksToHash += counter->blocksToHash;
+        m_currentSessionStatistics.blocksHashed += counter->blocksHashed;
+        m_currentSessionStatistics.bytesToWrite += counter->bytesToWrite;
+        m_currentSessionStatistics.bytesWritten += counter->bytesWritten;
+    }
+}
+
 
 // implement BackupTaskCheckpoint
 CheckpointSnapshot::CheckpointSnapshot(uint64_t length)
@@ -342,7 +741,8 @@ bool CheckpointSnapshot::SaveTo(const std::string& filepath) const
 // any session started (completed/crashed and restarted) is considered "Restarted"
 bool VolumeTaskCheckpointTrait::IsSessionRestarted(std::shared_ptr<VolumeTaskSession> session) const
 {
-    return fsapi::IsFileExists(session->sharedConfig->checkpointFilePath);
+    std::shared_ptr<CheckpointJournal> journal = session->sharedContext->checkpointJournal;
+    return fsapi::IsFileExists(session->sharedConfig->checkpointFilePath) || (journal != nullptr && !journal->Empty());
 }
 
 bool VolumeTaskCheckpointTrait::IsCheckpointEnabled(std::shared_ptr<VolumeTaskSession> session) const
@@ -355,6 +755,22 @@ void VolumeTaskCheckpointTrait::InitSessionBitmap(std::shared_ptr<VolumeTaskSess
     uint64_t numBlocks = session->TotalBlocks();
     session->sharedContext->processedBitmap = std::make_shared<Bitmap>(numBlocks);
     session->sharedContext->writtenBitmap = std::make_shared<Bitmap>(numBlocks);
+    if (!IsCheckpointEnabled(session) || session->sharedConfig->checkpointJournalPath.empty() ||
+        session->sharedContext->checkpointJournal != nullptr) {
+        return;
+    }
+    auto sharedConfig = session->sharedConfig;
+    auto hashingContext = session->sharedContext->hashingContext;
+    uint32_t checksumSize = (sharedConfig->hasherEnabled && hashingContext != nullptr) ?
+        blockhash::DigestSize(sharedConfig->hashAlgorithm) : 0;
+    uint32_t subChecksumSize = (checksumSize != 0 && hashingContext->subLastestTable != nullptr) ?
+        SUB_BLOCK_CHECKSUM_SIZE * SubBlocksPerBlock(sharedConfig->blockSize, sharedConfig->subBlockSize) : 0;
+    session->sharedContext->checkpointJournal = CheckpointJournal::Open(
+        session->sharedConfig->checkpointJournalPath, numBlocks, checksumSize, subChecksumSize);
+    if (session->sharedContext->checkpointJournal == nullptr) {
+        WARNLOG("failed to open checkpoint journal %s, fallback to snapshot checkpoint",
+            session->sharedConfig->checkpointJournalPath.c_str());
+    }
 }
 
 std::shared_ptr<CheckpointSnapshot> VolumeTaskCheckpointTrait::TakeSessionCheckpointSnapshot(
@@ -364,15 +780,25 @@ std::shared_ptr<CheckpointSnapshot> VolumeTaskCheckpointTrait::TakeSessionCheckp
     assert(sharedContext->writtenBitmap->Capacity() == sharedContext->processedBitmap->Capacity());
     uint64_t length = sharedContext->writtenBitmap->Capacity();
     auto checkpointSnapshot = std::make_shared<CheckpointSnapshot>(length);
-    memcpy(checkpointSnapshot->processedBitmapBuffer, sharedContext->processedBitmap->Ptr(), length);
-    memcpy(checkpointSnapshot->writtenBitmapBuffer, sharedContext->writtenBitmap->Ptr(), length);
+    sharedContext->processedBitmap->CopyTo(checkpointSnapshot->processedBitmapBuffer);
+    sharedContext->writtenBitmap->CopyTo(checkpointSnapshot->writtenBitmapBuffer);
     return checkpointSnapshot;
 }
 
 // Save sesion...
 void VolumeTaskCheckpointTrait::RefreshSessionCheckpoint(std::shared_ptr<VolumeTaskSession> session)
 {
-    if (!IsCheckpointEnabled(session) || !CheckLastUpdateTimer()) {
+    if (!IsCheckpointEnabled(session)) {
+        return;
+    }
+    std::shared_ptr<CheckpointJournal> journal = session->sharedContext->checkpointJournal;
+    if (journal != nullptr) {
+        if (journal->IsCommitDue() && !CommitSessionJournal(session)) {
+            ERRLOG("failed to commit checkpoint journal %s", session->sharedConfig->checkpointJournalPath.c_str());
+        }
+        return;
+    }
+    if (!CheckLastUpdateTimer(session)) {
         return;
     }
     session->readerTask->Pause();
@@ -404,6 +830,11 @@ void VolumeTaskCheckpointTrait::RefreshSessionCheckpoint(std::shared_ptr<VolumeT
 
 bool VolumeTaskCheckpointTrait::FlushSessionLatestHashingTable(std::shared_ptr<VolumeTaskSession> session) const
 {
+    if (session->sharedContext->hashingContext->IsLastestMapped()) {
+        // only pages of blocks hashed since the previous flush are written back
+        DBGLOG("flush dirty pages of latest checksum table %s", session->sharedConfig->lastestChecksumBinPath.c_str());
+        return session->sharedContext->hashingContext->FlushLastest();
+    }
     uint8_t* latestChecksumTable = session->sharedContext->hashingContext->lastestTable;
     uint64_t latestChecksumTableSize = session->sharedContext->hashingContext->lastestSize;
     if (session->sharedConfig->hasherEnabled && latestChecksumTable != nullptr) {
@@ -414,6 +845,16 @@ bool VolumeTaskCheckpointTrait::FlushSessionLatestHashingTable(std::shared_ptr<V
             return false;
         }
     }
+    uint8_t* subChecksumTable = session->sharedContext->hashingContext->subLastestTable;
+    uint64_t subChecksumTableSize = session->sharedContext->hashingContext->subLastestSize;
+    if (session->sharedConfig->hasherEnabled && subChecksumTable != nullptr) {
+        std::string filepath = session->sharedConfig->lastestSubChecksumBinPath;
+        DBGLOG("save latest sub-block checksum table to %s, size = %llu", filepath.c_str(), subChecksumTableSize);
+        if (!fsapi::WriteBinaryBuffer(filepath, subChecksumTable, subChecksumTableSize)) {
+            ERRLOG("failed to save session sub-block hashing context");
+            return false;
+        }
+    }
     return true;
 }
 
@@ -437,6 +878,55 @@ bool VolumeTaskCheckpointTrait::FlushSessionBitmap(SessionPtr session) const
     return true;
 }
 
+/**
+ * @brief blocks done before sealed have been written, flush them before recording them in journal,
+ *  blocks done meanwhile are committed next time, so the reader keeps running
+ */
+bool VolumeTaskCheckpointTrait::CommitSessionJournal(SessionPtr session) const
+{
+    std::shared_ptr<CheckpointJournal> journal = session->sharedContext->checkpointJournal;
+    journal->Seal();
+    if (!FlushSessionWriter(session)) {
+        ERRLOG("failed to flush writer, cannot commit checkpoint journal");
+        return false;
+    }
+    if (!journal->Commit(session->sharedContext->hashingContext.get())) {
+        return false;
+    }
+    return !journal->NeedCompaction() || CompactSessionJournal(session);
+}
+
+// save blocks committed as snapshot, the journal is truncated only after snapshot and checksum table are durable
+bool VolumeTaskCheckpointTrait::CompactSessionJournal(SessionPtr session) const
+{
+    std::shared_ptr<CheckpointJournal> journal = session->sharedContext->checkpointJournal;
+    auto checkpointSnapshot = journal->TakeCommittedSnapshot();
+    auto hashingContext = session->sharedContext->hashingContext;
+    // mapped tables are durable once flushed
+    if (session->sharedConfig->hasherEnabled && hashingContext != nullptr && hashingContext->IsLastestMapped()) {
+        if (!FlushSessionLatestHashingTable(session)) {
+            ERRLOG("failed to flush latest hashing table, cannot compact checkpoint journal");
+            return false;
+        }
+    } else if (session->sharedConfig->hasherEnabled && hashingContext != nullptr) {
+        if (!FlushSessionLatestHashingTable(session) ||
+            (hashingContext->lastestTable != nullptr &&
+                !fsapi::SyncFile(session->sharedConfig->lastestChecksumBinPath)) ||
+            (hashingContext->subLastestTable != nullptr &&
+                !fsapi::SyncFile(session->sharedConfig->lastestSubChecksumBinPath))) {
+            ERRLOG("failed to flush latest hashing table, cannot compact checkpoint journal");
+            return false;
+        }
+    }
+    std::string checkpointFilePath = session->sharedConfig->checkpointFilePath;
+    if (!checkpointSnapshot->SaveTo(checkpointFilePath) || !fsapi::SyncFile(checkpointFilePath)) {
+        ERRLOG("failed to save checkpoint snapshot file to %s", checkpointFilePath.c_str());
+        return false;
+    }
+    DBGLOG("checkpoint journal compacted to %s", checkpointFilePath.c_str());
+    return journal->Truncate();
+}
+
 // Restore section ...
 
 void VolumeTaskCheckpointTrait::RestoreSessionCheckpoint(std::shared_ptr<VolumeTaskSession> session) const
@@ -444,6 +934,10 @@ void VolumeTaskCheckpointTrait::RestoreSessionCheckpoint(std::shared_ptr<VolumeT
     if (!IsSessionRestarted(session) || !IsCheckpointEnabled(session)) {
         return;
     }
+    if (session->sharedContext->checkpointJournal != nullptr) {
+        RestoreSessionJournal(session);
+        return;
+    }
     // only should work during backup with hasher enabled, restore both checksum and bitmap
     if (session->sharedConfig->hasherEnabled && !RestoreSessionLatestHashingTable(session)) {
         // if checksum restore failed, session must be restarted from beginning
@@ -527,8 +1021,42 @@ void VolumeTaskCheckpointTrait::RestoreSessionCounter(std::shared_ptr<VolumeTask
         counter->bytesToWrite.load(), counter->bytesWritten.load());
 }
 
+// snapshot and checksum table are restored first if journal has been compacted, then records are replayed on them
+void VolumeTaskCheckpointTrait::RestoreSessionJournal(std::shared_ptr<VolumeTaskSession> session) const
+{
+    if (fsapi::IsFileExists(session->sharedConfig->checkpointFilePath) &&
+        ((session->sharedConfig->hasherEnabled && !RestoreSessionLatestHashingTable(session)) ||
+        !RestoreSessionBitmap(session))) {
+        ERRLOG("failed to restore compacted checkpoint, start session from beginning");
+        ResetSessionJournal(session);
+        return;
+    }
+    auto sharedContext = session->sharedContext;
+    if (!sharedContext->checkpointJournal->Replay(
+        *sharedContext->processedBitmap, *sharedContext->writtenBitmap, sharedContext->hashingContext.get())) {
+        ERRLOG("failed to replay checkpoint journal, start session from beginning");
+        ResetSessionJournal(session);
+        return;
+    }
+    RestoreSessionCounter(session);
+    DBGLOG("restore task from checkpoint journal success");
+}
+
+void VolumeTaskCheckpointTrait::ResetSessionJournal(std::shared_ptr<VolumeTaskSession> session) const
+{
+    InitSessionBitmap(session);
+    fsapi::RemoveFile(session->sharedConfig->checkpointFilePath);
+    if (!session->sharedContext->checkpointJournal->Reset()) {
+        WARNLOG("failed to reset checkpoint journal %s", session->sharedConfig->checkpointJournalPath.c_str());
+    }
+}
+
 bool VolumeTaskCheckpointTrait::ReadLatestHashingTable(std::shared_ptr<VolumeTaskSession> session) const
 {
+    if (session->sharedContext->hashingContext->IsLastestMapped()) {
+        // mapped from the checksum file saved by checkpoint, nothing to read
+        return true;
+    }
     std::string lastestChecksumBinPath = session->sharedConfig->lastestChecksumBinPath;
     uint64_t lastestChecksumTableSize = session->sharedContext->hashingContext->lastestSize;
     uint8_t* buffer = fsapi::ReadBinaryBuffer(lastestChecksumBinPath, lastestChecksumTableSize);
@@ -539,6 +1067,19 @@ bool VolumeTaskCheckpointTrait::ReadLatestHashingTable(std::shared_ptr<VolumeTas
     memcpy(session->sharedContext->hashingContext->lastestTable, buffer, sizeof(uint8_t) * lastestChecksumTableSize);
     delete[] buffer;
     buffer = nullptr;
+    if (session->sharedContext->hashingContext->subLastestTable == nullptr) {
+        return true;
+    }
+    std::string subChecksumBinPath = session->sharedConfig->lastestSubChecksumBinPath;
+    uint64_t subChecksumTableSize = session->sharedContext->hashingContext->subLastestSize;
+    buffer = fsapi::ReadBinaryBuffer(subChecksumBinPath, subChecksumTableSize);
+    if (buffer == nullptr) {
+        ERRLOG("failed to read latest sub-block hashing table from %s", subChecksumBinPath.c_str());
+        return false;
+    }
+    memcpy(session->sharedContext->hashingContext->subLastestTable, buffer, sizeof(uint8_t) * subChecksumTableSize);
+    delete[] buffer;
+    buffer = nullptr;
     return true;
 }
 
@@ -548,12 +1089,12 @@ std::shared_ptr<CheckpointSnapshot> VolumeTaskCheckpointTrait::ReadCheckpointSna
     return CheckpointSnapshot::LoadFrom(session->sharedConfig->checkpointFilePath);
 }
 
-bool VolumeTaskCheckpointTrait::CheckLastUpdateTimer()
+bool VolumeTaskCheckpointTrait::CheckLastUpdateTimer(std::shared_ptr<VolumeTaskSession> session) const
 {
     auto now = std::chrono::steady_clock::now();
-    if (now - m_lastUpdate > std::chrono::minutes(1)) {
-        DBGLOG("should update checkpoint now");
-        m_lastUpdate = now;
+    if (now - session->sharedContext->lastCheckpointTime > std::chrono::minutes(1)) {
+        DBGLOG("should update checkpoint of session %s now", session->sharedConfig->copyFilePath.c_str());
+        session->sharedContext->lastCheckpointTime = now;
         return true;
     }
     return false;
@@ -10,16 +10,20 @@
 #include "VolumeUtils.h"
 #include "VolumeBlockReader.h"
 #include "VolumeBlockWriter.h"
-#include "BlockingQueue.h"
+#include "VolumeBlockHasher.h"
+#include "BlockHash.h"
+#include "RingQueue.h"
 #include "VolumeRestoreTask.h"
 #include "native/FileSystemAPI.h"
+#include "native/RawIO.h"
 
 using namespace volumeprotect;
 using namespace volumeprotect::task;
 using namespace volumeprotect::common;
 
 namespace {
-    constexpr auto TASK_CHECK_SLEEP_INTERVAL = std::chrono::seconds(1);
+    // main thread is woken up by session events, statistics and checkpoint are refreshed on timeout
+    constexpr auto TASK_STATISTICS_REFRESH_INTERVAL = std::chrono::milliseconds(100);
 }
 
 static std::vector<std::string> GetCopyFilesFromCopyMeta(const VolumeCopyMeta& volumeCopyMeta)
@@ -39,7 +43,13 @@ VolumeRestoreTask::VolumeRestoreTask(const VolumeRestoreConfig& restoreConfig, c
         restoreConfig.copyDataDirPath,
         volumeCopyMeta.copyName,
         GetCopyFilesFromCopyMeta(volumeCopyMeta)
-    }))
+    })),
+    m_notifier(std::make_shared<TaskEventNotifier>()),
+    m_executorGroup(std::make_shared<ExecutorGroup>(restoreConfig.stageConcurrency)),
+    m_readLimiter(std::make_shared<IORateLimiter>(restoreConfig.rateLimit.readBytesPerSecond,
+        restoreConfig.rateLimit.readOpsPerSecond, restoreConfig.rateLimit.readLatencyThresholdUs)),
+    m_writeLimiter(std::make_shared<IORateLimiter>(restoreConfig.rateLimit.writeBytesPerSecond,
+        restoreConfig.rateLimit.writeOpsPerSecond))
 {}
 
 VolumeRestoreTask::~VolumeRestoreTask()
@@ -72,6 +82,25 @@ TaskStatistics VolumeRestoreTask::GetStatistics() const
     return m_completedSessionStatistics + m_currentSessionStatistics;
 }
 
+// wake up main thread to abort running sessions immediately
+void VolumeRestoreTask::Abort()
+{
+    StatefulTask::Abort();
+    m_notifier->Notify();
+}
+
+// limiters are shared by all sessions, new limit takes effect on the next I/O
+bool VolumeRestoreTask::SetRateLimit(const IORateLimit& rateLimit)
+{
+    INFOLOG("set rate limit, read %llu bytes/s %llu ops/s, write %llu bytes/s %llu ops/s, read latency threshold %uus",
+        rateLimit.readBytesPerSecond, rateLimit.readOpsPerSecond,
+        rateLimit.writeBytesPerSecond, rateLimit.writeOpsPerSecond, rateLimit.readLatencyThresholdUs);
+    m_readLimiter->SetLimit(
+        rateLimit.readBytesPerSecond, rateLimit.readOpsPerSecond, rateLimit.readLatencyThresholdUs);
+    m_writeLimiter->SetLimit(rateLimit.writeBytesPerSecond, rateLimit.writeOpsPerSecond);
+    return true;
+}
+
 // split session and write back
 bool VolumeRestoreTask::Prepare()
 {
@@ -107,7 +136,37 @@ bool VolumeRestoreTask::Prepare()
         session.sharedConfig->copyFilePath = copyFilePath;
         session.sharedConfig->checkpointFilePath = writerBitmapPath;
         session.sharedConfig->checkpointEnabled = m_restoreConfig->enableCheckpoint;
+        if (m_restoreConfig->checkpointMode == CheckpointMode::JOURNAL) {
+            session.sharedConfig->checkpointJournalPath = common::GetCheckpointJournalFilePath(
+                m_restoreConfig->checkpointDirPath, m_volumeCopyMeta->copyName, sessionIndex);
+            m_checkpointFiles.emplace_back(session.sharedConfig->checkpointJournalPath);
+        }
         session.sharedConfig->skipEmptyBlock = false;
+        session.sharedConfig->punchZeroBlock = m_restoreConfig->punchZeroBlock;
+        session.sharedConfig->ioEngine = m_restoreConfig->ioEngine;
+        session.sharedConfig->ioQueueDepth = m_restoreConfig->ioQueueDepth;
+        session.sharedConfig->ioCacheMode = m_restoreConfig->ioCacheMode;
+        session.sharedConfig->ioPriority = m_restoreConfig->ioPriority;
+        session.sharedConfig->readerWorkerNum = m_restoreConfig->readerNum;
+        session.sharedConfig->hasherWorkerNum = m_restoreConfig->hasherNum;
+        session.sharedConfig->hashAlgorithm = static_cast<HashAlgorithm>(m_volumeCopyMeta->hashAlgorithm);
+        if (m_restoreConfig->differentialRestore || m_restoreConfig->verifyRestore) {
+            std::string copyChecksumBinPath = common::GetChecksumBinPath(
+                m_restoreConfig->copyMetaDirPath, m_volumeCopyMeta->copyName, sessionIndex);
+            if (fsapi::IsFileExists(copyChecksumBinPath)) {
+                session.sharedConfig->prevChecksumBinPath = copyChecksumBinPath;
+            } else {
+                WARNLOG("checksum %s of copy not found, session %d can't be compared or verified",
+                    copyChecksumBinPath.c_str(), sessionIndex);
+            }
+        }
+        // blocks restored are hashed by verify hasher before written, checksum of them is checkpointed
+        if (m_restoreConfig->verifyRestore && !session.sharedConfig->prevChecksumBinPath.empty()) {
+            session.sharedConfig->hasherEnabled = true;
+            session.sharedConfig->lastestChecksumBinPath = common::GetRestoredChecksumFilePath(
+                m_restoreConfig->checkpointDirPath, m_volumeCopyMeta->copyName, sessionIndex);
+            m_checkpointFiles.emplace_back(session.sharedConfig->lastestChecksumBinPath);
+        }
         m_checkpointFiles.emplace_back(writerBitmapPath);
         m_sessionQueue.push(session);
     }
@@ -132,6 +191,17 @@ bool VolumeRestoreTask::InitRestoreSessionTaskExecutor(std::shared_ptr<VolumeTas
         ERRLOG("restore session failed to init writer task");
         return false;
     }
+    if (!session->sharedConfig->hasherEnabled) {
+        return true;
+    }
+    session->hasherTask = VolumeBlockHasher::BuildHasher(
+        session->sharedConfig,
+        session->sharedContext,
+        HasherForwardMode::VERIFY);
+    if (session->hasherTask == nullptr) {
+        ERRLOG("restore session failed to init hasher task");
+        return false;
+    }
     return true;
 }
 
@@ -143,15 +213,71 @@ bool VolumeRestoreTask::InitRestoreSessionContext(std::shared_ptr<VolumeTaskSess
     session->sharedContext->counter = std::make_shared<SessionCounter>();
     session->sharedContext->allocator = std::make_shared<VolumeBlockAllocator>(
         session->sharedConfig->blockSize,
-        DEFAULT_ALLOCATOR_BLOCK_NUM);
-    session->sharedContext->writeQueue = std::make_shared<BlockingQueue<VolumeConsumeBlock>>(DEFAULT_QUEUE_SIZE);
+        DEFAULT_ALLOCATOR_BLOCK_NUM,
+        rawio::DirectIOAlignment(session->sharedConfig->volumePath));
+    session->sharedContext->InitWriteQueue(DEFAULT_QUEUE_SIZE);
+    session->sharedContext->notifier = m_notifier;
+    session->sharedContext->executorGroup = m_executorGroup;
+    session->sharedContext->readLimiter = m_readLimiter;
+    session->sharedContext->writeLimiter = m_writeLimiter;
+    // hashing context must be inited before bitmap, checksum of blocks is recorded in checkpoint journal
+    if (session->sharedConfig->hasherEnabled && !InitVerifySessionContext(session)) {
+        return false;
+    }
     InitSessionBitmap(session);
     // 2. restore checkpoint if restarted
     RestoreSessionCheckpoint(session);
+    RestoreSessionMismatchedBlocks(session);
     // 3. check and init task executor
     return InitRestoreSessionTaskExecutor(session);
 }
 
+// previous table holds checksum of the copy, latest table holds checksum of blocks restored
+bool VolumeRestoreTask::InitVerifySessionContext(std::shared_ptr<VolumeTaskSession> session) const
+{
+    auto sharedContext = session->sharedContext;
+    sharedContext->InitHashingQueue(DEFAULT_QUEUE_SIZE);
+    sharedContext->mismatchedBitmap = std::make_shared<Bitmap>(session->TotalBlocks());
+    std::string copyChecksumBinPath = session->sharedConfig->prevChecksumBinPath;
+    uint64_t checksumTableSize = session->TotalBlocks() * blockhash::DigestSize(session->sharedConfig->hashAlgorithm);
+    try {
+        sharedContext->hashingContext = std::make_shared<BlockHashingContext>(checksumTableSize, checksumTableSize);
+    } catch (const std::exception& e) {
+        ERRLOG("failed to malloc BlockHashingContext, length: %llu, message: %s", checksumTableSize, e.what());
+        return false;
+    }
+    if (!fsapi::ReadBinaryBuffer(
+        copyChecksumBinPath, sharedContext->hashingContext->previousTable, checksumTableSize)) {
+        ERRLOG("failed to read checksum of copy from %s", copyChecksumBinPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// blocks restored before restart are skipped by reader, their mismatch is rebuilt from the checksum restored
+void VolumeRestoreTask::RestoreSessionMismatchedBlocks(std::shared_ptr<VolumeTaskSession> session) const
+{
+    auto sharedContext = session->sharedContext;
+    if (sharedContext->mismatchedBitmap == nullptr) {
+        return;
+    }
+    uint32_t digestSize = blockhash::DigestSize(session->sharedConfig->hashAlgorithm);
+    const uint8_t* lastestTable = sharedContext->hashingContext->lastestTable;
+    const uint8_t* previousTable = sharedContext->hashingContext->previousTable;
+    uint64_t totalBlocks = session->TotalBlocks();
+    for (uint64_t index = sharedContext->processedBitmap->NextSet(0);
+        index < totalBlocks;
+        index = sharedContext->processedBitmap->NextSet(index + 1)) {
+        if (memcmp(lastestTable + index * digestSize, previousTable + index * digestSize, digestSize) != 0) {
+            sharedContext->mismatchedBitmap->Set(index);
+        }
+    }
+    if (sharedContext->mismatchedBitmap->TotalSetCount() != 0) {
+        WARNLOG("%llu blocks restored before restart mismatch with copy",
+            sharedContext->mismatchedBitmap->TotalSetCount());
+    }
+}
+
 bool VolumeRestoreTask::StartRestoreSession(std::shared_ptr<VolumeTaskSession> session) const
 {
     DBGLOG("start restore session");
@@ -170,35 +296,157 @@ bool VolumeRestoreTask::StartRestoreSession(std::shared_ptr<VolumeTaskSession> s
         ERRLOG("restore session writerTask start failed");
         return false;
     }
+    if (session->hasherTask != nullptr && !session->hasherTask->Start()) {
+        ERRLOG("restore session hasherTask start failed");
+        return false;
+    }
     return true;
 }
 
 bool VolumeRestoreTask::WaitSessionTerminate(std::shared_ptr<VolumeTaskSession> session)
 {
-    // block the thread
+    if (!WaitSessionExecutors(session, session)) {
+        return false;
+    }
+    DBGLOG("restore session complete successfully");
+    FlushSessionWriter(session);
+    FlushSessionBitmap(session);
+    if (session->sharedConfig->hasherEnabled) {
+        FlushSessionLatestHashingTable(session);
+        CollectSessionMismatchedBlocks(session);
+    }
+    UpdateCompletedSessionStatistics(session);
+    return true;
+}
+
+void VolumeRestoreTask::CollectSessionMismatchedBlocks(std::shared_ptr<VolumeTaskSession> session)
+{
+    std::shared_ptr<Bitmap> mismatchedBitmap = session->sharedContext->mismatchedBitmap;
+    uint64_t totalBlocks = session->TotalBlocks();
+    uint64_t baseIndex = session->sharedConfig->sessionOffset / session->sharedConfig->blockSize;
+    std::lock_guard<std::mutex> lk(m_mismatchMutex);
+    for (uint64_t index = mismatchedBitmap->NextSet(0);
+        index < totalBlocks;
+        index = mismatchedBitmap->NextSet(index + 1)) {
+        m_mismatchedBlocks.push_back(baseIndex + index);
+    }
+}
+
+std::vector<uint64_t> VolumeRestoreTask::GetMismatchedBlocks() const
+{
+    std::lock_guard<std::mutex> lk(m_mismatchMutex);
+    return m_mismatchedBlocks;
+}
+
+// block the thread until executors of running session terminate, checkpoint of session is refreshed meanwhile
+bool VolumeRestoreTask::WaitSessionExecutors(
+    std::shared_ptr<VolumeTaskSession> session, std::shared_ptr<VolumeTaskSession> runningSession)
+{
     while (true) {
         if (m_abort) {
-            session->Abort();
+            runningSession->Abort();
             m_status = TaskStatus::ABORTED;
             return false;
         }
-        if (session->IsFailed()) {
+        if (runningSession->IsFailed()) {
             ERRLOG("session failed");
             m_status = TaskStatus::FAILED;
-            m_errorCode = session->GetErrorCode();
+            m_errorCode = runningSession->GetErrorCode();
             return false;
         }
-        if (session->IsTerminated())  {
+        if (runningSession->IsTerminated())  {
             break;
         }
-        UpdateRunningSessionStatistics(session);
+        UpdateRunningSessionStatistics(runningSession);
         RefreshSessionCheckpoint(session);
-        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+        m_notifier->WaitFor(TASK_STATISTICS_REFRESH_INTERVAL);
+    }
+    return true;
+}
+
+/**
+ * @brief Hash blocks of target volume not processed yet and compare them with checksum of the copy,
+ *  blocks matched are marked processed (and checkpointed) as if restored, only the mismatched ones are read from
+ *  copy and written by the restore session then.
+ */
+bool VolumeRestoreTask::CompareSessionVolume(std::shared_ptr<VolumeTaskSession> session)
+{
+    std::shared_ptr<VolumeTaskSession> compareSession = NewCompareSession(session);
+    if (compareSession == nullptr || !InitCompareSessionTaskExecutor(compareSession)) {
+        ERRLOG("failed to init compare session");
+        m_status = TaskStatus::FAILED;
+        return false;
+    }
+    DBGLOG("start compare session reader and hasher");
+    if (!compareSession->readerTask->Start() || !compareSession->hasherTask->Start()) {
+        ERRLOG("compare session start failed");
+        compareSession->Abort();
+        m_status = TaskStatus::FAILED;
+        return false;
+    }
+    if (!WaitSessionExecutors(session, compareSession)) {
+        return false;
+    }
+    auto counter = session->sharedContext->counter;
+    counter->blocksToHash += compareSession->sharedContext->counter->blocksToHash.load();
+    counter->blocksHashed += compareSession->sharedContext->counter->blocksHashed.load();
+    session->sharedContext->changedBitmap = compareSession->sharedContext->mismatchedBitmap;
+    INFOLOG("compare session complete, %llu of %llu blocks mismatch with copy",
+        session->sharedContext->changedBitmap->TotalSetCount(), session->TotalBlocks());
+    return true;
+}
+
+// bitmaps, checkpoint journal and block buffers are shared with the restore session, queues and counter are owned
+std::shared_ptr<VolumeTaskSession> VolumeRestoreTask::NewCompareSession(
+    std::shared_ptr<VolumeTaskSession> session) const
+{
+    auto compareSession = std::make_shared<VolumeTaskSession>();
+    compareSession->sharedConfig = std::make_shared<VolumeTaskSharedConfig>(*session->sharedConfig);
+    compareSession->sharedConfig->hasherEnabled = true;
+    compareSession->sharedContext = std::make_shared<VolumeTaskSharedContext>(*session->sharedContext);
+    auto sharedContext = compareSession->sharedContext;
+    sharedContext->counter = std::make_shared<SessionCounter>();
+    sharedContext->InitHashingQueue(DEFAULT_QUEUE_SIZE);
+    sharedContext->InitWriteQueue(DEFAULT_QUEUE_SIZE);
+    sharedContext->changedBitmap = nullptr;
+    sharedContext->mismatchedBitmap = std::make_shared<Bitmap>(session->TotalBlocks());
+    if (sharedContext->hashingContext != nullptr) {
+        // verify enabled, checksum of blocks matched is recorded as restored
+        return compareSession;
+    }
+    std::string copyChecksumBinPath = session->sharedConfig->prevChecksumBinPath;
+    uint64_t checksumTableSize = session->TotalBlocks() * blockhash::DigestSize(session->sharedConfig->hashAlgorithm);
+    try {
+        sharedContext->hashingContext = std::make_shared<BlockHashingContext>(checksumTableSize, checksumTableSize);
+    } catch (const std::exception& e) {
+        ERRLOG("failed to malloc BlockHashingContext, length: %llu, message: %s", checksumTableSize, e.what());
+        return nullptr;
+    }
+    if (!fsapi::ReadBinaryBuffer(
+        copyChecksumBinPath, sharedContext->hashingContext->previousTable, checksumTableSize)) {
+        ERRLOG("failed to read checksum of copy from %s", copyChecksumBinPath.c_str());
+        return nullptr;
+    }
+    return compareSession;
+}
+
+bool VolumeRestoreTask::InitCompareSessionTaskExecutor(std::shared_ptr<VolumeTaskSession> compareSession) const
+{
+    compareSession->readerTask = VolumeBlockReader::BuildVolumeReader(
+        compareSession->sharedConfig,
+        compareSession->sharedContext);
+    if (compareSession->readerTask == nullptr) {
+        ERRLOG("compare session failed to init volume reader");
+        return false;
+    }
+    compareSession->hasherTask = VolumeBlockHasher::BuildHasher(
+        compareSession->sharedConfig,
+        compareSession->sharedContext,
+        HasherForwardMode::COMPARE);
+    if (compareSession->hasherTask == nullptr) {
+        ERRLOG("compare session failed to init hasher");
+        return false;
     }
-    DBGLOG("restore session complete successfully");
-    FlushSessionWriter(session);
-    FlushSessionBitmap(session);
-    UpdateCompletedSessionStatistics(session);
     return true;
 }
 
@@ -218,6 +466,11 @@ void VolumeRestoreTask::ThreadFunc()
             return;
         }
         RestoreSessionCheckpoint(session);
+        // blocks of the volume matching the copy are skipped by differential restore
+        if (m_restoreConfig->differentialRestore && !session->sharedConfig->prevChecksumBinPath.empty() &&
+            !CompareSessionVolume(session)) {
+            return;
+        }
         if (!StartRestoreSession(session)) {
             session->Abort();
             m_status = TaskStatus::FAILED;
@@ -228,6 +481,13 @@ void VolumeRestoreTask::ThreadFunc()
             return;
         }
     }
+    if (!GetMismatchedBlocks().empty()) {
+        // checkpoint is kept, the checksum of blocks restored can be checked later
+        ERRLOG("%llu blocks restored mismatch with checksum of the copy", GetMismatchedBlocks().size());
+        m_errorCode = VOLUMEPROTECT_ERR_CHECKSUM_MISMATCH;
+        m_status = TaskStatus::FAILED;
+        return;
+    }
     ClearAllCheckpoints();
     m_status = TaskStatus::SUCCEED;
     return;
@@ -0,0 +1,221 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include "Logger.h"
+#include "VolumeProtector.h"
+#include "VolumeProtectTaskContext.h"
+#include "VolumeUtils.h"
+#include "VolumeZeroCopyBackupTask.h"
+#include "native/RawIO.h"
+#include "native/FileSystemAPI.h"
+
+using namespace volumeprotect;
+using namespace volumeprotect::task;
+using namespace volumeprotect::common;
+using namespace volumeprotect::rawio;
+
+VolumeZeroCopyBackupTask::VolumeZeroCopyBackupTask(const VolumeBackupConfig& backupConfig, uint64_t volumeSize)
+    : m_volumeSize(volumeSize),
+    m_backupConfig(std::make_shared<VolumeBackupConfig>(backupConfig)),
+    m_resourceManager(TaskResourceManager::BuildBackupTaskResourceManager(BackupTaskResourceManagerParams {
+        backupConfig.copyFormat,
+        backupConfig.backupType,
+        backupConfig.outputCopyDataDirPath,
+        backupConfig.copyName,
+        volumeSize,
+        backupConfig.sessionSize
+    }))
+{
+    if (!IsZeroCopySupported(backupConfig)) {
+        throw std::runtime_error("zero copy not supported by backup config");
+    }
+}
+
+VolumeZeroCopyBackupTask::~VolumeZeroCopyBackupTask()
+{
+    DBGLOG("destroy volume zero copy backup task, wait main thread to join");
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    DBGLOG("reset zero copy backup resource manager");
+    m_resourceManager.reset();
+    DBGLOG("volume zero copy backup destroyed");
+}
+
+// data moved inside kernel bypasses page cache hints, rate limiter and I/O priority applied by reader/writer
+bool VolumeZeroCopyBackupTask::IsZeroCopySupported(const VolumeBackupConfig& backupConfig)
+{
+    const IORateLimit& rateLimit = backupConfig.rateLimit;
+    bool rateLimited = rateLimit.readBytesPerSecond != 0 || rateLimit.readOpsPerSecond != 0 ||
+        rateLimit.writeBytesPerSecond != 0 || rateLimit.writeOpsPerSecond != 0 || rateLimit.readLatencyThresholdUs != 0;
+    return backupConfig.enableZeroCopy &&
+        (backupConfig.copyFormat == CopyFormat::IMAGE || backupConfig.copyFormat == CopyFormat::BIN) &&
+        backupConfig.backupType == BackupType::FULL &&
+        !backupConfig.hasherEnabled &&
+        !backupConfig.skipEmptyBlock &&
+        !backupConfig.skipUnallocatedBlock &&
+        backupConfig.cbtType == ChangedBlockTracking::NONE &&
+        backupConfig.ioCacheMode == IOCacheMode::BUFFERED &&
+        backupConfig.ioPriority == IOPriority::NORMAL &&
+        !rateLimited;
+}
+
+bool VolumeZeroCopyBackupTask::Start()
+{
+    AssertTaskNotStarted();
+    if (!Prepare()) {
+        ERRLOG("prepare task failed");
+        m_status = TaskStatus::FAILED;
+        return false;
+    }
+    m_status = TaskStatus::RUNNING;
+    m_thread = std::thread(&VolumeZeroCopyBackupTask::ThreadFunc, this);
+    return true;
+}
+
+TaskStatistics VolumeZeroCopyBackupTask::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_statisticMutex);
+    return m_completedSessionStatistics + m_currentSessionStatistics;
+}
+
+// split session and save copy meta, no checksum is generated
+bool VolumeZeroCopyBackupTask::Prepare()
+{
+    std::string volumePath = m_backupConfig->volumePath;
+    // 1. fill volume meta info
+    VolumeCopyMeta volumeCopyMeta {};
+    volumeCopyMeta.copyName = m_backupConfig->copyName;
+    volumeCopyMeta.backupType = static_cast<int>(m_backupConfig->backupType);
+    volumeCopyMeta.copyFormat = static_cast<int>(m_backupConfig->copyFormat);
+    volumeCopyMeta.volumeSize = m_volumeSize;
+    volumeCopyMeta.blockSize = m_backupConfig->blockSize;
+    volumeCopyMeta.volumePath = volumePath;
+    volumeCopyMeta.hashAlgorithm = static_cast<int>(m_backupConfig->hashAlgorithm);
+    // no checksum table is generated, the copy can't be the base of increment backup
+    volumeCopyMeta.checksumSize = 0;
+    volumeCopyMeta.subBlockSize = 0;
+
+    // 2. prepare zero copy backup resource
+    if (!m_resourceManager->PrepareCopyResource()) {
+        ERRLOG("failed to prepare copy resource for zero copy backup");
+        return false;
+    }
+
+    // 3. split session
+    int sessionIndex = 0;
+    for (uint64_t sessionOffset = 0; sessionOffset < m_volumeSize;) {
+        uint64_t sessionSize = m_backupConfig->sessionSize;
+        if (sessionOffset + m_backupConfig->sessionSize >= m_volumeSize) {
+            sessionSize = m_volumeSize - sessionOffset;
+        }
+        std::string copyFilePath = common::GetCopyDataFilePath(
+            m_backupConfig->outputCopyDataDirPath, m_backupConfig->copyName, m_backupConfig->copyFormat, sessionIndex);
+        volumeCopyMeta.segments.emplace_back(CopySegment {
+            common::GetFileName(copyFilePath),
+            "",
+            sessionIndex,
+            sessionOffset,
+            sessionSize
+        });
+        VolumeTaskSharedConfig sessionConfig;
+        sessionConfig.copyFormat = m_backupConfig->copyFormat;
+        sessionConfig.volumePath = volumePath;
+        sessionConfig.hasherEnabled = false;
+        sessionConfig.blockSize = m_backupConfig->blockSize;
+        sessionConfig.sessionOffset = sessionOffset;
+        sessionConfig.sessionSize = sessionSize;
+        sessionConfig.copyFilePath = copyFilePath;
+        sessionConfig.checkpointFilePath = common::GetWriterBitmapFilePath(
+            m_backupConfig->checkpointDirPath, m_backupConfig->copyName, sessionIndex);
+        sessionConfig.checkpointEnabled = m_backupConfig->enableCheckpoint;
+        sessionConfig.skipEmptyBlock = false;
+        if (sessionConfig.checkpointEnabled) {
+            m_checkpointFiles.emplace_back(sessionConfig.checkpointFilePath);
+        }
+        m_sessionQueue.emplace(sessionConfig);
+        sessionOffset += sessionSize;
+        ++sessionIndex;
+    }
+
+    if (!common::WriteVolumeCopyMeta(m_backupConfig->outputCopyMetaDirPath, m_backupConfig->copyName, volumeCopyMeta)) {
+        ERRLOG("failed to write copy meta to dir: %s", m_backupConfig->outputCopyMetaDirPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void VolumeZeroCopyBackupTask::ThreadFunc()
+{
+    DBGLOG("start task main thread");
+    while (!m_sessionQueue.empty()) {
+        if (m_abort) {
+            m_status = TaskStatus::ABORTED;
+            return;
+        }
+        VolumeTaskSharedConfig sessionConfig = m_sessionQueue.front();
+        m_sessionQueue.pop();
+        // only handles of reader/writer are used to copy inside kernel, so the sync engine is enough
+        RawIOOption ioOption { IOEngine::SYNC, m_backupConfig->ioQueueDepth, m_backupConfig->ioCacheMode };
+        std::shared_ptr<RawDataReader> dataReader = rawio::OpenRawDataVolumeReader(sessionConfig.volumePath, ioOption);
+        std::shared_ptr<RawDataWriter> dataWriter = rawio::OpenRawDataCopyWriter(SessionCopyRawIOParam {
+            sessionConfig.copyFormat,
+            sessionConfig.copyFilePath,
+            sessionConfig.sessionOffset,
+            sessionConfig.sessionSize,
+            ioOption
+        });
+        if (dataReader == nullptr || dataWriter == nullptr) {
+            ERRLOG("failed to build volume data reader or copy data writer");
+            m_status = TaskStatus::FAILED;
+            return;
+        }
+        if (!dataReader->Ok() || !dataWriter->Ok()) {
+            ERRLOG("failed to init volume data reader or copy data writer, format = %d, copyfile = %s, error = %u, %u",
+                sessionConfig.copyFormat, sessionConfig.copyFilePath.c_str(), dataReader->Error(), dataWriter->Error());
+            m_status = TaskStatus::FAILED;
+            return;
+        }
+        if (!PerformZeroCopyBackup(dataReader, dataWriter, sessionConfig)) {
+            ERRLOG("session (%llu, %llu) failed during copy", sessionConfig.sessionOffset, sessionConfig.sessionSize);
+            m_status = m_abort ? TaskStatus::ABORTED : TaskStatus::FAILED;
+            return;
+        }
+    }
+    DBGLOG("exit zero copy backup main thread, all session succeed");
+    ClearAllCheckpoints();
+    m_status = TaskStatus::SUCCEED;
+    return;
+}
+
+// the copy file of a bin copy only holds data of the session, offset of it is relative to session
+bool VolumeZeroCopyBackupTask::PerformZeroCopyBackup(
+    std::shared_ptr<RawDataReader> volumeDataReader,
+    std::shared_ptr<RawDataWriter> copyDataWriter,
+    const VolumeTaskSharedConfig& sessionConfig)
+{
+    uint64_t copyFileShift = (sessionConfig.copyFormat == CopyFormat::BIN) ? sessionConfig.sessionOffset : 0;
+    return PerformZeroCopySession(
+        volumeDataReader, copyDataWriter, sessionConfig, 0, copyFileShift, m_backupConfig->zeroCopyThreadNum);
+}
+
+bool VolumeZeroCopyBackupTask::IsZeroCopyAborted() const
+{
+    return m_abort;
+}
+
+void VolumeZeroCopyBackupTask::ClearAllCheckpoints() const
+{
+    if (!m_backupConfig->enableCheckpoint || !m_backupConfig->clearCheckpointsOnSucceed) {
+        return;
+    }
+    INFOLOG("clear all checkpoints file for this zero copy backup task, copyName : %s",
+        m_backupConfig->copyName.c_str());
+    for (const std::string& checkpointFile : m_checkpointFiles) {
+        INFOLOG("remove checkpoint file %s", checkpointFile.c_str());
+        fsapi::RemoveFile(checkpointFile);
+    }
+}
@@ -10,10 +10,7 @@
 #include "VolumeUtils.h"
 #include "VolumeZeroCopyRestoreTask.h"
 #include "native/RawIO.h"
-
-#ifdef __linux__
-#include <sys/sendfile.h>
-#endif
+#include "native/FileSystemAPI.h"
 
 using namespace volumeprotect;
 using namespace volumeprotect::task;
@@ -44,9 +41,9 @@ VolumeZeroCopyRestoreTask::VolumeZeroCopyRestoreTask(const VolumeRestoreConfig&
     }))
 {
     CopyFormat copyFormat = static_cast<CopyFormat>(m_volumeCopyMeta->copyFormat);
-    if (copyFormat != CopyFormat::IMAGE || !restoreConfig.enableZeroCopy) {
-        throw std::runtime_error("only image format supported for zero copy");
-        // support CopyFormat::IMAGE only
+    if ((copyFormat != CopyFormat::IMAGE && copyFormat != CopyFormat::BIN) || !restoreConfig.enableZeroCopy) {
+        throw std::runtime_error("only image or bin format supported for zero copy");
+        // support CopyFormat::IMAGE and CopyFormat::BIN only
     }
 }
 
@@ -110,8 +107,12 @@ bool VolumeZeroCopyRestoreTask::Prepare()
         sessionConfig.sessionOffset = sessionOffset;
         sessionConfig.sessionSize = sessionSize;
         sessionConfig.copyFilePath = copyFilePath;
-        sessionConfig.checkpointFilePath = "";
-        sessionConfig.checkpointEnabled = false;
+        sessionConfig.checkpointFilePath = common::GetWriterBitmapFilePath(
+            m_restoreConfig->checkpointDirPath, m_volumeCopyMeta->copyName, sessionIndex);
+        sessionConfig.checkpointEnabled = m_restoreConfig->enableCheckpoint;
+        if (sessionConfig.checkpointEnabled) {
+            m_checkpointFiles.emplace_back(sessionConfig.checkpointFilePath);
+        }
         sessionConfig.skipEmptyBlock = false;
         m_sessionQueue.emplace(sessionConfig);
     }
@@ -130,11 +131,13 @@ void VolumeZeroCopyRestoreTask::ThreadFunc()
         // pop a session from session queue to init a new session
         VolumeTaskSharedConfig sessionConfig = m_sessionQueue.front();
         m_sessionQueue.pop();
+        // only handles of reader/writer are used to copy inside kernel, which is always buffered
         std::shared_ptr<RawDataReader> dataReader = rawio::OpenRawDataCopyReader(SessionCopyRawIOParam {
             sessionConfig.copyFormat,
             sessionConfig.copyFilePath,
             sessionConfig.sessionOffset,
-            sessionConfig.sessionSize
+            sessionConfig.sessionSize,
+            RawIOOption { IOEngine::SYNC, m_restoreConfig->ioQueueDepth, IOCacheMode::BUFFERED }
         });
         std::shared_ptr<RawDataWriter> dataWriter = rawio::OpenRawDataVolumeWriter(sessionConfig.volumePath);
         // check reader writer valid
@@ -156,43 +159,36 @@ void VolumeZeroCopyRestoreTask::ThreadFunc()
         }
     }
     DBGLOG("exit zero copy main thread, all session succeed");
+    ClearAllCheckpoints();
     m_status = TaskStatus::SUCCEED;
     return;
 }
 
-bool VolumeZeroCopyRestoreTask::PerformZeroCopyRestore(
-    std::shared_ptr<RawDataReader> copyDataReader,
-    std::shared_ptr<RawDataWriter> volumeDataWriter,
-    const VolumeTaskSharedConfig& sessionConfig)
+void VolumeZeroCopyRestoreTask::ClearAllCheckpoints() const
 {
-    {
-        std::lock_guard<std::mutex> lock(m_statisticMutex);
-        m_completedSessionStatistics = m_completedSessionStatistics + m_currentSessionStatistics;
-        memset(&m_currentSessionStatistics, 0, sizeof(TaskStatistics));
-        m_currentSessionStatistics.bytesToRead = sessionConfig.sessionSize;
-        m_currentSessionStatistics.bytesToWrite = sessionConfig.sessionSize;
+    if (!m_restoreConfig->enableCheckpoint || !m_restoreConfig->clearCheckpointsOnSucceed) {
+        return;
     }
-
-    uint64_t offset = sessionConfig.sessionOffset;
-    size_t len = sessionConfig.blockSize;
-    uint64_t sessionMax = sessionConfig.sessionOffset + sessionConfig.sessionSize;
-    INFOLOG("perform zero copy restore, offset %llu, len %ld, sessionMax %llu", offset, sessionMax);
-    while (offset < sessionMax) {
-        if (offset + len > sessionMax) {
-            len = sessionMax - offset;
-        }
-#ifdef __linux__
-        int ret = ::sendfile(volumeDataWriter->Handle(), copyDataReader->Handle(), reinterpret_cast<off_t*>(&offset), len);
-        DBGLOG("sendfile syscall return = %d, offset = %llu, len = %llu", ret, offset, len);
-        if (ret < 0) {
-            ERRLOG("sendfile (%llu, %llu) failed with errno %d", offset, len, errno);
-            return false;
-        }
-        m_currentSessionStatistics.bytesRead += ret;
-        m_currentSessionStatistics.bytesWritten += ret;
-#endif
+    INFOLOG("clear all checkpoints file for this zero copy restore task, copyName : %s",
+        m_volumeCopyMeta->copyName.c_str());
+    for (const std::string& checkpointFile : m_checkpointFiles) {
+        INFOLOG("remove checkpoint file %s", checkpointFile.c_str());
+        fsapi::RemoveFile(checkpointFile);
     }
+}
 
+bool VolumeZeroCopyRestoreTask::IsZeroCopyAborted() const
+{
+    return m_abort;
+}
 
-    return true;
-}
\ No newline at end of file
+// the copy file of a bin copy only holds data of the session, offset of it is relative to session
+bool VolumeZeroCopyRestoreTask::PerformZeroCopyRestore(
+    std::shared_ptr<RawDataReader> copyDataReader,
+    std::shared_ptr<RawDataWriter> volumeDataWriter,
+    const VolumeTaskSharedConfig& sessionConfig)
+{
+    uint64_t copyFileShift = (sessionConfig.copyFormat == CopyFormat::BIN) ? sessionConfig.sessionOffset : 0;
+    return PerformZeroCopySession(
+        copyDataReader, volumeDataWriter, sessionConfig, copyFileShift, 0, m_restoreConfig->zeroCopyThreadNum);
+}
@@ -0,0 +1,272 @@
+/**
+ * @copyright Copyright 2023-2024 XUranus. All rights reserved.
+ * @license This project is released under the Apache License.
+ * @author XUranus(2257238649wdx@gmail.com)
+ */
+
+#include "Logger.h"
+#include "ZeroCopySessionTrait.h"
+#include "native/RawIO.h"
+#include "native/FileSystemAPI.h"
+
+#include <atomic>
+#include <algorithm>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace volumeprotect;
+using namespace volumeprotect::task;
+using namespace volumeprotect::rawio;
+
+namespace {
+    // statistics refreshed by threads copying ranges, main thread checks completion and refreshes checkpoint
+    constexpr auto TASK_CHECK_SLEEP_INTERVAL = std::chrono::milliseconds(100);
+    constexpr auto TASK_CHECKPOINT_INTERVAL = std::chrono::minutes(1);
+    // bytes moved by each syscall at most, abort and statistics are checked between them
+    constexpr uint64_t ZERO_COPY_CHUNK_SIZE = 64 * ONE_MB;
+
+#ifdef __linux__
+    constexpr int SPLICE_PIPE_SIZE = ONE_MB;
+
+    ssize_t CopyFileRange(int inFd, uint64_t inOffset, int outFd, uint64_t outOffset, size_t length)
+    {
+#ifdef SYS_copy_file_range
+        loff_t offIn = static_cast<loff_t>(inOffset);
+        loff_t offOut = static_cast<loff_t>(outOffset);
+        return ::syscall(SYS_copy_file_range, inFd, &offIn, outFd, &offOut, length, 0);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    // copy_file_range only works between regular files of the same filesystem on most kernels
+    bool IsCopyFileRangeUnsupported(int err)
+    {
+        return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+    }
+
+    // move pages from source to target through a pipe, pipe is drained before return
+    ssize_t SpliceRange(int inFd, uint64_t inOffset, int outFd, uint64_t outOffset, size_t length, const int* pipeFds)
+    {
+        loff_t offIn = static_cast<loff_t>(inOffset);
+        loff_t offOut = static_cast<loff_t>(outOffset);
+        ssize_t piped = ::splice(inFd, &offIn, pipeFds[1], nullptr, length, SPLICE_F_MOVE);
+        if (piped <= 0) {
+            return piped;
+        }
+        ssize_t left = piped;
+        while (left > 0) {
+            ssize_t ret = ::splice(pipeFds[0], nullptr, outFd, &offOut, static_cast<size_t>(left), SPLICE_F_MOVE);
+            if (ret <= 0) {
+                return -1;
+            }
+            left -= ret;
+        }
+        return piped;
+    }
+#endif
+}
+
+// blocks written are restored from checkpoint file of the session if exists, otherwise session starts from beginning
+std::shared_ptr<Bitmap> ZeroCopySessionTrait::RestoreSessionBitmap(
+    const VolumeTaskSharedConfig& sessionConfig) const
+{
+    uint64_t sessionBlocks = (sessionConfig.sessionSize + sessionConfig.blockSize - 1) / sessionConfig.blockSize;
+    auto writtenBitmap = std::make_shared<Bitmap>(sessionBlocks);
+    if (!sessionConfig.checkpointEnabled || !fsapi::IsFileExists(sessionConfig.checkpointFilePath)) {
+        return writtenBitmap;
+    }
+    std::shared_ptr<CheckpointSnapshot> checkpointSnapshot = CheckpointSnapshot::LoadFrom(
+        sessionConfig.checkpointFilePath);
+    if (checkpointSnapshot == nullptr || checkpointSnapshot->bitmapBufferBytesLength != writtenBitmap->Capacity()) {
+        ERRLOG("failed to restore bitmap from checkpoint %s, start session from beginning",
+            sessionConfig.checkpointFilePath.c_str());
+        return writtenBitmap;
+    }
+    writtenBitmap = std::make_shared<Bitmap>(
+        checkpointSnapshot->writtenBitmapBuffer, checkpointSnapshot->bitmapBufferBytesLength);
+    checkpointSnapshot->writtenBitmapBuffer = nullptr;
+    INFOLOG("restore zero copy session from checkpoint %s, %llu of %llu blocks written",
+        sessionConfig.checkpointFilePath.c_str(), writtenBitmap->TotalSetCount(), sessionBlocks);
+    return writtenBitmap;
+}
+
+// bitmap is taken before target flushed, so blocks recorded are always durable
+bool ZeroCopySessionTrait::SaveSessionCheckpoint(
+    std::shared_ptr<RawDataWriter> targetWriter,
+    const VolumeTaskSharedConfig& sessionConfig) const
+{
+    auto checkpointSnapshot = std::make_shared<CheckpointSnapshot>(m_writtenBitmap->Capacity());
+    m_writtenBitmap->CopyTo(checkpointSnapshot->writtenBitmapBuffer);
+    m_writtenBitmap->CopyTo(checkpointSnapshot->processedBitmapBuffer);
+    if (!targetWriter->Flush()) {
+        ERRLOG("failed to flush zero copy target, cannot save checkpoint");
+        return false;
+    }
+    if (!checkpointSnapshot->SaveTo(sessionConfig.checkpointFilePath)) {
+        ERRLOG("failed to save checkpoint snapshot file to %s", sessionConfig.checkpointFilePath.c_str());
+        return false;
+    }
+    DBGLOG("zero copy checkpoint saved to %s", sessionConfig.checkpointFilePath.c_str());
+    return true;
+}
+
+// main thread refreshes checkpoint while ranges are copied, progress is saved even if session failed or aborted
+bool ZeroCopySessionTrait::PerformZeroCopySession(
+    std::shared_ptr<RawDataReader>  sourceReader,
+    std::shared_ptr<RawDataWriter>  targetWriter,
+    const VolumeTaskSharedConfig&   sessionConfig,
+    uint64_t                        sourceShift,
+    uint64_t                        targetShift,
+    uint32_t                        threadNum)
+{
+    uint64_t sessionOffset = sessionConfig.sessionOffset;
+    uint64_t sessionMax = sessionConfig.sessionOffset + sessionConfig.sessionSize;
+    uint64_t blockSize = sessionConfig.blockSize;
+    uint64_t sessionBlocks = (sessionConfig.sessionSize + blockSize - 1) / blockSize;
+    m_writtenBitmap = RestoreSessionBitmap(sessionConfig);
+    uint64_t writtenCount = m_writtenBitmap->TotalSetCount();
+    uint64_t bytesWritten = (writtenCount == sessionBlocks) ? sessionConfig.sessionSize : writtenCount * blockSize;
+    {
+        std::lock_guard<std::mutex> lock(m_statisticMutex);
+        m_completedSessionStatistics = m_completedSessionStatistics + m_currentSessionStatistics;
+        memset(&m_currentSessionStatistics, 0, sizeof(TaskStatistics));
+        m_currentSessionStatistics.bytesToRead = sessionConfig.sessionSize;
+        m_currentSessionStatistics.bytesToWrite = sessionConfig.sessionSize;
+        m_currentSessionStatistics.bytesRead = bytesWritten;
+        m_currentSessionStatistics.bytesWritten = bytesWritten;
+    }
+
+    uint64_t rangeNum = std::max<uint64_t>(1, std::min<uint64_t>(threadNum, sessionBlocks));
+    uint64_t rangeBlocks = (sessionBlocks + rangeNum - 1) / rangeNum;
+    INFOLOG("perform zero copy session, offset %llu, sessionMax %llu, threads %llu",
+        sessionOffset, sessionMax, rangeNum);
+    HandleType sourceHandle = sourceReader->Handle();
+    HandleType targetHandle = targetWriter->Handle();
+    std::atomic<bool> success { true };
+    std::atomic<uint64_t> finished { 0 };
+    std::vector<std::thread> threads;
+    for (uint64_t beginBlock = 0; beginBlock < sessionBlocks; beginBlock += rangeBlocks) {
+        uint64_t endBlock = std::min(beginBlock + rangeBlocks, sessionBlocks);
+        threads.emplace_back([&, beginBlock, endBlock]() {
+            // copy each run of blocks not written yet
+            for (uint64_t block = m_writtenBitmap->NextUnset(beginBlock); block < endBlock && success;) {
+                uint64_t runEnd = std::min(m_writtenBitmap->NextSet(block), endBlock);
+                uint64_t offset = sessionOffset + block * blockSize;
+                uint64_t length = std::min(sessionOffset + runEnd * blockSize, sessionMax) - offset;
+                if (!CopyRange(sourceHandle, targetHandle, sessionConfig, sourceShift, targetShift, offset, length)) {
+                    success = false;
+                }
+                block = m_writtenBitmap->NextUnset(runEnd);
+            }
+            ++finished;
+        });
+    }
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    while (finished < threads.size()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+        if (sessionConfig.checkpointEnabled &&
+            std::chrono::steady_clock::now() - lastCheckpoint > TASK_CHECKPOINT_INTERVAL) {
+            SaveSessionCheckpoint(targetWriter, sessionConfig);
+            lastCheckpoint = std::chrono::steady_clock::now();
+        }
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (sessionConfig.checkpointEnabled && !SaveSessionCheckpoint(targetWriter, sessionConfig)) {
+        return false;
+    }
+    return success && !IsZeroCopyAborted();
+}
+
+#ifdef __linux__
+// copy_file_range is tried first, splice through a pipe is used once it's not supported between source and target
+bool ZeroCopySessionTrait::CopyRange(
+    HandleType                      sourceHandle,
+    HandleType                      targetHandle,
+    const VolumeTaskSharedConfig&   sessionConfig,
+    uint64_t                        sourceShift,
+    uint64_t                        targetShift,
+    uint64_t                        volumeOffset,
+    uint64_t                        length)
+{
+    uint64_t sessionOffset = sessionConfig.sessionOffset;
+    uint64_t sessionMax = sessionConfig.sessionOffset + sessionConfig.sessionSize;
+    uint64_t blockSize = sessionConfig.blockSize;
+    uint64_t sessionBlocks = (sessionConfig.sessionSize + blockSize - 1) / blockSize;
+    uint64_t sourceOffset = volumeOffset - sourceShift;
+    uint64_t targetOffset = volumeOffset - targetShift;
+    uint64_t doneBlock = (volumeOffset - sessionOffset) / blockSize;
+    int pipeFds[2] = { -1, -1 };
+    std::shared_ptr<void> defer(nullptr, [&](...) {
+        for (int fd : pipeFds) {
+            if (fd != -1) {
+                ::close(fd);
+            }
+        }
+    });
+    bool useSplice = false;
+    while (length > 0) {
+        if (IsZeroCopyAborted()) {
+            return false;
+        }
+        size_t len = static_cast<size_t>(std::min(length, ZERO_COPY_CHUNK_SIZE));
+        ssize_t ret = -1;
+        if (useSplice) {
+            ret = SpliceRange(sourceHandle, sourceOffset, targetHandle, targetOffset, len, pipeFds);
+        } else {
+            ret = CopyFileRange(sourceHandle, sourceOffset, targetHandle, targetOffset, len);
+            if (ret < 0 && IsCopyFileRangeUnsupported(errno)) {
+                DBGLOG("copy_file_range not supported, errno %d, fallback to splice", errno);
+                if (::pipe(pipeFds) != 0) {
+                    ERRLOG("failed to create pipe for splice, errno %d", errno);
+                    return false;
+                }
+                // larger pipe takes fewer syscalls, keep the default size if not permitted
+                ::fcntl(pipeFds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+                useSplice = true;
+                continue;
+            }
+        }
+        if (ret <= 0) {
+            ERRLOG("zero copy (%llu, %llu) to target offset %llu failed, ret %d, errno %d",
+                sourceOffset, len, targetOffset, ret, errno);
+            return false;
+        }
+        sourceOffset += ret;
+        targetOffset += ret;
+        volumeOffset += ret;
+        length -= ret;
+        // the last block of session may be partial
+        uint64_t doneEnd = (volumeOffset == sessionMax) ? sessionBlocks : (volumeOffset - sessionOffset) / blockSize;
+        if (doneEnd > doneBlock) {
+            m_writtenBitmap->SetRange(doneBlock, doneEnd);
+            doneBlock = doneEnd;
+        }
+        std::lock_guard<std::mutex> lock(m_statisticMutex);
+        m_currentSessionStatistics.bytesRead += ret;
+        m_currentSessionStatistics.bytesWritten += ret;
+    }
+    return true;
+}
+#else
+bool ZeroCopySessionTrait::CopyRange(
+    HandleType                      sourceHandle,
+    HandleType                      targetHandle,
+    const VolumeTaskSharedConfig&   sessionConfig,
+    uint64_t                        sourceShift,
+    uint64_t                        targetShift,
+    uint64_t                        volumeOffset,
+    uint64_t                        length)
+{
+    ERRLOG("zero copy not supported on this platform");
+    return false;
+}
+#endif
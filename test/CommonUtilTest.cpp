@@ -1,7 +1,27 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
 #include "common/VolumeUtils.h"
+#include "common/RingQueue.h"
+#include "common/BlockHash.h"
+#include "task/TaskExecutor.h"
+#include "task/IORateLimiter.h"
+#include "native/ChangedBlockTracking.h"
+#include "native/FileSystemAPI.h"
+#include "native/RawIO.h"
+#ifdef __linux__
+#include <cstdlib>
+#include <unistd.h>
+#include "native/linux/DmEraChangedBlockProvider.h"
+#endif
 
 using namespace ::testing;
 using namespace volumeprotect;
@@ -24,4 +44,535 @@ TEST(CommonUtilTest, GetFileNameTest)
 {
     EXPECT_EQ(common::GetFileName("/home/xuranus/file"), "file");
     EXPECT_EQ(common::GetFileName(R"(C:\Windows\System32\zip.dll)"), "zip.dll");
-}
\ No newline at end of file
+}
+
+TEST(CommonUtilTest, RingQueuePushPopTest)
+{
+    RingQueue<int> queue(3); // capacity rounded up to 4
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(queue.TryBlockingPush(i));
+    }
+    EXPECT_FALSE(queue.TryBlockingPush(4));
+    EXPECT_EQ(queue.Size(), 4);
+    int v = -1;
+    EXPECT_TRUE(queue.TryBlockingPop(v));
+    EXPECT_EQ(v, 0);
+    std::vector<int> items;
+    EXPECT_EQ(queue.BlockingPopBatch(items, 8), 3);
+    EXPECT_EQ(items, std::vector<int>({ 1, 2, 3 }));
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_FALSE(queue.TryBlockingPop(v));
+
+    // items pushed before finish can still be poped
+    EXPECT_TRUE(queue.BlockingPushBatch({ 5, 6 }));
+    queue.Finish();
+    EXPECT_FALSE(queue.BlockingPush(7));
+    EXPECT_TRUE(queue.BlockingPop(v));
+    EXPECT_EQ(v, 5);
+    EXPECT_TRUE(queue.BlockingPop(v));
+    EXPECT_EQ(v, 6);
+    EXPECT_FALSE(queue.BlockingPop(v));
+    EXPECT_EQ(queue.BlockingPopBatch(items, 8), 0);
+}
+
+TEST(CommonUtilTest, RingQueueConcurrentTest)
+{
+    const int producerNum = 4;
+    const int consumerNum = 4;
+    const int itemsPerProducer = 20000;
+    RingQueue<int> queue(16);
+    std::atomic<long long> sum { 0 };
+    std::atomic<int> count { 0 };
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < consumerNum; ++i) {
+        consumers.emplace_back([&]() {
+            int v = 0;
+            while (queue.BlockingPop(v)) {
+                sum += v;
+                ++count;
+            }
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int i = 0; i < producerNum; ++i) {
+        producers.emplace_back([&]() {
+            for (int v = 1; v <= itemsPerProducer; ++v) {
+                EXPECT_TRUE(queue.BlockingPush(v));
+            }
+        });
+    }
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+    queue.Finish();
+    for (std::thread& consumer : consumers) {
+        consumer.join();
+    }
+    EXPECT_EQ(count, producerNum * itemsPerProducer);
+    EXPECT_EQ(sum, static_cast<long long>(producerNum) * itemsPerProducer * (itemsPerProducer + 1) / 2);
+}
+
+// more producer/consumer routines than executor workers, would deadlock if routines block on the queue
+TEST(CommonUtilTest, TaskExecutorPipelineTest)
+{
+    const int producerNum = 4;
+    const int consumerNum = 4;
+    const int itemsPerProducer = 5000;
+    const uint32_t maxConcurrency = 2;
+    task::TaskExecutor executor(3);
+    auto group = std::make_shared<task::ExecutorGroup>(maxConcurrency);
+    RingQueue<int> queue(4);
+    std::atomic<long long> sum { 0 };
+    std::atomic<int> count { 0 };
+    std::atomic<int> producersRunning { producerNum };
+    std::atomic<uint32_t> running { 0 };
+    std::atomic<uint32_t> maxRunning { 0 };
+    auto enter = [&]() {
+        uint32_t current = ++running;
+        uint32_t observed = maxRunning.load();
+        while (current > observed && !maxRunning.compare_exchange_weak(observed, current)) {}
+    };
+    std::vector<std::shared_ptr<task::ExecutorJob>> jobs;
+    for (int i = 0; i < producerNum; ++i) {
+        auto next = std::make_shared<int>(1);
+        jobs.push_back(executor.Submit([&, next]() {
+            enter();
+            task::StepResult result = task::StepResult::CONTINUE;
+            if (*next > itemsPerProducer) {
+                if (--producersRunning == 0) {
+                    queue.Finish();
+                }
+                result = task::StepResult::DONE;
+            } else if (queue.TryBlockingPush(*next)) {
+                ++(*next);
+            } else {
+                result = task::StepResult::WAIT;
+            }
+            --running;
+            return result;
+        }, group));
+    }
+    for (int i = 0; i < consumerNum; ++i) {
+        jobs.push_back(executor.Submit([&]() {
+            enter();
+            task::StepResult result = task::StepResult::CONTINUE;
+            int v = 0;
+            if (queue.TryBlockingPop(v)) {
+                sum += v;
+                ++count;
+            } else {
+                result = queue.Drained() ? task::StepResult::DONE : task::StepResult::WAIT;
+            }
+            --running;
+            return result;
+        }, group));
+    }
+    for (const std::shared_ptr<task::ExecutorJob>& job : jobs) {
+        job->Wait();
+        EXPECT_TRUE(job->IsDone());
+    }
+    EXPECT_EQ(count, producerNum * itemsPerProducer);
+    EXPECT_EQ(sum, static_cast<long long>(producerNum) * itemsPerProducer * (itemsPerProducer + 1) / 2);
+    EXPECT_LE(maxRunning.load(), maxConcurrency);
+}
+
+// routine waiting for an event is parked until notified instead of being retried by backoff
+TEST(CommonUtilTest, TaskExecutorEventWaitTest)
+{
+    task::TaskExecutor executor(2);
+    auto event = std::make_shared<task::ExecutorEvent>();
+    RingQueue<int> queue(4);
+    queue.SetNotifyHook([event]() { event->Notify(); });
+    std::atomic<int> steps { 0 };
+    int v = 0;
+    auto job = executor.Submit([&]() {
+        ++steps;
+        uint64_t sequence = event->Sequence();
+        if (queue.TryBlockingPop(v)) {
+            return task::StepResult::DONE;
+        }
+        return task::TaskExecutor::WaitFor(event, sequence);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    EXPECT_TRUE(queue.TryBlockingPush(1));
+    job->Wait();
+    EXPECT_EQ(v, 1);
+    // initial step, at most a few retries for the fallback interval (100ms) and the step woken up by the push
+    EXPECT_LE(steps.load(), 5);
+}
+
+TEST(CommonUtilTest, IORateLimiterPacingTest)
+{
+    // 100 ops/s, each op costs 10ms, only one op can run ahead within burst tolerance
+    task::IORateLimiter limiter(0, 100);
+    auto start = std::chrono::steady_clock::now();
+    for (int ops = 0; ops < 11;) {
+        if (!limiter.Admit()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            continue;
+        }
+        limiter.Consume(ONE_MB);
+        ++ops;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, std::chrono::milliseconds(80));
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+
+    // debt of the previous limit is cleared once limit is changed
+    limiter.SetLimit(ONE_MB, 0);
+    EXPECT_TRUE(limiter.Admit());
+    limiter.Consume(10 * ONE_MB);
+    EXPECT_FALSE(limiter.Admit());
+    limiter.SetLimit(0, 0);
+    EXPECT_TRUE(limiter.Admit());
+}
+
+TEST(CommonUtilTest, IORateLimiterAdaptiveTest)
+{
+    uint64_t bytesPerSecond = 100 * ONE_MB;
+    task::IORateLimiter limiter(bytesPerSecond, 0, 1000);
+    // latency above threshold, back off from the configured limit
+    std::this_thread::sleep_for(std::chrono::milliseconds(210));
+    limiter.Consume(50 * ONE_MB);
+    limiter.RecordLatency(std::chrono::microseconds(5000));
+    uint64_t backoffBytesPerSecond = limiter.EffectiveBytesPerSecond();
+    EXPECT_LT(backoffBytesPerSecond, bytesPerSecond);
+    EXPECT_GT(backoffBytesPerSecond, 0);
+    // latency recovered, raise the limit until the configured one is restored
+    for (int i = 0; i < 100 && limiter.EffectiveBytesPerSecond() != bytesPerSecond; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(210));
+        limiter.RecordLatency(std::chrono::microseconds(100));
+        EXPECT_GE(limiter.EffectiveBytesPerSecond(), backoffBytesPerSecond);
+    }
+    EXPECT_EQ(limiter.EffectiveBytesPerSecond(), bytesPerSecond);
+}
+
+static std::string DigestHex(HashAlgorithm algorithm, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> digest(blockhash::DigestSize(algorithm));
+    EXPECT_TRUE(blockhash::ComputeDigest(algorithm, data.data(), data.size(), digest.data(), digest.size()));
+    std::string hex;
+    char buffer[3] = { 0 };
+    for (uint8_t byte : digest) {
+        ::snprintf(buffer, sizeof(buffer), "%02x", byte);
+        hex += buffer;
+    }
+    return hex;
+}
+
+TEST(CommonUtilTest, BlockHashDigestTest)
+{
+    std::vector<uint8_t> empty;
+    std::vector<uint8_t> abc { 'a', 'b', 'c' };
+    std::vector<uint8_t> check { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    std::vector<uint8_t> large(5000); // cover xxh3 long input and multiple blake3 chunks
+    for (std::size_t i = 0; i < large.size(); ++i) {
+        large[i] = static_cast<uint8_t>(i % 251);
+    }
+    EXPECT_EQ(DigestHex(HashAlgorithm::SHA256, abc),
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    EXPECT_EQ(DigestHex(HashAlgorithm::XXH3_128, empty), "99aa06d3014798d86001c324468d497f");
+    EXPECT_EQ(DigestHex(HashAlgorithm::XXH3_128, abc), "06b05ab6733a618578af5f94892f3950");
+    EXPECT_EQ(DigestHex(HashAlgorithm::XXH3_128, large), "b92ec02c39d33ce7b418500fc42320ee");
+    EXPECT_EQ(DigestHex(HashAlgorithm::BLAKE3, empty),
+        "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+    EXPECT_EQ(DigestHex(HashAlgorithm::BLAKE3, abc),
+        "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+    EXPECT_EQ(DigestHex(HashAlgorithm::BLAKE3, large),
+        "ee78d92070de3df1c57c37002abf0a6b1a6589acdeef4d8ffac7cf3d9e8f2836");
+    EXPECT_EQ(DigestHex(HashAlgorithm::CRC32C, check), "e3069283");
+
+    uint8_t output[SHA256_CHECKSUM_SIZE] = { 0 };
+    EXPECT_FALSE(blockhash::ComputeDigest(HashAlgorithm::XXH3_128, abc.data(), abc.size(), output, sizeof(output)));
+    HashAlgorithm algorithm = HashAlgorithm::SHA256;
+    EXPECT_TRUE(blockhash::ParseAlgorithm("BLAKE3", algorithm));
+    EXPECT_EQ(algorithm, HashAlgorithm::BLAKE3);
+    EXPECT_FALSE(blockhash::ParseAlgorithm("MD5", algorithm));
+}
+
+TEST(CommonUtilTest, DigestContextBatchTest)
+{
+    const uint32_t count = 11; // exceed lanes of any multi-buffer kernel
+    const uint64_t lengths[count] = { 4096, 4096, 4096, 4096, 4096, 4096, 4096, 4096, 4096, 100, 4096 };
+    std::vector<std::vector<uint8_t>> buffers(count);
+    std::vector<std::vector<uint8_t>> digests(count, std::vector<uint8_t>(SHA256_CHECKSUM_SIZE, 0));
+    const uint8_t* data[count];
+    uint8_t* output[count];
+    for (uint32_t i = 0; i < count; ++i) {
+        buffers[i].resize(lengths[i]);
+        for (std::size_t j = 0; j < buffers[i].size(); ++j) {
+            buffers[i][j] = static_cast<uint8_t>((i * 31 + j) % 253);
+        }
+        data[i] = buffers[i].data();
+        output[i] = digests[i].data();
+    }
+    blockhash::DigestContext context(HashAlgorithm::SHA256);
+    EXPECT_TRUE(context.Ok());
+    EXPECT_GE(context.MaxBatchSize(), 1U);
+    EXPECT_TRUE(context.ComputeBatch(data, lengths, output, count));
+    for (uint32_t i = 0; i < count; ++i) {
+        std::vector<uint8_t> expected(SHA256_CHECKSUM_SIZE, 0);
+        EXPECT_TRUE(blockhash::ComputeSHA256(buffers[i].data(), buffers[i].size(), expected.data()));
+        EXPECT_EQ(digests[i], expected);
+    }
+}
+
+TEST(CommonUtilTest, IsZeroBlockTest)
+{
+    // cover vectorized strides, the unaligned tail and unaligned start address
+    std::vector<uint8_t> buffer(4096 + 13 + 1, 0);
+    const uint8_t* data = buffer.data() + 1;
+    uint64_t length = buffer.size() - 1;
+    EXPECT_TRUE(blockhash::IsZeroBlock(data, length));
+    EXPECT_TRUE(blockhash::IsZeroBlock(data, 0));
+    std::vector<uint64_t> positions { 0, 31, 32, 63, 64, 2048, 4095, 4096, length - 1 };
+    for (uint64_t pos : positions) {
+        buffer[pos + 1] = 0x80;
+        EXPECT_FALSE(blockhash::IsZeroBlock(data, length)) << "non-zero byte at " << pos;
+        buffer[pos + 1] = 0;
+    }
+    buffer[0] = 1; // byte before the range is not tested
+    EXPECT_TRUE(blockhash::IsZeroBlock(data, length));
+}
+
+#ifdef __linux__
+TEST(CommonUtilTest, SparseCopyRawIOTest)
+{
+    const uint64_t sessionOffset = 8 * ONE_MB;
+    const uint64_t sessionSize = 4 * ONE_MB;
+    std::string copyFilePath = "/tmp/volumeprotect.sparse.copydata.bin";
+    fsapi::RemoveFile(copyFilePath);
+    ErrCodeType errorCode = 0;
+    ASSERT_TRUE(rawio::TruncateCreateFile(copyFilePath, sessionSize, errorCode));
+    rawio::SessionCopyRawIOParam param {};
+    param.copyFormat = CopyFormat::BIN;
+    param.copyFilePath = copyFilePath;
+    param.volumeOffset = sessionOffset;
+    param.length = sessionSize;
+    param.ioOption = rawio::RawIOOption { IOEngine::SYNC, 0, IOCacheMode::BUFFERED };
+    std::shared_ptr<rawio::RawDataWriter> writer = rawio::OpenRawDataCopyWriter(param);
+    std::shared_ptr<rawio::RawDataReader> reader = rawio::OpenRawDataCopyReader(param);
+    ASSERT_TRUE(writer != nullptr && writer->Ok() && reader != nullptr && reader->Ok());
+
+    // only the second MB of the session holds data, offsets are volume offsets
+    std::vector<uint8_t> data(ONE_MB, 0xAB);
+    ASSERT_TRUE(writer->Write(sessionOffset + ONE_MB, data.data(), data.size(), errorCode));
+    ASSERT_TRUE(writer->Flush());
+    uint64_t dataOffset = 0;
+    uint64_t dataLength = 0;
+    EXPECT_TRUE(reader->NextDataRange(sessionOffset, sessionSize, dataOffset, dataLength));
+    EXPECT_EQ(dataOffset, sessionOffset + ONE_MB);
+    EXPECT_EQ(dataLength, ONE_MB);
+    EXPECT_TRUE(reader->NextDataRange(sessionOffset + 2 * ONE_MB, 2 * ONE_MB, dataOffset, dataLength));
+    EXPECT_EQ(dataLength, 0);
+
+    // block became zero is deallocated and reads as zero
+    EXPECT_TRUE(writer->PunchHole(sessionOffset + ONE_MB, ONE_MB, errorCode));
+    EXPECT_TRUE(reader->NextDataRange(sessionOffset, sessionSize, dataOffset, dataLength));
+    EXPECT_EQ(dataLength, 0);
+    ASSERT_TRUE(reader->Read(sessionOffset + ONE_MB, data.data(), data.size(), errorCode));
+    EXPECT_TRUE(blockhash::IsZeroBlock(data.data(), data.size()));
+    EXPECT_EQ(fsapi::GetFileSize(copyFilePath), sessionSize);
+    writer.reset();
+    reader.reset();
+    fsapi::RemoveFile(copyFilePath);
+}
+#endif
+
+TEST(CommonUtilTest, FileChangedBlockProviderTest)
+{
+    const std::string filePath = "changed_ranges_test.txt";
+    std::ofstream file(filePath);
+    file << "# offset length" << std::endl;
+    file << "8192 4096" << std::endl;
+    file << "0x0 4096" << std::endl;
+    file << std::endl;
+    file << "10000 100" << std::endl;
+    file << "4096 4096" << std::endl;
+    file.close();
+    std::unique_ptr<cbt::ChangedBlockProvider> provider =
+        cbt::ChangedBlockProvider::Build(ChangedBlockTracking::FILE, filePath);
+    ASSERT_NE(provider, nullptr);
+    std::string token = "dirty";
+    EXPECT_TRUE(provider->CurrentToken(token));
+    EXPECT_TRUE(token.empty());
+    std::vector<fsapi::VolumeExtent> extents;
+    EXPECT_TRUE(provider->ListChangedExtents(token, extents));
+    ASSERT_EQ(extents.size(), 1);
+    EXPECT_EQ(extents[0].offset, 0);
+    EXPECT_EQ(extents[0].length, 12288);
+
+    file.open(filePath, std::ios::app);
+    file << "12288 -1" << std::endl;
+    file.close();
+    EXPECT_FALSE(provider->ListChangedExtents(token, extents));
+    std::remove(filePath.c_str());
+    EXPECT_FALSE(provider->ListChangedExtents(token, extents));
+    EXPECT_EQ(cbt::ChangedBlockProvider::Build(ChangedBlockTracking::NONE, ""), nullptr);
+}
+
+#ifdef __linux__
+namespace {
+    class MemoryDataReader : public rawio::RawDataReader {
+    public:
+        explicit MemoryDataReader(const std::vector<uint8_t>& data) : m_data(data) {}
+
+        bool Read(uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) override
+        {
+            if (offset + length > m_data.size()) {
+                errorCode = EINVAL;
+                return false;
+            }
+            memcpy(buffer, m_data.data() + offset, length);
+            return true;
+        }
+
+        bool Ok() override { return true; }
+
+        ErrCodeType Error() override { return 0; }
+
+        HandleType Handle() override { return -1; }
+
+    private:
+        std::vector<uint8_t> m_data;
+    };
+
+    void PutLE32(std::vector<uint8_t>& image, uint64_t offset, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i) {
+            image[offset + i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+    }
+
+    void PutLE64(std::vector<uint8_t>& image, uint64_t offset, uint64_t value)
+    {
+        PutLE32(image, offset, static_cast<uint32_t>(value));
+        PutLE32(image, offset + 4, static_cast<uint32_t>(value >> 32));
+    }
+
+    void PutBtreeNode(std::vector<uint8_t>& image, uint64_t blocknr, uint32_t flags, uint32_t maxEntries,
+        uint32_t valueSize, const std::vector<std::pair<uint64_t, std::vector<uint8_t>>>& entries)
+    {
+        uint64_t node = blocknr * 4096;
+        PutLE32(image, node + 4, flags);
+        PutLE64(image, node + 8, blocknr);
+        PutLE32(image, node + 16, static_cast<uint32_t>(entries.size()));
+        PutLE32(image, node + 20, maxEntries);
+        PutLE32(image, node + 24, valueSize);
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+            PutLE64(image, node + 32 + i * 8, entries[i].first);
+            memcpy(&image[node + 32 + maxEntries * 8 + i * valueSize], entries[i].second.data(), valueSize);
+        }
+    }
+
+    std::vector<uint8_t> LE64Value(uint64_t value)
+    {
+        std::vector<uint8_t> bytes(8, 0);
+        PutLE64(bytes, 0, value);
+        return bytes;
+    }
+}
+
+#ifdef __linux__
+TEST(CommonUtilTest, ResolvePhysicalDisksTest)
+{
+    // fake sysfs: LVM volume dm-1 on sda1 and a dm-crypt device dm-0 on nvme0n1p2, loop0 is a whole disk
+    const std::string root = "sysfs_resolve_test";
+    std::system(("rm -rf " + root).c_str());
+    std::vector<std::string> dirs {
+        "/devices/pci/sda/sda1", "/devices/pci/nvme0n1/nvme0n1p2", "/devices/virtual/dm-0/slaves",
+        "/devices/virtual/dm-1/slaves", "/devices/virtual/loop0", "/class/block", "/dev" };
+    for (const std::string& dir : dirs) {
+        std::system(("mkdir -p " + root + dir).c_str());
+    }
+    std::ofstream(root + "/devices/pci/sda/sda1/partition") << "1";
+    std::ofstream(root + "/devices/pci/nvme0n1/nvme0n1p2/partition") << "2";
+    std::vector<std::pair<std::string, std::string>> links {
+        { "../../devices/pci/sda/sda1", "/class/block/sda1" },
+        { "../../devices/pci/nvme0n1/nvme0n1p2", "/class/block/nvme0n1p2" },
+        { "../../devices/virtual/dm-0", "/class/block/dm-0" },
+        { "../../devices/virtual/dm-1", "/class/block/dm-1" },
+        { "../../devices/virtual/loop0", "/class/block/loop0" },
+        { "../../../../devices/pci/sda/sda1", "/devices/virtual/dm-1/slaves/sda1" },
+        { "../../../../devices/virtual/dm-0", "/devices/virtual/dm-1/slaves/dm-0" },
+        { "../../../../devices/pci/nvme0n1/nvme0n1p2", "/devices/virtual/dm-0/slaves/nvme0n1p2" },
+        { "dm-1", "/dev/vg-lv" } };
+    for (const auto& link : links) {
+        EXPECT_EQ(::symlink(link.first.c_str(), (root + link.second).c_str()), 0);
+    }
+    std::ofstream(root + "/dev/dm-1");
+    std::ofstream(root + "/dev/loop0");
+
+    EXPECT_EQ(fsapi::ResolvePhysicalDisksLinux(root + "/dev/vg-lv", root),
+        std::vector<std::string>({ "nvme0n1", "sda" }));
+    EXPECT_EQ(fsapi::ResolvePhysicalDisksLinux(root + "/dev/loop0", root), std::vector<std::string>({ "loop0" }));
+    EXPECT_EQ(fsapi::ResolvePhysicalDisksLinux("/dev/not-exists", root), std::vector<std::string>({ "not-exists" }));
+    std::system(("rm -rf " + root).c_str());
+}
+#endif
+
+TEST(CommonUtilTest, DmEraMetadataParserTest)
+{
+    const uint32_t nrBlocks = 200;
+    const uint64_t blockBytes = 128 * 512;
+    std::vector<uint8_t> image(10 * 4096, 0);
+    // superblock at block 0 and metadata snapshot at block 1
+    for (uint64_t sb : { 0, 4096 }) {
+        PutLE64(image, sb + 32, 2126579579);
+        PutLE32(image, sb + 172, 128);
+        PutLE32(image, sb + 176, 8);
+        PutLE32(image, sb + 180, nrBlocks);
+        PutLE32(image, sb + 184, 5);
+        PutLE64(image, sb + 200, 2);
+        PutLE64(image, sb + 208, 9);
+    }
+    // writeset tree: era 3 => bitset at block 3, era 4 => bitset at block 6
+    std::vector<uint8_t> writeset3(12, 0);
+    std::vector<uint8_t> writeset4(12, 0);
+    PutLE32(writeset3, 0, nrBlocks);
+    PutLE64(writeset3, 4, 3);
+    PutLE32(writeset4, 0, nrBlocks);
+    PutLE64(writeset4, 4, 6);
+    PutBtreeNode(image, 2, 2, 126, 12, { { 3, writeset3 }, { 4, writeset4 } });
+    // bitset of era 3 set bit 10, bitset of era 4 set bit 70 and 71
+    PutBtreeNode(image, 3, 2, 250, 8, { { 0, LE64Value(4) } });
+    PutLE32(image, 4 * 4096 + 4, 4);
+    PutLE32(image, 4 * 4096 + 8, 4);
+    PutLE32(image, 4 * 4096 + 12, 8);
+    PutLE64(image, 4 * 4096 + 24, 1ULL << 10);
+    PutBtreeNode(image, 6, 2, 250, 8, { { 0, LE64Value(7) } });
+    PutLE32(image, 7 * 4096 + 4, 4);
+    PutLE32(image, 7 * 4096 + 8, 4);
+    PutLE32(image, 7 * 4096 + 12, 8);
+    PutLE64(image, 7 * 4096 + 24 + 8, (1ULL << 6) | (1ULL << 7));
+    // era array: internal node at block 9 => leaf at block 5 => array block 8
+    PutBtreeNode(image, 9, 1, 250, 8, { { 0, LE64Value(5) } });
+    PutBtreeNode(image, 5, 2, 250, 8, { { 0, LE64Value(8) } });
+    PutLE32(image, 8 * 4096 + 4, nrBlocks);
+    PutLE32(image, 8 * 4096 + 8, nrBlocks);
+    PutLE32(image, 8 * 4096 + 12, 4);
+    PutLE32(image, 8 * 4096 + 24 + 100 * 4, 4);
+    PutLE32(image, 8 * 4096 + 24 + 101 * 4, 2);
+    PutLE32(image, 8 * 4096 + 24 + 199 * 4, 3);
+
+    // metadata snapshot not taken
+    std::vector<fsapi::VolumeExtent> extents;
+    cbt::DmEraMetadataParser noSnapshotParser(std::make_shared<MemoryDataReader>(image));
+    EXPECT_FALSE(noSnapshotParser.ListChangedExtents(3, extents));
+
+    PutLE64(image, 216, 1);
+    cbt::DmEraMetadataParser parser(std::make_shared<MemoryDataReader>(image));
+    EXPECT_TRUE(parser.ListChangedExtents(3, extents));
+    ASSERT_EQ(extents.size(), 4);
+    EXPECT_EQ(extents[0].offset, 10 * blockBytes);
+    EXPECT_EQ(extents[0].length, blockBytes);
+    EXPECT_EQ(extents[1].offset, 70 * blockBytes);
+    EXPECT_EQ(extents[1].length, 2 * blockBytes);
+    EXPECT_EQ(extents[2].offset, 100 * blockBytes);
+    EXPECT_EQ(extents[2].length, blockBytes);
+    EXPECT_EQ(extents[3].offset, 199 * blockBytes);
+    EXPECT_EQ(extents[3].length, blockBytes);
+    EXPECT_TRUE(parser.ListChangedExtents(5, extents));
+    EXPECT_TRUE(extents.empty());
+}
+#endif
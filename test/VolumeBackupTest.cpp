@@ -16,14 +16,22 @@
 #include <thread>
 
 #include "native/TaskResourceManager.h"
+#include "native/FileSystemAPI.h"
+#include "native/MappedFile.h"
 #include "VolumeProtector.h"
 #include "task/VolumeBackupTask.h"
 #include "task/VolumeRestoreTask.h"
+#include "task/VolumeZeroCopyBackupTask.h"
+#include "task/VolumeZeroCopyRestoreTask.h"
 #include "task/VolumeProtectTaskContext.h"
 #include "task/VolumeBlockReader.h"
 #include "task/VolumeBlockWriter.h"
 #include "task/VolumeBlockHasher.h"
+#include "task/VolumeBackupScheduler.h"
+#include "task/BlockBufferPool.h"
+#include "task/CheckpointJournal.h"
 #include "common/VolumeUtils.h"
+#include "common/BlockHash.h"
 #include "Logger.h"
 
 using namespace ::testing;
@@ -123,9 +131,9 @@ static void InitSessionSharedContext(std::shared_ptr<VolumeTaskSession> session)
     sharedContext->counter = std::make_shared<SessionCounter>();
     sharedContext->allocator = std::make_shared<VolumeBlockAllocator>(
         session->sharedConfig->blockSize, DEFAULT_ALLOCATOR_BLOCK_NUM);
-    sharedContext->hashingQueue = std::make_shared<BlockingQueue<VolumeConsumeBlock>>(DEFAULT_QUEUE_SIZE);
+    sharedContext->InitHashingQueue(DEFAULT_QUEUE_SIZE);
     // init hasher context
-    sharedContext->writeQueue = std::make_shared<BlockingQueue<VolumeConsumeBlock>>(DEFAULT_QUEUE_SIZE);
+    sharedContext->InitWriteQueue(DEFAULT_QUEUE_SIZE);
     uint64_t blockCount = session->sharedConfig->sessionSize / static_cast<uint64_t>(session->sharedConfig->blockSize);
     uint64_t numBlocks = session->TotalBlocks();
     uint64_t lastestChecksumTableSize = numBlocks * SHA256_CHECKSUM_SIZE;
@@ -147,7 +155,8 @@ static void InitSessionBlockVolumeReader(
         session->sharedConfig->sessionOffset,
         dataReader,
         session->sharedConfig,
-        session->sharedContext
+        session->sharedContext,
+        {}
     };
     auto volumeBlockReader = std::make_shared<VolumeBlockReader>(readerParam);
     session->readerTask = volumeBlockReader;
@@ -334,6 +343,43 @@ TEST_F(VolumeBackupTest, VolumeBackTask_RunBackupSuccess)
     EXPECT_EQ(backupTaskMock->GetStatusString(), "SUCCEED");
 }
 
+TEST_F(VolumeBackupTest, VolumeBackTask_RunConcurrentSessionsSuccess)
+{
+    VolumeBackupConfig backupConfig;
+    backupConfig.blockSize = DEFAULT_MOCK_SESSION_BLOCK_SIZE;
+    backupConfig.backupType = BackupType::FOREVER_INC;
+    backupConfig.hasherEnabled = true;
+    backupConfig.enableCheckpoint = false;
+    backupConfig.hasherNum = DEFAULT_MOCK_HASHER_NUM;
+    backupConfig.sessionSize = DEFAULT_MOCK_SESSION_SIZE;
+    backupConfig.sessionConcurrency = 2;
+    backupConfig.sessionMemoryBudget = 1LLU * ONE_GB;
+    backupConfig.volumePath = "/dev/dummyVolume";
+
+    auto backupTaskMock = std::make_shared<VolumeBackupTaskMock>(backupConfig, 1LLU * ONE_GB); // 2 session
+
+    EXPECT_CALL(*backupTaskMock, DataReaderReadMockReturn())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(*backupTaskMock, DataWriterWriteMockReturn())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(*backupTaskMock, SaveVolumeCopyMetaMockReturn())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(*backupTaskMock, LoadSessionPreviousCopyChecksumMockReturn())
+        .WillRepeatedly(Return(true));
+
+    EXPECT_TRUE(backupTaskMock->Start());
+    uint64_t bytesRead = 0;
+    while (!backupTaskMock->IsTerminated()) {
+        // statistics of concurrent sessions never go backwards
+        TaskStatistics statistics = backupTaskMock->GetStatistics();
+        EXPECT_GE(statistics.bytesRead, bytesRead);
+        bytesRead = statistics.bytesRead;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    EXPECT_EQ(backupTaskMock->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(backupTaskMock->GetStatistics().bytesRead, 1LLU * ONE_GB);
+}
+
 TEST_F(VolumeBackupTest, VolumeBackTask_RunBackupThenAbort)
 {
     VolumeBackupConfig backupConfig;
@@ -471,7 +517,8 @@ static void InitSessionBlockCopyReader(
         session->sharedConfig->sessionOffset,
         dataReader,
         session->sharedConfig,
-        session->sharedContext
+        session->sharedContext,
+        {}
     };
     auto volumeBlockReader = std::make_shared<VolumeBlockReader>(readerParam);
     session->readerTask = volumeBlockReader;
@@ -496,8 +543,10 @@ class VolumeRestoreTaskMock : public VolumeRestoreTask
 {
 public:
     VolumeRestoreTaskMock(const VolumeRestoreConfig& restoreConfig);
+    VolumeRestoreTaskMock(const VolumeRestoreConfig& restoreConfig, const VolumeCopyMeta& volumeCopyMeta);
     bool ValidateRestoreTask(const VolumeCopyMeta& volumeCopyMeta) const;
     bool InitRestoreSessionTaskExecutor(std::shared_ptr<VolumeTaskSession> session) const override;
+    bool InitCompareSessionTaskExecutor(std::shared_ptr<VolumeTaskSession> compareSession) const override;
     bool IsSessionRestarted(std::shared_ptr<VolumeTaskSession> session) const override;
 
     MOCK_METHOD(bool, DataReaderReadMockReturn, (), (const));
@@ -525,17 +574,33 @@ VolumeRestoreTaskMock::VolumeRestoreTaskMock(const VolumeRestoreConfig& restoreC
     m_resourceManager = std::dynamic_pointer_cast<TaskResourceManager>(TaskResourceManagerMock::Build());
 }
 
+VolumeRestoreTaskMock::VolumeRestoreTaskMock(
+    const VolumeRestoreConfig& restoreConfig, const VolumeCopyMeta& volumeCopyMeta)
+  : VolumeRestoreTask(restoreConfig, volumeCopyMeta)
+{
+    m_resourceManager = std::dynamic_pointer_cast<TaskResourceManager>(TaskResourceManagerMock::Build());
+}
+
 bool VolumeRestoreTaskMock::ValidateRestoreTask(const VolumeCopyMeta& volumeCopyMeta) const
 {
     return true;
 }
 
+// blocks of odd index of the copy are filled with 1, the others are zero
 bool VolumeRestoreTaskMock::InitRestoreSessionTaskExecutor(std::shared_ptr<VolumeTaskSession> session) const
 {
     // init mock
+    uint64_t blockSize = session->sharedConfig->blockSize;
+    bool readReturn = DataReaderReadMockReturn();
     auto dataReaderMock = std::make_shared<DataReaderMock>();
     EXPECT_CALL(*dataReaderMock, Read(_, _, _, _))
-        .WillRepeatedly(Return(DataReaderReadMockReturn()));
+        .WillRepeatedly(Invoke([blockSize, readReturn](
+            uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) {
+            if (readReturn) {
+                memset(buffer, static_cast<int>(offset / blockSize % 2), length);
+            }
+            return readReturn;
+        }));
     EXPECT_CALL(*dataReaderMock, Ok())
         .WillRepeatedly(Return(true));
     EXPECT_CALL(*dataReaderMock, Error())
@@ -554,7 +619,33 @@ bool VolumeRestoreTaskMock::InitRestoreSessionTaskExecutor(std::shared_ptr<Volum
     // init session
     InitSessionBlockCopyReader(session, std::dynamic_pointer_cast<rawio::RawDataReader>(dataReaderMock));
     InitSessionBlockVolumeWriter(session, std::dynamic_pointer_cast<rawio::RawDataWriter>(dataWriterMock));
-    return true;
+    if (!session->sharedConfig->hasherEnabled) {
+        return true;
+    }
+    session->hasherTask = VolumeBlockHasher::BuildHasher(
+        session->sharedConfig, session->sharedContext, HasherForwardMode::VERIFY);
+    return session->hasherTask != nullptr;
+}
+
+// blocks of odd index of the target volume are filled with 1, the others are zero
+bool VolumeRestoreTaskMock::InitCompareSessionTaskExecutor(std::shared_ptr<VolumeTaskSession> compareSession) const
+{
+    uint64_t blockSize = compareSession->sharedConfig->blockSize;
+    auto dataReaderMock = std::make_shared<DataReaderMock>();
+    EXPECT_CALL(*dataReaderMock, Read(_, _, _, _))
+        .WillRepeatedly(Invoke([blockSize](uint64_t offset, uint8_t* buffer, int length, ErrCodeType& errorCode) {
+            memset(buffer, static_cast<int>(offset / blockSize % 2), length);
+            return true;
+        }));
+    EXPECT_CALL(*dataReaderMock, Ok())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(*dataReaderMock, Error())
+        .WillRepeatedly(Return(static_cast<ErrCodeType>(0)));
+
+    InitSessionBlockVolumeReader(compareSession, std::dynamic_pointer_cast<rawio::RawDataReader>(dataReaderMock));
+    compareSession->hasherTask = VolumeBlockHasher::BuildHasher(
+        compareSession->sharedConfig, compareSession->sharedContext, HasherForwardMode::COMPARE);
+    return compareSession->hasherTask != nullptr;
 }
 
 bool VolumeRestoreTaskMock::IsSessionRestarted(std::shared_ptr<VolumeTaskSession> session) const
@@ -601,7 +692,7 @@ TEST_F(VolumeBackupTest, VolumeRestoreTask_RunRestoreThenAbort)
         .WillRepeatedly(Return(true));
 
     EXPECT_TRUE(restoreTaskMock->Start());
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // sessions complete without polling delay now, abort before the mock restore finishes
     restoreTaskMock->Abort();
     while (!restoreTaskMock->IsTerminated()) {
         restoreTaskMock->GetStatistics();
@@ -610,6 +701,312 @@ TEST_F(VolumeBackupTest, VolumeRestoreTask_RunRestoreThenAbort)
     EXPECT_EQ(restoreTaskMock->GetStatus(), TaskStatus::ABORTED);
 }
 
+TEST_F(VolumeBackupTest, VolumeRestoreTask_DifferentialRestoreWriteMismatchedOnly)
+{
+    const uint64_t sessionSize = 32 * ONE_MB;
+    const uint64_t sessionBlocks = 32;
+    VolumeCopyMeta volumeCopyMeta = MockReadVolumeCopyMeta();
+    volumeCopyMeta.volumeSize = 2 * sessionSize;
+    volumeCopyMeta.blockSize = ONE_MB;
+    volumeCopyMeta.segments = std::vector<CopySegment> {
+        CopySegment{ "volumeprotect.data.1", "volumeprotect.meta.1", 1, 0, sessionSize },
+        CopySegment{ "volumeprotect.data.2", "volumeprotect.meta.2", 2, sessionSize, sessionSize }
+    };
+    // copy of session 1 is all zero, blocks of odd index of target volume differ from it
+    std::vector<uint8_t> zeroBlock(ONE_MB, 0);
+    std::vector<uint8_t> checksumTable(sessionBlocks * SHA256_CHECKSUM_SIZE);
+    for (uint64_t index = 0; index < sessionBlocks; ++index) {
+        ASSERT_TRUE(blockhash::ComputeSHA256(
+            zeroBlock.data(), zeroBlock.size(), checksumTable.data() + index * SHA256_CHECKSUM_SIZE));
+    }
+    std::string checksumBinPath = common::GetChecksumBinPath("/tmp", volumeCopyMeta.copyName, 1);
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(checksumBinPath, checksumTable.data(), checksumTable.size()));
+    // checksum of session 2 not available, restored entirely
+    fsapi::RemoveFile(common::GetChecksumBinPath("/tmp", volumeCopyMeta.copyName, 2));
+
+    VolumeRestoreConfig restoreConfig;
+    restoreConfig.copyDataDirPath = "/dummy/dummyData";
+    restoreConfig.copyMetaDirPath = "/tmp";
+    restoreConfig.volumePath = "/dev/dummy/dummyVolume";
+    restoreConfig.enableCheckpoint = false;
+    restoreConfig.differentialRestore = true;
+    auto restoreTaskMock = std::make_shared<VolumeRestoreTaskMock>(restoreConfig, volumeCopyMeta);
+
+    EXPECT_CALL(*restoreTaskMock, DataReaderReadMockReturn())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(*restoreTaskMock, DataWriterWriteMockReturn())
+        .WillRepeatedly(Return(true));
+
+    EXPECT_TRUE(restoreTaskMock->Start());
+    while (!restoreTaskMock->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(restoreTaskMock->GetStatus(), TaskStatus::SUCCEED);
+    TaskStatistics statistics = restoreTaskMock->GetStatistics();
+    EXPECT_EQ(statistics.blocksHashed, sessionBlocks);
+    EXPECT_EQ(statistics.bytesWritten, sessionSize / 2 + sessionSize);
+    fsapi::RemoveFile(checksumBinPath);
+}
+
+TEST_F(VolumeBackupTest, VolumeRestoreTask_VerifyRestoreReportMismatchedBlocks)
+{
+    const uint64_t sessionSize = 32 * ONE_MB;
+    const uint64_t sessionBlocks = 32;
+    VolumeCopyMeta volumeCopyMeta = MockReadVolumeCopyMeta();
+    volumeCopyMeta.volumeSize = 2 * sessionSize;
+    volumeCopyMeta.blockSize = ONE_MB;
+    volumeCopyMeta.segments = std::vector<CopySegment> {
+        CopySegment{ "volumeprotect.data.1", "volumeprotect.meta.1", 1, 0, sessionSize },
+        CopySegment{ "volumeprotect.data.2", "volumeprotect.meta.2", 2, sessionSize, sessionSize }
+    };
+    // checksum of the copy is all zero, blocks of odd index read from copy are corrupted
+    std::vector<uint8_t> zeroBlock(ONE_MB, 0);
+    std::vector<uint8_t> checksumTable(sessionBlocks * SHA256_CHECKSUM_SIZE);
+    for (uint64_t index = 0; index < sessionBlocks; ++index) {
+        ASSERT_TRUE(blockhash::ComputeSHA256(
+            zeroBlock.data(), zeroBlock.size(), checksumTable.data() + index * SHA256_CHECKSUM_SIZE));
+    }
+    std::vector<std::string> checksumBinPaths {
+        common::GetChecksumBinPath("/tmp", volumeCopyMeta.copyName, 1),
+        common::GetChecksumBinPath("/tmp", volumeCopyMeta.copyName, 2)
+    };
+    for (const std::string& checksumBinPath : checksumBinPaths) {
+        ASSERT_TRUE(fsapi::WriteBinaryBuffer(checksumBinPath, checksumTable.data(), checksumTable.size()));
+    }
+
+    VolumeRestoreConfig restoreConfig;
+    restoreConfig.copyDataDirPath = "/dummy/dummyData";
+    restoreConfig.copyMetaDirPath = "/tmp";
+    restoreConfig.checkpointDirPath = "/tmp";
+    restoreConfig.volumePath = "/dev/dummy/dummyVolume";
+    restoreConfig.enableCheckpoint = false;
+    restoreConfig.verifyRestore = true;
+    auto restoreTaskMock = std::make_shared<VolumeRestoreTaskMock>(restoreConfig, volumeCopyMeta);
+
+    EXPECT_CALL(*restoreTaskMock, DataReaderReadMockReturn())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(*restoreTaskMock, DataWriterWriteMockReturn())
+        .WillRepeatedly(Return(true));
+
+    EXPECT_TRUE(restoreTaskMock->Start());
+    while (!restoreTaskMock->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(restoreTaskMock->GetStatus(), TaskStatus::FAILED);
+    EXPECT_EQ(restoreTaskMock->GetErrorCode(), VOLUMEPROTECT_ERR_CHECKSUM_MISMATCH);
+    TaskStatistics statistics = restoreTaskMock->GetStatistics();
+    EXPECT_EQ(statistics.blocksHashed, 2 * sessionBlocks);
+    EXPECT_EQ(statistics.bytesWritten, 2 * sessionSize);
+    std::vector<uint64_t> mismatchedBlocks = restoreTaskMock->GetMismatchedBlocks();
+    EXPECT_EQ(mismatchedBlocks.size(), sessionBlocks);
+    for (uint64_t index : mismatchedBlocks) {
+        EXPECT_EQ(index % 2, 1);
+    }
+    for (const std::string& checksumBinPath : checksumBinPaths) {
+        fsapi::RemoveFile(checksumBinPath);
+    }
+    for (int sessionIndex = 1; sessionIndex <= 2; ++sessionIndex) {
+        fsapi::RemoveFile(common::GetRestoredChecksumFilePath("/tmp", volumeCopyMeta.copyName, sessionIndex));
+    }
+}
+
+TEST_F(VolumeBackupTest, VolumeZeroCopyRestoreTask_RestoreBinFragmentsSuccess)
+{
+    const uint64_t sessionSize = 4 * ONE_MB;
+    VolumeCopyMeta volumeCopyMeta = MockReadVolumeCopyMeta();
+    volumeCopyMeta.volumeSize = 2 * sessionSize;
+    volumeCopyMeta.blockSize = ONE_MB;
+    volumeCopyMeta.segments = std::vector<CopySegment> {
+        CopySegment{ "volumeprotect.data.1", "volumeprotect.meta.1", 1, 0, sessionSize },
+        CopySegment{ "volumeprotect.data.2", "volumeprotect.meta.2", 2, sessionSize, sessionSize }
+    };
+    // fragment of session N is filled with N
+    std::vector<std::string> copyFilePaths;
+    for (CopySegment& segment : volumeCopyMeta.segments) {
+        std::vector<uint8_t> fragment(sessionSize, static_cast<uint8_t>(segment.index));
+        std::string copyFilePath = common::GetCopyDataFilePath(
+            "/tmp", volumeCopyMeta.copyName, CopyFormat::BIN, segment.index);
+        ASSERT_TRUE(fsapi::WriteBinaryBuffer(copyFilePath, fragment.data(), fragment.size()));
+        segment.copyDataFile = common::GetFileName(copyFilePath);
+        copyFilePaths.push_back(copyFilePath);
+    }
+    std::string volumePath = "/tmp/volumeprotect.zerocopy.volume";
+    std::vector<uint8_t> volumeData(2 * sessionSize, 0);
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+
+    VolumeRestoreConfig restoreConfig;
+    restoreConfig.copyDataDirPath = "/tmp";
+    restoreConfig.copyMetaDirPath = "/tmp";
+    restoreConfig.volumePath = volumePath;
+    restoreConfig.enableCheckpoint = false;
+    restoreConfig.enableZeroCopy = true;
+    restoreConfig.zeroCopyThreadNum = 3;
+    auto restoreTask = std::make_shared<VolumeZeroCopyRestoreTask>(restoreConfig, volumeCopyMeta);
+    EXPECT_TRUE(restoreTask->Start());
+    while (!restoreTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(restoreTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(restoreTask->GetStatistics().bytesWritten, 2 * sessionSize);
+    ASSERT_TRUE(fsapi::ReadBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+    for (uint64_t offset = 0; offset < volumeData.size(); offset += ONE_MB) {
+        EXPECT_EQ(volumeData[offset], static_cast<uint8_t>(offset / sessionSize + 1));
+    }
+    for (const std::string& copyFilePath : copyFilePaths) {
+        fsapi::RemoveFile(copyFilePath);
+    }
+    fsapi::RemoveFile(volumePath);
+}
+
+TEST_F(VolumeBackupTest, VolumeZeroCopyRestoreTask_ResumeFromCheckpointSuccess)
+{
+    const uint64_t sessionSize = 4 * ONE_MB;
+    VolumeCopyMeta volumeCopyMeta = MockReadVolumeCopyMeta();
+    volumeCopyMeta.volumeSize = 2 * sessionSize;
+    volumeCopyMeta.blockSize = ONE_MB;
+    volumeCopyMeta.segments = std::vector<CopySegment> {
+        CopySegment{ "volumeprotect.data.1", "volumeprotect.meta.1", 1, 0, sessionSize },
+        CopySegment{ "volumeprotect.data.2", "volumeprotect.meta.2", 2, sessionSize, sessionSize }
+    };
+    std::vector<std::string> copyFilePaths;
+    for (CopySegment& segment : volumeCopyMeta.segments) {
+        std::vector<uint8_t> fragment(sessionSize, static_cast<uint8_t>(segment.index));
+        std::string copyFilePath = common::GetCopyDataFilePath(
+            "/tmp", volumeCopyMeta.copyName, CopyFormat::BIN, segment.index);
+        ASSERT_TRUE(fsapi::WriteBinaryBuffer(copyFilePath, fragment.data(), fragment.size()));
+        segment.copyDataFile = common::GetFileName(copyFilePath);
+        copyFilePaths.push_back(copyFilePath);
+    }
+    std::string volumePath = "/tmp/volumeprotect.zerocopy.volume";
+    std::vector<uint8_t> volumeData(2 * sessionSize, 0);
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+    // first two blocks of session 1 are recorded written before restart, they are not copied again
+    Bitmap writtenBitmap(sessionSize / ONE_MB);
+    writtenBitmap.SetRange(0, 2);
+    CheckpointSnapshot checkpointSnapshot(writtenBitmap.Capacity());
+    writtenBitmap.CopyTo(checkpointSnapshot.processedBitmapBuffer);
+    writtenBitmap.CopyTo(checkpointSnapshot.writtenBitmapBuffer);
+    std::string checkpointFilePath = common::GetWriterBitmapFilePath("/tmp", volumeCopyMeta.copyName, 1);
+    ASSERT_TRUE(checkpointSnapshot.SaveTo(checkpointFilePath));
+
+    VolumeRestoreConfig restoreConfig;
+    restoreConfig.copyDataDirPath = "/tmp";
+    restoreConfig.copyMetaDirPath = "/tmp";
+    restoreConfig.checkpointDirPath = "/tmp";
+    restoreConfig.volumePath = volumePath;
+    restoreConfig.enableCheckpoint = true;
+    restoreConfig.enableZeroCopy = true;
+    auto restoreTask = std::make_shared<VolumeZeroCopyRestoreTask>(restoreConfig, volumeCopyMeta);
+    EXPECT_TRUE(restoreTask->Start());
+    while (!restoreTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(restoreTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(restoreTask->GetStatistics().bytesWritten, 2 * sessionSize);
+    ASSERT_TRUE(fsapi::ReadBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+    for (uint64_t offset = 0; offset < volumeData.size(); offset += ONE_MB) {
+        uint8_t expected = (offset < 2 * ONE_MB) ? 0 : static_cast<uint8_t>(offset / sessionSize + 1);
+        EXPECT_EQ(volumeData[offset], expected);
+    }
+    // checkpoint cleared on succeed
+    EXPECT_FALSE(fsapi::IsFileExists(checkpointFilePath));
+    for (const std::string& copyFilePath : copyFilePaths) {
+        fsapi::RemoveFile(copyFilePath);
+    }
+    fsapi::RemoveFile(volumePath);
+}
+
+TEST_F(VolumeBackupTest, VolumeZeroCopyBackupTask_BackupBinFragmentsSuccess)
+{
+    const uint64_t sessionSize = 4 * ONE_MB;
+    const std::string copyName = "volumeprotect.zerocopy.backup";
+    // each block of the volume is filled with its block index
+    std::string volumePath = "/tmp/volumeprotect.zerocopy.volume";
+    std::vector<uint8_t> volumeData(2 * sessionSize, 0);
+    for (uint64_t offset = 0; offset < volumeData.size(); offset += ONE_MB) {
+        std::fill_n(volumeData.begin() + offset, ONE_MB, static_cast<uint8_t>(offset / ONE_MB + 1));
+    }
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+
+    VolumeBackupConfig backupConfig;
+    backupConfig.copyFormat = CopyFormat::BIN;
+    backupConfig.backupType = BackupType::FULL;
+    backupConfig.copyName = copyName;
+    backupConfig.volumePath = volumePath;
+    backupConfig.outputCopyDataDirPath = "/tmp";
+    backupConfig.outputCopyMetaDirPath = "/tmp";
+    backupConfig.checkpointDirPath = "/tmp";
+    backupConfig.enableCheckpoint = true;
+    backupConfig.clearCheckpointsOnSucceed = true;
+    backupConfig.blockSize = ONE_MB;
+    backupConfig.sessionSize = sessionSize;
+    backupConfig.hasherEnabled = false;
+    backupConfig.enableZeroCopy = true;
+    backupConfig.zeroCopyThreadNum = 3;
+    ASSERT_TRUE(VolumeZeroCopyBackupTask::IsZeroCopySupported(backupConfig));
+    auto backupTask = std::make_shared<VolumeZeroCopyBackupTask>(backupConfig, volumeData.size());
+    EXPECT_TRUE(backupTask->Start());
+    while (!backupTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(backupTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(backupTask->GetStatistics().bytesWritten, 2 * sessionSize);
+    // fragment of each session holds data of the session only
+    std::vector<uint8_t> fragment(sessionSize, 0);
+    for (int sessionIndex = 0; sessionIndex < 2; ++sessionIndex) {
+        std::string copyFilePath = common::GetCopyDataFilePath("/tmp", copyName, CopyFormat::BIN, sessionIndex);
+        ASSERT_TRUE(fsapi::ReadBinaryBuffer(copyFilePath, fragment.data(), fragment.size()));
+        EXPECT_TRUE(std::equal(fragment.begin(), fragment.end(), volumeData.begin() + sessionIndex * sessionSize));
+        EXPECT_FALSE(fsapi::IsFileExists(common::GetWriterBitmapFilePath("/tmp", copyName, sessionIndex)));
+        fsapi::RemoveFile(copyFilePath);
+    }
+    fsapi::RemoveFile(std::string("/tmp/") + copyName + VOLUME_COPY_META_JSON_FILENAME_EXTENSION);
+    fsapi::RemoveFile(volumePath);
+}
+
+TEST_F(VolumeBackupTest, VolumeZeroCopyBackupTask_NotSupportedWithIOControl)
+{
+    VolumeBackupConfig backupConfig;
+    backupConfig.copyFormat = CopyFormat::IMAGE;
+    backupConfig.backupType = BackupType::FULL;
+    backupConfig.hasherEnabled = false;
+    backupConfig.enableZeroCopy = true;
+    EXPECT_TRUE(VolumeZeroCopyBackupTask::IsZeroCopySupported(backupConfig));
+    // page cache mode, rate limit and I/O priority can't be applied to data copied inside kernel
+    VolumeBackupConfig directConfig = backupConfig;
+    directConfig.ioCacheMode = IOCacheMode::DIRECT;
+    EXPECT_FALSE(VolumeZeroCopyBackupTask::IsZeroCopySupported(directConfig));
+    VolumeBackupConfig rateLimitedConfig = backupConfig;
+    rateLimitedConfig.rateLimit.writeBytesPerSecond = ONE_MB;
+    EXPECT_FALSE(VolumeZeroCopyBackupTask::IsZeroCopySupported(rateLimitedConfig));
+    VolumeBackupConfig idleConfig = backupConfig;
+    idleConfig.ioPriority = IOPriority::IDLE;
+    EXPECT_FALSE(VolumeZeroCopyBackupTask::IsZeroCopySupported(idleConfig));
+}
+
+TEST_F(VolumeBackupTest, TaskResourceManager_CreateBinFragmentOfEachSession)
+{
+    const std::string copyName = "volumeprotect.fragment";
+    const uint64_t sessionSize = 4 * ONE_MB;
+    // the last session is shorter than the others
+    const std::vector<uint64_t> fragmentSizes { sessionSize, sessionSize, ONE_MB };
+    for (uint32_t sessionIndex = 0; sessionIndex < fragmentSizes.size(); ++sessionIndex) {
+        fsapi::RemoveFile(common::GetCopyDataFilePath("/tmp", copyName, CopyFormat::BIN, sessionIndex));
+    }
+    std::unique_ptr<TaskResourceManager> resourceManager = TaskResourceManager::BuildBackupTaskResourceManager(
+        BackupTaskResourceManagerParams {
+            CopyFormat::BIN, BackupType::FULL, "/tmp", copyName, 2 * sessionSize + ONE_MB, sessionSize });
+    EXPECT_TRUE(resourceManager->PrepareCopyResource());
+    for (uint32_t sessionIndex = 0; sessionIndex < fragmentSizes.size(); ++sessionIndex) {
+        std::string copyFilePath = common::GetCopyDataFilePath("/tmp", copyName, CopyFormat::BIN, sessionIndex);
+        EXPECT_TRUE(fsapi::IsFileExists(copyFilePath));
+        std::ifstream copyFile(copyFilePath, std::ios::binary | std::ios::ate);
+        EXPECT_EQ(static_cast<uint64_t>(copyFile.tellg()), fragmentSizes[sessionIndex]);
+        copyFile.close();
+        fsapi::RemoveFile(copyFilePath);
+    }
+}
+
 // // Test Basic Component From Here...
 TEST_F(VolumeBackupTest, BuildBackupOrRestoreTask_FailForInvalidVolumePath)
 {
@@ -672,4 +1069,816 @@ TEST_F(VolumeBackupTest, VolumeBlockHasher_HasherDisabled)
     };
     auto volumeBlockHasher = std::make_shared<VolumeBlockHasher>(hasherParam);
     EXPECT_TRUE(volumeBlockHasher->Start());
+}
+// copy a file using VolumeBlockReader and VolumeBlockWriter, return true if target is identical to source
+static bool CopyFileUsingBlockReaderWriter(
+    IOEngine ioEngine, uint32_t readerNum, IOCacheMode cacheMode = IOCacheMode::BUFFERED,
+    uint64_t readBytesPerSecond = 0)
+{
+    std::string sourcePath = "/tmp/volumeprotect_reader_writer_source.img";
+    std::string targetPath = "/tmp/volumeprotect_reader_writer_target.img";
+    uint64_t sessionSize = 10 * ONE_MB + 4097; // make it not divide by block size and sector size
+    std::vector<uint8_t> sourceData(sessionSize);
+    for (uint64_t i = 0; i < sessionSize; ++i) {
+        sourceData[i] = static_cast<uint8_t>((i * 131) % 251);
+    }
+    ::remove(sourcePath.c_str());
+    ::remove(targetPath.c_str());
+    std::ofstream(sourcePath, std::ios::binary).write(reinterpret_cast<const char*>(sourceData.data()), sessionSize);
+    ErrCodeType errorCode = 0;
+    EXPECT_TRUE(rawio::TruncateCreateFile(targetPath, sessionSize, errorCode));
+
+    auto session = std::make_shared<VolumeTaskSession>();
+    InitSessionSharedConfig(session);
+    session->sharedConfig->sessionSize = sessionSize;
+    session->sharedConfig->blockSize = ONE_MB;
+    session->sharedConfig->hasherEnabled = false;
+    session->sharedConfig->checkpointEnabled = false;
+    session->sharedConfig->copyFormat = CopyFormat::IMAGE;
+    session->sharedConfig->volumePath = sourcePath;
+    session->sharedConfig->copyFilePath = targetPath;
+    session->sharedConfig->ioEngine = ioEngine;
+    session->sharedConfig->ioQueueDepth = 4;
+    session->sharedConfig->readerWorkerNum = readerNum;
+    session->sharedConfig->ioCacheMode = cacheMode;
+    session->sharedConfig->ioPriority = (readBytesPerSecond != 0) ? IOPriority::LOW : IOPriority::NORMAL;
+    InitSessionSharedContext(session);
+    if (readBytesPerSecond != 0) {
+        session->sharedContext->readLimiter = std::make_shared<IORateLimiter>(readBytesPerSecond, 0);
+        session->sharedContext->writeLimiter = std::make_shared<IORateLimiter>(0, 1000);
+    }
+    session->readerTask = VolumeBlockReader::BuildVolumeReader(session->sharedConfig, session->sharedContext);
+    session->writerTask = VolumeBlockWriter::BuildCopyWriter(session->sharedConfig, session->sharedContext);
+    if (session->readerTask == nullptr || session->writerTask == nullptr) {
+        return false;
+    }
+    EXPECT_TRUE(session->readerTask->Start());
+    EXPECT_TRUE(session->writerTask->Start());
+    while (!session->readerTask->IsTerminated() || !session->writerTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(session->readerTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(session->writerTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(session->sharedContext->counter->bytesRead, sessionSize);
+    EXPECT_EQ(session->sharedContext->counter->bytesWritten, sessionSize);
+    EXPECT_EQ(session->sharedContext->writtenBitmap->TotalSetCount(), session->TotalBlocks());
+    session->readerTask.reset();
+    session->writerTask.reset();
+
+    std::vector<uint8_t> targetData(sessionSize);
+    std::ifstream(targetPath, std::ios::binary).read(reinterpret_cast<char*>(targetData.data()), sessionSize);
+    ::remove(sourcePath.c_str());
+    ::remove(targetPath.c_str());
+    return sourceData == targetData;
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockReader_MultiReaderCopySuccess)
+{
+    EXPECT_TRUE(CopyFileUsingBlockReaderWriter(IOEngine::SYNC, 3));
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockReaderWriter_CacheModeCopySuccess)
+{
+    EXPECT_TRUE(CopyFileUsingBlockReaderWriter(IOEngine::SYNC, 2, IOCacheMode::DIRECT));
+    EXPECT_TRUE(CopyFileUsingBlockReaderWriter(IOEngine::SYNC, 1, IOCacheMode::DROP_BEHIND));
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockReaderWriter_RateLimitedCopySuccess)
+{
+    // 11 blocks of 1MB paced at 40MB/s, the first one is admitted immediately
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(CopyFileUsingBlockReaderWriter(IOEngine::SYNC, 2, IOCacheMode::BUFFERED, 40 * ONE_MB));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+#ifdef VOLUMEPROTECT_IO_URING
+    start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(CopyFileUsingBlockReaderWriter(IOEngine::IO_URING, 1, IOCacheMode::BUFFERED, 40 * ONE_MB));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+#endif
+}
+
+#ifdef VOLUMEPROTECT_IO_URING
+TEST_F(VolumeBackupTest, VolumeBlockReaderWriter_IOUringCopySuccess)
+{
+    EXPECT_TRUE(CopyFileUsingBlockReaderWriter(IOEngine::IO_URING, 1));
+    EXPECT_TRUE(CopyFileUsingBlockReaderWriter(IOEngine::IO_URING, 2));
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockReaderWriter_IOUringRejectUnbufferedCacheMode)
+{
+    std::string filePath = "/tmp/volumeprotect_iouring_cachemode.img";
+    std::vector<uint8_t> data(ONE_MB, 0xAA);
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(filePath, data.data(), data.size()));
+    auto sharedConfig = std::make_shared<VolumeTaskSharedConfig>();
+    auto sharedContext = std::make_shared<VolumeTaskSharedContext>();
+    sharedConfig->sessionSize = ONE_MB;
+    sharedConfig->blockSize = ONE_MB;
+    sharedConfig->copyFormat = CopyFormat::IMAGE;
+    sharedConfig->volumePath = filePath;
+    sharedConfig->copyFilePath = filePath;
+    sharedConfig->ioEngine = IOEngine::IO_URING;
+    // cache mode can't be applied to io_uring reader/writer, they are not built instead of ignoring it
+    for (IOCacheMode cacheMode : { IOCacheMode::DIRECT, IOCacheMode::DROP_BEHIND }) {
+        sharedConfig->ioCacheMode = cacheMode;
+        EXPECT_TRUE(VolumeBlockReader::BuildVolumeReader(sharedConfig, sharedContext) == nullptr);
+        EXPECT_TRUE(VolumeBlockWriter::BuildCopyWriter(sharedConfig, sharedContext) == nullptr);
+    }
+    sharedConfig->ioCacheMode = IOCacheMode::BUFFERED;
+    EXPECT_TRUE(VolumeBlockReader::BuildVolumeReader(sharedConfig, sharedContext) != nullptr);
+    EXPECT_TRUE(VolumeBlockWriter::BuildCopyWriter(sharedConfig, sharedContext) != nullptr);
+    fsapi::RemoveFile(filePath);
+}
+#endif
+
+TEST_F(VolumeBackupTest, VolumeBlockReaderWriter_SparseCopyRestoreSuccess)
+{
+    std::string copyPath = "/tmp/volumeprotect_sparse_copy.img";
+    std::string volumePath = "/tmp/volumeprotect_sparse_volume.img";
+    uint64_t sessionSize = 4 * ONE_MB;
+    ::remove(copyPath.c_str());
+    ::remove(volumePath.c_str());
+    // only block 1 of the copy holds data, the rest are holes
+    ErrCodeType errorCode = 0;
+    ASSERT_TRUE(rawio::TruncateCreateFile(copyPath, sessionSize, errorCode));
+    std::vector<uint8_t> blockData(ONE_MB, 0x5A);
+    {
+        std::fstream copyFile(copyPath, std::ios::binary | std::ios::in | std::ios::out);
+        copyFile.seekp(ONE_MB);
+        copyFile.write(reinterpret_cast<const char*>(blockData.data()), ONE_MB);
+    }
+    std::vector<uint8_t> volumeData(sessionSize, 0xFF);
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+
+    auto session = std::make_shared<VolumeTaskSession>();
+    InitSessionSharedConfig(session);
+    session->sharedConfig->sessionSize = sessionSize;
+    session->sharedConfig->blockSize = ONE_MB;
+    session->sharedConfig->hasherEnabled = false;
+    session->sharedConfig->checkpointEnabled = false;
+    session->sharedConfig->punchZeroBlock = true;
+    session->sharedConfig->copyFormat = CopyFormat::IMAGE;
+    session->sharedConfig->volumePath = volumePath;
+    session->sharedConfig->copyFilePath = copyPath;
+    session->sharedConfig->readerWorkerNum = 2;
+    InitSessionSharedContext(session);
+    session->readerTask = VolumeBlockReader::BuildCopyReader(session->sharedConfig, session->sharedContext);
+    session->writerTask = VolumeBlockWriter::BuildVolumeWriter(session->sharedConfig, session->sharedContext);
+    ASSERT_TRUE(session->readerTask != nullptr && session->writerTask != nullptr);
+    EXPECT_TRUE(session->readerTask->Start());
+    EXPECT_TRUE(session->writerTask->Start());
+    while (!session->readerTask->IsTerminated() || !session->writerTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(session->readerTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(session->writerTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(session->sharedContext->counter->bytesRead, sessionSize);
+    EXPECT_EQ(session->sharedContext->writtenBitmap->TotalSetCount(), session->TotalBlocks());
+    session->readerTask.reset();
+    session->writerTask.reset();
+
+    // blocks of holes are punched in volume instead of written
+    ASSERT_TRUE(fsapi::ReadBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+    std::vector<uint8_t> expected(sessionSize, 0);
+    std::copy(blockData.begin(), blockData.end(), expected.begin() + ONE_MB);
+    EXPECT_TRUE(volumeData == expected);
+    auto volumeReader = rawio::OpenRawDataVolumeReader(volumePath);
+    uint64_t dataOffset = 0;
+    uint64_t dataLength = 0;
+    EXPECT_TRUE(volumeReader->NextDataRange(0, sessionSize, dataOffset, dataLength));
+    EXPECT_EQ(dataOffset, ONE_MB);
+    EXPECT_EQ(dataLength, ONE_MB);
+    volumeReader.reset();
+    ::remove(copyPath.c_str());
+    ::remove(volumePath.c_str());
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockReader_SkipUnallocatedBlockSuccess)
+{
+    std::string sourcePath = "/tmp/volumeprotect_skip_unallocated_source.img";
+    std::string targetPath = "/tmp/volumeprotect_skip_unallocated_target.img";
+    uint64_t sessionSize = 10 * ONE_MB;
+    std::vector<uint8_t> sourceData(sessionSize, 0xAA);
+    ::remove(sourcePath.c_str());
+    ::remove(targetPath.c_str());
+    std::ofstream(sourcePath, std::ios::binary).write(reinterpret_cast<const char*>(sourceData.data()), sessionSize);
+    ErrCodeType errorCode = 0;
+    EXPECT_TRUE(rawio::TruncateCreateFile(targetPath, sessionSize, errorCode));
+
+    auto session = std::make_shared<VolumeTaskSession>();
+    InitSessionSharedConfig(session);
+    session->sharedConfig->sessionSize = sessionSize;
+    session->sharedConfig->blockSize = ONE_MB;
+    session->sharedConfig->hasherEnabled = false;
+    session->sharedConfig->checkpointEnabled = false;
+    session->sharedConfig->copyFormat = CopyFormat::IMAGE;
+    session->sharedConfig->volumePath = sourcePath;
+    session->sharedConfig->copyFilePath = targetPath;
+    session->sharedConfig->readerWorkerNum = 2;
+    InitSessionSharedContext(session);
+    // only blocks with even index are allocated
+    session->sharedContext->allocatedBitmap = std::make_shared<Bitmap>(session->TotalBlocks());
+    for (uint64_t index = 0; index < session->TotalBlocks(); index += 2) {
+        session->sharedContext->allocatedBitmap->Set(index);
+    }
+    session->readerTask = VolumeBlockReader::BuildVolumeReader(session->sharedConfig, session->sharedContext);
+    session->writerTask = VolumeBlockWriter::BuildCopyWriter(session->sharedConfig, session->sharedContext);
+    EXPECT_TRUE(session->readerTask != nullptr && session->writerTask != nullptr);
+    EXPECT_TRUE(session->readerTask->Start());
+    EXPECT_TRUE(session->writerTask->Start());
+    while (!session->readerTask->IsTerminated() || !session->writerTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(session->readerTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(session->writerTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(session->sharedContext->counter->bytesToRead, sessionSize / 2);
+    EXPECT_EQ(session->sharedContext->counter->bytesRead, sessionSize / 2);
+    EXPECT_EQ(session->sharedContext->writtenBitmap->TotalSetCount(), session->TotalBlocks() / 2);
+    session->readerTask.reset();
+    session->writerTask.reset();
+
+    // unallocated blocks are left as holes
+    std::vector<uint8_t> targetData(sessionSize);
+    std::ifstream(targetPath, std::ios::binary).read(reinterpret_cast<char*>(targetData.data()), sessionSize);
+    for (uint64_t index = 0; index < session->TotalBlocks(); ++index) {
+        uint8_t expected = (index % 2 == 0) ? 0xAA : 0x00;
+        EXPECT_EQ(targetData[index * ONE_MB], expected);
+        EXPECT_EQ(targetData[index * ONE_MB + ONE_MB - 1], expected);
+    }
+    ::remove(sourcePath.c_str());
+    ::remove(targetPath.c_str());
+}
+
+// free extents of volume are provided by the mock, blocks covered by them are not allocated
+class VolumeBackupTaskFreeExtentsMock : public VolumeBackupTask
+{
+public:
+    VolumeBackupTaskFreeExtentsMock(const VolumeBackupConfig& backupConfig, uint64_t volumeSize,
+        const std::vector<fsapi::VolumeExtent>& freeExtents)
+        : VolumeBackupTask(backupConfig, volumeSize), m_mockFreeExtents(freeExtents)
+    {}
+
+    bool LoadVolumeFreeExtents() override
+    {
+        m_freeExtents = m_mockFreeExtents;
+        return true;
+    }
+
+private:
+    std::vector<fsapi::VolumeExtent> m_mockFreeExtents;
+};
+
+TEST_F(VolumeBackupTest, VolumeRestoreTask_VerifyRestoreCopySkippedUnallocatedBlocks)
+{
+    const uint64_t sessionSize = 4 * ONE_MB;
+    const std::string copyName = "volumeprotect.unallocated";
+    // blocks of odd index are not allocated, stale data in them is not backup
+    std::string volumePath = "/tmp/volumeprotect.unallocated.volume";
+    std::string targetPath = "/tmp/volumeprotect.unallocated.target";
+    std::vector<uint8_t> volumeData(2 * sessionSize, 0xAA);
+    std::vector<fsapi::VolumeExtent> freeExtents;
+    for (uint64_t offset = ONE_MB; offset < volumeData.size(); offset += 2 * ONE_MB) {
+        freeExtents.push_back(fsapi::VolumeExtent { offset, ONE_MB });
+    }
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(volumePath, volumeData.data(), volumeData.size()));
+    fsapi::RemoveFile(targetPath);
+    ErrCodeType errorCode = 0;
+    ASSERT_TRUE(rawio::TruncateCreateFile(targetPath, volumeData.size(), errorCode));
+
+    VolumeBackupConfig backupConfig;
+    backupConfig.copyFormat = CopyFormat::IMAGE;
+    backupConfig.backupType = BackupType::FULL;
+    backupConfig.copyName = copyName;
+    backupConfig.volumePath = volumePath;
+    backupConfig.outputCopyDataDirPath = "/tmp";
+    backupConfig.outputCopyMetaDirPath = "/tmp";
+    backupConfig.checkpointDirPath = "/tmp";
+    backupConfig.enableCheckpoint = false;
+    backupConfig.blockSize = ONE_MB;
+    backupConfig.sessionSize = sessionSize;
+    backupConfig.skipUnallocatedBlock = true;
+    auto backupTask = std::make_shared<VolumeBackupTaskFreeExtentsMock>(backupConfig, volumeData.size(), freeExtents);
+    EXPECT_TRUE(backupTask->Start());
+    while (!backupTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(backupTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(backupTask->GetStatistics().bytesRead, sessionSize);
+
+    // checksum of unallocated blocks matches the zero data left in copy
+    VolumeCopyMeta volumeCopyMeta = MockReadVolumeCopyMeta();
+    volumeCopyMeta.copyName = copyName;
+    volumeCopyMeta.copyFormat = static_cast<int>(CopyFormat::IMAGE);
+    volumeCopyMeta.volumeSize = volumeData.size();
+    volumeCopyMeta.blockSize = ONE_MB;
+    volumeCopyMeta.segments = std::vector<CopySegment> {
+        CopySegment{ "", "", 0, 0, sessionSize },
+        CopySegment{ "", "", 1, sessionSize, sessionSize }
+    };
+    VolumeRestoreConfig restoreConfig;
+    restoreConfig.copyDataDirPath = "/tmp";
+    restoreConfig.copyMetaDirPath = "/tmp";
+    restoreConfig.checkpointDirPath = "/tmp";
+    restoreConfig.volumePath = targetPath;
+    restoreConfig.enableCheckpoint = false;
+    restoreConfig.verifyRestore = true;
+    auto restoreTask = std::make_shared<VolumeRestoreTask>(restoreConfig, volumeCopyMeta);
+    EXPECT_TRUE(restoreTask->Start());
+    while (!restoreTask->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(restoreTask->GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_TRUE(restoreTask->GetMismatchedBlocks().empty());
+    std::vector<uint8_t> targetData(volumeData.size(), 0);
+    ASSERT_TRUE(fsapi::ReadBinaryBuffer(targetPath, targetData.data(), targetData.size()));
+    for (uint64_t index = 0; index < volumeData.size() / ONE_MB; ++index) {
+        uint8_t expected = (index % 2 == 0) ? 0xAA : 0x00;
+        EXPECT_EQ(targetData[index * ONE_MB], expected);
+        EXPECT_EQ(targetData[index * ONE_MB + ONE_MB - 1], expected);
+    }
+    for (const CopySegment& segment : volumeCopyMeta.segments) {
+        fsapi::RemoveFile(common::GetChecksumBinPath("/tmp", copyName, segment.index));
+        fsapi::RemoveFile(common::GetSubBlockChecksumBinPath("/tmp", copyName, segment.index));
+        fsapi::RemoveFile(common::GetRestoredChecksumFilePath("/tmp", copyName, segment.index));
+    }
+    fsapi::RemoveFile(common::GetCopyDataFilePath("/tmp", copyName, CopyFormat::IMAGE, 0));
+    fsapi::RemoveFile(std::string("/tmp/") + copyName + VOLUME_COPY_META_JSON_FILENAME_EXTENSION);
+    fsapi::RemoveFile(volumePath);
+    fsapi::RemoveFile(targetPath);
+}
+
+// run a backup session from sourcePath to targetPath with reader, hasher and writer
+static std::shared_ptr<VolumeTaskSession> RunHashingSession(
+    const std::string& sourcePath, const std::string& targetPath, uint64_t sessionSize,
+    HasherForwardMode mode, const std::shared_ptr<VolumeTaskSession>& prevSession)
+{
+    auto session = std::make_shared<VolumeTaskSession>();
+    InitSessionSharedConfig(session);
+    session->sharedConfig->sessionSize = sessionSize;
+    session->sharedConfig->blockSize = ONE_MB;
+    session->sharedConfig->hasherWorkerNum = 2;
+    session->sharedConfig->checkpointEnabled = false;
+    session->sharedConfig->copyFormat = CopyFormat::IMAGE;
+    session->sharedConfig->volumePath = sourcePath;
+    session->sharedConfig->copyFilePath = targetPath;
+    session->sharedConfig->readerWorkerNum = 1;
+    session->sharedConfig->subBlockSize = DEFAULT_SUB_BLOCK_SIZE;
+    InitSessionSharedContext(session);
+    auto hashingContext = session->sharedContext->hashingContext;
+    hashingContext->AllocSubBlockTable(
+        session->TotalBlocks() * SubBlocksPerBlock(ONE_MB, DEFAULT_SUB_BLOCK_SIZE) * SUB_BLOCK_CHECKSUM_SIZE);
+    if (prevSession != nullptr) {
+        auto prevContext = prevSession->sharedContext->hashingContext;
+        ::memcpy(hashingContext->previousTable, prevContext->lastestTable, prevContext->lastestSize);
+        hashingContext->subPreviousTable = new uint8_t[prevContext->subLastestSize];
+        hashingContext->subPreviousSize = prevContext->subLastestSize;
+        ::memcpy(hashingContext->subPreviousTable, prevContext->subLastestTable, prevContext->subLastestSize);
+    }
+    session->readerTask = VolumeBlockReader::BuildVolumeReader(session->sharedConfig, session->sharedContext);
+    session->hasherTask = VolumeBlockHasher::BuildHasher(session->sharedConfig, session->sharedContext, mode);
+    session->writerTask = VolumeBlockWriter::BuildCopyWriter(session->sharedConfig, session->sharedContext);
+    EXPECT_TRUE(session->readerTask != nullptr && session->hasherTask != nullptr && session->writerTask != nullptr);
+    EXPECT_TRUE(session->readerTask->Start());
+    EXPECT_TRUE(session->hasherTask->Start());
+    EXPECT_TRUE(session->writerTask->Start());
+    while (!session->IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_FALSE(session->IsFailed());
+    session->readerTask.reset();
+    session->hasherTask.reset();
+    session->writerTask.reset();
+    return session;
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockHasher_SubBlockIncrementWriteChangedRangeOnly)
+{
+    std::string sourcePath = "/tmp/volumeprotect_subblock_source.img";
+    std::string targetPath = "/tmp/volumeprotect_subblock_target.img";
+    uint64_t sessionSize = 4 * ONE_MB + 4097; // last block is shorter than a sub-block
+    std::vector<uint8_t> sourceData(sessionSize);
+    for (uint64_t i = 0; i < sessionSize; ++i) {
+        sourceData[i] = static_cast<uint8_t>((i * 131) % 251);
+    }
+    ::remove(sourcePath.c_str());
+    ::remove(targetPath.c_str());
+    std::ofstream(sourcePath, std::ios::binary).write(reinterpret_cast<const char*>(sourceData.data()), sessionSize);
+    ErrCodeType errorCode = 0;
+    EXPECT_TRUE(rawio::TruncateCreateFile(targetPath, sessionSize, errorCode));
+    auto fullSession = RunHashingSession(sourcePath, targetPath, sessionSize, HasherForwardMode::DIRECT, nullptr);
+    EXPECT_EQ(fullSession->sharedContext->counter->bytesWritten, sessionSize);
+
+    // change the 4th sub-block of block[1] and the last block
+    uint64_t changedOffset = ONE_MB + 3 * DEFAULT_SUB_BLOCK_SIZE + 10;
+    sourceData[changedOffset] ^= 0xFF;
+    sourceData[sessionSize - 1] ^= 0xFF;
+    std::ofstream(sourcePath, std::ios::binary).write(reinterpret_cast<const char*>(sourceData.data()), sessionSize);
+    // sub-block not changed won't be rewritten, so the mark in copy should remain
+    uint64_t markOffset = ONE_MB + 5 * DEFAULT_SUB_BLOCK_SIZE;
+    uint8_t mark = sourceData[markOffset] ^ 0xFF;
+    {
+        std::fstream target(targetPath, std::ios::binary | std::ios::in | std::ios::out);
+        target.seekp(markOffset);
+        target.write(reinterpret_cast<const char*>(&mark), 1);
+    }
+    auto incSession = RunHashingSession(sourcePath, targetPath, sessionSize, HasherForwardMode::DIFF, fullSession);
+    EXPECT_EQ(incSession->sharedContext->counter->bytesToWrite, DEFAULT_SUB_BLOCK_SIZE + 4097);
+    EXPECT_EQ(incSession->sharedContext->counter->bytesWritten, DEFAULT_SUB_BLOCK_SIZE + 4097);
+    // sub-block checksum of unchanged block[0] are inherited from previous table
+    EXPECT_EQ(::memcmp(fullSession->sharedContext->hashingContext->subLastestTable,
+        incSession->sharedContext->hashingContext->subLastestTable,
+        ONE_MB / DEFAULT_SUB_BLOCK_SIZE * SUB_BLOCK_CHECKSUM_SIZE), 0);
+
+    std::vector<uint8_t> targetData(sessionSize);
+    std::ifstream(targetPath, std::ios::binary).read(reinterpret_cast<char*>(targetData.data()), sessionSize);
+    EXPECT_EQ(targetData[changedOffset], sourceData[changedOffset]);
+    EXPECT_EQ(targetData[sessionSize - 1], sourceData[sessionSize - 1]);
+    EXPECT_EQ(targetData[markOffset], mark);
+    ::remove(sourcePath.c_str());
+    ::remove(targetPath.c_str());
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockAllocator_AllocFreeSuccess)
+{
+    const uint32_t blockNum = 4;
+    VolumeBlockAllocator allocator(ONE_MB, blockNum);
+    std::vector<uint8_t*> buffers;
+    for (uint32_t i = 0; i < blockNum; ++i) {
+        uint8_t* buffer = allocator.BlockAlloc();
+        EXPECT_TRUE(buffer != nullptr);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer) % DEFAULT_DIRECT_IO_ALIGNMENT, 0);
+        buffers.push_back(buffer);
+    }
+    EXPECT_EQ(allocator.BlockAlloc(), nullptr);
+    EXPECT_EQ(allocator.BlockAllocWait(std::chrono::milliseconds(10)), nullptr);
+    EXPECT_THROW(allocator.BlockFree(buffers.front() + 1), std::runtime_error);
+    allocator.BlockFree(buffers.back());
+    EXPECT_EQ(allocator.BlockAlloc(), buffers.back());
+    for (uint8_t* buffer : buffers) {
+        allocator.BlockFree(buffer);
+    }
+}
+
+TEST_F(VolumeBackupTest, Bitmap_ScanAndRangeIteration)
+{
+    Bitmap bitmap(1000);
+    EXPECT_EQ(bitmap.Capacity(), 126);
+    EXPECT_EQ(bitmap.MaxIndex(), 1007);
+    bitmap.SetRange(3, 200);
+    bitmap.Set(500);
+    bitmap.Set(500);
+    bitmap.Set(2000); // out of range
+    EXPECT_EQ(bitmap.TotalSetCount(), 198);
+    EXPECT_EQ(bitmap.FirstIndexUnset(), 0);
+    bitmap.SetRange(0, 3);
+    EXPECT_EQ(bitmap.FirstIndexUnset(), 200);
+    EXPECT_EQ(bitmap.NextSet(200), 500);
+    EXPECT_EQ(bitmap.NextSet(501), 1008);
+    EXPECT_EQ(bitmap.NextUnset(500), 501);
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    for (uint64_t from = 0; bitmap.NextSetRange(from, begin, end); from = end) {
+        ranges.emplace_back(begin, end);
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> expected { { 0, 200 }, { 500, 501 } };
+    EXPECT_EQ(ranges, expected);
+
+    // checkpoint layout: bit i in byte i / 8, round trip through byte array
+    std::vector<uint8_t> bytes(bitmap.Capacity());
+    bitmap.CopyTo(bytes.data());
+    EXPECT_EQ(bytes[0], 0xFF);
+    EXPECT_EQ(bytes[62], 0x10); // index 500
+    uint8_t* buffer = new uint8_t[bitmap.Capacity()];
+    memcpy(buffer, bytes.data(), bytes.size());
+    Bitmap restored(buffer, bitmap.Capacity());
+    EXPECT_EQ(restored.TotalSetCount(), 201);
+    EXPECT_EQ(restored.FirstIndexUnset(), 200);
+    EXPECT_TRUE(restored.Test(500));
+    restored.SetRange(0, 2000);
+    EXPECT_EQ(restored.TotalSetCount(), 1008);
+    EXPECT_EQ(restored.FirstIndexUnset(), restored.MaxIndex() + 1);
+    EXPECT_TRUE(restored.NextSetRange(10, begin, end));
+    EXPECT_EQ(begin, 10);
+    EXPECT_EQ(end, 1008);
+}
+
+TEST_F(VolumeBackupTest, Bitmap_ConcurrentSetNoLostUpdate)
+{
+    const uint64_t size = 100000;
+    const int threadNum = 4;
+    Bitmap bitmap(size);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threadNum; ++t) {
+        workers.emplace_back([&bitmap, t]() {
+            for (uint64_t index = t; index < size; index += threadNum) {
+                bitmap.Set(index);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    EXPECT_EQ(bitmap.TotalSetCount(), size);
+    EXPECT_EQ(bitmap.FirstIndexUnset(), size);
+}
+
+TEST_F(VolumeBackupTest, CheckpointJournal_CommitAndReplaySuccess)
+{
+    std::string journalPath = "/tmp/volumeprotect_checkpoint.journal";
+    fsapi::RemoveFile(journalPath);
+    const uint64_t numBlocks = 100;
+    const uint32_t checksumSize = 4;
+    auto hashingContext = std::make_shared<BlockHashingContext>(numBlocks * checksumSize);
+    for (uint64_t index = 0; index < numBlocks; ++index) {
+        memcpy(hashingContext->lastestTable + index * checksumSize, &index, checksumSize);
+    }
+    {
+        auto journal = CheckpointJournal::Open(journalPath, numBlocks, checksumSize, 0);
+        ASSERT_TRUE(journal != nullptr);
+        EXPECT_TRUE(journal->Empty());
+        journal->Append(3, true);
+        journal->Append(7, false);
+        journal->Seal();
+        journal->Append(9, true); // appended after sealed, committed next time
+        EXPECT_TRUE(journal->Commit(hashingContext.get()));
+        EXPECT_FALSE(journal->Empty());
+        EXPECT_FALSE(journal->NeedCompaction());
+        auto checkpointSnapshot = journal->TakeCommittedSnapshot();
+        Bitmap processed(checkpointSnapshot->processedBitmapBuffer, checkpointSnapshot->bitmapBufferBytesLength);
+        checkpointSnapshot->processedBitmapBuffer = nullptr;
+        EXPECT_EQ(processed.TotalSetCount(), 2);
+        EXPECT_FALSE(processed.Test(9));
+    }
+    // torn record at tail is dropped
+    uint64_t journalSize = fsapi::GetFileSize(journalPath);
+    FILE* file = ::fopen(journalPath.c_str(), "ab");
+    ASSERT_TRUE(file != nullptr);
+    ::fwrite("torn", 1, 4, file);
+    ::fclose(file);
+
+    auto restoredContext = std::make_shared<BlockHashingContext>(numBlocks * checksumSize);
+    auto journal = CheckpointJournal::Open(journalPath, numBlocks, checksumSize, 0);
+    ASSERT_TRUE(journal != nullptr);
+    Bitmap processedBitmap(numBlocks);
+    Bitmap writtenBitmap(numBlocks);
+    processedBitmap.Set(50); // restored from compacted snapshot
+    EXPECT_TRUE(journal->Replay(processedBitmap, writtenBitmap, restoredContext.get()));
+    EXPECT_EQ(fsapi::GetFileSize(journalPath), journalSize);
+    EXPECT_EQ(processedBitmap.TotalSetCount(), 3);
+    EXPECT_TRUE(processedBitmap.Test(3) && processedBitmap.Test(7));
+    EXPECT_EQ(writtenBitmap.TotalSetCount(), 1);
+    EXPECT_TRUE(writtenBitmap.Test(3));
+    EXPECT_EQ(memcmp(restoredContext->lastestTable + 7 * checksumSize,
+        hashingContext->lastestTable + 7 * checksumSize, checksumSize), 0);
+
+    // blocks committed are kept in snapshot after truncated
+    EXPECT_TRUE(journal->Truncate());
+    EXPECT_TRUE(journal->Empty());
+    auto checkpointSnapshot = journal->TakeCommittedSnapshot();
+    Bitmap processed(checkpointSnapshot->processedBitmapBuffer, checkpointSnapshot->bitmapBufferBytesLength);
+    checkpointSnapshot->processedBitmapBuffer = nullptr;
+    EXPECT_EQ(processed.TotalSetCount(), 3);
+
+    // journal of another session is rejected
+    auto mismatched = CheckpointJournal::Open(journalPath, numBlocks + 1, checksumSize, 0);
+    ASSERT_TRUE(mismatched != nullptr);
+    EXPECT_FALSE(mismatched->Replay(processedBitmap, writtenBitmap, restoredContext.get()));
+    EXPECT_TRUE(mismatched->Reset());
+    fsapi::RemoveFile(journalPath);
+}
+
+TEST_F(VolumeBackupTest, MappedFile_FlushDirtyPagesSuccess)
+{
+    std::string tablePath = "/tmp/volumeprotect_mapped.sha256.meta.bin";
+    std::string prevTablePath = "/tmp/volumeprotect_mapped_prev.sha256.meta.bin";
+    fsapi::RemoveFile(tablePath);
+    const uint64_t tableSize = 3 * ONE_MB + 100;
+    {
+        auto mappedFile = fsapi::MappedFile::Open(tablePath, tableSize, true, true);
+        ASSERT_TRUE(mappedFile != nullptr);
+        EXPECT_EQ(fsapi::GetFileSize(tablePath), tableSize);
+        EXPECT_EQ(mappedFile->Ptr()[tableSize - 1], 0);
+        memset(mappedFile->Ptr() + ONE_MB, 0xAB, 10);
+        mappedFile->MarkDirty(ONE_MB, 10);
+        mappedFile->Ptr()[tableSize - 1] = 0xCD;
+        mappedFile->MarkDirty(tableSize - 1, 1);
+        EXPECT_TRUE(mappedFile->Flush());
+        EXPECT_TRUE(mappedFile->Flush()); // nothing dirty
+    }
+    // too small to map read-only
+    EXPECT_TRUE(fsapi::MappedFile::Open(tablePath, tableSize + 1, false, false) == nullptr);
+    EXPECT_TRUE(fsapi::MappedFile::Open(tablePath, 0, true, false) == nullptr);
+
+    // latest table keeps content unless truncated, previous table is mapped read-only
+    ASSERT_TRUE(fsapi::WriteBinaryBuffer(prevTablePath, reinterpret_cast<const uint8_t*>("previous"), 8));
+    auto hashingContext = std::make_shared<BlockHashingContext>();
+    EXPECT_TRUE(hashingContext->MapLastestTable(tablePath, tableSize, false));
+    EXPECT_TRUE(hashingContext->MapPreviousTable(prevTablePath, 8));
+    EXPECT_FALSE(hashingContext->MapSubPreviousTable(prevTablePath, 9));
+    EXPECT_TRUE(hashingContext->IsLastestMapped());
+    EXPECT_EQ(hashingContext->lastestTable[ONE_MB + 9], 0xAB);
+    EXPECT_EQ(hashingContext->lastestTable[tableSize - 1], 0xCD);
+    EXPECT_EQ(memcmp(hashingContext->previousTable, "previous", 8), 0);
+    hashingContext->lastestTable[0] = 0xEF;
+    hashingContext->MarkLastestDirty(0, 1);
+    EXPECT_TRUE(hashingContext->FlushLastest());
+    hashingContext.reset();
+
+    uint8_t buffer[2] = { 0 };
+    EXPECT_TRUE(fsapi::ReadBinaryBuffer(tablePath, buffer, sizeof(buffer)));
+    EXPECT_EQ(buffer[0], 0xEF);
+    fsapi::RemoveFile(tablePath);
+    fsapi::RemoveFile(prevTablePath);
+}
+
+TEST_F(VolumeBackupTest, BlockBufferPool_ReuseRegionSuccess)
+{
+    BlockBufferPool& pool = BlockBufferPool::Instance();
+    BufferPoolConfig config {};
+    config.prefault = true;
+    config.numaLocal = true;
+    pool.Configure(config);
+    EXPECT_EQ(pool.CachedBytes(), 0);
+
+    // size class rounded up to hugepage size, released region is leased again
+    uint64_t capacity = 0;
+    uint8_t* region = pool.Lease(3 * ONE_MB, capacity);
+    ASSERT_TRUE(region != nullptr);
+    EXPECT_EQ(capacity, 4 * ONE_MB);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(region) % BUFFER_POOL_REGION_ALIGNMENT, 0);
+    ::memset(region, 1, capacity);
+    pool.Release(region, capacity);
+    EXPECT_EQ(pool.CachedBytes(), 4 * ONE_MB);
+    uint64_t capacity2 = 0;
+    EXPECT_EQ(pool.Lease(3 * ONE_MB + ONE_KB, capacity2), region);
+    EXPECT_EQ(capacity2, capacity);
+    EXPECT_EQ(pool.CachedBytes(), 0);
+    pool.Release(region, capacity);
+
+    // allocator of the next session reuses buffers of the previous one
+    uint8_t* buffer = nullptr;
+    {
+        VolumeBlockAllocator allocator(12 * ONE_KB, 3);
+        buffer = allocator.BlockAlloc();
+        allocator.BlockFree(buffer);
+    }
+    {
+        VolumeBlockAllocator allocator(12 * ONE_KB, 3);
+        EXPECT_EQ(allocator.BlockAlloc(), buffer);
+    }
+
+    // regions beyond cache limit are freed on release
+    config.maxCachedBytes = 0;
+    pool.Configure(config);
+    region = pool.Lease(5000, capacity);
+    ASSERT_TRUE(region != nullptr);
+    EXPECT_EQ(capacity, 2 * BUFFER_POOL_REGION_ALIGNMENT);
+    pool.Release(region, capacity);
+    EXPECT_EQ(pool.CachedBytes(), 0);
+    pool.Configure(BufferPoolConfig {});
+}
+
+TEST_F(VolumeBackupTest, VolumeBlockAllocator_AllocWaitWakeOnFree)
+{
+    VolumeBlockAllocator allocator(ONE_MB, 1);
+    uint8_t* buffer = allocator.BlockAlloc();
+    EXPECT_TRUE(buffer != nullptr);
+    std::thread freeThread([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        allocator.BlockFree(buffer);
+    });
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(allocator.BlockAllocWait(std::chrono::milliseconds(10000)), buffer);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+    freeThread.join();
+
+    // concurrent alloc/free never hand out more blocks than the pool holds
+    const uint32_t blockNum = 8;
+    VolumeBlockAllocator sharedAllocator(4096, blockNum);
+    std::atomic<uint32_t> inUse { 0 };
+    std::atomic<bool> failed { false };
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&]() {
+            for (int i = 0; i < 10000; ++i) {
+                uint8_t* ptr = sharedAllocator.BlockAllocWait(std::chrono::milliseconds(1000));
+                if (ptr == nullptr || ++inUse > blockNum) {
+                    failed = true;
+                    return;
+                }
+                --inUse;
+                sharedAllocator.BlockFree(ptr);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    EXPECT_FALSE(failed);
+}
+
+/**
+ * @brief fake backup task running for a while, record max running tasks of each device
+ */
+class FakeBackupTask : public VolumeProtectTask {
+public:
+    FakeBackupTask(const std::vector<std::string>& devices, std::map<std::string, int>& running,
+        std::map<std::string, int>& maxRunning, std::mutex& mutex)
+        : m_devices(devices), m_running(running), m_maxRunning(maxRunning), m_mutex(mutex) {}
+
+    ~FakeBackupTask()
+    {
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    bool Start() override
+    {
+        m_status = TaskStatus::RUNNING;
+        UpdateRunning(1);
+        m_thread = std::thread([this]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            m_statistics.bytesRead = ONE_MB;
+            UpdateRunning(-1);
+            m_status = TaskStatus::SUCCEED;
+        });
+        return true;
+    }
+
+    TaskStatistics GetStatistics() const override
+    {
+        return m_statistics;
+    }
+
+private:
+    void UpdateRunning(int delta)
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        for (const std::string& device : m_devices) {
+            m_running[device] += delta;
+            m_maxRunning[device] = std::max(m_maxRunning[device], m_running[device]);
+        }
+        m_running["*"] += delta;
+        m_maxRunning["*"] = std::max(m_maxRunning["*"], m_running["*"]);
+    }
+
+private:
+    std::vector<std::string>    m_devices;
+    std::map<std::string, int>& m_running;
+    std::map<std::string, int>& m_maxRunning;
+    std::mutex&                 m_mutex;
+    std::thread                 m_thread;
+    TaskStatistics              m_statistics;
+};
+
+TEST_F(VolumeBackupTest, VolumeBackupScheduler_DeviceLimitSuccess)
+{
+    std::map<std::string, int> running;
+    std::map<std::string, int> maxRunning;
+    std::mutex mutex;
+    // 3 volumes on sda, 1 volume on sdb, 1 volume span sdc and sdd
+    std::vector<std::vector<std::string>> volumeDevices {
+        { "sda" }, { "sda" }, { "sda" }, { "sdb" }, { "sdc", "sdd" } };
+    std::vector<std::shared_ptr<ScheduledBackupTask>> tasks;
+    for (const std::vector<std::string>& devices : volumeDevices) {
+        auto scheduledTask = std::make_shared<ScheduledBackupTask>();
+        scheduledTask->task = exstd::make_unique<FakeBackupTask>(devices, running, maxRunning, mutex);
+        scheduledTask->volumePath = "/dev/dummy";
+        scheduledTask->devices = devices;
+        scheduledTask->memory = ONE_GB;
+        tasks.push_back(scheduledTask);
+    }
+    VolumeBackupSchedulerConfig schedulerConfig {};
+    schedulerConfig.maxRunningTasks = 3;
+    schedulerConfig.maxTasksPerDevice = 1;
+    schedulerConfig.memoryBudget = 2 * ONE_GB;
+    VolumeBackupScheduler scheduler(schedulerConfig, tasks);
+    EXPECT_TRUE(scheduler.Start());
+    while (!scheduler.IsTerminated()) {
+        std::this_thread::sleep_for(TASK_CHECK_SLEEP_INTERVAL);
+    }
+    EXPECT_EQ(scheduler.GetStatus(), TaskStatus::SUCCEED);
+    EXPECT_EQ(scheduler.GetStatistics().bytesRead, volumeDevices.size() * ONE_MB);
+    EXPECT_EQ(maxRunning["sda"], 1);
+    EXPECT_EQ(maxRunning["sdb"], 1);
+    EXPECT_EQ(maxRunning["sdc"], 1);
+    // tasks of other disks are not blocked behind sda tasks, but only 2 of them fit in the memory budget
+    EXPECT_EQ(maxRunning["*"], 2);
+    EXPECT_EQ(running["*"], 0);
+}
+
+TEST_F(VolumeBackupTest, VolumeBackupScheduler_EstimateTaskMemory)
+{
+    VolumeBackupConfig backupConfig {};
+    backupConfig.backupType = BackupType::FULL;
+    backupConfig.blockSize = DEFAULT_MOCK_SESSION_BLOCK_SIZE;
+    backupConfig.sessionSize = ONE_GB;
+    backupConfig.subBlockSize = 0;
+    uint64_t bufferMemory = DEFAULT_ALLOCATOR_BLOCK_NUM * DEFAULT_MOCK_SESSION_BLOCK_SIZE;
+    uint64_t tableMemory = ONE_GB / DEFAULT_MOCK_SESSION_BLOCK_SIZE * SHA256_CHECKSUM_SIZE;
+    EXPECT_EQ(VolumeBackupScheduler::EstimateTaskMemory(backupConfig, 4 * ONE_GB), bufferMemory + tableMemory);
+    backupConfig.backupType = BackupType::FOREVER_INC;
+    backupConfig.sessionConcurrency = 2;
+    EXPECT_EQ(VolumeBackupScheduler::EstimateTaskMemory(backupConfig, 4 * ONE_GB),
+        2 * (bufferMemory + 2 * tableMemory));
 }
\ No newline at end of file